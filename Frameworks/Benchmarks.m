@@ -0,0 +1,175 @@
+#import <GCDWebServers/GCDWebServers.h>
+#import <XCTest/XCTest.h>
+#import <stdatomic.h>
+
+#pragma clang diagnostic ignored "-Weverything"  // Prevent "messaging to unqualified id" warnings
+
+// Private helpers exported by the framework
+extern NSString* GCDWebServerNormalizeHeaderValue(NSString* value);
+extern NSString* GCDWebServerExtractHeaderValueParameter(NSString* value, NSString* attribute);
+
+// Hook called by libmalloc for every allocation and deallocation when set (same mechanism as MallocStackLogging)
+typedef void(malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip);
+extern malloc_logger_t* malloc_logger;
+
+#define kMallocLogTypeAllocate 2
+#define kBenchmarkMinimumDuration 0.25
+#define kBenchmarkBatchSize 64
+#define kBenchmarkAllocationSlack 0.1  // Allocations from other threads are counted too
+#define kNoAllocationCeiling INFINITY
+
+static _Atomic(uint64_t) _allocationCount;
+
+static void _CountingMallocLogger(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip) {
+  if (type & kMallocLogTypeAllocate) {
+    atomic_fetch_add_explicit(&_allocationCount, 1, memory_order_relaxed);
+  }
+}
+
+@interface Benchmarks : XCTestCase
+@end
+
+@implementation Benchmarks
+
+// Runs the block in batches until the minimum duration is reached then logs the time and number of heap allocations per call,
+// and fails if there are more allocations per call than the ceiling so regressions of the allocation-free paths are caught
+- (void)_benchmark:(NSString*)name maxAllocations:(double)maxAllocations block:(void (^)(void))block {
+  @autoreleasepool {
+    block();  // Warm up caches and lazily initialized globals
+  }
+  malloc_logger_t* previousLogger = malloc_logger;
+  malloc_logger = _CountingMallocLogger;
+  atomic_store(&_allocationCount, 0);
+  uint64_t iterations = 0;
+  CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+  CFAbsoluteTime elapsed;
+  do {
+    @autoreleasepool {
+      for (int i = 0; i < kBenchmarkBatchSize; ++i) {
+        block();
+      }
+    }
+    iterations += kBenchmarkBatchSize;
+    elapsed = CFAbsoluteTimeGetCurrent() - startTime;
+  } while (elapsed < kBenchmarkMinimumDuration);
+  uint64_t allocations = atomic_load(&_allocationCount);
+  malloc_logger = previousLogger;
+  double allocationsPerCall = (double)allocations / (double)iterations;
+  NSLog(@"[BENCHMARK] %@: %.0f ns/op, %.1f allocs/op (%llu iterations)", name, elapsed * 1e9 / (double)iterations, allocationsPerCall, iterations);
+  XCTAssertLessThanOrEqual(allocationsPerCall, maxAllocations + kBenchmarkAllocationSlack, @"%@ allocates more than %.0f times per call", name, maxAllocations);
+}
+
+- (void)_benchmark:(NSString*)name block:(void (^)(void))block {
+  [self _benchmark:name maxAllocations:kNoAllocationCeiling block:block];
+}
+
+- (void)testURLEncodedForm {
+  NSString* simpleForm = @"name=John+Smith&email=john%40example.com&age=42&subscribe=on";
+  NSMutableString* escapedForm = [NSMutableString string];
+  for (int i = 0; i < 64; ++i) {
+    [escapedForm appendFormat:@"%@field%i=%%E2%%9C%%93%%20caf%%C3%%A9+%%26+%%3D+value", i ? @"&" : @"", i];
+  }
+  NSMutableString* adversarialForm = [NSMutableString string];
+  for (int i = 0; i < 1024; ++i) {
+    [adversarialForm appendString:@"&&=&%%=%zz&"];
+  }
+  XCTAssertEqualObjects(GCDWebServerParseURLEncodedForm(simpleForm)[@"email"], @"john@example.com");
+  // Ceilings are the key and value strings of each pair plus the dictionary storage growth and decoding buffer
+  [self _benchmark:@"GCDWebServerParseURLEncodedForm (simple)" maxAllocations:(4 + 4 * 2) block:^{ GCDWebServerParseURLEncodedForm(simpleForm); }];
+  [self _benchmark:@"GCDWebServerParseURLEncodedForm (64 escaped fields)" maxAllocations:(16 + 64 * 2) block:^{ GCDWebServerParseURLEncodedForm(escapedForm); }];
+  [self _benchmark:@"GCDWebServerParseURLEncodedForm (malformed)" block:^{ GCDWebServerParseURLEncodedForm(adversarialForm); }];
+}
+
+- (void)testNormalizePath {
+  NSString* simplePath = @"/images/2024/photo.jpg";
+  NSString* dirtyPath = @"/a/./b//c/../d/./e/../../f/";
+  NSMutableString* adversarialPath = [NSMutableString string];
+  for (int i = 0; i < 512; ++i) {
+    [adversarialPath appendString:(i % 2 ? @"/../" : @"//x/./")];
+  }
+  XCTAssertEqualObjects(GCDWebServerNormalizePath(dirtyPath), @"/a/b/f");
+  // Ceilings allow for a UTF-8 copy of the input, a heap buffer for long paths and the result string if the path changed
+  [self _benchmark:@"GCDWebServerNormalizePath (clean)" maxAllocations:1 block:^{ GCDWebServerNormalizePath(simplePath); }];
+  [self _benchmark:@"GCDWebServerNormalizePath (dot segments)" maxAllocations:2 block:^{ GCDWebServerNormalizePath(dirtyPath); }];
+  [self _benchmark:@"GCDWebServerNormalizePath (1024 segments)" maxAllocations:3 block:^{ GCDWebServerNormalizePath(adversarialPath); }];
+}
+
+- (void)testHeaderValues {
+  NSString* contentType = @"multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW";
+  NSString* quotedContentType = @"Text/HTML; Charset=\"UTF-8\"; format=flowed";
+  NSMutableString* adversarialValue = [NSMutableString stringWithString:@"text/plain"];
+  for (int i = 0; i < 256; ++i) {
+    [adversarialValue appendFormat:@"; p%i=\"%@\"", i, i % 2 ? @"a;b=c" : @""];
+  }
+  XCTAssertEqualObjects(GCDWebServerExtractHeaderValueParameter(contentType, @"boundary"), @"----WebKitFormBoundary7MA4YWxkTrZu0gW");
+  [self _benchmark:@"GCDWebServerNormalizeHeaderValue (simple)" block:^{ GCDWebServerNormalizeHeaderValue(contentType); }];
+  [self _benchmark:@"GCDWebServerNormalizeHeaderValue (quoted)" block:^{ GCDWebServerNormalizeHeaderValue(quotedContentType); }];
+  [self _benchmark:@"GCDWebServerNormalizeHeaderValue (256 parameters)" block:^{ GCDWebServerNormalizeHeaderValue(adversarialValue); }];
+  [self _benchmark:@"GCDWebServerExtractHeaderValueParameter (simple)" block:^{ GCDWebServerExtractHeaderValueParameter(contentType, @"boundary"); }];
+  [self _benchmark:@"GCDWebServerExtractHeaderValueParameter (quoted)" block:^{ GCDWebServerExtractHeaderValueParameter(quotedContentType, @"charset"); }];
+  [self _benchmark:@"GCDWebServerExtractHeaderValueParameter (missing in 256 parameters)" block:^{ GCDWebServerExtractHeaderValueParameter(adversarialValue, @"missing"); }];
+}
+
+- (void)testUnescapeURLString {
+  NSString* plainString = @"/documents/report-final.pdf";
+  NSString* escapedString = @"/%E6%96%87%E6%9B%B8/r%C3%A9sum%C3%A9%20(1).pdf";
+  NSMutableString* adversarialString = [NSMutableString string];
+  for (int i = 0; i < 1024; ++i) {
+    [adversarialString appendString:@"%25"];
+  }
+  [self _benchmark:@"GCDWebServerUnescapeURLString (plain)" block:^{ GCDWebServerUnescapeURLString(plainString); }];
+  [self _benchmark:@"GCDWebServerUnescapeURLString (UTF-8)" block:^{ GCDWebServerUnescapeURLString(escapedString); }];
+  [self _benchmark:@"GCDWebServerUnescapeURLString (1024 escapes)" block:^{ GCDWebServerUnescapeURLString(adversarialString); }];
+}
+
+- (void)testMimeTypes {
+  NSDictionary* overrides = @{@"md" : @"text/markdown"};
+  XCTAssertEqualObjects(GCDWebServerGetMimeTypeForExtension(@"css", nil), @"text/css");
+  // Built-in extensions are resolved from the static table while the others need a lowercased key string
+  [self _benchmark:@"GCDWebServerGetMimeTypeForExtension (common)" maxAllocations:0 block:^{ GCDWebServerGetMimeTypeForExtension(@"html", nil); }];
+  [self _benchmark:@"GCDWebServerGetMimeTypeForExtension (uppercase)" maxAllocations:0 block:^{ GCDWebServerGetMimeTypeForExtension(@"JPG", nil); }];
+  [self _benchmark:@"GCDWebServerGetMimeTypeForExtension (override)" maxAllocations:1 block:^{ GCDWebServerGetMimeTypeForExtension(@"md", overrides); }];
+  [self _benchmark:@"GCDWebServerGetMimeTypeForExtension (unknown)" maxAllocations:1 block:^{ GCDWebServerGetMimeTypeForExtension(@"unknownextension", nil); }];
+}
+
+- (NSData*)_multiPartBodyWithBoundary:(NSString*)boundary argumentCount:(NSUInteger)argumentCount fileSize:(NSUInteger)fileSize {
+  NSMutableData* body = [NSMutableData data];
+  for (NSUInteger i = 0; i < argumentCount; ++i) {
+    [body appendData:[[NSString stringWithFormat:@"--%@\r\nContent-Disposition: form-data; name=\"field%lu\"\r\n\r\nvalue %lu\r\n", boundary, (unsigned long)i, (unsigned long)i] dataUsingEncoding:NSUTF8StringEncoding]];
+  }
+  if (fileSize) {
+    [body appendData:[[NSString stringWithFormat:@"--%@\r\nContent-Disposition: form-data; name=\"file\"; filename=\"data.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
+    NSMutableData* fileData = [NSMutableData dataWithLength:fileSize];
+    char* bytes = fileData.mutableBytes;
+    for (NSUInteger i = 0; i < fileSize; ++i) {
+      bytes[i] = (i % 64 < 2) ? '-' : (i % 64 == 2 ? '\r' : 'x');  // Lots of partial boundary matches
+    }
+    [body appendData:fileData];
+    [body appendData:[@"\r\n" dataUsingEncoding:NSUTF8StringEncoding]];
+  }
+  [body appendData:[[NSString stringWithFormat:@"--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding]];
+  return body;
+}
+
+- (void)_benchmarkMultiPartForm:(NSString*)name boundary:(NSString*)boundary body:(NSData*)body chunkSize:(NSUInteger)chunkSize {
+  NSDictionary* headers = @{@"Content-Type" : [NSString stringWithFormat:@"multipart/form-data; boundary=%@", boundary], @"Content-Length" : [NSString stringWithFormat:@"%lu", (unsigned long)body.length]};
+  NSURL* url = [NSURL URLWithString:@"http://localhost/upload"];
+  [self _benchmark:name
+             block:^{
+               GCDWebServerMultiPartFormRequest* request = [[GCDWebServerMultiPartFormRequest alloc] initWithMethod:@"POST" url:url headers:headers path:@"/upload" query:nil];
+               [request open:NULL];
+               for (NSUInteger offset = 0; offset < body.length; offset += chunkSize) {
+                 [request writeData:[body subdataWithRange:NSMakeRange(offset, MIN(chunkSize, body.length - offset))] error:NULL];
+               }
+               [request close:NULL];
+             }];
+}
+
+- (void)testMultiPartForm {
+  NSString* boundary = @"----WebKitFormBoundary7MA4YWxkTrZu0gW";
+  [self _benchmarkMultiPartForm:@"GCDWebServerMultiPartFormRequest (8 arguments)" boundary:boundary body:[self _multiPartBodyWithBoundary:boundary argumentCount:8 fileSize:0] chunkSize:32768];
+  [self _benchmarkMultiPartForm:@"GCDWebServerMultiPartFormRequest (256 arguments in 64 byte chunks)" boundary:boundary body:[self _multiPartBodyWithBoundary:boundary argumentCount:256 fileSize:0] chunkSize:64];
+  [self _benchmarkMultiPartForm:@"GCDWebServerMultiPartFormRequest (256 KiB file with boundary-like content)" boundary:boundary body:[self _multiPartBodyWithBoundary:boundary argumentCount:1 fileSize:(256 * 1024)] chunkSize:32768];
+}
+
+@end
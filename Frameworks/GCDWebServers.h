@@ -30,8 +30,11 @@
 #import "GCDWebServerConnection.h"
 #import "GCDWebServerFunctions.h"
 #import "GCDWebServerHTTPStatusCodes.h"
+#import "GCDWebServerMetrics.h"
+#import "GCDWebServerAccessLog.h"
 #import "GCDWebServerResponse.h"
 #import "GCDWebServerRequest.h"
+#import "GCDWebServerWebSocket.h"
 
 // GCDWebServer Requests
 #import "GCDWebServerDataRequest.h"
@@ -44,6 +47,7 @@
 #import "GCDWebServerErrorResponse.h"
 #import "GCDWebServerFileResponse.h"
 #import "GCDWebServerStreamedResponse.h"
+#import "GCDWebServerEventStreamResponse.h"
 
 // GCDWebUploader
 #import "GCDWebUploader.h"
@@ -203,11 +203,7 @@ static inline BOOL _IsMacFinder(GCDWebServerRequest* request) {
     });
   }
 
-  if ([request hasByteRange]) {
-    return [GCDWebServerFileResponse responseWithFile:absolutePath byteRange:request.byteRange];
-  }
-
-  return [GCDWebServerFileResponse responseWithFile:absolutePath];
+  return [[GCDWebServerFileResponse alloc] initWithFile:absolutePath byteRanges:request.byteRanges ifRange:[request.headers objectForKey:@"If-Range"] isAttachment:NO mimeTypeOverrides:nil];
 }
 
 - (GCDWebServerResponse*)performPUT:(GCDWebServerFileRequest*)request {
@@ -227,6 +223,12 @@ static inline BOOL _IsMacFinder(GCDWebServerRequest* request) {
     return [GCDWebServerErrorResponse responseWithClientError:kGCDWebServerHTTPStatusCode_MethodNotAllowed message:@"PUT not allowed on existing collection \"%@\"", relativePath];
   }
 
+  GCDWebServerFileResponse* currentFile = existing ? [[GCDWebServerFileResponse alloc] initWithFile:absolutePath] : nil;  // Only stats the file to compute the same validators as GET
+  NSInteger preconditionCode = [request statusCodeForPreconditionsWithETag:currentFile.eTag lastModifiedDate:currentFile.lastModifiedDate resourceExists:existing];
+  if (preconditionCode) {
+    return [GCDWebServerResponse responseWithStatusCode:preconditionCode];
+  }
+
   NSString* fileName = [absolutePath lastPathComponent];
   if (([fileName hasPrefix:@"."] && !_allowHiddenItems) || ![self _checkFileExtension:fileName]) {
     return [GCDWebServerErrorResponse responseWithClientError:kGCDWebServerHTTPStatusCode_Forbidden message:@"Uploading file name \"%@\" is not allowed", fileName];
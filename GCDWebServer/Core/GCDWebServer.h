@@ -194,13 +194,235 @@ extern NSString* const GCDWebServerOption_ConnectedStateCoalescingInterval;
 
 /**
  *  Set the dispatch queue priority on which server connection will be 
- *  run (NSNumber / long).
+ *  run (NSNumber / long). This applies to the queues accepting connections,
+ *  performing socket I/O and running handlers which don't specify their own
+ *  priority.
  *
  *
  *  The default value is DISPATCH_QUEUE_PRIORITY_DEFAULT.
  */
 extern NSString* const GCDWebServerOption_DispatchQueuePriority;
 
+/**
+ *  The number of serial queues on which socket reads and writes are performed
+ *  (NSNumber / NSUInteger). Each GCDWebServerConnection is assigned to one of
+ *  these queues for its entire lifetime.
+ *
+ *  The default value is the number of active processors.
+ */
+extern NSString* const GCDWebServerOption_IOConcurrencyWidth;
+
+/**
+ *  The number of threads dedicated to running the synchronous process blocks
+ *  of handlers (NSNumber / NSUInteger). Handlers added with a specific priority
+ *  or with an asynchronous process block are not affected.
+ *
+ *  Using a fixed-size worker pool keeps the number of threads bounded when
+ *  process blocks perform blocking work like disk I/O.
+ *
+ *  The default value is 0 i.e. synchronous process blocks run on the handler
+ *  queue like asynchronous ones.
+ */
+extern NSString* const GCDWebServerOption_WorkerPoolSize;
+
+/**
+ *  The maximum number of synchronous process blocks waiting for a worker
+ *  thread when the worker pool is enabled (NSNumber / NSUInteger). Requests
+ *  arriving while this queue is full are answered with a 503 "Service
+ *  Unavailable" response.
+ *
+ *  The default value is 256.
+ */
+extern NSString* const GCDWebServerOption_WorkerPoolQueueSize;
+
+/**
+ *  Enables recording of request counts, latencies and bytes transferred in
+ *  the metrics property of the GCDWebServer (NSNumber / BOOL).
+ *
+ *  The default value is NO.
+ */
+extern NSString* const GCDWebServerOption_EnableMetrics;
+
+/**
+ *  A block called with the phase timings of every HTTP request once its
+ *  connection is closed (GCDWebServerRequestTimingsBlock).
+ *
+ *  The default value is nil.
+ */
+extern NSString* const GCDWebServerOption_RequestTimingsObserver;
+
+/**
+ *  An access log to which a record is appended for every HTTP request once
+ *  its connection is closed (GCDWebServerAccessLog).
+ *
+ *  The default value is nil.
+ */
+extern NSString* const GCDWebServerOption_AccessLog;
+
+/**
+ *  Customizes the MIME types of the files served by the handlers added with
+ *  -addGETHandlerForBasePath:directoryPath:indexFilename:cacheAge:allowRangeRequests:
+ *  (NSDictionary mapping file extensions without the period to MIME types).
+ *
+ *  Extensions are matched case-insensitively.
+ *
+ *  The default value is nil.
+ */
+extern NSString* const GCDWebServerOption_MimeTypeOverrides;
+
+/**
+ *  Uses SHA-256 digests of the file contents as the entity tags of the files
+ *  served by the handlers added with -addGETHandlerForPath:filePath:isAttachment:cacheAge:allowRangeRequests:
+ *  and -addGETHandlerForBasePath:directoryPath:indexFilename:cacheAge:allowRangeRequests:
+ *  instead of their node IDs and modification dates (NSNumber / BOOL).
+ *
+ *  See kGCDWebServerFileETagMode_ContentDigest for details.
+ *
+ *  The default value is NO.
+ */
+extern NSString* const GCDWebServerOption_UseContentDigestETags;
+
+/**
+ *  The maximum total size in bytes of the response bodies kept in the shared
+ *  response cache (NSNumber / NSUInteger). Set to 0 to disable the cache.
+ *
+ *  When enabled, the GCDWebServerDataResponses returned by handlers for GET
+ *  requests without a body are cached if they have a 200 status code and a
+ *  "Cache-Control" max-age, either set through the cacheControlMaxAge property
+ *  or through an additional "Cache-Control" header which can also specify
+ *  "s-maxage" and "stale-while-revalidate". Responses with "no-store",
+ *  "no-cache" or "private" directives, "Set-Cookie" headers or "Vary: *" are
+ *  never cached, and responses to requests with an "Authorization" header are
+ *  only cached if they have a "public", "must-revalidate" or "s-maxage"
+ *  directive. Cached responses are keyed by path, query, whether the client
+ *  accepts gzip encoding and the request headers listed in their "Vary"
+ *  header, and are served without calling the handler until they expire. During the stale-while-revalidate period, the
+ *  stale response keeps being served while the handler is called once in the
+ *  background to refresh it.
+ *
+ *  @warning Only enable the cache if the handlers of cacheable responses do
+ *  not depend on anything else than the path, query and "Vary" headers of the
+ *  requests, like cookies.
+ *
+ *  The default value is 0.
+ */
+extern NSString* const GCDWebServerOption_ResponseCacheSize;
+
+/**
+ *  Coalesces identical concurrent GET requests so that only the first one
+ *  calls the handler while the others wait for its response (NSNumber / BOOL).
+ *  Requests are identical if they are handled by the same handler and have the
+ *  same path, query, "Authorization", "Cookie" and "Accept-Encoding" headers.
+ *
+ *  If the handler returns a GCDWebServerDataResponse, its body is shared with
+ *  all the waiting requests, otherwise they call the handler themselves.
+ *
+ *  @warning Only enable coalescing if handlers for GET requests do not depend
+ *  on other request headers or on being called once per request.
+ *
+ *  The default value is NO.
+ */
+extern NSString* const GCDWebServerOption_CoalesceRequests;
+
+/**
+ *  The maximum number of GCDWebServerConnections that can be active at the
+ *  same time (NSNumber / NSUInteger). When this limit is reached, new incoming
+ *  connections are immediately answered with a pre-built 503 "Service Unavailable"
+ *  response including a "Retry-After" header, then closed without any request
+ *  parsing. Set to 0 to disable the limit.
+ *
+ *  The default value is 0.
+ */
+extern NSString* const GCDWebServerOption_MaxActiveConnections;
+
+/**
+ *  The maximum number of HTTP requests that can be processed by handlers at the
+ *  same time (NSNumber / NSUInteger). Requests received while this limit is
+ *  reached are put in a bounded queue (see GCDWebServerOption_MaxQueuedRequests)
+ *  or rejected with a 503 "Service Unavailable" response. Set to 0 to disable
+ *  the limit. WebSockets and event streams stop counting against the limit
+ *  once their response headers have been sent.
+ *
+ *  The default value is 0.
+ */
+extern NSString* const GCDWebServerOption_MaxInFlightRequests;
+
+/**
+ *  The maximum number of HTTP requests waiting for processing when the
+ *  GCDWebServerOption_MaxInFlightRequests limit is reached (NSNumber / NSUInteger).
+ *  Set to 0 to reject requests immediately instead.
+ *
+ *  The default value is 32.
+ */
+extern NSString* const GCDWebServerOption_MaxQueuedRequests;
+
+/**
+ *  The maximum time expressed in seconds an HTTP request can wait in the queue
+ *  before being rejected with a 503 "Service Unavailable" response
+ *  (NSNumber / double).
+ *
+ *  The default value is 1.0 second.
+ */
+extern NSString* const GCDWebServerOption_RequestQueueTimeout;
+
+/**
+ *  The order in which queued HTTP requests are processed when processing slots
+ *  become available (one of "GCDWebServerRequestQueueOrdering_...").
+ *
+ *  The default value is GCDWebServerRequestQueueOrdering_LIFO.
+ */
+extern NSString* const GCDWebServerOption_RequestQueueOrdering;
+
+/**
+ *  The value in seconds of the "Retry-After" header sent with 503 "Service
+ *  Unavailable" responses when the server is overloaded (NSNumber / NSUInteger).
+ *
+ *  The default value is 1.
+ */
+extern NSString* const GCDWebServerOption_OverloadRetryAfter;
+
+/**
+ *  The maximum time expressed in seconds a GCDWebServerConnection can wait for
+ *  the first byte of an HTTP request before being closed (NSNumber / double).
+ *  Since GCDWebServer closes connections after each response, this is also the
+ *  idle timeout of a connection. Set to 0.0 to disable this timeout.
+ *
+ *  The default value is 0.0 (disabled).
+ */
+extern NSString* const GCDWebServerOption_IdleTimeout;
+
+/**
+ *  The maximum time expressed in seconds for receiving the complete headers of an
+ *  HTTP request once its first byte has been received (NSNumber / double).
+ *  The request is answered with a 408 "Request Timeout" response if the deadline
+ *  is missed. Set to 0.0 to disable this timeout.
+ *
+ *  The default value is 0.0 (disabled).
+ */
+extern NSString* const GCDWebServerOption_HeaderReadTimeout;
+
+/**
+ *  The maximum time expressed in seconds without receiving any data while reading
+ *  the body of an HTTP request (NSNumber / double). The request is answered with
+ *  a 408 "Request Timeout" response if the deadline is missed. Set to 0.0 to
+ *  disable this timeout.
+ *
+ *  The default value is 0.0 (disabled).
+ */
+extern NSString* const GCDWebServerOption_BodyReadTimeout;
+
+/**
+ *  The maximum time expressed in seconds for a write to the socket to complete
+ *  when sending an HTTP response before the connection is closed
+ *  (NSNumber / double). Set to 0.0 to disable this timeout.
+ *
+ *  The default value is 0.0 (disabled).
+ *
+ *  @warning This timeout does not apply while the server is waiting on the
+ *  response body reader e.g. for asynchronous or streamed responses.
+ */
+extern NSString* const GCDWebServerOption_WriteTimeout;
+
 #if TARGET_OS_IPHONE
 
 /**
@@ -229,15 +451,50 @@ extern NSString* const GCDWebServerAuthenticationMethod_Basic;
 
 /**
  *  HTTP Digest Access Authentication scheme (see https://tools.ietf.org/html/rfc2617).
+ *
+ *  Nonces are bound to the client IP address and expire after 5 minutes, and
+ *  the "auth" quality of protection is supported to prevent request replays:
+ *  each nonce count is accepted once, and may arrive out of order within a
+ *  window of 64 counts.
  */
 extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
 
+/**
+ *  Process queued HTTP requests in the order they were received.
+ */
+extern NSString* const GCDWebServerRequestQueueOrdering_FIFO;
+
+/**
+ *  Process the most recently queued HTTP requests first and when the queue is
+ *  full, reject the oldest ones which are the most likely to have been given up
+ *  on by their clients.
+ */
+extern NSString* const GCDWebServerRequestQueueOrdering_LIFO;
+
+/**
+ *  Statistics of the worker pool running synchronous process blocks.
+ *  Wait and execution times are expressed in seconds.
+ */
+typedef struct {
+  NSUInteger workerCount;
+  NSUInteger busyWorkers;
+  NSUInteger queuedBlocks;
+  NSUInteger maxQueuedBlocks;
+  uint64_t executedBlocks;
+  uint64_t rejectedBlocks;
+  NSTimeInterval totalWaitTime;
+  NSTimeInterval totalExecutionTime;
+} GCDWebServerWorkerPoolStatistics;
+
 @class GCDWebServer;
+@class GCDWebServerMetrics;
 
 /**
  *  Delegate methods for GCDWebServer.
  *
- *  @warning These methods are always called on the main thread in a serialized way.
+ *  @warning These methods are always called on the delegate queue of the
+ *  GCDWebServer which is the main queue by default. They are only called in
+ *  a serialized way if that queue is serial.
  */
 @protocol GCDWebServerDelegate <NSObject>
 @optional
@@ -313,6 +570,17 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 @property(nonatomic, weak, nullable) id<GCDWebServerDelegate> delegate;
 
+/**
+ *  Sets the dispatch queue on which the delegate methods are called.
+ *
+ *  The default value is the main queue. Headless servers whose main thread
+ *  is busy can use a different queue so that connection and disconnection
+ *  notifications are not delayed.
+ *
+ *  @warning This property must be set before the server is started.
+ */
+@property(nonatomic, null_resettable) dispatch_queue_t delegateQueue;
+
 /**
  *  Returns YES if the server is currently running.
  */
@@ -341,6 +609,22 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 @property(nonatomic, readonly, nullable) NSString* bonjourType;
 
+/**
+ *  Returns the statistics of the worker pool or all zeros if the server is not
+ *  running or GCDWebServerOption_WorkerPoolSize is 0.
+ *
+ *  "maxQueuedBlocks" is the highest number of queued blocks seen so far.
+ */
+@property(nonatomic, readonly) GCDWebServerWorkerPoolStatistics workerPoolStatistics;
+
+/**
+ *  Returns the metrics recorded by the server since it was created.
+ *
+ *  @warning Metrics are only recorded while the server is running with the
+ *  GCDWebServerOption_EnableMetrics option set.
+ */
+@property(nonatomic, readonly) GCDWebServerMetrics* metrics;
+
 /**
  *  This method is the designated initializer for the class.
  */
@@ -366,6 +650,23 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 - (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock asyncProcessBlock:(GCDWebServerAsyncProcessBlock)processBlock;
 
+/**
+ *  Same as -addHandlerWithMatchBlock:processBlock: but the handler runs on its
+ *  own concurrent queue targeting the global queue for the given priority
+ *  instead of the default one set with GCDWebServerOption_DispatchQueuePriority.
+ *
+ *  This allows latency sensitive handlers to stay responsive while others are
+ *  busy generating large responses.
+ */
+- (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock priority:(dispatch_queue_priority_t)priority processBlock:(GCDWebServerProcessBlock)processBlock;
+
+/**
+ *  Same as -addHandlerWithMatchBlock:asyncProcessBlock: but the handler runs on
+ *  its own concurrent queue targeting the global queue for the given priority
+ *  instead of the default one set with GCDWebServerOption_DispatchQueuePriority.
+ */
+- (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock priority:(dispatch_queue_priority_t)priority asyncProcessBlock:(GCDWebServerAsyncProcessBlock)processBlock;
+
 /**
  *  Removes all handlers previously added to the server.
  *
@@ -390,6 +691,23 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 - (void)stop;
 
+/**
+ *  Removes all the responses from the response cache.
+ *
+ *  This method does nothing if the server is not running or
+ *  GCDWebServerOption_ResponseCacheSize is 0.
+ */
+- (void)purgeCachedResponses;
+
+/**
+ *  Removes from the response cache all the responses for a given path
+ *  regardless of their query or "Vary" headers.
+ *
+ *  This method does nothing if the server is not running or
+ *  GCDWebServerOption_ResponseCacheSize is 0.
+ */
+- (void)purgeCachedResponsesForPath:(NSString*)path;
+
 @end
 
 @interface GCDWebServer (Extensions)
@@ -506,6 +824,30 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 - (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block;
 
+/**
+ *  Same as -addHandlerForMethod:path:requestClass:processBlock: but the handler
+ *  runs on its own queue with the given priority.
+ */
+- (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority processBlock:(GCDWebServerProcessBlock)block;
+
+/**
+ *  Same as -addHandlerForMethod:path:requestClass:asyncProcessBlock: but the
+ *  handler runs on its own queue with the given priority.
+ */
+- (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block;
+
+/**
+ *  Same as -addHandlerForMethod:pathRegex:requestClass:processBlock: but the
+ *  handler runs on its own queue with the given priority.
+ */
+- (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority processBlock:(GCDWebServerProcessBlock)block;
+
+/**
+ *  Same as -addHandlerForMethod:pathRegex:requestClass:asyncProcessBlock: but
+ *  the handler runs on its own queue with the given priority.
+ */
+- (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block;
+
 @end
 
 @interface GCDWebServer (GETHandlers)
@@ -533,6 +875,13 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 - (void)addGETHandlerForBasePath:(NSString*)basePath directoryPath:(NSString*)directoryPath indexFilename:(nullable NSString*)indexFilename cacheAge:(NSUInteger)cacheAge allowRangeRequests:(BOOL)allowRangeRequests;
 
+/**
+ *  Adds a handler to the server to respond to incoming "GET" HTTP requests
+ *  on a given path with the metrics of the server in the Prometheus text
+ *  exposition format.
+ */
+- (void)addMetricsHandlerForPath:(NSString*)path;
+
 @end
 
 /**
@@ -637,6 +986,29 @@ extern NSString* const GCDWebServerAuthenticationMethod_DigestAccess;
  */
 - (NSInteger)runTestsWithOptions:(nullable NSDictionary<NSString*, id>*)options inDirectory:(NSString*)path;
 
+/**
+ *  Replays the pre-recorded HTTP requests in the given directory "repeatCount"
+ *  times over "concurrency" simultaneous connections and measures the latency
+ *  of every request and the overall throughput. Only the status codes of the
+ *  responses are checked against the pre-recorded ones.
+ *
+ *  The requests are first performed once sequentially and untimed to learn the
+ *  ETags served for the pre-recorded ones, so that conditional requests
+ *  ("If-None-Match", "If-Match"...) are replayed with the actual validators.
+ *
+ *  If "baselinePath" is not nil and the file exists, the measurements are
+ *  compared to the ones it contains and any regression beyond the tolerance
+ *  stored in the file (20% by default) counts as a failure. If the file does
+ *  not exist, the measurements are written to it instead.
+ *
+ *  Returns the number of failed requests and regressions or -1 if server
+ *  failed to start or the directory contains requests modifying state on the
+ *  server (PUT, POST, DELETE, MOVE, COPY or MKCOL), which cannot produce the
+ *  pre-recorded responses when replayed concurrently and repeatedly. Use
+ *  -runTestsWithOptions:inDirectory: for those.
+ */
+- (NSInteger)runReplayWithOptions:(nullable NSDictionary<NSString*, id>*)options inDirectory:(NSString*)path concurrency:(NSUInteger)concurrency repeatCount:(NSUInteger)repeatCount baselinePath:(nullable NSString*)baselinePath;
+
 @end
 
 #endif
@@ -39,6 +39,9 @@
 #endif
 #import <netinet/in.h>
 #import <dns_sd.h>
+#import <stdatomic.h>
+#import <pthread.h>
+#import <fcntl.h>
 
 #import "GCDWebServerPrivate.h"
 
@@ -50,6 +53,12 @@
 
 #define kBonjourResolutionTimeout 5.0
 
+#define kTimerWheelSlotCount 128
+#define kTimerWheelTickInterval (250 * NSEC_PER_MSEC)
+
+#define kOverloadLingerTimeout (1 * NSEC_PER_SEC)
+#define kOverloadLingerMaxBytes (64 * 1024)
+
 NSString* const GCDWebServerOption_Port = @"Port";
 NSString* const GCDWebServerOption_BonjourName = @"BonjourName";
 NSString* const GCDWebServerOption_BonjourType = @"BonjourType";
@@ -65,6 +74,26 @@ NSString* const GCDWebServerOption_ConnectionClass = @"ConnectionClass";
 NSString* const GCDWebServerOption_AutomaticallyMapHEADToGET = @"AutomaticallyMapHEADToGET";
 NSString* const GCDWebServerOption_ConnectedStateCoalescingInterval = @"ConnectedStateCoalescingInterval";
 NSString* const GCDWebServerOption_DispatchQueuePriority = @"DispatchQueuePriority";
+NSString* const GCDWebServerOption_IOConcurrencyWidth = @"IOConcurrencyWidth";
+NSString* const GCDWebServerOption_WorkerPoolSize = @"WorkerPoolSize";
+NSString* const GCDWebServerOption_WorkerPoolQueueSize = @"WorkerPoolQueueSize";
+NSString* const GCDWebServerOption_EnableMetrics = @"EnableMetrics";
+NSString* const GCDWebServerOption_RequestTimingsObserver = @"RequestTimingsObserver";
+NSString* const GCDWebServerOption_AccessLog = @"AccessLog";
+NSString* const GCDWebServerOption_MimeTypeOverrides = @"MimeTypeOverrides";
+NSString* const GCDWebServerOption_UseContentDigestETags = @"UseContentDigestETags";
+NSString* const GCDWebServerOption_ResponseCacheSize = @"ResponseCacheSize";
+NSString* const GCDWebServerOption_CoalesceRequests = @"CoalesceRequests";
+NSString* const GCDWebServerOption_MaxActiveConnections = @"MaxActiveConnections";
+NSString* const GCDWebServerOption_MaxInFlightRequests = @"MaxInFlightRequests";
+NSString* const GCDWebServerOption_MaxQueuedRequests = @"MaxQueuedRequests";
+NSString* const GCDWebServerOption_RequestQueueTimeout = @"RequestQueueTimeout";
+NSString* const GCDWebServerOption_RequestQueueOrdering = @"RequestQueueOrdering";
+NSString* const GCDWebServerOption_OverloadRetryAfter = @"OverloadRetryAfter";
+NSString* const GCDWebServerOption_IdleTimeout = @"IdleTimeout";
+NSString* const GCDWebServerOption_HeaderReadTimeout = @"HeaderReadTimeout";
+NSString* const GCDWebServerOption_BodyReadTimeout = @"BodyReadTimeout";
+NSString* const GCDWebServerOption_WriteTimeout = @"WriteTimeout";
 #if TARGET_OS_IPHONE
 NSString* const GCDWebServerOption_AutomaticallySuspendInBackground = @"AutomaticallySuspendInBackground";
 #endif
@@ -72,6 +101,9 @@ NSString* const GCDWebServerOption_AutomaticallySuspendInBackground = @"Automati
 NSString* const GCDWebServerAuthenticationMethod_Basic = @"Basic";
 NSString* const GCDWebServerAuthenticationMethod_DigestAccess = @"DigestAccess";
 
+NSString* const GCDWebServerRequestQueueOrdering_FIFO = @"FIFO";
+NSString* const GCDWebServerRequestQueueOrdering_LIFO = @"LIFO";
+
 #if defined(__GCDWEBSERVER_LOGGING_FACILITY_BUILTIN__)
 #if DEBUG
 GCDWebServerLoggingLevel GCDWebServerLogLevel = kGCDWebServerLoggingLevel_Debug;
@@ -135,29 +167,773 @@ static void _ExecuteMainThreadRunLoopSources() {
 
 @implementation GCDWebServerHandler
 
-- (instancetype)initWithMatchBlock:(GCDWebServerMatchBlock _Nonnull)matchBlock asyncProcessBlock:(GCDWebServerAsyncProcessBlock _Nonnull)processBlock {
+- (instancetype)initWithMatchBlock:(GCDWebServerMatchBlock _Nonnull)matchBlock queue:(dispatch_queue_t _Nullable)queue asyncProcessBlock:(GCDWebServerAsyncProcessBlock _Nonnull)processBlock {
+  return [self initWithMatchBlock:matchBlock queue:queue processBlock:nil asyncProcessBlock:processBlock];
+}
+
+- (instancetype)initWithMatchBlock:(GCDWebServerMatchBlock _Nonnull)matchBlock queue:(dispatch_queue_t _Nullable)queue processBlock:(GCDWebServerProcessBlock _Nullable)processBlock asyncProcessBlock:(GCDWebServerAsyncProcessBlock _Nonnull)asyncProcessBlock {
   if ((self = [super init])) {
     _matchBlock = [matchBlock copy];
-    _asyncProcessBlock = [processBlock copy];
+    _processBlock = [processBlock copy];
+    _asyncProcessBlock = [asyncProcessBlock copy];
+    _route = @"custom";
+    _queue = queue;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    if (_queue) {
+      dispatch_retain(_queue);
+    }
+#endif
+  }
+  return self;
+}
+
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+
+- (void)dealloc {
+  if (_queue) {
+    dispatch_release(_queue);
+  }
+}
+
+#endif
+
+@end
+
+@interface GCDWebServerQueuedRequest : NSObject
+@property(nonatomic, readonly) dispatch_block_t admitBlock;
+@property(nonatomic, readonly) dispatch_block_t rejectBlock;
+@property(nonatomic, readonly) uint64_t deadline;  // Monotonic time in nanoseconds
+@end
+
+@implementation GCDWebServerQueuedRequest
+
+- (instancetype)initWithAdmitBlock:(dispatch_block_t)admitBlock rejectBlock:(dispatch_block_t)rejectBlock deadline:(uint64_t)deadline {
+  if ((self = [super init])) {
+    _admitBlock = [admitBlock copy];
+    _rejectBlock = [rejectBlock copy];
+    _deadline = deadline;
+  }
+  return self;
+}
+
+@end
+
+@interface GCDWebServerTimerWheelEntry ()
+@property(nonatomic, readonly, weak) GCDWebServerConnection* connection;
+@property(nonatomic) NSUInteger slot;
+@property(nonatomic) NSUInteger rounds;
+@property(nonatomic) uint64_t scheduledTime;
+@end
+
+@implementation GCDWebServerTimerWheelEntry
+
+- (instancetype)initWithConnection:(GCDWebServerConnection*)connection {
+  if ((self = [super init])) {
+    _connection = connection;
+    _slot = NSNotFound;
+  }
+  return self;
+}
+
+@end
+
+// Hashed timer wheel shared by all connections of a server: connections only update their deadline atomically
+// as they make progress and entries are lazily re-inserted when their slot comes up, so a single timer at a
+// fixed resolution can enforce any number of connection timeouts
+@implementation GCDWebServerTimerWheel {
+  dispatch_queue_t _queue;
+  dispatch_source_t _timer;  // Only exists while there are entries in the wheel
+  NSMutableArray<NSMutableSet<GCDWebServerTimerWheelEntry*>*>* _slots;
+  NSUInteger _currentSlot;
+  NSUInteger _entryCount;
+}
+
+- (instancetype)init {
+  if ((self = [super init])) {
+    _queue = dispatch_queue_create([NSStringFromClass([self class]) UTF8String], DISPATCH_QUEUE_SERIAL);
+    _slots = [[NSMutableArray alloc] initWithCapacity:kTimerWheelSlotCount];
+    for (NSUInteger i = 0; i < kTimerWheelSlotCount; ++i) {
+      [_slots addObject:[[NSMutableSet alloc] init]];
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  GWS_DCHECK(_timer == NULL);  // The wheel can never be dealloc'ed while the timer is running because of the retain-cycle
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_queue);
+#endif
+}
+
+// Must be called on _queue
+- (void)_removeEntry:(GCDWebServerTimerWheelEntry*)entry {
+  [_slots[entry.slot] removeObject:entry];
+  entry.slot = NSNotFound;
+  _entryCount -= 1;
+}
+
+// Must be called on _queue
+- (void)_insertEntry:(GCDWebServerTimerWheelEntry*)entry now:(uint64_t)now {
+  GCDWebServerConnection* connection = entry.connection;
+  uint64_t deadline = connection ? connection.timeoutDeadline : 0;
+  if (entry.slot != NSNotFound) {
+    if (deadline && (entry.scheduledTime <= deadline)) {
+      return;  // The entry will be re-evaluated early enough
+    }
+    [self _removeEntry:entry];
+  }
+  if (deadline == 0) {
+    return;
+  }
+
+  uint64_t ticks = deadline > now ? (deadline - now + kTimerWheelTickInterval - 1) / kTimerWheelTickInterval : 1;
+  entry.slot = (_currentSlot + ticks) % kTimerWheelSlotCount;
+  entry.rounds = (NSUInteger)((ticks - 1) / kTimerWheelSlotCount);
+  entry.scheduledTime = now + ticks * kTimerWheelTickInterval;
+  [_slots[entry.slot] addObject:entry];
+  _entryCount += 1;
+
+  if (_timer == NULL) {
+    _timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _queue);
+    dispatch_source_set_timer(_timer, dispatch_time(DISPATCH_TIME_NOW, kTimerWheelTickInterval), kTimerWheelTickInterval, kTimerWheelTickInterval / 10);
+    dispatch_source_set_event_handler(_timer, ^{
+      @autoreleasepool {
+        [self _advanceTicks:dispatch_source_get_data(self->_timer)];
+      }
+    });
+    dispatch_resume(_timer);
+  }
+}
+
+// Must be called on _queue
+- (void)_advanceTicks:(unsigned long)count {
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  for (unsigned long i = 0; i < MIN(count, kTimerWheelSlotCount); ++i) {  // Late entries are caught by the deadline check anyway
+    _currentSlot = (_currentSlot + 1) % kTimerWheelSlotCount;
+    NSMutableSet* slot = _slots[_currentSlot];
+    if (slot.count == 0) {
+      continue;
+    }
+    for (GCDWebServerTimerWheelEntry* entry in [slot allObjects]) {
+      if (entry.rounds > 0) {
+        entry.rounds -= 1;
+        continue;
+      }
+      [self _removeEntry:entry];
+      GCDWebServerConnection* connection = entry.connection;
+      uint64_t deadline = connection ? connection.timeoutDeadline : 0;
+      if (deadline == 0) {
+        continue;  // Timeout was disarmed, connection will re-schedule the entry when arming a new one
+      }
+      if (deadline <= now) {
+        [connection timeoutDidExpire];
+      } else {
+        [self _insertEntry:entry now:now];
+      }
+    }
+  }
+
+  if (_entryCount == 0) {
+    dispatch_source_cancel(_timer);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_timer);
+#endif
+    _timer = NULL;
+  }
+}
+
+- (void)scheduleEntry:(GCDWebServerTimerWheelEntry*)entry {
+  dispatch_async(_queue, ^{
+    @autoreleasepool {
+      [self _insertEntry:entry now:GCDWebServerGetMonotonicTime()];
+    }
+  });
+}
+
+@end
+
+@interface GCDWebServerWorkerPoolItem : NSObject
+@property(nonatomic, readonly) dispatch_block_t block;
+@property(nonatomic, readonly) uint64_t enqueueTime;
+@end
+
+@implementation GCDWebServerWorkerPoolItem
+
+- (instancetype)initWithBlock:(dispatch_block_t)block {
+  if ((self = [super init])) {
+    _block = [block copy];
+    _enqueueTime = GCDWebServerGetMonotonicTime();
+  }
+  return self;
+}
+
+@end
+
+// Fixed set of threads consuming a bounded FIFO queue: unlike libdispatch, which spawns more threads whenever
+// blocks on its queues are blocked in the kernel, the number of threads running synchronous handlers never grows
+@implementation GCDWebServerWorkerPool {
+  pthread_mutex_t _mutex;
+  pthread_cond_t _condition;
+  NSMutableArray<GCDWebServerWorkerPoolItem*>* _items;  // Protected by _mutex
+  NSUInteger _maxQueuedBlocks;
+  BOOL _invalidated;  // Protected by _mutex
+  GCDWebServerWorkerPoolStatistics _statistics;  // Protected by _mutex
+}
+
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount maxQueuedBlocks:(NSUInteger)maxQueuedBlocks {
+  GWS_DCHECK(workerCount > 0);
+  if ((self = [super init])) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_condition, NULL);
+    _items = [[NSMutableArray alloc] init];
+    _maxQueuedBlocks = maxQueuedBlocks;
+    _statistics.workerCount = workerCount;
+    for (NSUInteger i = 0; i < workerCount; ++i) {
+      NSThread* thread = [[NSThread alloc] initWithTarget:self selector:@selector(_runWorker) object:nil];  // Threads retain the pool until they exit
+      thread.name = [NSString stringWithFormat:@"%@.%lu", NSStringFromClass([self class]), (unsigned long)i];
+      [thread start];
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  pthread_cond_destroy(&_condition);
+  pthread_mutex_destroy(&_mutex);
+}
+
+- (void)_runWorker {
+  pthread_mutex_lock(&_mutex);
+  while (1) {
+    while ((_items.count == 0) && !_invalidated) {
+      pthread_cond_wait(&_condition, &_mutex);
+    }
+    if (_items.count == 0) {
+      break;  // Pool was invalidated and all queued blocks have been executed
+    }
+    GCDWebServerWorkerPoolItem* item = _items[0];
+    [_items removeObjectAtIndex:0];
+    uint64_t startTime = GCDWebServerGetMonotonicTime();
+    _statistics.queuedBlocks -= 1;
+    _statistics.busyWorkers += 1;
+    _statistics.totalWaitTime += (double)(startTime - item.enqueueTime) / (double)NSEC_PER_SEC;
+    pthread_mutex_unlock(&_mutex);
+
+    @autoreleasepool {
+      item.block();
+      item = nil;
+    }
+
+    uint64_t endTime = GCDWebServerGetMonotonicTime();
+    pthread_mutex_lock(&_mutex);
+    _statistics.busyWorkers -= 1;
+    _statistics.executedBlocks += 1;
+    _statistics.totalExecutionTime += (double)(endTime - startTime) / (double)NSEC_PER_SEC;
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (BOOL)submitBlock:(dispatch_block_t)block {
+  GCDWebServerWorkerPoolItem* item = [[GCDWebServerWorkerPoolItem alloc] initWithBlock:block];
+  BOOL success = NO;
+  pthread_mutex_lock(&_mutex);
+  if (!_invalidated && (_items.count < _maxQueuedBlocks)) {
+    [_items addObject:item];
+    _statistics.queuedBlocks += 1;
+    _statistics.maxQueuedBlocks = MAX(_statistics.maxQueuedBlocks, _statistics.queuedBlocks);
+    pthread_cond_signal(&_condition);
+    success = YES;
+  } else {
+    _statistics.rejectedBlocks += 1;
+  }
+  pthread_mutex_unlock(&_mutex);
+  return success;
+}
+
+- (void)invalidate {
+  pthread_mutex_lock(&_mutex);
+  _invalidated = YES;
+  pthread_cond_broadcast(&_condition);
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (GCDWebServerWorkerPoolStatistics)statistics {
+  pthread_mutex_lock(&_mutex);
+  GCDWebServerWorkerPoolStatistics statistics = _statistics;
+  pthread_mutex_unlock(&_mutex);
+  return statistics;
+}
+
+@end
+
+#define kResponseCacheEntryOverhead 512  // Rough size of the entry, headers and response objects besides the body
+
+@interface GCDWebServerResponseCacheEntry : NSObject
+@property(nonatomic) NSString* path;
+@property(nonatomic) NSString* query;
+@property(nonatomic) NSArray<NSString*>* varyHeaders;
+@property(nonatomic) NSArray* varyValues;  // NSNull for missing request headers
+@property(nonatomic) BOOL acceptsGzip;  // Gzip encoding is decided by the handler from "Accept-Encoding" so it is always part of the key
+@property(nonatomic) GCDWebServerDataResponse* response;  // Never sent, only copied
+@property(nonatomic) uint64_t expirationTime;
+@property(nonatomic) uint64_t staleExpirationTime;
+@property(nonatomic) BOOL revalidating;
+@property(nonatomic, readonly) NSUInteger cost;
+@end
+
+@implementation GCDWebServerResponseCacheEntry
+
+- (NSUInteger)cost {
+  return _response.data.length + kResponseCacheEntryOverhead;
+}
+
+@end
+
+static NSString* _GetAdditionalHeader(GCDWebServerResponse* response, NSString* name) {
+  for (NSString* header in response.additionalHeaders) {
+    if ([header caseInsensitiveCompare:name] == NSOrderedSame) {
+      return [response.additionalHeaders objectForKey:header];
+    }
+  }
+  return nil;
+}
+
+static NSArray* _GetVaryValues(GCDWebServerRequest* request, NSArray<NSString*>* varyHeaders) {
+  NSMutableArray* values = [[NSMutableArray alloc] initWithCapacity:varyHeaders.count];
+  for (NSString* header in varyHeaders) {
+    NSString* value = [request.headers objectForKey:header];
+    [values addObject:(value ? value : [NSNull null])];
+  }
+  return values;
+}
+
+// Returns NO if the response must not be cached
+// https://tools.ietf.org/html/rfc7234#section-3.2 - responses to authenticated requests are only shared if explicitly allowed
+static BOOL _GetCacheLifetimes(GCDWebServerResponse* response, BOOL isAuthenticated, NSUInteger* maxAge, NSUInteger* staleWhileRevalidate) {
+  *maxAge = response.cacheControlMaxAge;
+  *staleWhileRevalidate = 0;
+  BOOL isShareable = !isAuthenticated;
+  NSString* cacheControl = _GetAdditionalHeader(response, @"Cache-Control");
+  if (cacheControl) {
+    *maxAge = 0;
+    BOOL hasSharedMaxAge = NO;
+    for (NSString* component in [[cacheControl lowercaseString] componentsSeparatedByString:@","]) {
+      NSString* directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+      if ([directive isEqualToString:@"no-store"] || [directive hasPrefix:@"no-cache"] || [directive hasPrefix:@"private"]) {
+        return NO;
+      } else if ([directive hasPrefix:@"s-maxage="]) {
+        *maxAge = [[directive substringFromIndex:9] integerValue];
+        hasSharedMaxAge = YES;
+        isShareable = YES;
+      } else if ([directive hasPrefix:@"max-age="] && !hasSharedMaxAge) {
+        *maxAge = [[directive substringFromIndex:8] integerValue];
+      } else if ([directive hasPrefix:@"stale-while-revalidate="]) {
+        *staleWhileRevalidate = [[directive substringFromIndex:23] integerValue];
+      } else if ([directive isEqualToString:@"public"] || [directive isEqualToString:@"must-revalidate"]) {
+        isShareable = YES;
+      }
+    }
+  }
+  return isShareable && (*maxAge > 0);
+}
+
+// Bounded LRU cache of complete in-memory responses shared by all connections: entries are grouped by path
+// so purging a path does not require scanning the whole cache, and are matched on query and "Vary" headers
+@implementation GCDWebServerResponseCache {
+  pthread_mutex_t _mutex;
+  NSUInteger _maxSize;
+  NSUInteger _size;  // Protected by _mutex
+  NSMutableDictionary<NSString*, NSMutableArray<GCDWebServerResponseCacheEntry*>*>* _entries;  // Protected by _mutex
+  NSMutableOrderedSet<GCDWebServerResponseCacheEntry*>* _lru;  // Protected by _mutex - Least recently used first
+}
+
+- (instancetype)initWithMaxSize:(NSUInteger)maxSize {
+  if ((self = [super init])) {
+    pthread_mutex_init(&_mutex, NULL);
+    _maxSize = maxSize;
+    _entries = [[NSMutableDictionary alloc] init];
+    _lru = [[NSMutableOrderedSet alloc] init];
   }
   return self;
 }
 
+- (void)dealloc {
+  pthread_mutex_destroy(&_mutex);
+}
+
+static inline BOOL _IsCacheableRequest(GCDWebServerRequest* request) {
+  return [request.method isEqualToString:@"GET"] && ![request hasBody] && !GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Upgrade);
+}
+
+// Must be called with _mutex locked
+- (GCDWebServerResponseCacheEntry*)_findEntryForRequest:(GCDWebServerRequest*)request {
+  NSString* query = request.URL.query ?: @"";
+  for (GCDWebServerResponseCacheEntry* entry in [_entries objectForKey:request.path]) {
+    if ([entry.query isEqualToString:query] && (entry.acceptsGzip == request.acceptsGzipContentEncoding) && [entry.varyValues isEqualToArray:_GetVaryValues(request, entry.varyHeaders)]) {
+      return entry;
+    }
+  }
+  return nil;
+}
+
+// Must be called with _mutex locked
+- (void)_removeEntry:(GCDWebServerResponseCacheEntry*)entry {
+  NSMutableArray* pathEntries = [_entries objectForKey:entry.path];
+  [pathEntries removeObjectIdenticalTo:entry];
+  if (pathEntries.count == 0) {
+    [_entries removeObjectForKey:entry.path];
+  }
+  [_lru removeObject:entry];
+  _size -= entry.cost;
+}
+
+- (GCDWebServerResponse*)cachedResponseForRequest:(GCDWebServerRequest*)request needsRevalidation:(BOOL*)needsRevalidation {
+  *needsRevalidation = NO;
+  if (!_IsCacheableRequest(request)) {
+    return nil;
+  }
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  pthread_mutex_lock(&_mutex);
+  GCDWebServerResponseCacheEntry* entry = [self _findEntryForRequest:request];
+  if (entry) {
+    if (now < entry.staleExpirationTime) {
+      if ((now >= entry.expirationTime) && !entry.revalidating) {
+        entry.revalidating = YES;
+        *needsRevalidation = YES;
+      }
+      [_lru removeObject:entry];
+      [_lru addObject:entry];
+    } else {
+      [self _removeEntry:entry];
+      entry = nil;
+    }
+  }
+  pthread_mutex_unlock(&_mutex);
+  if (entry == nil) {
+    return nil;
+  }
+
+  return [entry.response copyResponse];
+}
+
+- (void)storeResponse:(GCDWebServerResponse*)response forRequest:(GCDWebServerRequest*)request {
+  if (!_IsCacheableRequest(request)) {
+    return;
+  }
+  GCDWebServerResponseCacheEntry* newEntry = nil;
+  NSUInteger maxAge;
+  NSUInteger staleWhileRevalidate;
+  if ([response isMemberOfClass:[GCDWebServerDataResponse class]] && (response.statusCode == kGCDWebServerHTTPStatusCode_OK) && _GetCacheLifetimes(response, GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Authorization) != nil, &maxAge, &staleWhileRevalidate) && !_GetAdditionalHeader(response, @"Set-Cookie")) {
+    NSString* vary = _GetAdditionalHeader(response, @"Vary");
+    NSMutableArray<NSString*>* varyHeaders = [[NSMutableArray alloc] init];
+    for (NSString* component in [vary componentsSeparatedByString:@","]) {
+      NSString* header = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+      if (header.length) {
+        [varyHeaders addObject:header];
+      }
+    }
+    if (![varyHeaders containsObject:@"*"]) {
+      uint64_t now = GCDWebServerGetMonotonicTime();
+      newEntry = [[GCDWebServerResponseCacheEntry alloc] init];
+      newEntry.path = request.path;
+      newEntry.query = request.URL.query ?: @"";
+      newEntry.varyHeaders = varyHeaders;
+      newEntry.varyValues = _GetVaryValues(request, varyHeaders);
+      newEntry.acceptsGzip = request.acceptsGzipContentEncoding;
+      newEntry.response = [(GCDWebServerDataResponse*)response copyResponse];  // The response gets modified while being sent (e.g. for byte ranges)
+      newEntry.expirationTime = now + (uint64_t)maxAge * NSEC_PER_SEC;
+      newEntry.staleExpirationTime = newEntry.expirationTime + (uint64_t)staleWhileRevalidate * NSEC_PER_SEC;
+      if (newEntry.cost > _maxSize / 4) {  // Prevent a single response from flushing the entire cache
+        newEntry = nil;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&_mutex);
+  GCDWebServerResponseCacheEntry* entry = [self _findEntryForRequest:request];
+  if (entry) {
+    [self _removeEntry:entry];
+  }
+  if (newEntry) {
+    NSMutableArray* pathEntries = [_entries objectForKey:request.path];
+    if (pathEntries == nil) {
+      pathEntries = [[NSMutableArray alloc] init];
+      [_entries setObject:pathEntries forKey:request.path];
+    }
+    [pathEntries addObject:newEntry];
+    [_lru addObject:newEntry];
+    _size += newEntry.cost;
+    while (_size > _maxSize) {
+      [self _removeEntry:_lru.firstObject];
+    }
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (void)cancelRevalidationForRequest:(GCDWebServerRequest*)request {
+  pthread_mutex_lock(&_mutex);
+  [self _findEntryForRequest:request].revalidating = NO;
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (void)removeResponseForRequest:(GCDWebServerRequest*)request {
+  pthread_mutex_lock(&_mutex);
+  GCDWebServerResponseCacheEntry* entry = [self _findEntryForRequest:request];
+  if (entry) {
+    [self _removeEntry:entry];
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (void)removeAllResponses {
+  pthread_mutex_lock(&_mutex);
+  [_entries removeAllObjects];
+  [_lru removeAllObjects];
+  _size = 0;
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (void)removeResponsesForPath:(NSString*)path {
+  pthread_mutex_lock(&_mutex);
+  for (GCDWebServerResponseCacheEntry* entry in [[_entries objectForKey:path] copy]) {
+    [self _removeEntry:entry];
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+@end
+
+#define kVerifiedCredentialsLimit 256
+#define kDigestNonceLifetime (300 * NSEC_PER_SEC)
+#define kDigestNoncesLimit 4096
+#define kDigestNonceCountWindow 64  // Bits in "seenNonceCounts"
+
+@interface GCDWebServerDigestNonce : NSObject
+@property(nonatomic, copy) NSString* client;
+@property(nonatomic) uint64_t expirationTime;
+@property(nonatomic) uint64_t highestNonceCount;
+@property(nonatomic) uint64_t seenNonceCounts;  // Bit N is set if "highestNonceCount - N" was accepted
+@end
+
+@implementation GCDWebServerDigestNonce
+@end
+
+// Credentials are only verified once per lifetime and Digest nonces are bound to the client address and expire
+// so that captured Authorization headers can only be replayed from the same client for a short time
+@implementation GCDWebServerAuthenticationState {
+  pthread_mutex_t _mutex;
+  NSMutableDictionary<NSString*, NSNumber*>* _verifiedCredentials;  // Protected by _mutex
+  NSMutableDictionary<NSString*, GCDWebServerDigestNonce*>* _nonces;  // Protected by _mutex
+  NSMutableArray<NSString*>* _issuedNonces;  // Protected by _mutex - Oldest first which is also expiration order as all nonces have the same lifetime
+}
+
+- (instancetype)init {
+  if ((self = [super init])) {
+    pthread_mutex_init(&_mutex, NULL);
+    _verifiedCredentials = [[NSMutableDictionary alloc] init];
+    _nonces = [[NSMutableDictionary alloc] init];
+    _issuedNonces = [[NSMutableArray alloc] init];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  pthread_mutex_destroy(&_mutex);
+}
+
+- (BOOL)isVerifiedCredential:(NSString*)authorization {
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  pthread_mutex_lock(&_mutex);
+  NSNumber* expirationTime = [_verifiedCredentials objectForKey:authorization];
+  BOOL verified = expirationTime && (now < expirationTime.unsignedLongLongValue);
+  pthread_mutex_unlock(&_mutex);
+  return verified;
+}
+
+- (void)addVerifiedCredential:(NSString*)authorization expirationTime:(uint64_t)expirationTime {
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  pthread_mutex_lock(&_mutex);
+  if (_verifiedCredentials.count >= kVerifiedCredentialsLimit) {
+    for (NSString* key in _verifiedCredentials.allKeys) {
+      if (now >= [[_verifiedCredentials objectForKey:key] unsignedLongLongValue]) {
+        [_verifiedCredentials removeObjectForKey:key];
+      }
+    }
+    if (_verifiedCredentials.count >= kVerifiedCredentialsLimit) {
+      [_verifiedCredentials removeAllObjects];
+    }
+  }
+  [_verifiedCredentials setObject:@(expirationTime) forKey:authorization];
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (NSString*)issueNonceForClient:(NSString*)client {
+  unsigned char bytes[16];
+  arc4random_buf(bytes, sizeof(bytes));
+  char buffer[2 * sizeof(bytes) + 1];
+  for (size_t i = 0; i < sizeof(bytes); ++i) {
+    snprintf(&buffer[2 * i], 3, "%02x", bytes[i]);
+  }
+  NSString* string = [[NSString alloc] initWithUTF8String:buffer];
+  GCDWebServerDigestNonce* nonce = [[GCDWebServerDigestNonce alloc] init];
+  nonce.client = client;
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  nonce.expirationTime = now + kDigestNonceLifetime;
+  pthread_mutex_lock(&_mutex);
+  while (_issuedNonces.count) {  // NSMutableArray removes from the front in constant time
+    NSString* oldestKey = _issuedNonces.firstObject;
+    GCDWebServerDigestNonce* oldest = [_nonces objectForKey:oldestKey];
+    if ((_issuedNonces.count < kDigestNoncesLimit) && oldest && (now < oldest.expirationTime)) {
+      break;
+    }
+    [_nonces removeObjectForKey:oldestKey];
+    [_issuedNonces removeObjectAtIndex:0];
+  }
+  [_nonces setObject:nonce forKey:string];
+  [_issuedNonces addObject:string];
+  pthread_mutex_unlock(&_mutex);
+  return string;
+}
+
+- (GCDWebServerNonceStatus)checkNonce:(NSString*)nonce client:(NSString*)client expirationTime:(uint64_t*)expirationTime {
+  GCDWebServerNonceStatus status = kGCDWebServerNonceStatus_Unknown;
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  pthread_mutex_lock(&_mutex);
+  GCDWebServerDigestNonce* entry = [_nonces objectForKey:nonce];
+  if (entry && [entry.client isEqualToString:client]) {
+    if (now < entry.expirationTime) {
+      *expirationTime = entry.expirationTime;
+      status = kGCDWebServerNonceStatus_Valid;
+    } else {
+      [_nonces removeObjectForKey:nonce];
+      status = kGCDWebServerNonceStatus_Expired;
+    }
+  }
+  pthread_mutex_unlock(&_mutex);
+  return status;
+}
+
+- (BOOL)acceptNonceCount:(uint64_t)nonceCount forNonce:(NSString*)nonce {
+  BOOL accepted = NO;
+  pthread_mutex_lock(&_mutex);
+  GCDWebServerDigestNonce* entry = [_nonces objectForKey:nonce];
+  if (entry && (nonceCount > 0)) {  // Concurrent requests may arrive slightly out of order so a window of recent counts is tracked
+    if (nonceCount > entry.highestNonceCount) {
+      uint64_t shift = nonceCount - entry.highestNonceCount;
+      entry.seenNonceCounts = (shift < kDigestNonceCountWindow ? entry.seenNonceCounts << shift : 0) | 1;
+      entry.highestNonceCount = nonceCount;
+      accepted = YES;
+    } else {
+      uint64_t offset = entry.highestNonceCount - nonceCount;
+      if ((offset < kDigestNonceCountWindow) && !(entry.seenNonceCounts & (1ULL << offset))) {
+        entry.seenNonceCounts |= 1ULL << offset;
+        accepted = YES;
+      }
+    }
+  }
+  pthread_mutex_unlock(&_mutex);
+  return accepted;
+}
+
+@end
+
+// Single-flight table: the first request for a key is processed normally while the identical ones received before
+// it completes are parked here, then all get a copy of its response sharing the same body buffer
+@implementation GCDWebServerRequestCoalescer {
+  pthread_mutex_t _mutex;
+  NSMutableDictionary<NSString*, NSMutableArray<GCDWebServerCoalescedResponseBlock>*>* _waiters;  // Protected by _mutex
+}
+
+- (instancetype)init {
+  if ((self = [super init])) {
+    pthread_mutex_init(&_mutex, NULL);
+    _waiters = [[NSMutableDictionary alloc] init];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  pthread_mutex_destroy(&_mutex);
+}
+
+static NSString* _GetCoalescingKey(GCDWebServerRequest* request, GCDWebServerHandler* handler) {
+  if (![request.method isEqualToString:@"GET"] || [request hasBody] || GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Upgrade)) {  // Protocol upgrades take over the connection
+    return nil;
+  }
+  NSString* authorization = GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Authorization);
+  NSString* cookie = GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Cookie);
+  NSString* acceptEncoding = GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_AcceptEncoding);  // Handlers enable gzip encoding based on it
+  return [NSString stringWithFormat:@"%p\n%@\n%@\n%@\n%@\n%@", handler, request.path, request.URL.query ?: @"", authorization ?: @"", cookie ?: @"", acceptEncoding ?: @""];
+}
+
+- (BOOL)addWaiterForRequest:(GCDWebServerRequest*)request handler:(GCDWebServerHandler*)handler block:(GCDWebServerCoalescedResponseBlock)block {
+  NSString* key = _GetCoalescingKey(request, handler);
+  if (key == nil) {
+    return NO;
+  }
+  BOOL added = NO;
+  pthread_mutex_lock(&_mutex);
+  NSMutableArray* waiters = [_waiters objectForKey:key];
+  if (waiters) {
+    [waiters addObject:[block copy]];
+    added = YES;
+  } else {
+    [_waiters setObject:[[NSMutableArray alloc] init] forKey:key];  // The caller becomes the leader for this key
+  }
+  pthread_mutex_unlock(&_mutex);
+  return added;
+}
+
+- (void)finishRequest:(GCDWebServerRequest*)request handler:(GCDWebServerHandler*)handler withResponse:(GCDWebServerResponse*)response {
+  NSString* key = _GetCoalescingKey(request, handler);
+  if (key == nil) {
+    return;
+  }
+  pthread_mutex_lock(&_mutex);
+  NSArray* waiters = [_waiters objectForKey:key];
+  [_waiters removeObjectForKey:key];
+  pthread_mutex_unlock(&_mutex);
+  if (waiters.count) {
+    GCDWebServerDataResponse* sharedResponse = [response isKindOfClass:[GCDWebServerDataResponse class]] ? [(GCDWebServerDataResponse*)response copyResponse] : nil;
+    GWS_LOG_DEBUG(@"Coalesced %lu requests for \"%@\"", (unsigned long)waiters.count, request.path);
+    for (GCDWebServerCoalescedResponseBlock block in waiters) {
+      block(sharedResponse ? [sharedResponse copyResponse] : nil);
+    }
+  }
+}
+
 @end
 
 @implementation GCDWebServer {
   dispatch_queue_t _syncQueue;
   dispatch_group_t _sourceGroup;
   NSMutableArray<GCDWebServerHandler*>* _handlers;
-  NSInteger _activeConnections;  // Accessed through _syncQueue only
-  BOOL _connected;  // Accessed on main thread only
-  CFRunLoopTimerRef _disconnectTimer;  // Accessed on main thread only
+  _Atomic(NSInteger) _activeConnections;
+  NSUInteger _inFlightRequests;  // Accessed through _syncQueue only
+  NSMutableArray<GCDWebServerQueuedRequest*>* _requestQueue;  // Accessed through _syncQueue only
+  BOOL _connected;  // Accessed through _syncQueue only
+  dispatch_source_t _disconnectTimer;  // Accessed through _syncQueue only
+  dispatch_queue_t _delegateQueue;
 
   NSDictionary<NSString*, id>* _options;
   NSMutableDictionary<NSString*, NSString*>* _authenticationBasicAccounts;
   NSMutableDictionary<NSString*, NSString*>* _authenticationDigestAccounts;
   Class _connectionClass;
   CFTimeInterval _disconnectDelay;
+  NSUInteger _maxActiveConnections;
+  NSUInteger _maxQueuedRequests;
+  CFTimeInterval _requestQueueTimeout;
+  BOOL _lifoRequestQueue;
+  NSData* _overloadResponseData;
+  dispatch_queue_t _acceptQueue;
+#if OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  __strong dispatch_queue_t* _ioQueues;  // Queues are ARC managed objects so the malloc'ed slots need an explicit ownership
+#else
+  dispatch_queue_t* _ioQueues;
+#endif
+  NSUInteger _ioQueueCount;
+  _Atomic(NSUInteger) _nextIOQueueIndex;
   dispatch_source_t _source4;
   dispatch_source_t _source6;
   CFNetServiceRef _registrationService;
@@ -186,6 +962,9 @@ static void _ExecuteMainThreadRunLoopSources() {
     _syncQueue = dispatch_queue_create([NSStringFromClass([self class]) UTF8String], DISPATCH_QUEUE_SERIAL);
     _sourceGroup = dispatch_group_create();
     _handlers = [[NSMutableArray alloc] init];
+    _requestQueue = [[NSMutableArray alloc] init];
+    _timerWheel = [[GCDWebServerTimerWheel alloc] init];
+    _metrics = [[GCDWebServerMetrics alloc] init];
 #if TARGET_OS_IPHONE
     _backgroundTask = UIBackgroundTaskInvalid;
 #endif
@@ -200,11 +979,31 @@ static void _ExecuteMainThreadRunLoopSources() {
   GWS_DCHECK(_disconnectTimer == NULL);  // The server can never be dealloc'ed while the disconnect timer is pending because of the retain-cycle
 
 #if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  if (_delegateQueue) {
+    dispatch_release(_delegateQueue);
+  }
   dispatch_release(_sourceGroup);
   dispatch_release(_syncQueue);
 #endif
 }
 
+- (dispatch_queue_t)delegateQueue {
+  return _delegateQueue ? _delegateQueue : dispatch_get_main_queue();
+}
+
+- (void)setDelegateQueue:(dispatch_queue_t)delegateQueue {
+  GWS_DCHECK(_options == nil);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  if (delegateQueue) {
+    dispatch_retain(delegateQueue);
+  }
+  if (_delegateQueue) {
+    dispatch_release(_delegateQueue);
+  }
+#endif
+  _delegateQueue = delegateQueue;
+}
+
 #if TARGET_OS_IPHONE
 
 // Always called on main thread
@@ -223,41 +1022,72 @@ static void _ExecuteMainThreadRunLoopSources() {
 
 #endif
 
-// Always called on main thread
+// Always called on _syncQueue
 - (void)_didConnect {
-  GWS_DCHECK([NSThread isMainThread]);
   GWS_DCHECK(_connected == NO);
   _connected = YES;
   GWS_LOG_DEBUG(@"Did connect");
 
 #if TARGET_OS_IPHONE
-  if ([[UIApplication sharedApplication] applicationState] != UIApplicationStateBackground) {
-    [self _startBackgroundTask];
-  }
+  dispatch_async(dispatch_get_main_queue(), ^{
+    if ([[UIApplication sharedApplication] applicationState] != UIApplicationStateBackground) {
+      [self _startBackgroundTask];
+    }
+  });
 #endif
 
-  if ([_delegate respondsToSelector:@selector(webServerDidConnect:)]) {
-    [_delegate webServerDidConnect:self];
+  id<GCDWebServerDelegate> delegate = _delegate;
+  if ([delegate respondsToSelector:@selector(webServerDidConnect:)]) {
+    dispatch_async(self.delegateQueue, ^{
+      [delegate webServerDidConnect:self];
+    });
   }
 }
 
-- (void)willStartConnection:(GCDWebServerConnection*)connection {
-  dispatch_sync(_syncQueue, ^{
-    GWS_DCHECK(self->_activeConnections >= 0);
-    if (self->_activeConnections == 0) {
-      dispatch_async(dispatch_get_main_queue(), ^{
-        if (self->_disconnectTimer) {
-          CFRunLoopTimerInvalidate(self->_disconnectTimer);
-          CFRelease(self->_disconnectTimer);
-          self->_disconnectTimer = NULL;
-        }
-        if (self->_connected == NO) {
-          [self _didConnect];
+// Always called on _syncQueue
+- (void)_cancelDisconnectTimer {
+  if (_disconnectTimer) {
+    dispatch_source_cancel(_disconnectTimer);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_disconnectTimer);
+#endif
+    _disconnectTimer = NULL;
+  }
+}
+
+// Always called on _syncQueue
+// Connection transitions are only counted atomically so this re-checks the current count instead of relying on the order in which it was scheduled
+- (void)_updateConnectedState {
+  if (atomic_load(&_activeConnections) > 0) {
+    [self _cancelDisconnectTimer];
+    if (_connected == NO) {
+      [self _didConnect];
+    }
+  } else if (_connected && (_disconnectTimer == NULL)) {
+    if ((_disconnectDelay > 0.0) && (_source4 != NULL)) {
+      _disconnectTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _syncQueue);
+      dispatch_source_set_timer(_disconnectTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_disconnectDelay * (double)NSEC_PER_SEC)), DISPATCH_TIME_FOREVER, 0);
+      dispatch_source_set_event_handler(_disconnectTimer, ^{
+        [self _cancelDisconnectTimer];
+        if ((atomic_load(&self->_activeConnections) == 0) && self->_connected) {
+          [self _didDisconnect];
         }
       });
+      dispatch_resume(_disconnectTimer);
+    } else {
+      [self _didDisconnect];
     }
-    self->_activeConnections += 1;
-  });
+  }
+}
+
+- (void)willStartConnection:(GCDWebServerConnection*)connection {
+  NSInteger previousCount = atomic_fetch_add(&_activeConnections, 1);
+  GWS_DCHECK(previousCount >= 0);
+  if (previousCount == 0) {
+    dispatch_async(_syncQueue, ^{
+      [self _updateConnectedState];
+    });
+  }
 }
 
 #if TARGET_OS_IPHONE
@@ -277,46 +1107,153 @@ static void _ExecuteMainThreadRunLoopSources() {
 
 #endif
 
-// Always called on main thread
+// Always called on _syncQueue
 - (void)_didDisconnect {
-  GWS_DCHECK([NSThread isMainThread]);
   GWS_DCHECK(_connected == YES);
   _connected = NO;
   GWS_LOG_DEBUG(@"Did disconnect");
 
 #if TARGET_OS_IPHONE
-  [self _endBackgroundTask];
+  dispatch_async(dispatch_get_main_queue(), ^{
+    [self _endBackgroundTask];
+  });
 #endif
 
-  if ([_delegate respondsToSelector:@selector(webServerDidDisconnect:)]) {
-    [_delegate webServerDidDisconnect:self];
+  id<GCDWebServerDelegate> delegate = _delegate;
+  if ([delegate respondsToSelector:@selector(webServerDidDisconnect:)]) {
+    dispatch_async(self.delegateQueue, ^{
+      [delegate webServerDidDisconnect:self];
+    });
   }
 }
 
 - (void)didEndConnection:(GCDWebServerConnection*)connection {
+  NSInteger previousCount = atomic_fetch_sub(&_activeConnections, 1);
+  GWS_DCHECK(previousCount > 0);
+  if (previousCount == 1) {
+    dispatch_async(_syncQueue, ^{
+      [self _updateConnectedState];
+    });
+  }
+}
+
+- (BOOL)_hasConnectionCapacity {
+  return (atomic_load(&_activeConnections) < (NSInteger)_maxActiveConnections);
+}
+
+// Must be called on _syncQueue
+- (GCDWebServerQueuedRequest*)_dequeueRequestWithExpiredRequests:(NSMutableArray<GCDWebServerQueuedRequest*>*)expiredRequests {
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  while (_requestQueue.count) {
+    GCDWebServerQueuedRequest* queuedRequest;
+    if (_lifoRequestQueue) {
+      queuedRequest = _requestQueue.lastObject;
+      [_requestQueue removeLastObject];
+    } else {
+      queuedRequest = _requestQueue.firstObject;
+      [_requestQueue removeObjectAtIndex:0];
+    }
+    if (queuedRequest.deadline > now) {
+      return queuedRequest;
+    }
+    [expiredRequests addObject:queuedRequest];
+  }
+  return nil;
+}
+
+// Must be called on _syncQueue
+- (void)_expireQueuedRequests {
+  uint64_t now = GCDWebServerGetMonotonicTime();
+  NSIndexSet* indexes = [_requestQueue indexesOfObjectsPassingTest:^BOOL(GCDWebServerQueuedRequest* queuedRequest, NSUInteger index, BOOL* stop) {
+    return (queuedRequest.deadline <= now);
+  }];
+  if (indexes.count) {
+    NSArray* expiredRequests = [_requestQueue objectsAtIndexes:indexes];
+    [_requestQueue removeObjectsAtIndexes:indexes];
+    for (GCDWebServerQueuedRequest* queuedRequest in expiredRequests) {
+      dispatch_async(dispatch_get_global_queue(_dispatchQueuePriority, 0), queuedRequest.rejectBlock);
+    }
+    GWS_LOG_VERBOSE(@"Rejected %lu queued requests past their deadline", (unsigned long)expiredRequests.count);
+  }
+}
+
+- (void)admitRequestWithBlock:(dispatch_block_t)admitBlock rejectBlock:(dispatch_block_t)rejectBlock {
+  if (_maxInFlightRequests == 0) {
+    admitBlock();
+    return;
+  }
+  __block BOOL admitted = NO;
+  __block BOOL rejected = NO;
+  __block GCDWebServerQueuedRequest* shedRequest = nil;
   dispatch_sync(_syncQueue, ^{
-    GWS_DCHECK(self->_activeConnections > 0);
-    self->_activeConnections -= 1;
-    if (self->_activeConnections == 0) {
-      dispatch_async(dispatch_get_main_queue(), ^{
-        if ((self->_disconnectDelay > 0.0) && (self->_source4 != NULL)) {
-          if (self->_disconnectTimer) {
-            CFRunLoopTimerInvalidate(self->_disconnectTimer);
-            CFRelease(self->_disconnectTimer);
-          }
-          self->_disconnectTimer = CFRunLoopTimerCreateWithHandler(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + self->_disconnectDelay, 0.0, 0, 0, ^(CFRunLoopTimerRef timer) {
-            GWS_DCHECK([NSThread isMainThread]);
-            [self _didDisconnect];
-            CFRelease(self->_disconnectTimer);
-            self->_disconnectTimer = NULL;
-          });
-          CFRunLoopAddTimer(CFRunLoopGetMain(), self->_disconnectTimer, kCFRunLoopCommonModes);
-        } else {
-          [self _didDisconnect];
-        }
-      });
+    if (self->_inFlightRequests < self->_maxInFlightRequests) {
+      self->_inFlightRequests += 1;
+      admitted = YES;
+      return;
+    }
+    if (self->_requestQueue.count >= self->_maxQueuedRequests) {
+      if (!self->_lifoRequestQueue || (self->_maxQueuedRequests == 0)) {
+        rejected = YES;
+        return;
+      }
+      shedRequest = self->_requestQueue.firstObject;  // The oldest request is the least likely to still be useful
+      [self->_requestQueue removeObjectAtIndex:0];
+    }
+    uint64_t deadline = GCDWebServerGetMonotonicTime() + (uint64_t)(self->_requestQueueTimeout * (double)NSEC_PER_SEC);  // Immune to wall clock changes
+    [self->_requestQueue addObject:[[GCDWebServerQueuedRequest alloc] initWithAdmitBlock:admitBlock rejectBlock:rejectBlock deadline:deadline]];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self->_requestQueueTimeout * (double)NSEC_PER_SEC)), self->_syncQueue, ^{
+      [self _expireQueuedRequests];
+    });
+  });
+  if (admitted) {
+    admitBlock();
+  } else if (rejected) {
+    rejectBlock();
+  }
+  if (shedRequest) {
+    dispatch_async(dispatch_get_global_queue(_dispatchQueuePriority, 0), shedRequest.rejectBlock);
+  }
+}
+
+- (void)didFinishRequest {
+  NSMutableArray* expiredRequests = [[NSMutableArray alloc] init];
+  __block GCDWebServerQueuedRequest* nextRequest = nil;
+  dispatch_sync(_syncQueue, ^{
+    GWS_DCHECK(self->_inFlightRequests > 0);
+    nextRequest = [self _dequeueRequestWithExpiredRequests:expiredRequests];
+    if (nextRequest == nil) {
+      self->_inFlightRequests -= 1;  // Otherwise the processing slot is handed over to the dequeued request
     }
   });
+  for (GCDWebServerQueuedRequest* queuedRequest in expiredRequests) {
+    dispatch_async(dispatch_get_global_queue(_dispatchQueuePriority, 0), queuedRequest.rejectBlock);
+  }
+  if (nextRequest) {
+    dispatch_async(dispatch_get_global_queue(_dispatchQueuePriority, 0), nextRequest.admitBlock);
+  }
+}
+
+- (GCDWebServerWorkerPoolStatistics)workerPoolStatistics {
+  GCDWebServerWorkerPoolStatistics statistics = {0};
+  GCDWebServerWorkerPool* workerPool = _workerPool;
+  if (workerPool) {
+    statistics = workerPool.statistics;
+  }
+  return statistics;
+}
+
+- (void)purgeCachedResponses {
+  [_responseCache removeAllResponses];
+}
+
+- (void)purgeCachedResponsesForPath:(NSString*)path {
+  [_responseCache removeResponsesForPath:path];
+}
+
+- (dispatch_queue_t)nextIOQueue {
+  GWS_DCHECK(_ioQueueCount > 0);
+  NSUInteger index = atomic_fetch_add_explicit(&_nextIOQueueIndex, 1, memory_order_relaxed);
+  return _ioQueues[index % _ioQueueCount];
 }
 
 - (NSString*)bonjourName {
@@ -330,18 +1267,47 @@ static void _ExecuteMainThreadRunLoopSources() {
 }
 
 - (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock processBlock:(GCDWebServerProcessBlock)processBlock {
+  GWS_DCHECK(_options == nil);
+  GCDWebServerHandler* handler = [[GCDWebServerHandler alloc] initWithMatchBlock:matchBlock
+                                                                           queue:NULL
+                                                                    processBlock:processBlock
+                                                               asyncProcessBlock:^(GCDWebServerRequest* request, GCDWebServerCompletionBlock completionBlock) {
+                                                                 completionBlock(processBlock(request));
+                                                               }];
+  [_handlers insertObject:handler atIndex:0];
+}
+
+- (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock asyncProcessBlock:(GCDWebServerAsyncProcessBlock)processBlock {
+  [self _addHandlerWithMatchBlock:matchBlock queue:NULL asyncProcessBlock:processBlock];
+}
+
+- (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock priority:(dispatch_queue_priority_t)priority processBlock:(GCDWebServerProcessBlock)processBlock {
   [self addHandlerWithMatchBlock:matchBlock
+                        priority:priority
                asyncProcessBlock:^(GCDWebServerRequest* request, GCDWebServerCompletionBlock completionBlock) {
                  completionBlock(processBlock(request));
                }];
 }
 
-- (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock asyncProcessBlock:(GCDWebServerAsyncProcessBlock)processBlock {
+- (void)addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock priority:(dispatch_queue_priority_t)priority asyncProcessBlock:(GCDWebServerAsyncProcessBlock)processBlock {
+  dispatch_queue_t queue = dispatch_queue_create([[NSStringFromClass([self class]) stringByAppendingString:@".handler"] UTF8String], DISPATCH_QUEUE_CONCURRENT);
+  dispatch_set_target_queue(queue, dispatch_get_global_queue(priority, 0));
+  [self _addHandlerWithMatchBlock:matchBlock queue:queue asyncProcessBlock:processBlock];
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(queue);
+#endif
+}
+
+- (void)_addHandlerWithMatchBlock:(GCDWebServerMatchBlock)matchBlock queue:(dispatch_queue_t)queue asyncProcessBlock:(GCDWebServerAsyncProcessBlock)processBlock {
   GWS_DCHECK(_options == nil);
-  GCDWebServerHandler* handler = [[GCDWebServerHandler alloc] initWithMatchBlock:matchBlock asyncProcessBlock:processBlock];
+  GCDWebServerHandler* handler = [[GCDWebServerHandler alloc] initWithMatchBlock:matchBlock queue:queue asyncProcessBlock:processBlock];
   [_handlers insertObject:handler atIndex:0];
 }
 
+- (void)_setRouteOfLatestHandler:(NSString*)route {
+  _handlers.firstObject.route = route;
+}
+
 - (void)removeAllHandlers {
   GWS_DCHECK(_options == nil);
   [_handlers removeAllObjects];
@@ -373,8 +1339,11 @@ static void _NetServiceResolveCallBack(CFNetServiceRef service, CFStreamError* e
     } else {
       GCDWebServer* server = (__bridge GCDWebServer*)info;
       GWS_LOG_INFO(@"%@ now locally reachable at %@", [server class], server.bonjourServerURL);
-      if ([server.delegate respondsToSelector:@selector(webServerDidCompleteBonjourRegistration:)]) {
-        [server.delegate webServerDidCompleteBonjourRegistration:server];
+      id<GCDWebServerDelegate> delegate = server.delegate;
+      if ([delegate respondsToSelector:@selector(webServerDidCompleteBonjourRegistration:)]) {
+        dispatch_async(server.delegateQueue, ^{
+          [delegate webServerDidCompleteBonjourRegistration:server];
+        });
       }
     }
   }
@@ -398,8 +1367,11 @@ static void _DNSServiceCallBack(DNSServiceRef sdRef, DNSServiceFlags flags, uint
       server->_dnsAddress = nil;
       server->_dnsPort = 0;
     }
-    if ([server.delegate respondsToSelector:@selector(webServerDidUpdateNATPortMapping:)]) {
-      [server.delegate webServerDidUpdateNATPortMapping:server];
+    id<GCDWebServerDelegate> delegate = server.delegate;
+    if ([delegate respondsToSelector:@selector(webServerDidUpdateNATPortMapping:)]) {
+      dispatch_async(server.delegateQueue, ^{
+        [delegate webServerDidUpdateNATPortMapping:server];
+      });
     }
   }
 }
@@ -470,9 +1442,41 @@ static inline NSString* _EncodeBase64(NSString* string) {
   return -1;
 }
 
+// Closing a socket with unread request bytes makes the kernel send a RST which can discard the response before the client
+// reads it, so the write side is shut down first and the input drained for a bounded time and amount before closing
+static void _LingerAndCloseSocket(int socket, dispatch_queue_t queue) {
+  shutdown(socket, SHUT_WR);
+  fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+  dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, socket, 0, queue);
+  __block NSUInteger drainedBytes = 0;
+  dispatch_source_set_event_handler(source, ^{
+    char buffer[4096];
+    ssize_t result;
+    while ((result = read(socket, buffer, sizeof(buffer))) > 0) {
+      drainedBytes += result;
+      if (drainedBytes >= kOverloadLingerMaxBytes) {
+        break;
+      }
+    }
+    if ((result == 0) || (drainedBytes >= kOverloadLingerMaxBytes) || ((result < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+      dispatch_source_cancel(source);
+    }
+  });
+  dispatch_source_set_cancel_handler(source, ^{
+    close(socket);
+  });
+  dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kOverloadLingerTimeout), queue, ^{
+    dispatch_source_cancel(source);  // No-op if already cancelled
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(source);
+#endif
+  });
+  dispatch_resume(source);
+}
+
 - (dispatch_source_t)_createDispatchSourceWithListeningSocket:(int)listeningSocket isIPv6:(BOOL)isIPv6 {
   dispatch_group_enter(_sourceGroup);
-  dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, listeningSocket, 0, dispatch_get_global_queue(_dispatchQueuePriority, 0));
+  dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, listeningSocket, 0, _acceptQueue);
   dispatch_source_set_cancel_handler(source, ^{
     @autoreleasepool {
       int result = close(listeningSocket);
@@ -489,7 +1493,15 @@ static inline NSString* _EncodeBase64(NSString* string) {
       struct sockaddr_storage remoteSockAddr;
       socklen_t remoteAddrLen = sizeof(remoteSockAddr);
       int socket = accept(listeningSocket, (struct sockaddr*)&remoteSockAddr, &remoteAddrLen);
-      if (socket > 0) {
+      if ((socket > 0) && self->_maxActiveConnections && ![self _hasConnectionCapacity]) {
+        int noSigPipe = 1;
+        setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+        if (write(socket, self->_overloadResponseData.bytes, self->_overloadResponseData.length) != (ssize_t)self->_overloadResponseData.length) {  // The response is small enough to always fit in the socket send buffer
+          GWS_LOG_DEBUG(@"Failed writing overload response to socket %i: %s (%i)", socket, strerror(errno), errno);
+        }
+        _LingerAndCloseSocket(socket, dispatch_get_global_queue(self->_dispatchQueuePriority, 0));
+        GWS_LOG_VERBOSE(@"Rejected %s connection as the maximum number of active connections has been reached", isIPv6 ? "IPv6" : "IPv4");
+      } else if (socket > 0) {
         NSData* remoteAddress = [NSData dataWithBytes:&remoteSockAddr length:remoteAddrLen];
 
         struct sockaddr_storage localSockAddr;
@@ -555,6 +1567,7 @@ static inline NSString* _EncodeBase64(NSString* string) {
   }
 
   _serverName = [(NSString*)_GetOption(_options, GCDWebServerOption_ServerName, NSStringFromClass([self class])) copy];
+  _serverHeaderData = [[NSString stringWithFormat:@"Server: %@\r\n", _serverName] dataUsingEncoding:NSUTF8StringEncoding];
   NSString* authenticationMethod = _GetOption(_options, GCDWebServerOption_AuthenticationMethod, nil);
   if ([authenticationMethod isEqualToString:GCDWebServerAuthenticationMethod_Basic]) {
     _authenticationRealm = [(NSString*)_GetOption(_options, GCDWebServerOption_AuthenticationRealm, _serverName) copy];
@@ -571,10 +1584,72 @@ static inline NSString* _EncodeBase64(NSString* string) {
       [self->_authenticationDigestAccounts setObject:GCDWebServerComputeMD5Digest(@"%@:%@:%@", username, self->_authenticationRealm, password) forKey:username];
     }];
   }
+  if (_authenticationRealm) {
+    _authenticationState = [[GCDWebServerAuthenticationState alloc] init];
+  }
   _connectionClass = _GetOption(_options, GCDWebServerOption_ConnectionClass, [GCDWebServerConnection class]);
   _shouldAutomaticallyMapHEADToGET = [(NSNumber*)_GetOption(_options, GCDWebServerOption_AutomaticallyMapHEADToGET, @YES) boolValue];
   _disconnectDelay = [(NSNumber*)_GetOption(_options, GCDWebServerOption_ConnectedStateCoalescingInterval, @1.0) doubleValue];
   _dispatchQueuePriority = [(NSNumber*)_GetOption(_options, GCDWebServerOption_DispatchQueuePriority, @(DISPATCH_QUEUE_PRIORITY_DEFAULT)) longValue];
+  _maxActiveConnections = [(NSNumber*)_GetOption(_options, GCDWebServerOption_MaxActiveConnections, @0) unsignedIntegerValue];
+  _maxInFlightRequests = [(NSNumber*)_GetOption(_options, GCDWebServerOption_MaxInFlightRequests, @0) unsignedIntegerValue];
+  _maxQueuedRequests = [(NSNumber*)_GetOption(_options, GCDWebServerOption_MaxQueuedRequests, @32) unsignedIntegerValue];
+  _requestQueueTimeout = [(NSNumber*)_GetOption(_options, GCDWebServerOption_RequestQueueTimeout, @1.0) doubleValue];
+  _lifoRequestQueue = ![(NSString*)_GetOption(_options, GCDWebServerOption_RequestQueueOrdering, GCDWebServerRequestQueueOrdering_LIFO) isEqualToString:GCDWebServerRequestQueueOrdering_FIFO];
+  _overloadRetryAfter = [(NSNumber*)_GetOption(_options, GCDWebServerOption_OverloadRetryAfter, @1) unsignedIntegerValue];
+  _idleTimeout = [(NSNumber*)_GetOption(_options, GCDWebServerOption_IdleTimeout, @0.0) doubleValue];
+  _headerReadTimeout = [(NSNumber*)_GetOption(_options, GCDWebServerOption_HeaderReadTimeout, @0.0) doubleValue];
+  _bodyReadTimeout = [(NSNumber*)_GetOption(_options, GCDWebServerOption_BodyReadTimeout, @0.0) doubleValue];
+  _writeTimeout = [(NSNumber*)_GetOption(_options, GCDWebServerOption_WriteTimeout, @0.0) doubleValue];
+  CFHTTPMessageRef overloadMessage = CFHTTPMessageCreateResponse(kCFAllocatorDefault, kGCDWebServerHTTPStatusCode_ServiceUnavailable, NULL, kCFHTTPVersion1_1);
+  CFHTTPMessageSetHeaderFieldValue(overloadMessage, CFSTR("Connection"), CFSTR("Close"));
+  CFHTTPMessageSetHeaderFieldValue(overloadMessage, CFSTR("Server"), (__bridge CFStringRef)_serverName);
+  CFHTTPMessageSetHeaderFieldValue(overloadMessage, CFSTR("Retry-After"), (__bridge CFStringRef)[NSString stringWithFormat:@"%lu", (unsigned long)_overloadRetryAfter]);
+  CFHTTPMessageSetHeaderFieldValue(overloadMessage, CFSTR("Content-Length"), CFSTR("0"));
+  _overloadResponseData = CFBridgingRelease(CFHTTPMessageCopySerializedMessage(overloadMessage));
+  CFRelease(overloadMessage);
+
+  NSString* queueLabelPrefix = NSStringFromClass([self class]);
+  dispatch_queue_t globalQueue = dispatch_get_global_queue(_dispatchQueuePriority, 0);
+  _acceptQueue = dispatch_queue_create([[queueLabelPrefix stringByAppendingString:@".accept"] UTF8String], DISPATCH_QUEUE_SERIAL);
+  dispatch_set_target_queue(_acceptQueue, globalQueue);
+  _ioQueueCount = MAX([(NSNumber*)_GetOption(_options, GCDWebServerOption_IOConcurrencyWidth, @([[NSProcessInfo processInfo] activeProcessorCount])) unsignedIntegerValue], (NSUInteger)1);
+  _ioQueues = (__typeof__(_ioQueues))calloc(_ioQueueCount, sizeof(dispatch_queue_t));
+  for (NSUInteger i = 0; i < _ioQueueCount; ++i) {
+    _ioQueues[i] = dispatch_queue_create([[queueLabelPrefix stringByAppendingFormat:@".io.%lu", (unsigned long)i] UTF8String], DISPATCH_QUEUE_SERIAL);
+    dispatch_set_target_queue(_ioQueues[i], globalQueue);
+  }
+  _handlerQueue = dispatch_queue_create([[queueLabelPrefix stringByAppendingString:@".handler"] UTF8String], DISPATCH_QUEUE_CONCURRENT);
+  dispatch_set_target_queue(_handlerQueue, globalQueue);
+  NSUInteger workerPoolSize = [(NSNumber*)_GetOption(_options, GCDWebServerOption_WorkerPoolSize, @0) unsignedIntegerValue];
+  if (workerPoolSize > 0) {
+    NSUInteger workerPoolQueueSize = [(NSNumber*)_GetOption(_options, GCDWebServerOption_WorkerPoolQueueSize, @256) unsignedIntegerValue];
+    _workerPool = [[GCDWebServerWorkerPool alloc] initWithWorkerCount:workerPoolSize maxQueuedBlocks:workerPoolQueueSize];
+  }
+  _requestTimingsObserver = [_GetOption(_options, GCDWebServerOption_RequestTimingsObserver, nil) copy];
+  _accessLog = _GetOption(_options, GCDWebServerOption_AccessLog, nil);
+  NSDictionary* mimeTypeOverrides = _GetOption(_options, GCDWebServerOption_MimeTypeOverrides, nil);
+  if (mimeTypeOverrides.count) {
+    NSMutableDictionary* lowercaseOverrides = [[NSMutableDictionary alloc] initWithCapacity:mimeTypeOverrides.count];  // Merged once so lookups for every file do not need to lowercase keys
+    [mimeTypeOverrides enumerateKeysAndObjectsUsingBlock:^(NSString* extension, NSString* mimeType, BOOL* stop) {
+      [lowercaseOverrides setObject:mimeType forKey:[extension lowercaseString]];
+    }];
+    _mimeTypeOverrides = [lowercaseOverrides copy];
+  }
+  _fileETagMode = [(NSNumber*)_GetOption(_options, GCDWebServerOption_UseContentDigestETags, @NO) boolValue] ? kGCDWebServerFileETagMode_ContentDigest : kGCDWebServerFileETagMode_FileSystem;
+  NSUInteger responseCacheSize = [(NSNumber*)_GetOption(_options, GCDWebServerOption_ResponseCacheSize, @0) unsignedIntegerValue];
+  if (responseCacheSize > 0) {
+    _responseCache = [[GCDWebServerResponseCache alloc] initWithMaxSize:responseCacheSize];
+  }
+  if ([(NSNumber*)_GetOption(_options, GCDWebServerOption_CoalesceRequests, @NO) boolValue]) {
+    _requestCoalescer = [[GCDWebServerRequestCoalescer alloc] init];
+  }
+  if ([(NSNumber*)_GetOption(_options, GCDWebServerOption_EnableMetrics, @NO) boolValue]) {
+    for (GCDWebServerHandler* handler in _handlers) {
+      handler.routeMetrics = [_metrics routeMetricsForRoute:handler.route];
+    }
+    _activeMetrics = _metrics;
+  }
 
   _source4 = [self _createDispatchSourceWithListeningSocket:listeningSocket4 isIPv6:NO];
   _source6 = [self _createDispatchSourceWithListeningSocket:listeningSocket6 isIPv6:YES];
@@ -654,9 +1729,10 @@ static inline NSString* _EncodeBase64(NSString* string) {
   dispatch_resume(_source4);
   dispatch_resume(_source6);
   GWS_LOG_INFO(@"%@ started on port %i and reachable at %@", [self class], (int)_port, self.serverURL);
-  if ([_delegate respondsToSelector:@selector(webServerDidStart:)]) {
-    dispatch_async(dispatch_get_main_queue(), ^{
-      [self->_delegate webServerDidStart:self];
+  id<GCDWebServerDelegate> delegate = _delegate;
+  if ([delegate respondsToSelector:@selector(webServerDidStart:)]) {
+    dispatch_async(self.delegateQueue, ^{
+      [delegate webServerDidStart:self];
     });
   }
 
@@ -708,27 +1784,55 @@ static inline NSString* _EncodeBase64(NSString* string) {
   dispatch_release(_source4);
 #endif
   _source4 = NULL;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_acceptQueue);
+#endif
+  _acceptQueue = NULL;
+  for (NSUInteger i = 0; i < _ioQueueCount; ++i) {  // Connections still running retain their own I/O queue
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_ioQueues[i]);
+#endif
+    _ioQueues[i] = NULL;  // Releases the queue under ARC as the slots are zeroed by free() without it
+  }
+  free(_ioQueues);
+  _ioQueues = NULL;
+  _ioQueueCount = 0;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_handlerQueue);
+#endif
+  _handlerQueue = NULL;
+  [_workerPool invalidate];  // Workers exit once the blocks already queued have been executed
+  _workerPool = nil;
+  _activeMetrics = nil;
+  _requestTimingsObserver = nil;
+  _accessLog = nil;
+  _mimeTypeOverrides = nil;
+  _fileETagMode = kGCDWebServerFileETagMode_FileSystem;
+  _responseCache = nil;
+  _requestCoalescer = nil;
   _port = 0;
   _bindToLocalhost = NO;
 
   _serverName = nil;
+  _serverHeaderData = nil;
   _authenticationRealm = nil;
   _authenticationBasicAccounts = nil;
   _authenticationDigestAccounts = nil;
+  _authenticationState = nil;
+  _overloadResponseData = nil;
 
-  dispatch_async(dispatch_get_main_queue(), ^{
+  dispatch_async(_syncQueue, ^{
     if (self->_disconnectTimer) {
-      CFRunLoopTimerInvalidate(self->_disconnectTimer);
-      CFRelease(self->_disconnectTimer);
-      self->_disconnectTimer = NULL;
+      [self _cancelDisconnectTimer];
       [self _didDisconnect];
     }
   });
 
   GWS_LOG_INFO(@"%@ stopped", [self class]);
-  if ([_delegate respondsToSelector:@selector(webServerDidStop:)]) {
-    dispatch_async(dispatch_get_main_queue(), ^{
-      [self->_delegate webServerDidStop:self];
+  id<GCDWebServerDelegate> delegate = _delegate;
+  if ([delegate respondsToSelector:@selector(webServerDidStop:)]) {
+    dispatch_async(self.delegateQueue, ^{
+      [delegate webServerDidStop:self];
     });
   }
 }
@@ -891,93 +1995,149 @@ static inline NSString* _EncodeBase64(NSString* string) {
 
 @implementation GCDWebServer (Handlers)
 
+static GCDWebServerMatchBlock _CreateDefaultMatchBlock(NSString* method, Class aClass) {
+  return ^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
+    if (![requestMethod isEqualToString:method]) {
+      return nil;
+    }
+    return [(GCDWebServerRequest*)[aClass alloc] initWithMethod:requestMethod url:requestURL headers:requestHeaders path:urlPath query:urlQuery];
+  };
+}
+
 - (void)addDefaultHandlerForMethod:(NSString*)method requestClass:(Class)aClass processBlock:(GCDWebServerProcessBlock)block {
-  [self addDefaultHandlerForMethod:method
-                      requestClass:aClass
-                 asyncProcessBlock:^(GCDWebServerRequest* request, GCDWebServerCompletionBlock completionBlock) {
-                   completionBlock(block(request));
-                 }];
+  [self addHandlerWithMatchBlock:_CreateDefaultMatchBlock(method, aClass) processBlock:block];
+  [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ *", method]];
 }
 
 - (void)addDefaultHandlerForMethod:(NSString*)method requestClass:(Class)aClass asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
-  [self
-      addHandlerWithMatchBlock:^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
-        if (![requestMethod isEqualToString:method]) {
-          return nil;
+  [self addHandlerWithMatchBlock:_CreateDefaultMatchBlock(method, aClass) asyncProcessBlock:block];
+  [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ *", method]];
+}
+
+static GCDWebServerMatchBlock _CreatePathMatchBlock(NSString* method, NSString* path, Class aClass) {
+  if (![path hasPrefix:@"/"] || ![aClass isSubclassOfClass:[GCDWebServerRequest class]]) {
+    return nil;
+  }
+  return ^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
+    if (![requestMethod isEqualToString:method]) {
+      return nil;
+    }
+    if ([urlPath caseInsensitiveCompare:path] != NSOrderedSame) {
+      return nil;
+    }
+    return [(GCDWebServerRequest*)[aClass alloc] initWithMethod:requestMethod url:requestURL headers:requestHeaders path:urlPath query:urlQuery];
+  };
+}
+
+static GCDWebServerMatchBlock _CreatePathRegexMatchBlock(NSString* method, NSString* regex, Class aClass) {
+  NSRegularExpression* expression = [NSRegularExpression regularExpressionWithPattern:regex options:NSRegularExpressionCaseInsensitive error:NULL];
+  if (!expression || ![aClass isSubclassOfClass:[GCDWebServerRequest class]]) {
+    return nil;
+  }
+  return ^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
+    if (![requestMethod isEqualToString:method]) {
+      return nil;
+    }
+
+    NSArray* matches = [expression matchesInString:urlPath options:0 range:NSMakeRange(0, urlPath.length)];
+    if (matches.count == 0) {
+      return nil;
+    }
+
+    NSMutableArray* captures = [NSMutableArray array];
+    for (NSTextCheckingResult* result in matches) {
+      // Start at 1; index 0 is the whole string
+      for (NSUInteger i = 1; i < result.numberOfRanges; i++) {
+        NSRange range = [result rangeAtIndex:i];
+        // range is {NSNotFound, 0} "if one of the capture groups did not participate in this particular match"
+        // see discussion in -[NSRegularExpression firstMatchInString:options:range:]
+        if (range.location != NSNotFound) {
+          [captures addObject:[urlPath substringWithRange:range]];
         }
-        return [(GCDWebServerRequest*)[aClass alloc] initWithMethod:requestMethod url:requestURL headers:requestHeaders path:urlPath query:urlQuery];
       }
-             asyncProcessBlock:block];
+    }
+
+    GCDWebServerRequest* request = [(GCDWebServerRequest*)[aClass alloc] initWithMethod:requestMethod url:requestURL headers:requestHeaders path:urlPath query:urlQuery];
+    [request setAttribute:captures forKey:GCDWebServerRequestAttribute_RegexCaptures];
+    return request;
+  };
 }
 
 - (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass processBlock:(GCDWebServerProcessBlock)block {
+  GCDWebServerMatchBlock matchBlock = _CreatePathMatchBlock(method, path, aClass);
+  if (matchBlock) {
+    [self addHandlerWithMatchBlock:matchBlock processBlock:block];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ %@", method, path]];
+  } else {
+    GWS_DNOT_REACHED();
+  }
+}
+
+- (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
+  GCDWebServerMatchBlock matchBlock = _CreatePathMatchBlock(method, path, aClass);
+  if (matchBlock) {
+    [self addHandlerWithMatchBlock:matchBlock asyncProcessBlock:block];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ %@", method, path]];
+  } else {
+    GWS_DNOT_REACHED();
+  }
+}
+
+- (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority processBlock:(GCDWebServerProcessBlock)block {
   [self addHandlerForMethod:method
                        path:path
                requestClass:aClass
+                   priority:priority
           asyncProcessBlock:^(GCDWebServerRequest* request, GCDWebServerCompletionBlock completionBlock) {
             completionBlock(block(request));
           }];
 }
 
-- (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
-  if ([path hasPrefix:@"/"] && [aClass isSubclassOfClass:[GCDWebServerRequest class]]) {
-    [self
-        addHandlerWithMatchBlock:^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
-          if (![requestMethod isEqualToString:method]) {
-            return nil;
-          }
-          if ([urlPath caseInsensitiveCompare:path] != NSOrderedSame) {
-            return nil;
-          }
-          return [(GCDWebServerRequest*)[aClass alloc] initWithMethod:requestMethod url:requestURL headers:requestHeaders path:urlPath query:urlQuery];
-        }
-               asyncProcessBlock:block];
+- (void)addHandlerForMethod:(NSString*)method path:(NSString*)path requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
+  GCDWebServerMatchBlock matchBlock = _CreatePathMatchBlock(method, path, aClass);
+  if (matchBlock) {
+    [self addHandlerWithMatchBlock:matchBlock priority:priority asyncProcessBlock:block];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ %@", method, path]];
   } else {
     GWS_DNOT_REACHED();
   }
 }
 
 - (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass processBlock:(GCDWebServerProcessBlock)block {
+  GCDWebServerMatchBlock matchBlock = _CreatePathRegexMatchBlock(method, regex, aClass);
+  if (matchBlock) {
+    [self addHandlerWithMatchBlock:matchBlock processBlock:block];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ %@", method, regex]];
+  } else {
+    GWS_DNOT_REACHED();
+  }
+}
+
+- (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
+  GCDWebServerMatchBlock matchBlock = _CreatePathRegexMatchBlock(method, regex, aClass);
+  if (matchBlock) {
+    [self addHandlerWithMatchBlock:matchBlock asyncProcessBlock:block];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ %@", method, regex]];
+  } else {
+    GWS_DNOT_REACHED();
+  }
+}
+
+- (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority processBlock:(GCDWebServerProcessBlock)block {
   [self addHandlerForMethod:method
                   pathRegex:regex
                requestClass:aClass
+                   priority:priority
           asyncProcessBlock:^(GCDWebServerRequest* request, GCDWebServerCompletionBlock completionBlock) {
             completionBlock(block(request));
           }];
 }
 
-- (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
-  NSRegularExpression* expression = [NSRegularExpression regularExpressionWithPattern:regex options:NSRegularExpressionCaseInsensitive error:NULL];
-  if (expression && [aClass isSubclassOfClass:[GCDWebServerRequest class]]) {
-    [self
-        addHandlerWithMatchBlock:^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
-          if (![requestMethod isEqualToString:method]) {
-            return nil;
-          }
-
-          NSArray* matches = [expression matchesInString:urlPath options:0 range:NSMakeRange(0, urlPath.length)];
-          if (matches.count == 0) {
-            return nil;
-          }
-
-          NSMutableArray* captures = [NSMutableArray array];
-          for (NSTextCheckingResult* result in matches) {
-            // Start at 1; index 0 is the whole string
-            for (NSUInteger i = 1; i < result.numberOfRanges; i++) {
-              NSRange range = [result rangeAtIndex:i];
-              // range is {NSNotFound, 0} "if one of the capture groups did not participate in this particular match"
-              // see discussion in -[NSRegularExpression firstMatchInString:options:range:]
-              if (range.location != NSNotFound) {
-                [captures addObject:[urlPath substringWithRange:range]];
-              }
-            }
-          }
-
-          GCDWebServerRequest* request = [(GCDWebServerRequest*)[aClass alloc] initWithMethod:requestMethod url:requestURL headers:requestHeaders path:urlPath query:urlQuery];
-          [request setAttribute:captures forKey:GCDWebServerRequestAttribute_RegexCaptures];
-          return request;
-        }
-               asyncProcessBlock:block];
+- (void)addHandlerForMethod:(NSString*)method pathRegex:(NSString*)regex requestClass:(Class)aClass priority:(dispatch_queue_priority_t)priority asyncProcessBlock:(GCDWebServerAsyncProcessBlock)block {
+  GCDWebServerMatchBlock matchBlock = _CreatePathRegexMatchBlock(method, regex, aClass);
+  if (matchBlock) {
+    [self addHandlerWithMatchBlock:matchBlock priority:priority asyncProcessBlock:block];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"%@ %@", method, regex]];
   } else {
     GWS_DNOT_REACHED();
   }
@@ -999,16 +2159,17 @@ static inline NSString* _EncodeBase64(NSString* string) {
 }
 
 - (void)addGETHandlerForPath:(NSString*)path filePath:(NSString*)filePath isAttachment:(BOOL)isAttachment cacheAge:(NSUInteger)cacheAge allowRangeRequests:(BOOL)allowRangeRequests {
+  GCDWebServer* __unsafe_unretained server = self;
   [self addHandlerForMethod:@"GET"
                        path:path
                requestClass:[GCDWebServerRequest class]
                processBlock:^GCDWebServerResponse*(GCDWebServerRequest* request) {
                  GCDWebServerResponse* response = nil;
                  if (allowRangeRequests) {
-                   response = [GCDWebServerFileResponse responseWithFile:filePath byteRange:request.byteRange isAttachment:isAttachment];
+                   response = [[GCDWebServerFileResponse alloc] initWithFile:filePath byteRanges:request.byteRanges ifRange:GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_IfRange) isAttachment:isAttachment mimeTypeOverrides:nil eTagMode:server.fileETagMode];
                    [response setValue:@"bytes" forAdditionalHeader:@"Accept-Ranges"];
                  } else {
-                   response = [GCDWebServerFileResponse responseWithFile:filePath isAttachment:isAttachment];
+                   response = [[GCDWebServerFileResponse alloc] initWithFile:filePath byteRanges:nil ifRange:nil isAttachment:isAttachment mimeTypeOverrides:nil eTagMode:server.fileETagMode];
                  }
                  response.cacheControlMaxAge = cacheAge;
                  return response;
@@ -1048,6 +2209,7 @@ static inline NSString* _EncodeBase64(NSString* string) {
 - (void)addGETHandlerForBasePath:(NSString*)basePath directoryPath:(NSString*)directoryPath indexFilename:(NSString*)indexFilename cacheAge:(NSUInteger)cacheAge allowRangeRequests:(BOOL)allowRangeRequests {
   if ([basePath hasPrefix:@"/"] && [basePath hasSuffix:@"/"]) {
     GCDWebServer* __unsafe_unretained server = self;
+    NSString* rootPath = [directoryPath hasSuffix:@"/"] && (directoryPath.length > 1) ? [directoryPath substringToIndex:(directoryPath.length - 1)] : directoryPath;
     [self
         addHandlerWithMatchBlock:^GCDWebServerRequest*(NSString* requestMethod, NSURL* requestURL, NSDictionary<NSString*, NSString*>* requestHeaders, NSString* urlPath, NSDictionary<NSString*, NSString*>* urlQuery) {
           if (![requestMethod isEqualToString:@"GET"]) {
@@ -1060,7 +2222,11 @@ static inline NSString* _EncodeBase64(NSString* string) {
         }
         processBlock:^GCDWebServerResponse*(GCDWebServerRequest* request) {
           GCDWebServerResponse* response = nil;
-          NSString* filePath = [directoryPath stringByAppendingPathComponent:GCDWebServerNormalizePath([request.path substringFromIndex:basePath.length])];
+          NSString* relativePath = [request.path substringFromIndex:(basePath.length - 1)];  // Request paths are already canonical so only the trailing slash needs to go
+          if ((relativePath.length > 1) && [relativePath hasSuffix:@"/"]) {
+            relativePath = [relativePath substringToIndex:(relativePath.length - 1)];
+          }
+          NSString* filePath = relativePath.length > 1 ? [rootPath stringByAppendingString:relativePath] : rootPath;
           NSString* fileType = [[[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:NULL] fileType];
           if (fileType) {
             if ([fileType isEqualToString:NSFileTypeDirectory]) {
@@ -1068,16 +2234,16 @@ static inline NSString* _EncodeBase64(NSString* string) {
                 NSString* indexPath = [filePath stringByAppendingPathComponent:indexFilename];
                 NSString* indexType = [[[NSFileManager defaultManager] attributesOfItemAtPath:indexPath error:NULL] fileType];
                 if ([indexType isEqualToString:NSFileTypeRegular]) {
-                  return [GCDWebServerFileResponse responseWithFile:indexPath];
+                  return [[GCDWebServerFileResponse alloc] initWithFile:indexPath byteRanges:nil ifRange:nil isAttachment:NO mimeTypeOverrides:server.mimeTypeOverrides eTagMode:server.fileETagMode];
                 }
               }
               response = [server _responseWithContentsOfDirectory:filePath];
             } else if ([fileType isEqualToString:NSFileTypeRegular]) {
               if (allowRangeRequests) {
-                response = [GCDWebServerFileResponse responseWithFile:filePath byteRange:request.byteRange];
+                response = [[GCDWebServerFileResponse alloc] initWithFile:filePath byteRanges:request.byteRanges ifRange:GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_IfRange) isAttachment:NO mimeTypeOverrides:server.mimeTypeOverrides eTagMode:server.fileETagMode];
                 [response setValue:@"bytes" forAdditionalHeader:@"Accept-Ranges"];
               } else {
-                response = [GCDWebServerFileResponse responseWithFile:filePath];
+                response = [[GCDWebServerFileResponse alloc] initWithFile:filePath byteRanges:nil ifRange:nil isAttachment:NO mimeTypeOverrides:server.mimeTypeOverrides eTagMode:server.fileETagMode];
               }
             }
           }
@@ -1088,11 +2254,22 @@ static inline NSString* _EncodeBase64(NSString* string) {
           }
           return response;
         }];
+    [self _setRouteOfLatestHandler:[NSString stringWithFormat:@"GET %@*", basePath]];
   } else {
     GWS_DNOT_REACHED();
   }
 }
 
+- (void)addMetricsHandlerForPath:(NSString*)path {
+  GCDWebServer* __unsafe_unretained server = self;
+  [self addHandlerForMethod:@"GET"
+                       path:path
+               requestClass:[GCDWebServerRequest class]
+               processBlock:^GCDWebServerResponse*(GCDWebServerRequest* request) {
+                 return [GCDWebServerDataResponse responseWithData:(NSData*)[[server.metrics prometheusTextRepresentation] dataUsingEncoding:NSUTF8StringEncoding] contentType:@"text/plain; version=0.0.4; charset=utf-8"];
+               }];
+}
+
 @end
 
 @implementation GCDWebServer (Logging)
@@ -1204,6 +2381,43 @@ static CFHTTPMessageRef _CreateHTTPMessageFromPerformingRequest(NSData* inData,
   return response;
 }
 
+static NSData* _ReplaceOccurrencesInData(NSData* data, NSData* target, NSData* replacement) {
+  NSMutableData* result = [[NSMutableData alloc] initWithCapacity:data.length];
+  NSRange searchRange = NSMakeRange(0, data.length);
+  while (1) {
+    NSRange range = [data rangeOfData:target options:0 range:searchRange];
+    if (range.location == NSNotFound) {
+      break;
+    }
+    [result appendBytes:((const char*)data.bytes + searchRange.location) length:(range.location - searchRange.location)];
+    [result appendData:replacement];
+    searchRange = NSMakeRange(range.location + range.length, data.length - range.location - range.length);
+  }
+  [result appendBytes:((const char*)data.bytes + searchRange.location) length:searchRange.length];
+  return result;
+}
+
+// Recorded requests carry validators computed from the file system node IDs of the recording machine so they are
+// translated to the ones served during replay, learned from the previous responses
+static NSData* _TranslateRecordedETags(NSData* requestData, NSDictionary<NSString*, NSString*>* eTags) {
+  NSRange headersEnd = [requestData rangeOfData:[NSData dataWithBytes:"\r\n\r\n" length:4] options:0 range:NSMakeRange(0, requestData.length)];
+  if ((headersEnd.location == NSNotFound) || (eTags.count == 0)) {
+    return requestData;
+  }
+  NSData* headers = [requestData subdataWithRange:NSMakeRange(0, headersEnd.location)];
+  for (NSString* recordedETag in eTags) {
+    headers = _ReplaceOccurrencesInData(headers, [recordedETag dataUsingEncoding:NSUTF8StringEncoding], [[eTags objectForKey:recordedETag] dataUsingEncoding:NSUTF8StringEncoding]);
+  }
+  NSMutableData* data = [[NSMutableData alloc] initWithData:headers];
+  [data appendData:[requestData subdataWithRange:NSMakeRange(headersEnd.location, requestData.length - headersEnd.location)]];
+  return data;
+}
+
+static NSString* _GetMultipartBoundary(NSString* contentType) {
+  NSString* prefix = @"multipart/byteranges; boundary=";
+  return [contentType hasPrefix:prefix] ? [contentType substringFromIndex:prefix.length] : nil;
+}
+
 static void _LogResult(NSString* format, ...) {
   va_list arguments;
   va_start(arguments, format);
@@ -1215,6 +2429,7 @@ static void _LogResult(NSString* format, ...) {
 - (NSInteger)runTestsWithOptions:(NSDictionary<NSString*, id>*)options inDirectory:(NSString*)path {
   GWS_DCHECK([NSThread isMainThread]);
   NSArray* ignoredHeaders = @[ @"Date", @"Etag" ];  // Dates are always different by definition and ETags depend on file system node IDs
+  NSMutableDictionary<NSString*, NSString*>* eTags = [[NSMutableDictionary alloc] init];  // Recorded ETags to the actual ones
   NSInteger result = -1;
   if ([self startWithOptions:options error:NULL]) {
     _ExecuteMainThreadRunLoopSources();
@@ -1230,6 +2445,7 @@ static void _LogResult(NSString* format, ...) {
         BOOL success = NO;
         NSData* requestData = [NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:requestFile]];
         if (requestData) {
+          requestData = _TranslateRecordedETags(requestData, eTags);
           CFHTTPMessageRef request = _CreateHTTPMessageFromData(requestData, YES);
           if (request) {
             NSString* requestMethod = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(request));
@@ -1255,6 +2471,20 @@ static void _LogResult(NSString* format, ...) {
 
                       NSDictionary* expectedHeaders = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(expectedResponse));
                       NSDictionary* actualHeaders = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(actualResponse));
+                      NSString* expectedETag = [expectedHeaders objectForKey:@"Etag"];
+                      NSString* actualETag = [actualHeaders objectForKey:@"Etag"];
+                      if (expectedETag && actualETag) {
+                        [eTags setObject:actualETag forKey:expectedETag];
+                      }
+                      NSString* expectedBoundary = _GetMultipartBoundary([expectedHeaders objectForKey:@"Content-Type"]);
+                      NSString* actualBoundary = _GetMultipartBoundary([actualHeaders objectForKey:@"Content-Type"]);
+                      NSData* actualBody = CFBridgingRelease(CFHTTPMessageCopyBody(actualResponse));
+                      if (expectedBoundary && actualBoundary && (expectedBoundary.length == actualBoundary.length)) {  // Boundaries are random
+                        NSMutableDictionary* headers = [actualHeaders mutableCopy];
+                        [headers setObject:[expectedHeaders objectForKey:@"Content-Type"] forKey:@"Content-Type"];
+                        actualHeaders = headers;
+                        actualBody = _ReplaceOccurrencesInData(actualBody, [actualBoundary dataUsingEncoding:NSUTF8StringEncoding], [expectedBoundary dataUsingEncoding:NSUTF8StringEncoding]);
+                      }
                       for (NSString* expectedHeader in expectedHeaders) {
                         if ([ignoredHeaders containsObject:expectedHeader]) {
                           continue;
@@ -1276,7 +2506,6 @@ static void _LogResult(NSString* format, ...) {
                       NSString* expectedContentLength = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(expectedResponse, CFSTR("Content-Length")));
                       NSData* expectedBody = CFBridgingRelease(CFHTTPMessageCopyBody(expectedResponse));
                       NSString* actualContentLength = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(actualResponse, CFSTR("Content-Length")));
-                      NSData* actualBody = CFBridgingRelease(CFHTTPMessageCopyBody(actualResponse));
                       if ([actualContentLength isEqualToString:expectedContentLength] && (actualBody.length > expectedBody.length)) {  // Handle web browser closing connection before retrieving entire body (e.g. when playing a video file)
                         actualBody = [actualBody subdataWithRange:NSMakeRange(0, expectedBody.length)];
                       }
@@ -1329,6 +2558,199 @@ static void _LogResult(NSString* format, ...) {
   return result;
 }
 
+static uint64_t _LatencyPercentile(NSArray<NSNumber*>* sortedLatencies, double percentile) {
+  if (sortedLatencies.count == 0) {
+    return 0;
+  }
+  NSUInteger index = (NSUInteger)ceil(percentile * (double)sortedLatencies.count);
+  return [sortedLatencies[index > 0 ? index - 1 : 0] unsignedLongLongValue];
+}
+
+static NSInteger _CheckRegression(NSString* name, double actual, double baseline, double tolerance, BOOL higherIsBetter) {
+  BOOL regressed = higherIsBetter ? (actual < baseline * (1.0 - tolerance)) : (actual > baseline * (1.0 + tolerance) + 1.0);  // Latencies get 1ms of slack to absorb scheduling noise on very fast requests
+  _LogResult(@"  %@: %.3f (baseline %.3f)%@", name, actual, baseline, regressed ? @" REGRESSION" : @"");
+  return regressed ? 1 : 0;
+}
+
+- (NSInteger)runReplayWithOptions:(NSDictionary<NSString*, id>*)options inDirectory:(NSString*)path concurrency:(NSUInteger)concurrency repeatCount:(NSUInteger)repeatCount baselinePath:(NSString*)baselinePath {
+  GWS_DCHECK([NSThread isMainThread]);
+  concurrency = MAX(concurrency, 1);
+  repeatCount = MAX(repeatCount, 1);
+  NSInteger result = -1;
+  if ([self startWithOptions:options error:NULL]) {
+    _ExecuteMainThreadRunLoopSources();
+
+    result = 0;
+    NSMutableArray* indexes = [[NSMutableArray alloc] init];
+    NSMutableArray* requests = [[NSMutableArray alloc] init];
+    NSMutableArray* expectedStatusCodes = [[NSMutableArray alloc] init];
+    NSMutableArray* expectedETags = [[NSMutableArray alloc] init];
+    NSArray* stateChangingMethods = @[ @"PUT", @"POST", @"DELETE", @"MOVE", @"COPY", @"MKCOL" ];  // Replaying these concurrently and repeatedly cannot reproduce the recorded responses
+    NSArray* files = [[[NSFileManager defaultManager] contentsOfDirectoryAtPath:path error:NULL] sortedArrayUsingSelector:@selector(localizedStandardCompare:)];
+    for (NSString* requestFile in files) {
+      if (![requestFile hasSuffix:@".request"]) {
+        continue;
+      }
+      NSString* index = [[requestFile componentsSeparatedByString:@"-"] firstObject];
+      NSString* prefix = [index stringByAppendingString:@"-"];
+      NSData* requestData = [NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:requestFile]];
+      CFHTTPMessageRef request = requestData ? _CreateHTTPMessageFromData(requestData, YES) : NULL;
+      if (request) {
+        NSString* requestMethod = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(request));
+        CFRelease(request);
+        if ([stateChangingMethods containsObject:requestMethod]) {
+          _LogResult(@"[%i] %@ requests cannot be replayed", (int)[index integerValue], requestMethod);
+          result = -1;
+          break;
+        }
+      }
+      for (NSString* responseFile in files) {
+        if ([responseFile hasPrefix:prefix] && [responseFile hasSuffix:@".response"]) {
+          CFHTTPMessageRef expectedResponse = _CreateHTTPMessageFromData([NSData dataWithContentsOfFile:[path stringByAppendingPathComponent:responseFile]], NO);
+          if (requestData && expectedResponse) {
+            NSString* expectedETag = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(expectedResponse, CFSTR("Etag")));
+            [indexes addObject:index];
+            [requests addObject:requestData];
+            [expectedStatusCodes addObject:@(CFHTTPMessageGetResponseStatusCode(expectedResponse))];
+            [expectedETags addObject:(expectedETag ? expectedETag : [NSNull null])];
+          } else {
+            GWS_DNOT_REACHED();
+          }
+          if (expectedResponse) {
+            CFRelease(expectedResponse);
+          }
+          break;
+        }
+      }
+    }
+    if (result < 0) {
+      [self stop];
+      _ExecuteMainThreadRunLoopSources();
+      return result;
+    }
+
+    // Sequential warm-up pass learning the ETags served during replay so the recorded conditional requests can be translated
+    NSMutableDictionary<NSString*, NSString*>* eTags = [[NSMutableDictionary alloc] init];  // Recorded ETags to the actual ones
+    for (NSUInteger i = 0; i < requests.count; ++i) {
+      @autoreleasepool {
+        requests[i] = _TranslateRecordedETags(requests[i], eTags);
+        CFHTTPMessageRef response = _CreateHTTPMessageFromPerformingRequest(requests[i], self.port);
+        if (response) {
+          NSString* actualETag = CFBridgingRelease(CFHTTPMessageCopyHeaderFieldValue(response, CFSTR("Etag")));
+          if (actualETag && (expectedETags[i] != [NSNull null])) {
+            [eTags setObject:actualETag forKey:expectedETags[i]];
+          }
+          CFRelease(response);
+        }
+      }
+      _ExecuteMainThreadRunLoopSources();
+    }
+
+    NSUInteger requestCount = requests.count;
+    NSUInteger totalCount = requestCount * repeatCount;
+    uint64_t* latencies = calloc(MAX(totalCount, 1), sizeof(uint64_t));
+    CFIndex* statusCodes = calloc(MAX(totalCount, 1), sizeof(CFIndex));
+    __block atomic_uint_fast64_t nextItem = 0;
+    NSUInteger port = self.port;
+    dispatch_group_t group = dispatch_group_create();
+    uint64_t startTime = GCDWebServerGetMonotonicTime();
+    for (NSUInteger i = 0; i < concurrency; ++i) {
+      dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        while (1) {
+          NSUInteger item = (NSUInteger)atomic_fetch_add(&nextItem, 1);
+          if (item >= totalCount) {
+            break;
+          }
+          @autoreleasepool {
+            uint64_t requestStartTime = GCDWebServerGetMonotonicTime();
+            CFHTTPMessageRef response = _CreateHTTPMessageFromPerformingRequest(requests[item % requestCount], port);
+            latencies[item] = GCDWebServerGetMonotonicTime() - requestStartTime;
+            if (response) {
+              statusCodes[item] = CFHTTPMessageGetResponseStatusCode(response);
+              CFRelease(response);
+            }
+          }
+        }
+      });
+    }
+    while (dispatch_group_wait(group, DISPATCH_TIME_NOW)) {
+      CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.01, true);  // Delegate callbacks may be delivered on the main thread while requests are in flight
+    }
+    double elapsed = (double)(GCDWebServerGetMonotonicTime() - startTime) / (double)NSEC_PER_SEC;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(group);
+#endif
+
+    NSMutableArray* allLatencies = [[NSMutableArray alloc] initWithCapacity:totalCount];
+    NSMutableDictionary* medianLatencies = [[NSMutableDictionary alloc] init];
+    for (NSUInteger i = 0; i < requestCount; ++i) {
+      NSMutableArray* requestLatencies = [[NSMutableArray alloc] initWithCapacity:repeatCount];
+      NSUInteger failures = 0;
+      for (NSUInteger j = 0; j < repeatCount; ++j) {
+        NSUInteger item = j * requestCount + i;
+        if (statusCodes[item] == [expectedStatusCodes[i] integerValue]) {
+          [requestLatencies addObject:@(latencies[item])];
+        } else {
+          ++failures;
+        }
+      }
+      [requestLatencies sortUsingSelector:@selector(compare:)];
+      [allLatencies addObjectsFromArray:requestLatencies];
+      double median = (double)_LatencyPercentile(requestLatencies, 0.5) / (double)NSEC_PER_MSEC;
+      [medianLatencies setObject:@(median) forKey:indexes[i]];
+      _LogResult(@"[%i] %lu/%lu succeeded, median latency %.3f ms", (int)[indexes[i] integerValue], (unsigned long)(repeatCount - failures), (unsigned long)repeatCount, median);
+      result += failures;
+    }
+    free(statusCodes);
+    free(latencies);
+
+    [allLatencies sortUsingSelector:@selector(compare:)];
+    double throughput = elapsed > 0.0 ? (double)totalCount / elapsed : 0.0;
+    double p50 = (double)_LatencyPercentile(allLatencies, 0.5) / (double)NSEC_PER_MSEC;
+    double p99 = (double)_LatencyPercentile(allLatencies, 0.99) / (double)NSEC_PER_MSEC;
+    _LogResult(@"");
+    _LogResult(@"%lu requests over %lu connections in %.3f seconds: %.1f requests/s, p50 %.3f ms, p99 %.3f ms", (unsigned long)totalCount, (unsigned long)concurrency, elapsed, throughput, p50, p99);
+
+    if (baselinePath) {
+      NSData* baselineData = [NSData dataWithContentsOfFile:baselinePath];
+      if (baselineData) {
+        NSDictionary* baseline = [NSJSONSerialization JSONObjectWithData:baselineData options:0 error:NULL];
+        if ([baseline isKindOfClass:[NSDictionary class]]) {
+          double tolerance = [baseline objectForKey:@"tolerance"] ? [[baseline objectForKey:@"tolerance"] doubleValue] : 0.2;
+          _LogResult(@"Comparing with baseline \"%@\" (tolerance %.0f%%):", baselinePath, tolerance * 100.0);
+          result += _CheckRegression(@"requests/s", throughput, [[baseline objectForKey:@"throughput"] doubleValue], tolerance, YES);
+          result += _CheckRegression(@"p50 ms", p50, [[baseline objectForKey:@"p50"] doubleValue], tolerance, NO);
+          result += _CheckRegression(@"p99 ms", p99, [[baseline objectForKey:@"p99"] doubleValue], tolerance, NO);
+          NSDictionary* baselineMedians = [baseline objectForKey:@"requests"];
+          for (NSString* index in indexes) {
+            NSNumber* baselineMedian = [baselineMedians objectForKey:index];
+            if (baselineMedian) {
+              result += _CheckRegression([NSString stringWithFormat:@"[%i] median ms", (int)[index integerValue]], [[medianLatencies objectForKey:index] doubleValue], [baselineMedian doubleValue], tolerance, NO);
+            }
+          }
+        } else {
+          _LogResult(@"Invalid baseline \"%@\"", baselinePath);
+          ++result;
+        }
+      } else {
+        NSDictionary* baseline = @{@"tolerance" : @0.2, @"throughput" : @(throughput), @"p50" : @(p50), @"p99" : @(p99), @"requests" : medianLatencies};
+        NSData* data = [NSJSONSerialization dataWithJSONObject:baseline options:NSJSONWritingPrettyPrinted error:NULL];
+        if ([data writeToFile:baselinePath atomically:YES]) {
+          _LogResult(@"Wrote baseline to \"%@\"", baselinePath);
+        } else {
+          _LogResult(@"Failed writing baseline to \"%@\"", baselinePath);
+          ++result;
+        }
+      }
+    }
+
+    [self stop];
+
+    _ExecuteMainThreadRunLoopSources();
+  }
+  return result;
+}
+
 @end
 
 #endif
@@ -0,0 +1,115 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Formats in which GCDWebServerAccessLog can write its records.
+ */
+typedef NS_ENUM(int, GCDWebServerAccessLogFormat) {
+  kGCDWebServerAccessLogFormat_Combined = 0,  // Apache / NCSA combined log format
+  kGCDWebServerAccessLogFormat_JSONLines  // One JSON object per line
+};
+
+/**
+ *  The GCDWebServerAccessLog class writes one line per HTTP request handled
+ *  by a GCDWebServer to a file descriptor.
+ *
+ *  Connections copy their request into a fixed-size record stored in a
+ *  bounded lock-free ring buffer and never format or write anything
+ *  themselves: a dedicated background thread drains the ring buffer, formats
+ *  records in batches and writes each batch with a single system call.
+ *
+ *  If the ring buffer is full, records are dropped instead of slowing down
+ *  the server and the droppedRecords counter is incremented.
+ *
+ *  Pass an instance with the GCDWebServerOption_AccessLog option when
+ *  starting the server to enable it.
+ *
+ *  @warning The background thread retains the access log until -close is called.
+ */
+@interface GCDWebServerAccessLog : NSObject
+
+/**
+ *  Returns the format of the access log.
+ */
+@property(nonatomic, readonly) GCDWebServerAccessLogFormat format;
+
+/**
+ *  Sets the sampling interval of the access log i.e. only 1 request out of
+ *  this value is logged. Requests that result in a 5xx status code are always
+ *  logged.
+ *
+ *  The default value is 1 i.e. all requests are logged.
+ */
+@property(nonatomic) NSUInteger sampleInterval;
+
+/**
+ *  Returns the number of records dropped because the ring buffer was full.
+ */
+@property(nonatomic, readonly) uint64_t droppedRecords;
+
+/**
+ *  Returns the number of records written so far.
+ */
+@property(nonatomic, readonly) uint64_t writtenRecords;
+
+/**
+ *  This method is the designated initializer for the class.
+ *
+ *  The capacity is rounded up to the next power of 2 and each record takes
+ *  about 1.25 KiB of memory.
+ *
+ *  If "closeFileDescriptor" is YES, the file descriptor is closed by -close.
+ */
+- (instancetype)initWithFileDescriptor:(int)fd format:(GCDWebServerAccessLogFormat)format capacity:(NSUInteger)capacity closeFileDescriptor:(BOOL)closeFileDescriptor;
+
+/**
+ *  Creates an access log appending to the file at a given path with a
+ *  capacity of 4096 records.
+ *
+ *  Returns nil if the file cannot be opened.
+ */
+- (nullable instancetype)initWithPath:(NSString*)path format:(GCDWebServerAccessLogFormat)format;
+
+/**
+ *  Blocks until all records appended so far have been written.
+ */
+- (void)flush;
+
+/**
+ *  Writes all pending records and stops the background thread.
+ *
+ *  Records appended afterwards are dropped.
+ */
+- (void)close;
+
+@end
+
+NS_ASSUME_NONNULL_END
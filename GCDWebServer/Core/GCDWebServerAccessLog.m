@@ -0,0 +1,381 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !__has_feature(objc_arc)
+#error GCDWebServer requires ARC
+#endif
+
+#import <netdb.h>
+#import <pthread.h>
+#import <stdatomic.h>
+#import <time.h>
+
+#import "GCDWebServerPrivate.h"
+
+#define kDefaultCapacity 4096
+#define kMaxBatchSize 256
+#define kIdleTimeout (1 * NSEC_PER_SEC)
+
+typedef struct {
+  _Atomic(uint64_t) sequence;
+  GCDWebServerAccessLogRecord record;
+} GCDWebServerAccessLogSlot;
+
+typedef struct {
+  char* bytes;
+  size_t length;
+  size_t capacity;
+} GCDWebServerAccessLogBuffer;
+
+static void _BufferAppend(GCDWebServerAccessLogBuffer* buffer, const char* bytes, size_t length) {
+  if (buffer->length + length > buffer->capacity) {
+    buffer->capacity = MAX(2 * buffer->capacity, buffer->length + length);
+    buffer->bytes = realloc(buffer->bytes, buffer->capacity);
+  }
+  memcpy(buffer->bytes + buffer->length, bytes, length);
+  buffer->length += length;
+}
+
+static inline void _BufferAppendString(GCDWebServerAccessLogBuffer* buffer, const char* string) {
+  _BufferAppend(buffer, string, strlen(string));
+}
+
+// Escapes double-quotes, backslashes and control characters which is valid for both formats
+static void _BufferAppendEscapedString(GCDWebServerAccessLogBuffer* buffer, const char* string, BOOL json) {
+  const char* start = string;
+  const char* p = string;
+  for (; *p; ++p) {
+    unsigned char c = (unsigned char)*p;
+    if ((c < 0x20) || (c == 0x7F) || (c == '"') || (c == '\\')) {
+      _BufferAppend(buffer, start, (size_t)(p - start));
+      char escape[8];
+      if ((c == '"') || (c == '\\')) {
+        escape[0] = '\\';
+        escape[1] = (char)c;
+        escape[2] = 0;
+      } else if (json) {
+        snprintf(escape, sizeof(escape), "\\u%04x", c);
+      } else {
+        snprintf(escape, sizeof(escape), "\\x%02x", c);
+      }
+      _BufferAppendString(buffer, escape);
+      start = p + 1;
+    }
+  }
+  _BufferAppend(buffer, start, (size_t)(p - start));
+}
+
+static void _FormatRemoteAddress(const GCDWebServerAccessLogRecord* record, char* host, size_t size) {
+  if ((record->remoteAddressLength == 0) || getnameinfo((const struct sockaddr*)&record->remoteAddress, record->remoteAddressLength, host, (socklen_t)size, NULL, 0, NI_NUMERICHOST)) {
+    strlcpy(host, "-", size);
+  }
+}
+
+static void _AppendCombinedRecord(GCDWebServerAccessLogBuffer* buffer, const GCDWebServerAccessLogRecord* record) {
+  char host[NI_MAXHOST];
+  _FormatRemoteAddress(record, host, sizeof(host));
+  time_t seconds = (time_t)(record->time + kCFAbsoluteTimeIntervalSince1970);
+  struct tm tm;
+  localtime_r(&seconds, &tm);
+  char date[64];
+  strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S %z", &tm);
+  char line[256];
+  snprintf(line, sizeof(line), "%s - - [%s] \"", host, date);
+  _BufferAppendString(buffer, line);
+  _BufferAppendEscapedString(buffer, record->method, NO);
+  _BufferAppendString(buffer, " ");
+  _BufferAppendEscapedString(buffer, record->target, NO);
+  snprintf(line, sizeof(line), " HTTP/1.1\" %i %llu \"", record->statusCode, (unsigned long long)record->bytesSent);
+  _BufferAppendString(buffer, line);
+  _BufferAppendEscapedString(buffer, record->referrer[0] ? record->referrer : "-", NO);
+  _BufferAppendString(buffer, "\" \"");
+  _BufferAppendEscapedString(buffer, record->userAgent[0] ? record->userAgent : "-", NO);
+  _BufferAppendString(buffer, "\"\n");
+}
+
+static void _AppendJSONField(GCDWebServerAccessLogBuffer* buffer, const char* name, const char* value) {
+  _BufferAppendString(buffer, ",\"");
+  _BufferAppendString(buffer, name);
+  _BufferAppendString(buffer, "\":\"");
+  _BufferAppendEscapedString(buffer, value, YES);
+  _BufferAppendString(buffer, "\"");
+}
+
+static void _AppendJSONRecord(GCDWebServerAccessLogBuffer* buffer, const GCDWebServerAccessLogRecord* record) {
+  char host[NI_MAXHOST];
+  _FormatRemoteAddress(record, host, sizeof(host));
+  double time = record->time + kCFAbsoluteTimeIntervalSince1970;
+  time_t seconds = (time_t)time;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  char date[64];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+  char line[256];
+  snprintf(line, sizeof(line), "{\"time\":\"%s.%03iZ\"", date, (int)((time - (double)seconds) * 1000.0));
+  _BufferAppendString(buffer, line);
+  _AppendJSONField(buffer, "remote", host);
+  _AppendJSONField(buffer, "method", record->method);
+  _AppendJSONField(buffer, "target", record->target);
+  snprintf(line, sizeof(line), ",\"status\":%i,\"bytes_in\":%llu,\"bytes_out\":%llu,\"duration_ms\":%.3f", record->statusCode, (unsigned long long)record->bytesReceived, (unsigned long long)record->bytesSent, (double)record->duration / (double)NSEC_PER_MSEC);
+  _BufferAppendString(buffer, line);
+  if (record->referrer[0]) {
+    _AppendJSONField(buffer, "referrer", record->referrer);
+  }
+  if (record->userAgent[0]) {
+    _AppendJSONField(buffer, "user_agent", record->userAgent);
+  }
+  if (record->traceID[0]) {
+    _AppendJSONField(buffer, "trace_id", record->traceID);
+  }
+  _BufferAppendString(buffer, "}\n");
+}
+
+void GCDWebServerAccessLogCopyString(NSString* string, char* buffer, size_t size) {
+  NSUInteger length = 0;
+  if (string) {
+    [string getBytes:buffer maxLength:(size - 1) usedLength:&length encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, string.length) remainingRange:NULL];  // Truncates on a character boundary
+  }
+  buffer[length] = 0;
+}
+
+@implementation GCDWebServerAccessLog {
+  int _fileDescriptor;
+  BOOL _closeFileDescriptor;
+  GCDWebServerAccessLogSlot* _slots;
+  uint64_t _mask;
+  _Atomic(uint64_t) _enqueuePosition;
+  uint64_t _dequeuePosition;  // Only accessed by the writer thread
+  _Atomic(uint64_t) _sampleCounter;
+  _Atomic(uint64_t) _droppedRecords;
+  _Atomic(uint64_t) _writtenRecords;
+  atomic_bool _idle;
+  atomic_bool _closing;
+  dispatch_semaphore_t _wakeUpSemaphore;
+  pthread_mutex_t _mutex;
+  pthread_cond_t _condition;  // Signaled after each batch is written and when the writer thread exits
+  uint64_t _writtenPosition;  // Protected by _mutex
+  BOOL _exited;  // Protected by _mutex
+}
+
+- (instancetype)initWithFileDescriptor:(int)fd format:(GCDWebServerAccessLogFormat)format capacity:(NSUInteger)capacity closeFileDescriptor:(BOOL)closeFileDescriptor {
+  GWS_DCHECK(fd >= 0);
+  if ((self = [super init])) {
+    _fileDescriptor = fd;
+    _format = format;
+    _closeFileDescriptor = closeFileDescriptor;
+    _sampleInterval = 1;
+    uint64_t count = 2;
+    while (count < capacity) {
+      count <<= 1;
+    }
+    _mask = count - 1;
+    _slots = calloc(count, sizeof(GCDWebServerAccessLogSlot));
+    for (uint64_t i = 0; i < count; ++i) {
+      atomic_init(&_slots[i].sequence, i);
+    }
+    _wakeUpSemaphore = dispatch_semaphore_create(0);
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_condition, NULL);
+    NSThread* thread = [[NSThread alloc] initWithTarget:self selector:@selector(_runWriter) object:nil];  // Thread retains the access log until it exits
+    thread.name = NSStringFromClass([self class]);
+    [thread start];
+  }
+  return self;
+}
+
+- (instancetype)initWithPath:(NSString*)path format:(GCDWebServerAccessLogFormat)format {
+  int fd = open([path fileSystemRepresentation], O_CREAT | O_WRONLY | O_APPEND, 0644);
+  if (fd < 0) {
+    GWS_LOG_ERROR(@"Failed opening access log at \"%@\": %s (%i)", path, strerror(errno), errno);
+    return nil;
+  }
+  return [self initWithFileDescriptor:fd format:format capacity:kDefaultCapacity closeFileDescriptor:YES];
+}
+
+- (void)dealloc {
+  free(_slots);
+  pthread_cond_destroy(&_condition);
+  pthread_mutex_destroy(&_mutex);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_wakeUpSemaphore);
+#endif
+}
+
+- (uint64_t)droppedRecords {
+  return atomic_load_explicit(&_droppedRecords, memory_order_relaxed);
+}
+
+- (uint64_t)writtenRecords {
+  return atomic_load_explicit(&_writtenRecords, memory_order_relaxed);
+}
+
+- (BOOL)shouldLogRequestWithStatusCode:(NSInteger)statusCode {
+  NSUInteger interval = _sampleInterval;
+  if ((interval <= 1) || (statusCode >= 500)) {
+    return YES;
+  }
+  return (atomic_fetch_add_explicit(&_sampleCounter, 1, memory_order_relaxed) % interval) == 0;
+}
+
+// Bounded queue from Dmitry Vyukov where each slot carries a sequence number: producers claim positions with a CAS and the single consumer never writes the enqueue position
+- (void)appendRecord:(const GCDWebServerAccessLogRecord*)record {
+  if (atomic_load_explicit(&_closing, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&_droppedRecords, 1, memory_order_relaxed);
+    return;
+  }
+  uint64_t position = atomic_load_explicit(&_enqueuePosition, memory_order_relaxed);
+  GCDWebServerAccessLogSlot* slot;
+  while (1) {
+    slot = &_slots[position & _mask];
+    uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    int64_t difference = (int64_t)sequence - (int64_t)position;
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(&_enqueuePosition, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      atomic_fetch_add_explicit(&_droppedRecords, 1, memory_order_relaxed);  // Ring buffer is full
+      return;
+    } else {
+      position = atomic_load_explicit(&_enqueuePosition, memory_order_relaxed);
+    }
+  }
+  memcpy(&slot->record, record, sizeof(GCDWebServerAccessLogRecord));
+  atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+  atomic_thread_fence(memory_order_seq_cst);  // Pairs with the fence in -_runWriter so that wake-ups cannot be lost
+  if (atomic_load_explicit(&_idle, memory_order_relaxed) && atomic_exchange(&_idle, false)) {
+    dispatch_semaphore_signal(_wakeUpSemaphore);
+  }
+}
+
+- (NSUInteger)_drainIntoBuffer:(GCDWebServerAccessLogBuffer*)buffer position:(uint64_t*)outPosition {
+  NSUInteger count = 0;
+  uint64_t position = _dequeuePosition;
+  while (count < kMaxBatchSize) {
+    GCDWebServerAccessLogSlot* slot = &_slots[position & _mask];
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != position + 1) {
+      break;  // Slot is empty or still being written by its producer
+    }
+    if (_format == kGCDWebServerAccessLogFormat_JSONLines) {
+      _AppendJSONRecord(buffer, &slot->record);
+    } else {
+      _AppendCombinedRecord(buffer, &slot->record);
+    }
+    atomic_store_explicit(&slot->sequence, position + _mask + 1, memory_order_release);
+    position += 1;
+    count += 1;
+  }
+  _dequeuePosition = position;
+  *outPosition = position;
+  return count;
+}
+
+- (void)_writeBuffer:(GCDWebServerAccessLogBuffer*)buffer {
+  const char* bytes = buffer->bytes;
+  size_t remaining = buffer->length;
+  while (remaining > 0) {
+    ssize_t result = write(_fileDescriptor, bytes, remaining);
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      GWS_LOG_ERROR(@"Failed writing access log: %s (%i)", strerror(errno), errno);
+      break;
+    }
+    bytes += result;
+    remaining -= (size_t)result;
+  }
+  buffer->length = 0;
+}
+
+- (void)_runWriter {
+  GCDWebServerAccessLogBuffer buffer = {0};
+  while (1) {
+    uint64_t position;
+    NSUInteger count = [self _drainIntoBuffer:&buffer position:&position];
+    if (count) {
+      [self _writeBuffer:&buffer];
+      atomic_fetch_add_explicit(&_writtenRecords, count, memory_order_relaxed);
+      pthread_mutex_lock(&_mutex);
+      _writtenPosition = position;
+      pthread_cond_broadcast(&_condition);
+      pthread_mutex_unlock(&_mutex);
+      continue;
+    }
+    if (atomic_load(&_closing)) {
+      break;
+    }
+    atomic_store(&_idle, true);
+    atomic_thread_fence(memory_order_seq_cst);
+    if ((atomic_load_explicit(&_slots[position & _mask].sequence, memory_order_acquire) == position + 1) || atomic_load(&_closing)) {
+      atomic_store(&_idle, false);
+      continue;
+    }
+    dispatch_semaphore_wait(_wakeUpSemaphore, dispatch_time(DISPATCH_TIME_NOW, kIdleTimeout));
+    atomic_store(&_idle, false);
+  }
+  free(buffer.bytes);
+
+  if (_closeFileDescriptor) {
+    close(_fileDescriptor);
+  }
+  pthread_mutex_lock(&_mutex);
+  _exited = YES;
+  pthread_cond_broadcast(&_condition);
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (void)_wakeUpWriter {
+  if (atomic_exchange(&_idle, false)) {
+    dispatch_semaphore_signal(_wakeUpSemaphore);
+  }
+}
+
+- (void)flush {
+  uint64_t target = atomic_load(&_enqueuePosition);
+  [self _wakeUpWriter];
+  pthread_mutex_lock(&_mutex);
+  while (!_exited && (_writtenPosition < target)) {
+    pthread_cond_wait(&_condition, &_mutex);
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+- (void)close {
+  if (atomic_exchange(&_closing, true)) {
+    return;
+  }
+  [self _wakeUpWriter];
+  pthread_mutex_lock(&_mutex);
+  while (!_exited) {
+    pthread_cond_wait(&_condition, &_mutex);
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+@end
@@ -31,6 +31,31 @@ NS_ASSUME_NONNULL_BEGIN
 
 @class GCDWebServerHandler;
 
+/**
+ *  Timestamps of the phases of the HTTP request handled by a connection.
+ *  All values are expressed in seconds relative to the time the connection
+ *  was accepted and are 0.0 for phases which were not reached.
+ */
+typedef struct {
+  CFAbsoluteTime acceptTime;  // Absolute time the connection was accepted
+  CFTimeInterval firstByteRead;
+  CFTimeInterval headersParsed;
+  CFTimeInterval handlerStarted;
+  CFTimeInterval handlerFinished;
+  CFTimeInterval firstByteWritten;  // Time the response headers were sent
+  CFTimeInterval lastByteWritten;
+} GCDWebServerRequestTimings;
+
+/**
+ *  The GCDWebServerRequestTimingsBlock is called when a connection is closed
+ *  with the request it handled (nil if the request was invalid), the HTTP status
+ *  code of the response (0 if none was sent) and the timings of the request.
+ *
+ *  @warning The block is called on the I/O queue of the connection and should
+ *  return quickly.
+ */
+typedef void (^GCDWebServerRequestTimingsBlock)(GCDWebServerRequest* _Nullable request, NSInteger statusCode, GCDWebServerRequestTimings timings);
+
 /**
  *  The GCDWebServerConnection class is instantiated by GCDWebServer to handle
  *  each new HTTP connection. Each instance stays alive until the connection is
@@ -90,6 +115,11 @@ NS_ASSUME_NONNULL_BEGIN
  */
 @property(nonatomic, readonly) NSUInteger totalBytesWritten;
 
+/**
+ *  Returns the timings of the phases of the HTTP request reached so far.
+ */
+@property(nonatomic, readonly) GCDWebServerRequestTimings timings;
+
 @end
 
 /**
@@ -158,9 +188,14 @@ NS_ASSUME_NONNULL_BEGIN
  *  You can either modify the current response and return it, or return a
  *  completely new one.
  *
- *  The default implementation replaces any response matching the "ETag" or
- *  "Last-Modified-Date" header of the request by a barebone "Not-Modified" (304)
- *  one.
+ *  The default implementation evaluates the conditional headers of GET and HEAD
+ *  requests against the "ETag" and "Last-Modified" of successful responses (unless the
+ *  handler already called -statusCodeForPreconditionsWithETag:lastModifiedDate:resourceExists:)
+ *  and replaces them if needed by a barebone "Not Modified" (304) or
+ *  "Precondition Failed" (412) one. Otherwise if the request has a single byte range and the response
+ *  has a body of known length, only that range of the body is sent as a
+ *  "Partial Content" (206) response (GCDWebServerFileResponse handles byte
+ *  ranges on its own and is left unchanged).
  */
 - (GCDWebServerResponse*)overrideResponse:(GCDWebServerResponse*)response forRequest:(GCDWebServerRequest*)request;
 
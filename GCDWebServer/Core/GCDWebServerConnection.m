@@ -30,7 +30,10 @@
 #endif
 
 #import <TargetConditionals.h>
+#import <CommonCrypto/CommonDigest.h>
 #import <netdb.h>
+#import <pthread.h>
+#import <stdatomic.h>
 #ifdef __GCDWEBSERVER_ENABLE_TESTING__
 #import <libkern/OSAtomic.h>
 #endif
@@ -52,11 +55,179 @@ static NSData* _CRLFData = nil;
 static NSData* _CRLFCRLFData = nil;
 static NSData* _continueData = nil;
 static NSData* _lastChunkData = nil;
-static NSString* _digestAuthenticationNonce = nil;
 #ifdef __GCDWEBSERVER_ENABLE_TESTING__
 static int32_t _connectionCounter = 0;
 #endif
 
+#define kResponseHeadersInlineCapacity 1024
+
+// Builds the serialized response headers in an inline buffer which only spills to the heap for unusually large headers
+typedef struct {
+  char* bytes;
+  size_t length;
+  size_t capacity;
+  char inlineBytes[kResponseHeadersInlineCapacity];
+} GCDWebServerHeaderWriter;
+
+// Headers set by the connection itself which are replaced by any additional header with the same name
+typedef NS_ENUM(int, GCDWebServerBuiltInHeader) {
+  kGCDWebServerBuiltInHeader_Server = 0,
+  kGCDWebServerBuiltInHeader_Date,
+  kGCDWebServerBuiltInHeader_Connection,
+  kGCDWebServerBuiltInHeader_LastModified,
+  kGCDWebServerBuiltInHeader_ETag,
+  kGCDWebServerBuiltInHeader_CacheControl,
+  kGCDWebServerBuiltInHeader_ContentType,
+  kGCDWebServerBuiltInHeader_ContentLength,
+  kGCDWebServerBuiltInHeader_TransferEncoding,
+  kGCDWebServerBuiltInHeaderCount
+};
+
+static const char* const _builtInHeaderNames[kGCDWebServerBuiltInHeaderCount] = {"Server", "Date", "Connection", "Last-Modified", "ETag", "Cache-Control", "Content-Type", "Content-Length", "Transfer-Encoding"};
+
+#define _STATUS_LINE(__CODE__, __REASON__)                                    \
+  case __CODE__: {                                                            \
+    static const char line[] = "HTTP/1.1 " #__CODE__ " " __REASON__ "\r\n"; \
+    *length = sizeof(line) - 1;                                               \
+    return line;                                                              \
+  }
+
+static const char* _GetStatusLine(NSInteger statusCode, size_t* length) {
+  switch (statusCode) {
+    _STATUS_LINE(100, "Continue")
+    _STATUS_LINE(101, "Switching Protocols")
+    _STATUS_LINE(102, "Processing")
+    _STATUS_LINE(200, "OK")
+    _STATUS_LINE(201, "Created")
+    _STATUS_LINE(202, "Accepted")
+    _STATUS_LINE(203, "Non-Authoritative Information")
+    _STATUS_LINE(204, "No Content")
+    _STATUS_LINE(205, "Reset Content")
+    _STATUS_LINE(206, "Partial Content")
+    _STATUS_LINE(207, "Multi-Status")
+    _STATUS_LINE(208, "Already Reported")
+    _STATUS_LINE(300, "Multiple Choices")
+    _STATUS_LINE(301, "Moved Permanently")
+    _STATUS_LINE(302, "Found")
+    _STATUS_LINE(303, "See Other")
+    _STATUS_LINE(304, "Not Modified")
+    _STATUS_LINE(305, "Use Proxy")
+    _STATUS_LINE(307, "Temporary Redirect")
+    _STATUS_LINE(308, "Permanent Redirect")
+    _STATUS_LINE(400, "Bad Request")
+    _STATUS_LINE(401, "Unauthorized")
+    _STATUS_LINE(402, "Payment Required")
+    _STATUS_LINE(403, "Forbidden")
+    _STATUS_LINE(404, "Not Found")
+    _STATUS_LINE(405, "Method Not Allowed")
+    _STATUS_LINE(406, "Not Acceptable")
+    _STATUS_LINE(407, "Proxy Authentication Required")
+    _STATUS_LINE(408, "Request Timeout")
+    _STATUS_LINE(409, "Conflict")
+    _STATUS_LINE(410, "Gone")
+    _STATUS_LINE(411, "Length Required")
+    _STATUS_LINE(412, "Precondition Failed")
+    _STATUS_LINE(413, "Payload Too Large")
+    _STATUS_LINE(414, "URI Too Long")
+    _STATUS_LINE(415, "Unsupported Media Type")
+    _STATUS_LINE(416, "Range Not Satisfiable")
+    _STATUS_LINE(417, "Expectation Failed")
+    _STATUS_LINE(422, "Unprocessable Entity")
+    _STATUS_LINE(423, "Locked")
+    _STATUS_LINE(424, "Failed Dependency")
+    _STATUS_LINE(426, "Upgrade Required")
+    _STATUS_LINE(428, "Precondition Required")
+    _STATUS_LINE(429, "Too Many Requests")
+    _STATUS_LINE(431, "Request Header Fields Too Large")
+    _STATUS_LINE(500, "Internal Server Error")
+    _STATUS_LINE(501, "Not Implemented")
+    _STATUS_LINE(502, "Bad Gateway")
+    _STATUS_LINE(503, "Service Unavailable")
+    _STATUS_LINE(504, "Gateway Timeout")
+    _STATUS_LINE(505, "HTTP Version Not Supported")
+    _STATUS_LINE(507, "Insufficient Storage")
+    _STATUS_LINE(508, "Loop Detected")
+    _STATUS_LINE(510, "Not Extended")
+    _STATUS_LINE(511, "Network Authentication Required")
+  }
+  return NULL;
+}
+
+static inline void _HeaderWriterInitialize(GCDWebServerHeaderWriter* writer) {
+  writer->bytes = writer->inlineBytes;
+  writer->length = 0;
+  writer->capacity = kResponseHeadersInlineCapacity;
+}
+
+static char* _HeaderWriterReserve(GCDWebServerHeaderWriter* writer, size_t length) {
+  if (writer->length + length > writer->capacity) {
+    size_t capacity = MAX(2 * writer->capacity, writer->length + length);
+    if (writer->bytes == writer->inlineBytes) {
+      writer->bytes = malloc(capacity);
+      memcpy(writer->bytes, writer->inlineBytes, writer->length);
+    } else {
+      writer->bytes = realloc(writer->bytes, capacity);
+    }
+    writer->capacity = capacity;
+  }
+  char* bytes = &writer->bytes[writer->length];
+  writer->length += length;
+  return bytes;
+}
+
+static inline void _HeaderWriterAppend(GCDWebServerHeaderWriter* writer, const void* bytes, size_t length) {
+  memcpy(_HeaderWriterReserve(writer, length), bytes, length);
+}
+
+#define _HeaderWriterAppendLiteral(__WRITER__, __STRING__) _HeaderWriterAppend(__WRITER__, __STRING__, sizeof(__STRING__) - 1)
+
+static inline void _HeaderWriterAppendCString(GCDWebServerHeaderWriter* writer, const char* string) {
+  _HeaderWriterAppend(writer, string, strlen(string));
+}
+
+static void _HeaderWriterAppendUnsigned(GCDWebServerHeaderWriter* writer, uint64_t value) {
+  char digits[20];
+  char* end = digits + sizeof(digits);
+  char* start = end;
+  do {
+    *--start = '0' + (char)(value % 10);
+    value /= 10;
+  } while (value);
+  _HeaderWriterAppend(writer, start, end - start);
+}
+
+static void _HeaderWriterAppendHTTPDate(GCDWebServerHeaderWriter* writer, time_t time) {
+  GCDWebServerFormatHTTPDate(time, _HeaderWriterReserve(writer, kGCDWebServerHTTPDateLength));
+}
+
+#define kDateLineLength (6 + kGCDWebServerHTTPDateLength + 2)
+
+static pthread_mutex_t _dateLineMutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t _dateLineTime = 0;  // Protected by _dateLineMutex
+static char _dateLine[kDateLineLength];  // Protected by _dateLineMutex
+
+// The "Date" header only has a resolution of 1 second so it is formatted at most once per second and shared by all connections
+static void _HeaderWriterAppendDateLine(GCDWebServerHeaderWriter* writer) {
+  time_t now = time(NULL);
+  char* line = _HeaderWriterReserve(writer, kDateLineLength);
+  pthread_mutex_lock(&_dateLineMutex);
+  if (now != _dateLineTime) {
+    memcpy(_dateLine, "Date: ", 6);
+    GCDWebServerFormatHTTPDate(now, &_dateLine[6]);
+    memcpy(&_dateLine[6 + kGCDWebServerHTTPDateLength], "\r\n", 2);
+    _dateLineTime = now;
+  }
+  memcpy(line, _dateLine, kDateLineLength);
+  pthread_mutex_unlock(&_dateLineMutex);
+}
+
+static NSData* _HeaderWriterCopyData(GCDWebServerHeaderWriter* writer) {
+  if (writer->bytes == writer->inlineBytes) {
+    return [[NSData alloc] initWithBytes:writer->bytes length:writer->length];
+  }
+  return [[NSData alloc] initWithBytesNoCopy:writer->bytes length:writer->length freeWhenDone:YES];
+}
+
 NS_ASSUME_NONNULL_BEGIN
 
 @interface GCDWebServerConnection (Read)
@@ -76,16 +247,35 @@ NS_ASSUME_NONNULL_END
 
 @implementation GCDWebServerConnection {
   CFSocketNativeHandle _socket;
+  dispatch_queue_t _ioQueue;
+  dispatch_queue_t _handlerQueue;
+  GCDWebServerWorkerPool* _workerPool;
+  GCDWebServerMetrics* _metrics;
+  GCDWebServerRequestTimingsBlock _timingsObserver;
+  GCDWebServerAccessLog* _accessLog;
+  CFAbsoluteTime _acceptAbsoluteTime;
+  uint64_t _acceptTime;  // Monotonic times in nanoseconds or 0 if not reached
+  uint64_t _firstByteReadTime;
+  uint64_t _headersParsedTime;
+  uint64_t _handlerStartTime;
+  uint64_t _handlerEndTime;
+  uint64_t _firstByteWrittenTime;
+  uint64_t _lastByteWrittenTime;
+  BOOL _requestInFlight;
   BOOL _virtualHEAD;
 
   CFHTTPMessageRef _requestMessage;
   GCDWebServerRequest* _request;
   GCDWebServerHandler* _handler;
-  CFHTTPMessageRef _responseMessage;
+  NSData* _responseHeadersData;
   GCDWebServerResponse* _response;
   NSInteger _statusCode;
 
   BOOL _opened;
+  BOOL _holdsRequestSlot;
+  GCDWebServerTimerWheelEntry* _timerEntry;
+  _Atomic(uint64_t) _timeoutDeadline;
+  atomic_bool _timedOut;
 #ifdef __GCDWEBSERVER_ENABLE_TESTING__
   NSUInteger _connectionIndex;
   NSString* _requestPath;
@@ -113,11 +303,6 @@ NS_ASSUME_NONNULL_END
   if (_lastChunkData == nil) {
     _lastChunkData = [[NSData alloc] initWithBytes:"0\r\n\r\n" length:5];
   }
-  if (_digestAuthenticationNonce == nil) {
-    CFUUIDRef uuid = CFUUIDCreate(kCFAllocatorDefault);
-    _digestAuthenticationNonce = GCDWebServerComputeMD5Digest(@"%@", CFBridgingRelease(CFUUIDCreateString(kCFAllocatorDefault, uuid)));
-    CFRelease(uuid);
-  }
 }
 
 - (BOOL)isUsingIPv6 {
@@ -125,31 +310,256 @@ NS_ASSUME_NONNULL_END
   return (localSockAddr->sa_family == AF_INET6);
 }
 
-- (void)_initializeResponseHeadersWithStatusCode:(NSInteger)statusCode {
+static inline CFTimeInterval _IntervalSinceAccept(uint64_t acceptTime, uint64_t time) {
+  return time ? (double)(time - acceptTime) / (double)NSEC_PER_SEC : 0.0;
+}
+
+- (GCDWebServerRequestTimings)timings {
+  GCDWebServerRequestTimings timings;
+  timings.acceptTime = _acceptAbsoluteTime;
+  timings.firstByteRead = _IntervalSinceAccept(_acceptTime, _firstByteReadTime);
+  timings.headersParsed = _IntervalSinceAccept(_acceptTime, _headersParsedTime);
+  timings.handlerStarted = _IntervalSinceAccept(_acceptTime, _handlerStartTime);
+  timings.handlerFinished = _IntervalSinceAccept(_acceptTime, _handlerEndTime);
+  timings.firstByteWritten = _IntervalSinceAccept(_acceptTime, _firstByteWrittenTime);
+  timings.lastByteWritten = _IntervalSinceAccept(_acceptTime, _lastByteWrittenTime);
+  return timings;
+}
+
+- (uint64_t)timeoutDeadline {
+  return atomic_load_explicit(&_timeoutDeadline, memory_order_relaxed);
+}
+
+// Arms a new timeout from now or disarms the current one if "timeout" is <= 0.0
+- (void)_setTimeout:(NSTimeInterval)timeout {
+  uint64_t deadline = timeout > 0.0 ? GCDWebServerGetMonotonicTime() + (uint64_t)(timeout * (double)NSEC_PER_SEC) : 0;
+  uint64_t previousDeadline = atomic_exchange_explicit(&_timeoutDeadline, deadline, memory_order_relaxed);
+  if (deadline && (!previousDeadline || (deadline < previousDeadline))) {  // Extending a deadline doesn't require rescheduling
+    [_server.timerWheel scheduleEntry:_timerEntry];
+  }
+}
+
+- (void)timeoutDidExpire {
+  if (atomic_exchange(&_timedOut, true)) {
+    return;
+  }
+  GWS_LOG_WARNING(@"Connection on socket %i timed out after receiving %lu bytes and sending %lu bytes", _socket, (unsigned long)_totalBytesRead, (unsigned long)_totalBytesWritten);
+  shutdown(_socket, _responseHeadersData ? SHUT_RDWR : SHUT_RD);  // Pending reads and writes will fail which will end the connection
+}
+
+// Serializes the headers directly instead of going through CFHTTPMessage as this is a significant part of the cost of small responses
+- (void)_initializeResponseHeadersWithStatusCode:(NSInteger)statusCode response:(GCDWebServerResponse*)response {
   _statusCode = statusCode;
-  _responseMessage = CFHTTPMessageCreateResponse(kCFAllocatorDefault, statusCode, NULL, kCFHTTPVersion1_1);
-  CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Connection"), CFSTR("Close"));
-  CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Server"), (__bridge CFStringRef)_server.serverName);
-  CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Date"), (__bridge CFStringRef)GCDWebServerFormatRFC822([NSDate date]));
+  GCDWebServerHeaderWriter writer;
+  _HeaderWriterInitialize(&writer);
+
+  size_t statusLineLength;
+  const char* statusLine = _GetStatusLine(statusCode, &statusLineLength);
+  if (statusLine) {
+    _HeaderWriterAppend(&writer, statusLine, statusLineLength);
+  } else {
+    _HeaderWriterAppendLiteral(&writer, "HTTP/1.1 ");
+    _HeaderWriterAppendUnsigned(&writer, (uint64_t)statusCode);
+    _HeaderWriterAppendLiteral(&writer, " \r\n");  // The reason phrase is optional
+  }
+
+  unsigned int overriddenHeaders = 0;
+  NSDictionary<NSString*, NSString*>* additionalHeaders = response.additionalHeaders;
+  for (NSString* key in additionalHeaders) {
+    const char* name = key.UTF8String;
+    for (int i = 0; i < kGCDWebServerBuiltInHeaderCount; ++i) {
+      if (!strcasecmp(name, _builtInHeaderNames[i])) {
+        overriddenHeaders |= 1 << i;
+        break;
+      }
+    }
+  }
+#define _IS_BUILT_IN_HEADER_ENABLED(__HEADER__) (!(overriddenHeaders & (1 << (__HEADER__))))
+
+  if (_IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_Server)) {
+    NSData* serverHeaderData = _server.serverHeaderData;
+    _HeaderWriterAppend(&writer, serverHeaderData.bytes, serverHeaderData.length);
+  }
+  if (_IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_Date)) {
+    _HeaderWriterAppendDateLine(&writer);
+  }
+  if (_IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_Connection)) {
+    _HeaderWriterAppendLiteral(&writer, "Connection: Close\r\n");
+  }
+  if (response) {
+    if (response.lastModifiedDate && _IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_LastModified)) {
+      _HeaderWriterAppendLiteral(&writer, "Last-Modified: ");
+      _HeaderWriterAppendHTTPDate(&writer, (time_t)floor(response.lastModifiedDate.timeIntervalSince1970));
+      _HeaderWriterAppendLiteral(&writer, "\r\n");
+    }
+    if (response.eTag && _IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_ETag)) {
+      _HeaderWriterAppendLiteral(&writer, "ETag: ");
+      _HeaderWriterAppendCString(&writer, response.eTag.UTF8String);
+      _HeaderWriterAppendLiteral(&writer, "\r\n");
+    }
+    if ((statusCode >= 200) && (statusCode < 300) && _IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_CacheControl)) {
+      if (response.cacheControlMaxAge > 0) {
+        _HeaderWriterAppendLiteral(&writer, "Cache-Control: max-age=");
+        _HeaderWriterAppendUnsigned(&writer, response.cacheControlMaxAge);
+        _HeaderWriterAppendLiteral(&writer, ", public\r\n");
+      } else {
+        _HeaderWriterAppendLiteral(&writer, "Cache-Control: no-cache\r\n");
+      }
+    }
+    if (response.contentType && _IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_ContentType)) {
+      _HeaderWriterAppendLiteral(&writer, "Content-Type: ");
+      const char* contentType = response.contentType.UTF8String;
+      size_t length = strlen(contentType);
+      char* bytes = _HeaderWriterReserve(&writer, length);
+      BOOL lowercase = YES;  // Same as GCDWebServerNormalizeHeaderValue() i.e. assume part before ";" separator is case-insensitive
+      for (size_t i = 0; i < length; ++i) {
+        char c = contentType[i];
+        if (c == ';') {
+          lowercase = NO;
+        }
+        bytes[i] = (lowercase && (c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+      }
+      _HeaderWriterAppendLiteral(&writer, "\r\n");
+    }
+    if ((response.contentLength != NSUIntegerMax) && _IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_ContentLength)) {
+      _HeaderWriterAppendLiteral(&writer, "Content-Length: ");
+      _HeaderWriterAppendUnsigned(&writer, response.contentLength);
+      _HeaderWriterAppendLiteral(&writer, "\r\n");
+    }
+    if (response.usesChunkedTransferEncoding && _IS_BUILT_IN_HEADER_ENABLED(kGCDWebServerBuiltInHeader_TransferEncoding)) {
+      _HeaderWriterAppendLiteral(&writer, "Transfer-Encoding: chunked\r\n");
+    }
+  }
+#undef _IS_BUILT_IN_HEADER_ENABLED
+
+  for (NSString* key in additionalHeaders) {  // Not using a block as the writer points to its own inline buffer
+    const char* name = key.UTF8String;
+    const char* value = [additionalHeaders objectForKey:key].UTF8String;
+    if (strpbrk(name, "\r\n:") || strpbrk(value, "\r\n")) {
+      GWS_LOG_ERROR(@"Ignoring invalid additional header '%@' on socket %i", key, _socket);
+      GWS_DNOT_REACHED();
+      continue;
+    }
+    _HeaderWriterAppendCString(&writer, name);
+    _HeaderWriterAppendLiteral(&writer, ": ");
+    _HeaderWriterAppendCString(&writer, value);
+    _HeaderWriterAppendLiteral(&writer, "\r\n");
+  }
+  _HeaderWriterAppendLiteral(&writer, "\r\n");
+  _responseHeadersData = _HeaderWriterCopyData(&writer);
 }
 
 - (void)_startProcessingRequest {
-  GWS_DCHECK(_responseMessage == NULL);
+  GWS_DCHECK(_responseHeadersData == nil);
+  [self _setTimeout:0.0];
+  if (_metrics) {
+    [_metrics requestDidStart];
+    _requestInFlight = YES;
+  }
 
   GCDWebServerResponse* preflightResponse = [self preflightRequest:_request];
+  GCDWebServerResponseCache* responseCache = _server.responseCache;
+  BOOL needsRevalidation = NO;
+  GCDWebServerResponse* cachedResponse = !preflightResponse && responseCache ? [responseCache cachedResponseForRequest:_request needsRevalidation:&needsRevalidation] : nil;
   if (preflightResponse) {
     [self _finishProcessingRequest:preflightResponse];
+  } else if (cachedResponse) {
+    if (needsRevalidation) {
+      [self _revalidateCachedResponseForRequest:_request inCache:responseCache];
+    }
+    [self _finishProcessingRequest:cachedResponse];
   } else {
-    [self processRequest:_request
+    GCDWebServerRequestCoalescer* coalescer = _server.requestCoalescer;
+    if (coalescer && [coalescer addWaiterForRequest:_request
+                                            handler:_handler
+                                              block:^(GCDWebServerResponse* sharedResponse) {
+                                                if (sharedResponse) {
+                                                  dispatch_async(self->_ioQueue, ^{
+                                                    [self _finishProcessingRequest:sharedResponse];
+                                                  });
+                                                } else {
+                                                  [self _admitRequestWithResponseCache:responseCache coalescer:nil];
+                                                }
+                                              }]) {
+      GWS_LOG_DEBUG(@"Connection on socket %i waiting for identical request in flight", _socket);
+      return;
+    }
+    [self _admitRequestWithResponseCache:responseCache coalescer:coalescer];
+  }
+}
+
+// The coalescer must always be notified when the request completes or is rejected so waiting requests are not stranded
+- (void)_admitRequestWithResponseCache:(GCDWebServerResponseCache*)responseCache coalescer:(GCDWebServerRequestCoalescer*)coalescer {
+  [_server admitRequestWithBlock:^{
+    self->_holdsRequestSlot = (self->_server.maxInFlightRequests > 0);
+    [self processRequest:self->_request
               completion:^(GCDWebServerResponse* processResponse) {
-                [self _finishProcessingRequest:processResponse];
+                self->_handlerEndTime = GCDWebServerGetMonotonicTime();
+                if (responseCache && processResponse) {
+                  [responseCache storeResponse:processResponse forRequest:self->_request];  // Before the response gets modified by -overrideResponse:forRequest:
+                }
+                [coalescer finishRequest:self->_request handler:self->_handler withResponse:processResponse];
+                dispatch_async(self->_ioQueue, ^{  // Handlers may complete on any queue
+                  [self _finishProcessingRequest:processResponse];
+                });
               }];
   }
+      rejectBlock:^{
+        GWS_LOG_VERBOSE(@"Rejecting request on socket %i as the server is overloaded", self->_socket);
+        [coalescer finishRequest:self->_request handler:self->_handler withResponse:nil];
+        GCDWebServerResponse* overloadResponse = [GCDWebServerResponse responseWithStatusCode:kGCDWebServerHTTPStatusCode_ServiceUnavailable];
+        [overloadResponse setValue:[NSString stringWithFormat:@"%lu", (unsigned long)self->_server.overloadRetryAfter] forAdditionalHeader:@"Retry-After"];
+        dispatch_async(self->_ioQueue, ^{
+          [self _finishProcessingRequest:overloadResponse];
+        });
+      }];
+}
+
+// The stale response is sent right away while the handler refreshes the cache in the background - the refresh
+// goes through admission control and the worker pool like any other request and is simply dropped under load
+- (void)_revalidateCachedResponseForRequest:(GCDWebServerRequest*)request inCache:(GCDWebServerResponseCache*)responseCache {
+  GCDWebServer* server = _server;
+  GCDWebServerHandler* handler = _handler;
+  GCDWebServerWorkerPool* workerPool = _workerPool;
+  [server admitRequestWithBlock:^{
+    BOOL holdsRequestSlot = (server.maxInFlightRequests > 0);
+    GCDWebServerCompletionBlock completionBlock = ^(GCDWebServerResponse* response) {
+      if (response) {
+        [responseCache storeResponse:response forRequest:request];
+      } else {
+        [responseCache removeResponseForRequest:request];  // Clears the entry being revalidated but not the other variants of the path
+      }
+      if (holdsRequestSlot) {
+        [server didFinishRequest];
+      }
+    };
+    if (handler.processBlock && !handler.queue && workerPool) {
+      if (![workerPool submitBlock:^{
+            completionBlock(handler.processBlock(request));
+          }]) {
+        GWS_LOG_VERBOSE(@"Worker pool is full, skipping revalidation of \"%@\"", request.path);
+        [responseCache cancelRevalidationForRequest:request];
+        if (holdsRequestSlot) {
+          [server didFinishRequest];
+        }
+      }
+      return;
+    }
+    dispatch_async(handler.queue ? handler.queue : self->_handlerQueue, ^{  // The connection retains the handler queue
+      @autoreleasepool {
+        handler.asyncProcessBlock(request, completionBlock);
+      }
+    });
+  }
+      rejectBlock:^{
+        GWS_LOG_VERBOSE(@"Server is overloaded, skipping revalidation of \"%@\"", request.path);
+        [responseCache cancelRevalidationForRequest:request];
+      }];
 }
 
 // http://www.w3.org/Protocols/rfc2616/rfc2616-sec10.html
 - (void)_finishProcessingRequest:(GCDWebServerResponse*)response {
-  GWS_DCHECK(_responseMessage == NULL);
+  GWS_DCHECK(_responseHeadersData == nil);
   BOOL hasBody = NO;
 
   if (response) {
@@ -169,36 +579,19 @@ NS_ASSUME_NONNULL_END
   }
 
   if (_response) {
-    [self _initializeResponseHeadersWithStatusCode:_response.statusCode];
-    if (_response.lastModifiedDate) {
-      CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Last-Modified"), (__bridge CFStringRef)GCDWebServerFormatRFC822((NSDate*)_response.lastModifiedDate));
-    }
-    if (_response.eTag) {
-      CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("ETag"), (__bridge CFStringRef)_response.eTag);
-    }
-    if ((_response.statusCode >= 200) && (_response.statusCode < 300)) {
-      if (_response.cacheControlMaxAge > 0) {
-        CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Cache-Control"), (__bridge CFStringRef)[NSString stringWithFormat:@"max-age=%i, public", (int)_response.cacheControlMaxAge]);
-      } else {
-        CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Cache-Control"), CFSTR("no-cache"));
-      }
-    }
-    if (_response.contentType != nil) {
-      CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Content-Type"), (__bridge CFStringRef)GCDWebServerNormalizeHeaderValue(_response.contentType));
-    }
-    if (_response.contentLength != NSUIntegerMax) {
-      CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Content-Length"), (__bridge CFStringRef)[NSString stringWithFormat:@"%lu", (unsigned long)_response.contentLength]);
-    }
-    if (_response.usesChunkedTransferEncoding) {
-      CFHTTPMessageSetHeaderFieldValue(_responseMessage, CFSTR("Transfer-Encoding"), CFSTR("chunked"));
-    }
-    [_response.additionalHeaders enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL* stop) {
-      CFHTTPMessageSetHeaderFieldValue(self->_responseMessage, (__bridge CFStringRef)key, (__bridge CFStringRef)obj);
-    }];
+    [self _initializeResponseHeadersWithStatusCode:_response.statusCode response:_response];
     [self writeHeadersWithCompletionBlock:^(BOOL success) {
       if (success) {
-        if (hasBody) {
+        if ([self->_response isKindOfClass:[GCDWebServerWebSocketResponse class]] && !self->_virtualHEAD) {
+          [self _upgradeToWebSocketWithResponse:(GCDWebServerWebSocketResponse*)self->_response];
+        } else if (hasBody) {
+          if ([self->_response isKindOfClass:[GCDWebServerEventStreamResponse class]]) {  // Event streams stay open until the client goes away
+            [self _releaseRequestSlot];
+          }
           [self writeBodyWithCompletionBlock:^(BOOL successInner) {
+            if (successInner) {
+              self->_lastByteWrittenTime = GCDWebServerGetMonotonicTime();
+            }
             [self->_response performClose];  // TODO: There's nothing we can do on failure as headers have already been sent
           }];
         }
@@ -211,6 +604,38 @@ NS_ASSUME_NONNULL_END
   }
 }
 
+// Long-lived responses must not count against the in-flight requests limit nor as in-flight requests in the metrics
+- (void)_releaseRequestSlot {
+  if (_holdsRequestSlot) {
+    _holdsRequestSlot = NO;
+    [_server didFinishRequest];
+  }
+  if (_requestInFlight) {
+    [_metrics requestDidEnd];
+    _requestInFlight = NO;
+  }
+}
+
+// The WebSocket keeps the connection alive from now on and the socket is closed once both are released
+- (void)_upgradeToWebSocketWithResponse:(GCDWebServerWebSocketResponse*)response {
+  [self _releaseRequestSlot];
+  GWS_LOG_DEBUG(@"Connection on socket %i upgraded to WebSocket", _socket);
+  GCDWebServerWebSocket* webSocket = [[GCDWebServerWebSocket alloc] initWithConnection:self request:_request response:response];
+  [webSocket start];
+}
+
+- (void)readUpgradedData:(NSMutableData*)data completionBlock:(ReadDataCompletionBlock)block {
+  [self readData:data withLength:NSUIntegerMax completionBlock:block];
+}
+
+- (void)writeUpgradedData:(NSData*)data completionBlock:(WriteDataCompletionBlock)block {
+  [self writeData:data withCompletionBlock:block];
+}
+
+- (void)shutdownUpgradedConnection {
+  shutdown(_socket, SHUT_RDWR);
+}
+
 - (void)_readBodyWithLength:(NSUInteger)length initialData:(NSData*)initialData {
   NSError* error = nil;
   if (![_request performOpen:&error]) {
@@ -235,7 +660,10 @@ NS_ASSUME_NONNULL_END
     [self readBodyWithRemainingLength:length
                       completionBlock:^(BOOL success) {
                         NSError* localError = nil;
-                        if ([self->_request performClose:&localError]) {
+                        if (!success && atomic_load(&self->_timedOut)) {
+                          [self->_request performClose:NULL];
+                          [self abortRequest:self->_request withStatusCode:kGCDWebServerHTTPStatusCode_RequestTimeout];
+                        } else if ([self->_request performClose:&localError]) {
                           [self _startProcessingRequest];
                         } else {
                           GWS_LOG_ERROR(@"Failed closing request body for socket %i: %@", self->_socket, error);
@@ -264,7 +692,10 @@ NS_ASSUME_NONNULL_END
   [self readNextBodyChunk:chunkData
           completionBlock:^(BOOL success) {
             NSError* localError = nil;
-            if ([self->_request performClose:&localError]) {
+            if (!success && atomic_load(&self->_timedOut)) {
+              [self->_request performClose:NULL];
+              [self abortRequest:self->_request withStatusCode:kGCDWebServerHTTPStatusCode_RequestTimeout];
+            } else if ([self->_request performClose:&localError]) {
               [self _startProcessingRequest];
             } else {
               GWS_LOG_ERROR(@"Failed closing request body for socket %i: %@", self->_socket, error);
@@ -279,14 +710,15 @@ NS_ASSUME_NONNULL_END
   [self readHeaders:headersData
       withCompletionBlock:^(NSData* extraData) {
         if (extraData) {
+          self->_headersParsedTime = GCDWebServerGetMonotonicTime();
           NSString* requestMethod = CFBridgingRelease(CFHTTPMessageCopyRequestMethod(self->_requestMessage));  // Method verbs are case-sensitive and uppercase
           if (self->_server.shouldAutomaticallyMapHEADToGET && [requestMethod isEqualToString:@"HEAD"]) {
             requestMethod = @"GET";
             self->_virtualHEAD = YES;
           }
-          NSDictionary* requestHeaders = CFBridgingRelease(CFHTTPMessageCopyAllHeaderFields(self->_requestMessage));  // Header names are case-insensitive but CFHTTPMessageCopyAllHeaderFields() will standardize the common ones
+          GCDWebServerHeaderMap* requestHeaders = [[GCDWebServerHeaderMap alloc] initWithData:headersData length:(headersData.length - extraData.length)];  // Header names are case-insensitive and values are only decoded on access
           NSURL* requestURL = CFBridgingRelease(CFHTTPMessageCopyRequestURL(self->_requestMessage));
-          if (requestURL) {
+          if (requestURL && requestHeaders) {
             requestURL = [self rewriteRequestURL:requestURL withMethod:requestMethod headers:requestHeaders];
             GWS_DCHECK(requestURL);
           }
@@ -294,10 +726,16 @@ NS_ASSUME_NONNULL_END
           if (urlPath == nil) {
             urlPath = @"/";  // CFURLCopyPath() returns NULL for a relative URL with path "//" contrary to -[NSURL path] which returns "/"
           }
-          NSString* requestPath = urlPath ? GCDWebServerUnescapeURLString(urlPath) : nil;
+          NSString* requestPath = GCDWebServerCanonicalizeRequestPath(urlPath);  // Unescapes and resolves dot segments in a single pass
           NSString* queryString = requestURL ? CFBridgingRelease(CFURLCopyQueryString((CFURLRef)requestURL, NULL)) : nil;  // Don't use -[NSURL query] to make sure query is not unescaped;
-          NSDictionary* requestQuery = queryString ? GCDWebServerParseURLEncodedForm(queryString) : @{};
-          if (requestMethod && requestURL && requestHeaders && requestPath && requestQuery) {
+          NSDictionary* requestQuery = queryString ? [[GCDWebServerLazyURLEncodedForm alloc] initWithString:queryString] : @{};  // Only parsed if a match block or handler reads it
+          if (requestURL && (requestHeaders == nil)) {
+            GWS_LOG_WARNING(@"Rejecting request with malformed headers on socket %i", self->_socket);
+            [self abortRequest:nil withStatusCode:kGCDWebServerHTTPStatusCode_BadRequest];
+          } else if (requestURL && (requestPath == nil)) {
+            GWS_LOG_WARNING(@"Rejecting request with invalid path \"%@\" on socket %i", urlPath, self->_socket);
+            [self abortRequest:nil withStatusCode:kGCDWebServerHTTPStatusCode_BadRequest];
+          } else if (requestMethod && requestURL && requestHeaders && requestPath && requestQuery) {
             for (self->_handler in self->_server.handlers) {
               self->_request = self->_handler.matchBlock(requestMethod, requestURL, requestHeaders, requestPath, requestQuery);
               if (self->_request) {
@@ -310,7 +748,7 @@ NS_ASSUME_NONNULL_END
               if ([self->_request hasBody]) {
                 [self->_request prepareForWriting];
                 if (self->_request.usesChunkedTransferEncoding || (extraData.length <= self->_request.contentLength)) {
-                  NSString* expectHeader = [requestHeaders objectForKey:@"Expect"];
+                  NSString* expectHeader = [requestHeaders valueForHeader:kGCDWebServerHeader_Expect];
                   if (expectHeader) {
                     if ([expectHeader caseInsensitiveCompare:@"100-continue"] == NSOrderedSame) {  // TODO: Actually validate request before continuing
                       [self writeData:_continueData
@@ -350,18 +788,81 @@ NS_ASSUME_NONNULL_END
             [self abortRequest:nil withStatusCode:kGCDWebServerHTTPStatusCode_InternalServerError];
             GWS_DNOT_REACHED();
           }
+        } else if (atomic_load(&self->_timedOut)) {
+          if (self->_totalBytesRead > 0) {
+            [self abortRequest:nil withStatusCode:kGCDWebServerHTTPStatusCode_RequestTimeout];
+          }  // Otherwise the connection was idle and can simply be closed
         } else {
           [self abortRequest:nil withStatusCode:kGCDWebServerHTTPStatusCode_InternalServerError];
         }
       }];
 }
 
+- (void)_recordMetrics {
+  if (_statusCode && _firstByteReadTime) {
+    [_metrics recordResponseWithRouteMetrics:_handler.routeMetrics statusCode:_statusCode latency:(GCDWebServerGetMonotonicTime() - _firstByteReadTime)];
+  }
+  if (_response.compressedBodyLength) {
+    [_metrics recordCompressedBodyWithUncompressedLength:_response.uncompressedBodyLength compressedLength:_response.compressedBodyLength];
+  }
+  if (_requestInFlight) {
+    [_metrics requestDidEnd];
+  }
+  [_metrics connectionDidCloseWithBytesReceived:_totalBytesRead bytesSent:_totalBytesWritten];
+}
+
+// Only copies raw values into the record as formatting happens on the access log thread
+- (void)_appendAccessLogRecord {
+  GCDWebServerAccessLogRecord record;
+  record.time = CFAbsoluteTimeGetCurrent();
+  record.duration = _firstByteReadTime ? GCDWebServerGetMonotonicTime() - _firstByteReadTime : 0;
+  record.bytesReceived = _totalBytesRead;
+  record.bytesSent = _totalBytesWritten;
+  record.statusCode = (int)_statusCode;
+  record.remoteAddressLength = (socklen_t)MIN(_remoteAddressData.length, sizeof(record.remoteAddress));
+  memcpy(&record.remoteAddress, _remoteAddressData.bytes, record.remoteAddressLength);
+  if (_request) {
+    GCDWebServerAccessLogCopyString(_virtualHEAD ? @"HEAD" : _request.method, record.method, sizeof(record.method));
+    GCDWebServerAccessLogCopyString(_request.path, record.target, sizeof(record.target));
+    NSString* query = _request.URL.query;
+    size_t length = strlen(record.target);
+    if (query && (length + 2 < sizeof(record.target))) {
+      record.target[length] = '?';
+      GCDWebServerAccessLogCopyString(query, &record.target[length + 1], sizeof(record.target) - length - 1);
+    }
+    GCDWebServerAccessLogCopyString(GCDWebServerGetHeaderValue(_request.headers, kGCDWebServerHeader_Referer), record.referrer, sizeof(record.referrer));
+    GCDWebServerAccessLogCopyString(GCDWebServerGetHeaderValue(_request.headers, kGCDWebServerHeader_UserAgent), record.userAgent, sizeof(record.userAgent));
+    GCDWebServerAccessLogCopyString(_request.traceID, record.traceID, sizeof(record.traceID));
+  } else {
+    strlcpy(record.method, "-", sizeof(record.method));
+    strlcpy(record.target, "-", sizeof(record.target));
+    record.referrer[0] = 0;
+    record.userAgent[0] = 0;
+    record.traceID[0] = 0;
+  }
+  [_accessLog appendRecord:&record];
+}
+
 - (instancetype)initWithServer:(GCDWebServer*)server localAddress:(NSData*)localAddress remoteAddress:(NSData*)remoteAddress socket:(CFSocketNativeHandle)socket {
   if ((self = [super init])) {
     _server = server;
     _localAddressData = localAddress;
     _remoteAddressData = remoteAddress;
     _socket = socket;
+    _ioQueue = [server nextIOQueue];
+    _handlerQueue = server.handlerQueue;  // Retained as the server may be stopped while the request is in flight
+    _workerPool = server.workerPool;
+    _metrics = server.activeMetrics;
+    _timingsObserver = server.requestTimingsObserver;
+    _accessLog = server.accessLog;
+    _acceptAbsoluteTime = CFAbsoluteTimeGetCurrent();
+    _acceptTime = GCDWebServerGetMonotonicTime();
+    [_metrics connectionDidOpen];
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_retain(_ioQueue);
+    dispatch_retain(_handlerQueue);
+#endif
+    _timerEntry = [[GCDWebServerTimerWheelEntry alloc] initWithConnection:self];
     GWS_LOG_DEBUG(@"Did open connection on socket %i", _socket);
 
     [_server willStartConnection:self];
@@ -372,6 +873,7 @@ NS_ASSUME_NONNULL_END
     }
     _opened = YES;
 
+    [self _setTimeout:_server.idleTimeout];
     [self _readRequestHeaders];
   }
   return self;
@@ -397,15 +899,28 @@ NS_ASSUME_NONNULL_END
     [self close];
   }
 
+  if (_holdsRequestSlot) {
+    [_server didFinishRequest];
+  }
+  if (_metrics) {
+    [self _recordMetrics];
+  }
+  if (_timingsObserver) {
+    _timingsObserver(_request, _statusCode, self.timings);
+  }
+  if (_statusCode && [_accessLog shouldLogRequestWithStatusCode:_statusCode]) {
+    [self _appendAccessLogRecord];
+  }
   [_server didEndConnection:self];
 
   if (_requestMessage) {
     CFRelease(_requestMessage);
   }
 
-  if (_responseMessage) {
-    CFRelease(_responseMessage);
-  }
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_handlerQueue);
+  dispatch_release(_ioQueue);
+#endif
 }
 
 @end
@@ -413,11 +928,15 @@ NS_ASSUME_NONNULL_END
 @implementation GCDWebServerConnection (Read)
 
 - (void)readData:(NSMutableData*)data withLength:(NSUInteger)length completionBlock:(ReadDataCompletionBlock)block {
-  dispatch_read(_socket, length, dispatch_get_global_queue(_server.dispatchQueuePriority, 0), ^(dispatch_data_t buffer, int error) {
+  dispatch_read(_socket, length, _ioQueue, ^(dispatch_data_t buffer, int error) {
     @autoreleasepool {
       if (error == 0) {
         size_t size = dispatch_data_get_size(buffer);
         if (size > 0) {
+          if (self->_totalBytesRead == 0) {
+            self->_firstByteReadTime = GCDWebServerGetMonotonicTime();
+            [self _setTimeout:self->_server.headerReadTimeout];  // Headers must be received within a fixed delay after the first byte
+          }
           NSUInteger originalLength = data.length;
           dispatch_data_apply(buffer, ^bool(dispatch_data_t region, size_t chunkOffset, const void* chunkBytes, size_t chunkSize) {
             [data appendBytes:chunkBytes length:chunkSize];
@@ -472,6 +991,7 @@ NS_ASSUME_NONNULL_END
 
 - (void)readBodyWithRemainingLength:(NSUInteger)length completionBlock:(ReadBodyCompletionBlock)block {
   GWS_DCHECK([_request hasBody] && ![_request usesChunkedTransferEncoding]);
+  [self _setTimeout:_server.bodyReadTimeout];
   NSMutableData* bodyData = [[NSMutableData alloc] initWithCapacity:kBodyReadCapacity];
   [self readData:bodyData
            withLength:length
@@ -554,6 +1074,7 @@ static inline NSUInteger _ScanHexNumber(const void* bytes, NSUInteger size) {
     }
   }
 
+  [self _setTimeout:_server.bodyReadTimeout];
   [self readData:chunkData
            withLength:NSUIntegerMax
       completionBlock:^(BOOL success) {
@@ -569,15 +1090,13 @@ static inline NSUInteger _ScanHexNumber(const void* bytes, NSUInteger size) {
 
 @implementation GCDWebServerConnection (Write)
 
-- (void)writeData:(NSData*)data withCompletionBlock:(WriteDataCompletionBlock)block {
-  dispatch_data_t buffer = dispatch_data_create(data.bytes, data.length, dispatch_get_global_queue(_server.dispatchQueuePriority, 0), ^{
-    [data self];  // Keeps ARC from releasing data too early
-  });
-  dispatch_write(_socket, buffer, dispatch_get_global_queue(_server.dispatchQueuePriority, 0), ^(dispatch_data_t remainingData, int error) {
+- (void)_writeBuffer:(dispatch_data_t)buffer withCompletionBlock:(WriteDataCompletionBlock)block {
+  [self _setTimeout:_server.writeTimeout];
+  dispatch_write(_socket, buffer, _ioQueue, ^(dispatch_data_t remainingData, int error) {
     @autoreleasepool {
+      [self _setTimeout:0.0];
       if (error == 0) {
         GWS_DCHECK(remainingData == NULL);
-        [self didWriteBytes:data.bytes length:data.length];
         block(YES);
       } else {
         GWS_LOG_ERROR(@"Error while writing to socket %i: %s (%i)", self->_socket, strerror(error), error);
@@ -585,16 +1104,66 @@ static inline NSUInteger _ScanHexNumber(const void* bytes, NSUInteger size) {
       }
     }
   });
+}
+
+- (void)writeData:(NSData*)data withCompletionBlock:(WriteDataCompletionBlock)block {
+  dispatch_data_t buffer = dispatch_data_create(data.bytes, data.length, _ioQueue, ^{
+    [data self];  // Keeps ARC from releasing data too early
+  });
+  [self _writeBuffer:buffer
+      withCompletionBlock:^(BOOL success) {
+        if (success) {
+          [self didWriteBytes:data.bytes length:data.length];
+        }
+        block(success);
+      }];
 #if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
   dispatch_release(buffer);
 #endif
 }
 
+// Wraps the data in a chunk without copying it as the same data may be shared by many responses
+- (void)_writeChunkWithData:(NSData*)data completionBlock:(WriteDataCompletionBlock)block {
+  char header[sizeof(unsigned long) * 2 + 3];
+  int headerLength = snprintf(header, sizeof(header), "%lx\r\n", (unsigned long)data.length);
+  NSData* headerData = [[NSData alloc] initWithBytes:header length:(NSUInteger)headerLength];
+  dispatch_data_t headerBuffer = dispatch_data_create(headerData.bytes, headerData.length, _ioQueue, ^{
+    [headerData self];
+  });
+  dispatch_data_t dataBuffer = dispatch_data_create(data.bytes, data.length, _ioQueue, ^{
+    [data self];
+  });
+  dispatch_data_t trailerBuffer = dispatch_data_create(_CRLFData.bytes, _CRLFData.length, _ioQueue, DISPATCH_DATA_DESTRUCTOR_DEFAULT);
+  dispatch_data_t chunkHeadBuffer = dispatch_data_create_concat(headerBuffer, dataBuffer);
+  dispatch_data_t buffer = dispatch_data_create_concat(chunkHeadBuffer, trailerBuffer);
+  [self _writeBuffer:buffer
+      withCompletionBlock:^(BOOL success) {
+        if (success) {
+          [self didWriteBytes:headerData.bytes length:headerData.length];
+          [self didWriteBytes:data.bytes length:data.length];
+          [self didWriteBytes:_CRLFData.bytes length:_CRLFData.length];
+        }
+        block(success);
+      }];
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(buffer);
+  dispatch_release(chunkHeadBuffer);
+  dispatch_release(trailerBuffer);
+  dispatch_release(dataBuffer);
+  dispatch_release(headerBuffer);
+#endif
+}
+
 - (void)writeHeadersWithCompletionBlock:(WriteHeadersCompletionBlock)block {
-  GWS_DCHECK(_responseMessage);
-  CFDataRef data = CFHTTPMessageCopySerializedMessage(_responseMessage);
-  [self writeData:(__bridge NSData*)data withCompletionBlock:block];
-  CFRelease(data);
+  GWS_DCHECK(_responseHeadersData);
+  [self writeData:_responseHeadersData
+      withCompletionBlock:^(BOOL success) {
+        if (success) {
+          self->_firstByteWrittenTime = GCDWebServerGetMonotonicTime();
+          self->_lastByteWrittenTime = self->_firstByteWrittenTime;  // Updated again once the body has been sent if any
+        }
+        block(success);
+      }];
 }
 
 - (void)writeBodyWithCompletionBlock:(WriteBodyCompletionBlock)block {
@@ -602,34 +1171,18 @@ static inline NSUInteger _ScanHexNumber(const void* bytes, NSUInteger size) {
   [_response performReadDataWithCompletion:^(NSData* data, NSError* error) {
     if (data) {
       if (data.length) {
-        if (self->_response.usesChunkedTransferEncoding) {
-          const char* hexString = [[NSString stringWithFormat:@"%lx", (unsigned long)data.length] UTF8String];
-          size_t hexLength = strlen(hexString);
-          NSData* chunk = [NSMutableData dataWithLength:(hexLength + 2 + data.length + 2)];
-          if (chunk == nil) {
-            GWS_LOG_ERROR(@"Failed allocating memory for response body chunk for socket %i: %@", self->_socket, error);
+        WriteDataCompletionBlock writeBlock = ^(BOOL success) {
+          if (success) {
+            [self writeBodyWithCompletionBlock:block];
+          } else {
             block(NO);
-            return;
           }
-          char* ptr = (char*)[(NSMutableData*)chunk mutableBytes];
-          bcopy(hexString, ptr, hexLength);
-          ptr += hexLength;
-          *ptr++ = '\r';
-          *ptr++ = '\n';
-          bcopy(data.bytes, ptr, data.length);
-          ptr += data.length;
-          *ptr++ = '\r';
-          *ptr = '\n';
-          data = chunk;
+        };
+        if (self->_response.usesChunkedTransferEncoding) {
+          [self _writeChunkWithData:data completionBlock:writeBlock];
+        } else {
+          [self writeData:data withCompletionBlock:writeBlock];
         }
-        [self writeData:data
-            withCompletionBlock:^(BOOL success) {
-              if (success) {
-                [self writeBodyWithCompletionBlock:block];
-              } else {
-                block(NO);
-              }
-            }];
       } else {
         if (self->_response.usesChunkedTransferEncoding) {
           [self writeData:_lastChunkData
@@ -703,51 +1256,141 @@ static inline NSUInteger _ScanHexNumber(const void* bytes, NSUInteger size) {
 }
 
 // https://tools.ietf.org/html/rfc2617
+#define kVerifiedCredentialLifetime (60 * NSEC_PER_SEC)
+
+// Runs in a time that only depends on the length of the expected string
+static BOOL _IsEqualInConstantTime(const char* actual, const char* expected) {
+  size_t actualLength = strlen(actual);
+  size_t expectedLength = strlen(expected);
+  unsigned char difference = actualLength != expectedLength;
+  for (size_t i = 0; i < expectedLength; ++i) {
+    difference |= (unsigned char)(i < actualLength ? actual[i] : 0) ^ (unsigned char)expected[i];
+  }
+  return difference == 0;
+}
+
+// Hashes the parts joined with colons without formatting an intermediary string
+static void _ComputeMD5Digest(const char* const* parts, size_t count, char digest[2 * CC_MD5_DIGEST_LENGTH + 1]) {
+  unsigned char md5[CC_MD5_DIGEST_LENGTH];
+  CC_MD5_CTX context;
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+  CC_MD5_Init(&context);
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0) {
+      CC_MD5_Update(&context, ":", 1);
+    }
+    CC_MD5_Update(&context, parts[i], (CC_LONG)strlen(parts[i]));
+  }
+  CC_MD5_Final(md5, &context);
+#pragma clang diagnostic pop
+  static const char hexDigits[] = "0123456789abcdef";
+  for (int i = 0; i < CC_MD5_DIGEST_LENGTH; ++i) {
+    digest[2 * i + 0] = hexDigits[md5[i] >> 4];
+    digest[2 * i + 1] = hexDigits[md5[i] & 0x0F];
+  }
+  digest[2 * CC_MD5_DIGEST_LENGTH] = 0;
+}
+
+// https://tools.ietf.org/html/rfc7616#section-3.4 - Parameter names are case-insensitive and lowercased
+static NSDictionary<NSString*, NSString*>* _ParseAuthorizationParameters(NSString* string) {
+  NSMutableDictionary<NSString*, NSString*>* parameters = [[NSMutableDictionary alloc] init];
+  NSScanner* scanner = [[NSScanner alloc] initWithString:string];
+  scanner.charactersToBeSkipped = [NSCharacterSet whitespaceCharacterSet];
+  NSCharacterSet* nameDelimiters = [NSCharacterSet characterSetWithCharactersInString:@"=, "];
+  NSCharacterSet* valueDelimiters = [NSCharacterSet characterSetWithCharactersInString:@", "];
+  while (!scanner.atEnd) {
+    NSString* name = nil;
+    if (![scanner scanUpToCharactersFromSet:nameDelimiters intoString:&name] || ![scanner scanString:@"=" intoString:NULL]) {
+      break;
+    }
+    NSString* value = @"";
+    if ([scanner scanString:@"\"" intoString:NULL]) {
+      [scanner scanUpToString:@"\"" intoString:&value];
+      [scanner scanString:@"\"" intoString:NULL];
+    } else {
+      [scanner scanUpToCharactersFromSet:valueDelimiters intoString:&value];
+    }
+    [parameters setObject:value forKey:[name lowercaseString]];
+    [scanner scanString:@"," intoString:NULL];
+  }
+  return parameters;
+}
+
+- (BOOL)_isAuthorizedWithBasicAuthorization:(NSString*)authorizationHeader authenticationState:(GCDWebServerAuthenticationState*)authenticationState {
+  if ([authenticationState isVerifiedCredential:authorizationHeader]) {
+    return YES;
+  }
+  NSString* basicAccount = [authorizationHeader substringFromIndex:6];
+  NSData* credentials = [[NSData alloc] initWithBase64EncodedString:basicAccount options:0];
+  const char* separator = credentials ? memchr(credentials.bytes, ':', credentials.length) : NULL;
+  if (separator == NULL) {
+    return NO;
+  }
+  NSString* username = [[NSString alloc] initWithBytes:credentials.bytes length:(separator - (const char*)credentials.bytes) encoding:NSUTF8StringEncoding];
+  NSString* expectedAccount = username ? [_server.authenticationBasicAccounts objectForKey:username] : nil;
+  if (expectedAccount && _IsEqualInConstantTime(basicAccount.UTF8String, expectedAccount.UTF8String)) {
+    [authenticationState addVerifiedCredential:authorizationHeader expirationTime:(GCDWebServerGetMonotonicTime() + kVerifiedCredentialLifetime)];
+    return YES;
+  }
+  return NO;
+}
+
+- (BOOL)_isAuthorizedWithDigestAuthorization:(NSString*)authorizationHeader client:(NSString*)client authenticationState:(GCDWebServerAuthenticationState*)authenticationState isStaled:(BOOL*)isStaled {
+  NSDictionary<NSString*, NSString*>* parameters = _ParseAuthorizationParameters([authorizationHeader substringFromIndex:7]);
+  if (![_server.authenticationRealm isEqualToString:[parameters objectForKey:@"realm"]]) {
+    return NO;
+  }
+  NSString* nonce = [parameters objectForKey:@"nonce"];
+  uint64_t nonceExpirationTime = 0;
+  GCDWebServerNonceStatus status = nonce ? [authenticationState checkNonce:nonce client:client expirationTime:&nonceExpirationTime] : kGCDWebServerNonceStatus_Unknown;
+  if (status != kGCDWebServerNonceStatus_Valid) {
+    *isStaled = (status == kGCDWebServerNonceStatus_Expired);  // Lets clients retry transparently with the new nonce but not with unknown or forged ones
+    return NO;
+  }
+  NSString* ha1 = [_server.authenticationDigestAccounts objectForKey:[parameters objectForKey:@"username"]];
+  NSString* uri = [parameters objectForKey:@"uri"];  // We cannot use "request.path" as the query string is required
+  NSString* actualResponse = [parameters objectForKey:@"response"];
+  if (!ha1 || !uri || !actualResponse) {
+    return NO;
+  }
+  char ha2[2 * CC_MD5_DIGEST_LENGTH + 1];
+  const char* ha2Parts[] = {(_virtualHEAD ? "HEAD" : _request.method.UTF8String), uri.UTF8String};
+  _ComputeMD5Digest(ha2Parts, 2, ha2);
+  char expectedResponse[2 * CC_MD5_DIGEST_LENGTH + 1];
+  NSString* qop = [parameters objectForKey:@"qop"];
+  if (qop) {
+    NSString* nonceCount = [parameters objectForKey:@"nc"];
+    NSString* clientNonce = [parameters objectForKey:@"cnonce"];
+    if (![qop isEqualToString:@"auth"] || !nonceCount || !clientNonce) {
+      return NO;
+    }
+    const char* parts[] = {ha1.UTF8String, nonce.UTF8String, nonceCount.UTF8String, clientNonce.UTF8String, "auth", ha2};
+    _ComputeMD5Digest(parts, 6, expectedResponse);
+    return _IsEqualInConstantTime(actualResponse.UTF8String, expectedResponse) && [authenticationState acceptNonceCount:strtoull(nonceCount.UTF8String, NULL, 16) forNonce:nonce];  // Replayed requests reuse a nonce count
+  }
+  const char* parts[] = {ha1.UTF8String, nonce.UTF8String, ha2};  // RFC 2069 compatibility - never cached as there is no nonce count to protect against replays
+  _ComputeMD5Digest(parts, 3, expectedResponse);
+  return _IsEqualInConstantTime(actualResponse.UTF8String, expectedResponse);
+}
+
 - (GCDWebServerResponse*)preflightRequest:(GCDWebServerRequest*)request {
   GWS_LOG_DEBUG(@"Connection on socket %i preflighting request \"%@ %@\" with %lu bytes body", _socket, _virtualHEAD ? @"HEAD" : _request.method, _request.path, (unsigned long)_totalBytesRead);
   GCDWebServerResponse* response = nil;
+  GCDWebServerAuthenticationState* authenticationState = _server.authenticationState;
   if (_server.authenticationBasicAccounts) {
-    __block BOOL authenticated = NO;
-    NSString* authorizationHeader = [request.headers objectForKey:@"Authorization"];
-    if ([authorizationHeader hasPrefix:@"Basic "]) {
-      NSString* basicAccount = [authorizationHeader substringFromIndex:6];
-      [_server.authenticationBasicAccounts enumerateKeysAndObjectsUsingBlock:^(NSString* username, NSString* digest, BOOL* stop) {
-        if ([basicAccount isEqualToString:digest]) {
-          authenticated = YES;
-          *stop = YES;
-        }
-      }];
-    }
-    if (!authenticated) {
+    NSString* authorizationHeader = GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Authorization);
+    if (![authorizationHeader hasPrefix:@"Basic "] || ![self _isAuthorizedWithBasicAuthorization:authorizationHeader authenticationState:authenticationState]) {
       response = [GCDWebServerResponse responseWithStatusCode:kGCDWebServerHTTPStatusCode_Unauthorized];
       [response setValue:[NSString stringWithFormat:@"Basic realm=\"%@\"", _server.authenticationRealm] forAdditionalHeader:@"WWW-Authenticate"];
     }
   } else if (_server.authenticationDigestAccounts) {
-    BOOL authenticated = NO;
     BOOL isStaled = NO;
-    NSString* authorizationHeader = [request.headers objectForKey:@"Authorization"];
-    if ([authorizationHeader hasPrefix:@"Digest "]) {
-      NSString* realm = GCDWebServerExtractHeaderValueParameter(authorizationHeader, @"realm");
-      if (realm && [_server.authenticationRealm isEqualToString:realm]) {
-        NSString* nonce = GCDWebServerExtractHeaderValueParameter(authorizationHeader, @"nonce");
-        if ([nonce isEqualToString:_digestAuthenticationNonce]) {
-          NSString* username = GCDWebServerExtractHeaderValueParameter(authorizationHeader, @"username");
-          NSString* uri = GCDWebServerExtractHeaderValueParameter(authorizationHeader, @"uri");
-          NSString* actualResponse = GCDWebServerExtractHeaderValueParameter(authorizationHeader, @"response");
-          NSString* ha1 = [_server.authenticationDigestAccounts objectForKey:username];
-          NSString* ha2 = GCDWebServerComputeMD5Digest(@"%@:%@", request.method, uri);  // We cannot use "request.path" as the query string is required
-          NSString* expectedResponse = GCDWebServerComputeMD5Digest(@"%@:%@:%@", ha1, _digestAuthenticationNonce, ha2);
-          if ([actualResponse isEqualToString:expectedResponse]) {
-            authenticated = YES;
-          }
-        } else if (nonce.length) {
-          isStaled = YES;
-        }
-      }
-    }
-    if (!authenticated) {
+    NSString* client = GCDWebServerStringFromSockAddr(_remoteAddressData.bytes, NO);
+    NSString* authorizationHeader = GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_Authorization);
+    if (![authorizationHeader hasPrefix:@"Digest "] || ![self _isAuthorizedWithDigestAuthorization:authorizationHeader client:client authenticationState:authenticationState isStaled:&isStaled]) {
       response = [GCDWebServerResponse responseWithStatusCode:kGCDWebServerHTTPStatusCode_Unauthorized];
-      [response setValue:[NSString stringWithFormat:@"Digest realm=\"%@\", nonce=\"%@\"%@", _server.authenticationRealm, _digestAuthenticationNonce, isStaled ? @", stale=TRUE" : @""] forAdditionalHeader:@"WWW-Authenticate"];  // TODO: Support Quality of Protection ("qop")
+      [response setValue:[NSString stringWithFormat:@"Digest realm=\"%@\", qop=\"auth\", nonce=\"%@\"%@", _server.authenticationRealm, [authenticationState issueNonceForClient:client], isStaled ? @", stale=TRUE" : @""] forAdditionalHeader:@"WWW-Authenticate"];
     }
   }
   return response;
@@ -755,31 +1398,59 @@ static inline NSUInteger _ScanHexNumber(const void* bytes, NSUInteger size) {
 
 - (void)processRequest:(GCDWebServerRequest*)request completion:(GCDWebServerCompletionBlock)completion {
   GWS_LOG_DEBUG(@"Connection on socket %i processing request \"%@ %@\" with %lu bytes body", _socket, _virtualHEAD ? @"HEAD" : _request.method, _request.path, (unsigned long)_totalBytesRead);
-  _handler.asyncProcessBlock(request, [completion copy]);
-}
-
-// http://www.w3.org/Protocols/rfc2616/rfc2616-sec14.html#sec14.25
-// http://www.w3.org/Protocols/rfc2616/rfc2616-sec14.html#sec14.26
-static inline BOOL _CompareResources(NSString* responseETag, NSString* requestETag, NSDate* responseLastModified, NSDate* requestLastModified) {
-  if (requestLastModified && responseLastModified) {
-    if ([responseLastModified compare:requestLastModified] != NSOrderedDescending) {
-      return YES;
+  GCDWebServerHandler* handler = _handler;
+  GCDWebServerCompletionBlock completionBlock = [completion copy];
+  if (handler.processBlock && !handler.queue && _workerPool) {
+    BOOL submitted = [_workerPool submitBlock:^{
+      self->_handlerStartTime = GCDWebServerGetMonotonicTime();
+      completionBlock(handler.processBlock(request));
+    }];
+    if (!submitted) {
+      GWS_LOG_WARNING(@"Worker pool is full, rejecting request on socket %i", _socket);
+      GCDWebServerResponse* overloadResponse = [GCDWebServerResponse responseWithStatusCode:kGCDWebServerHTTPStatusCode_ServiceUnavailable];
+      [overloadResponse setValue:[NSString stringWithFormat:@"%lu", (unsigned long)_server.overloadRetryAfter] forAdditionalHeader:@"Retry-After"];
+      completionBlock(overloadResponse);
     }
+    return;
   }
-  if (requestETag && responseETag) {  // Per the specs "If-None-Match" must be checked after "If-Modified-Since"
-    if ([requestETag isEqualToString:@"*"]) {
-      return YES;
-    }
-    if ([responseETag isEqualToString:requestETag]) {
-      return YES;
+  dispatch_async(handler.queue ? handler.queue : _handlerQueue, ^{
+    @autoreleasepool {
+      self->_handlerStartTime = GCDWebServerGetMonotonicTime();
+      handler.asyncProcessBlock(request, completionBlock);
     }
+  });
+}
+
+// https://tools.ietf.org/html/rfc7233#section-3.1
+static GCDWebServerResponse* _ApplyByteRange(GCDWebServerResponse* response, GCDWebServerRequest* request) {
+  if ((response.statusCode != kGCDWebServerHTTPStatusCode_OK) || ![response hasBody] || (response.contentLength == NSUIntegerMax) || response.gzipContentEncodingEnabled) {
+    return response;  // The range would apply to the gzip encoded body whose length isn't known ahead of time
   }
-  return NO;
+  if ([response isKindOfClass:[GCDWebServerFileResponse class]] || [response.additionalHeaders objectForKey:@"Content-Range"]) {
+    return response;  // Byte ranges have already been handled or were deliberately not requested
+  }
+  NSString* ifRange = GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_IfRange);
+  if (ifRange && !GCDWebServerIsIfRangeMatching(ifRange, response.eTag, response.lastModifiedDate)) {
+    return response;
+  }
+  NSRange range = request.byteRange;
+  if (!GCDWebServerResolveByteRange(&range, response.contentLength)) {  // https://tools.ietf.org/html/rfc7233#section-4.4
+    GCDWebServerResponse* newResponse = [GCDWebServerResponse responseWithStatusCode:kGCDWebServerHTTPStatusCode_RequestedRangeNotSatisfiable];
+    [newResponse setValue:[NSString stringWithFormat:@"bytes */%lu", (unsigned long)response.contentLength] forAdditionalHeader:@"Content-Range"];
+    return newResponse;
+  }
+  [response restrictToByteRange:range];
+  [response setValue:@"bytes" forAdditionalHeader:@"Accept-Ranges"];
+  return response;
 }
 
 - (GCDWebServerResponse*)overrideResponse:(GCDWebServerResponse*)response forRequest:(GCDWebServerRequest*)request {
-  if ((response.statusCode >= 200) && (response.statusCode < 300) && _CompareResources(response.eTag, request.ifNoneMatch, response.lastModifiedDate, request.ifModifiedSince)) {
-    NSInteger code = [request.method isEqualToString:@"HEAD"] || [request.method isEqualToString:@"GET"] ? kGCDWebServerHTTPStatusCode_NotModified : kGCDWebServerHTTPStatusCode_PreconditionFailed;
+  NSInteger code = 0;
+  BOOL isSafeMethod = [request.method isEqualToString:@"GET"] || [request.method isEqualToString:@"HEAD"];  // Other methods have already modified the resource at this point
+  if (isSafeMethod && (response.statusCode >= 200) && (response.statusCode < 300) && !request.hasEvaluatedPreconditions) {
+    code = [request statusCodeForPreconditionsWithETag:response.eTag lastModifiedDate:response.lastModifiedDate resourceExists:YES];
+  }
+  if (code) {
     GCDWebServerResponse* newResponse = [GCDWebServerResponse responseWithStatusCode:code];
     newResponse.cacheControlMaxAge = response.cacheControlMaxAge;
     newResponse.lastModifiedDate = response.lastModifiedDate;
@@ -787,13 +1458,16 @@ static inline BOOL _CompareResources(NSString* responseETag, NSString* requestET
     GWS_DCHECK(newResponse);
     return newResponse;
   }
+  if ([request hasByteRange] && [request.method isEqualToString:@"GET"]) {
+    return _ApplyByteRange(response, request);
+  }
   return response;
 }
 
 - (void)abortRequest:(GCDWebServerRequest*)request withStatusCode:(NSInteger)statusCode {
-  GWS_DCHECK(_responseMessage == NULL);
+  GWS_DCHECK(_responseHeadersData == nil);
   GWS_DCHECK((statusCode >= 400) && (statusCode < 600));
-  [self _initializeResponseHeadersWithStatusCode:statusCode];
+  [self _initializeResponseHeadersWithStatusCode:statusCode response:nil];
   [self writeHeadersWithCompletionBlock:^(BOOL success){
       // Nothing more to do
   }];
@@ -834,7 +1508,11 @@ static inline BOOL _CompareResources(NSString* responseETag, NSString* requestET
 #endif
 
   if (_request) {
-    GWS_LOG_VERBOSE(@"[%@] %@ %i \"%@ %@\" (%lu | %lu)", self.localAddressString, self.remoteAddressString, (int)_statusCode, _virtualHEAD ? @"HEAD" : _request.method, _request.path, (unsigned long)_totalBytesRead, (unsigned long)_totalBytesWritten);
+    GCDWebServerRequestTimings timings = self.timings;
+    GWS_LOG_VERBOSE(@"[%@] %@ %i \"%@ %@\" (%lu | %lu) [headers %.3fms | handler %.3fms | send %.3fms | total %.3fms]%@", self.localAddressString, self.remoteAddressString, (int)_statusCode, _virtualHEAD ? @"HEAD" : _request.method, _request.path, (unsigned long)_totalBytesRead, (unsigned long)_totalBytesWritten,
+                    timings.headersParsed * 1000.0, (timings.handlerFinished > timings.handlerStarted ? timings.handlerFinished - timings.handlerStarted : 0.0) * 1000.0,
+                    (timings.lastByteWritten > timings.firstByteWritten ? timings.lastByteWritten - timings.firstByteWritten : 0.0) * 1000.0, timings.lastByteWritten * 1000.0,
+                    _request.traceID ? [NSString stringWithFormat:@" trace=%@", _request.traceID] : @"");
   } else {
     GWS_LOG_VERBOSE(@"[%@] %@ %i \"(invalid request)\" (%lu | %lu)", self.localAddressString, self.remoteAddressString, (int)_statusCode, (unsigned long)_totalBytesRead, (unsigned long)_totalBytesWritten);
   }
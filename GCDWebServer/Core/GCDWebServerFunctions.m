@@ -40,6 +40,7 @@
 #import <ifaddrs.h>
 #import <net/if.h>
 #import <netdb.h>
+#import <pthread.h>
 
 #import "GCDWebServerPrivate.h"
 
@@ -119,6 +120,132 @@ NSStringEncoding GCDWebServerStringEncodingFromCharset(NSString* charset) {
   return (encoding != kCFStringEncodingInvalidId ? encoding : NSUTF8StringEncoding);
 }
 
+BOOL GCDWebServerResolveByteRange(NSRange* range, NSUInteger length) {
+  if (range->location != NSUIntegerMax) {
+    if (range->location >= length) {
+      return NO;
+    }
+    range->length = MIN(range->length, length - range->location);
+  } else {
+    if ((range->length == 0) || (length == 0)) {
+      return NO;
+    }
+    range->length = MIN(range->length, length);
+    range->location = length - range->length;
+  }
+  return YES;
+}
+
+// Entity tags set by the application are usually unquoted but quoted ones are accepted too
+static const char* _GetOpaqueTag(const char* string, size_t* length, BOOL* isWeak) {
+  *isWeak = !strncmp(string, "W/", 2);
+  if (*isWeak) {
+    string += 2;
+  }
+  size_t size = strlen(string);
+  if ((size >= 2) && (string[0] == '"') && (string[size - 1] == '"')) {
+    string += 1;
+    size -= 2;
+  }
+  *length = size;
+  return string;
+}
+
+// https://tools.ietf.org/html/rfc7232#section-2.3.2
+BOOL GCDWebServerIsETagListMatching(NSString* list, NSString* eTag, BOOL weakComparison) {
+  const char* tagString = eTag.UTF8String;
+  if (tagString == NULL) {
+    return NO;
+  }
+  size_t tagLength;
+  BOOL tagIsWeak;
+  const char* tag = _GetOpaqueTag(tagString, &tagLength, &tagIsWeak);
+  if (tagIsWeak && !weakComparison) {
+    return NO;
+  }
+  const char* p = list.UTF8String;
+  while (p) {
+    while ((*p == ' ') || (*p == '\t') || (*p == ',')) {
+      ++p;
+    }
+    if (*p == 0) {
+      break;
+    }
+    BOOL entryIsWeak = !strncmp(p, "W/", 2);
+    if (entryIsWeak) {
+      p += 2;
+    }
+    const char* entry;
+    size_t entryLength;
+    if (*p == '"') {
+      entry = p + 1;
+      const char* end = strchr(entry, '"');
+      if (end == NULL) {
+        return NO;
+      }
+      entryLength = end - entry;
+      p = end + 1;
+    } else {  // Tolerate unquoted entity tags as echoed back by clients of GCDWebServer
+      entry = p;
+      while (*p && (*p != ',') && (*p != ' ') && (*p != '\t')) {
+        ++p;
+      }
+      entryLength = p - entry;
+    }
+    if ((entryLength == tagLength) && !memcmp(entry, tag, tagLength) && (weakComparison || !entryIsWeak)) {
+      return YES;
+    }
+  }
+  return NO;
+}
+
+// https://tools.ietf.org/html/rfc7233#section-3.2
+BOOL GCDWebServerIsIfRangeMatching(NSString* ifRange, NSString* eTag, NSDate* lastModifiedDate) {
+  ifRange = [ifRange stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+  if ([ifRange hasPrefix:@"W/"]) {  // Weak entity tags never match
+    return NO;
+  }
+  if ([ifRange hasPrefix:@"\""]) {
+    return eTag && (ifRange.length >= 2) && [ifRange hasSuffix:@"\""] && [[ifRange substringWithRange:NSMakeRange(1, ifRange.length - 2)] isEqualToString:eTag];
+  }
+  if (eTag && [ifRange isEqualToString:eTag]) {  // Entity tags are sent unquoted by GCDWebServer
+    return YES;
+  }
+  NSDate* date = lastModifiedDate ? GCDWebServerParseRFC822(ifRange) : nil;
+  return date && (floor(date.timeIntervalSince1970) == floor(lastModifiedDate.timeIntervalSince1970));  // HTTP dates have a 1 second resolution
+}
+
+// Formats without going through NSDateFormatter as this is called for every response
+void GCDWebServerFormatHTTPDate(time_t time, char buffer[kGCDWebServerHTTPDateLength]) {
+  static const char* const days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  static const char* const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  struct tm tm;
+  gmtime_r(&time, &tm);
+  int year = tm.tm_year + 1900;
+  memcpy(&buffer[0], days[tm.tm_wday], 3);
+  buffer[3] = ',';
+  buffer[4] = ' ';
+  buffer[5] = '0' + tm.tm_mday / 10;
+  buffer[6] = '0' + tm.tm_mday % 10;
+  buffer[7] = ' ';
+  memcpy(&buffer[8], months[tm.tm_mon], 3);
+  buffer[11] = ' ';
+  buffer[12] = '0' + (year / 1000) % 10;
+  buffer[13] = '0' + (year / 100) % 10;
+  buffer[14] = '0' + (year / 10) % 10;
+  buffer[15] = '0' + year % 10;
+  buffer[16] = ' ';
+  buffer[17] = '0' + tm.tm_hour / 10;
+  buffer[18] = '0' + tm.tm_hour % 10;
+  buffer[19] = ':';
+  buffer[20] = '0' + tm.tm_min / 10;
+  buffer[21] = '0' + tm.tm_min % 10;
+  buffer[22] = ':';
+  buffer[23] = '0' + tm.tm_sec / 10;
+  buffer[24] = '0' + tm.tm_sec % 10;
+  memcpy(&buffer[25], " GMT", 4);
+}
+
 NSString* GCDWebServerFormatRFC822(NSDate* date) {
   __block NSString* string;
   dispatch_sync(_dateFormatterQueue, ^{
@@ -166,24 +293,190 @@ NSString* GCDWebServerDescribeData(NSData* data, NSString* type) {
   return [NSString stringWithFormat:@"<%lu bytes>", (unsigned long)data.length];
 }
 
-NSString* GCDWebServerGetMimeTypeForExtension(NSString* extension, NSDictionary<NSString*, NSString*>* overrides) {
-  NSDictionary* builtInOverrides = @{@"css" : @"text/css"};
-  NSString* mimeType = nil;
-  extension = [extension lowercaseString];
-  if (extension.length) {
-    mimeType = [overrides objectForKey:extension];
-    if (mimeType == nil) {
-      mimeType = [builtInOverrides objectForKey:extension];
+#define kMimeTypeTableSize 512  // Must be a power of 2
+#define kMimeTypeTableSeed 36
+#define kMimeTypeMaxExtensionLength 15
+#define kMimeTypeCacheMaxCount 1024
+
+typedef struct {
+  const char* extension;
+  __unsafe_unretained NSString* mimeType;  // Constant strings
+} GCDWebServerMimeTypeEntry;
+
+// Perfect hash table of common extensions: the seed was chosen offline so that every extension lands in its own slot with _HashExtension()
+static const GCDWebServerMimeTypeEntry _mimeTypeTable[kMimeTypeTableSize] = {
+    [6] = {"js", @"application/javascript"},
+    [15] = {"swf", @"application/x-shockwave-flash"},
+    [16] = {"png", @"image/png"},
+    [17] = {"bz2", @"application/x-bzip2"},
+    [24] = {"webm", @"video/webm"},
+    [31] = {"jpeg", @"image/jpeg"},
+    [32] = {"htm", @"text/html"},
+    [55] = {"woff2", @"font/woff2"},
+    [67] = {"m4a", @"audio/mp4"},
+    [70] = {"jar", @"application/java-archive"},
+    [71] = {"flac", @"audio/flac"},
+    [72] = {"7z", @"application/x-7z-compressed"},
+    [74] = {"ico", @"image/x-icon"},
+    [75] = {"plist", @"application/x-plist"},
+    [93] = {"mp3", @"audio/mpeg"},
+    [94] = {"rar", @"application/vnd.rar"},
+    [99] = {"docx", @"application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    [102] = {"tsv", @"text/tab-separated-values"},
+    [108] = {"atom", @"application/atom+xml"},
+    [115] = {"txt", @"text/plain"},
+    [116] = {"css", @"text/css"},
+    [117] = {"avif", @"image/avif"},
+    [129] = {"mpg", @"video/mpeg"},
+    [132] = {"webmanifest", @"application/manifest+json"},
+    [142] = {"tiff", @"image/tiff"},
+    [143] = {"webp", @"image/webp"},
+    [150] = {"ics", @"text/calendar"},
+    [164] = {"bmp", @"image/bmp"},
+    [177] = {"avi", @"video/x-msvideo"},
+    [185] = {"pdf", @"application/pdf"},
+    [186] = {"bin", @"application/octet-stream"},
+    [187] = {"exe", @"application/octet-stream"},
+    [194] = {"oga", @"audio/ogg"},
+    [211] = {"rtf", @"application/rtf"},
+    [216] = {"zip", @"application/zip"},
+    [233] = {"mid", @"audio/midi"},
+    [237] = {"pptx", @"application/vnd.openxmlformats-officedocument.presentationml.presentation"},
+    [242] = {"m4v", @"video/x-m4v"},
+    [244] = {"otf", @"font/otf"},
+    [256] = {"md", @"text/markdown"},
+    [259] = {"dmg", @"application/x-apple-diskimage"},
+    [263] = {"ppt", @"application/vnd.ms-powerpoint"},
+    [264] = {"tar", @"application/x-tar"},
+    [270] = {"heic", @"image/heic"},
+    [278] = {"opus", @"audio/opus"},
+    [279] = {"eot", @"application/vnd.ms-fontobject"},
+    [280] = {"gz", @"application/gzip"},
+    [282] = {"sh", @"application/x-sh"},
+    [293] = {"gif", @"image/gif"},
+    [295] = {"rss", @"application/rss+xml"},
+    [297] = {"wasm", @"application/wasm"},
+    [319] = {"json", @"application/json"},
+    [336] = {"ogg", @"audio/ogg"},
+    [338] = {"text", @"text/plain"},
+    [344] = {"mp4", @"video/mp4"},
+    [350] = {"xlsx", @"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    [353] = {"apk", @"application/vnd.android.package-archive"},
+    [357] = {"mov", @"video/quicktime"},
+    [372] = {"mpeg", @"video/mpeg"},
+    [379] = {"mjs", @"application/javascript"},
+    [380] = {"jpg", @"image/jpeg"},
+    [381] = {"map", @"application/json"},
+    [383] = {"woff", @"font/woff"},
+    [384] = {"midi", @"audio/midi"},
+    [389] = {"svg", @"image/svg+xml"},
+    [393] = {"doc", @"application/msword"},
+    [402] = {"xls", @"application/vnd.ms-excel"},
+    [411] = {"ipa", @"application/octet-stream"},
+    [412] = {"tif", @"image/tiff"},
+    [413] = {"wav", @"audio/wav"},
+    [420] = {"html", @"text/html"},
+    [424] = {"m3u8", @"application/vnd.apple.mpegurl"},
+    [426] = {"xml", @"application/xml"},
+    [435] = {"ogv", @"video/ogg"},
+    [436] = {"ts", @"video/mp2t"},
+    [438] = {"xhtml", @"application/xhtml+xml"},
+    [443] = {"csv", @"text/csv"},
+    [453] = {"ttf", @"font/ttf"},
+    [483] = {"epub", @"application/epub+zip"},
+    [485] = {"vtt", @"text/vtt"},
+    [486] = {"tgz", @"application/gzip"},
+    [489] = {"3gp", @"video/3gpp"},
+    [496] = {"aac", @"audio/aac"},
+    [497] = {"mkv", @"video/x-matroska"},
+};
+
+static pthread_rwlock_t _mimeTypeCacheLock = PTHREAD_RWLOCK_INITIALIZER;
+static NSMutableDictionary<NSString*, NSString*>* _mimeTypeCache = nil;  // Protected by _mimeTypeCacheLock
+
+static inline uint32_t _HashExtension(const char* extension, size_t length) {
+  uint32_t hash = 2166136261U ^ kMimeTypeTableSeed;  // FNV-1a
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (unsigned char)extension[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+// Returns the MIME type from the built-in table or nil if the extension is not in it
+static NSString* _LookUpBuiltInMimeType(const char* extension, size_t length) {
+  const GCDWebServerMimeTypeEntry* entry = &_mimeTypeTable[_HashExtension(extension, length) & (kMimeTypeTableSize - 1)];
+  if (entry->extension && !strncmp(entry->extension, extension, length) && (entry->extension[length] == 0)) {
+    return entry->mimeType;
+  }
+  return nil;
+}
+
+// Resolves through the system and memoizes the result including misses
+static NSString* _LookUpSystemMimeType(NSString* extension) {
+  pthread_rwlock_rdlock(&_mimeTypeCacheLock);
+  NSString* mimeType = [_mimeTypeCache objectForKey:extension];
+  pthread_rwlock_unlock(&_mimeTypeCacheLock);
+  if (mimeType == nil) {
+#if defined(__APPLE__)
+    CFStringRef uti = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)extension, NULL);
+    if (uti) {
+      mimeType = CFBridgingRelease(UTTypeCopyPreferredTagWithClass(uti, kUTTagClassMIMEType));
+      CFRelease(uti);
     }
+#endif
     if (mimeType == nil) {
-      CFStringRef uti = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension, (__bridge CFStringRef)extension, NULL);
-      if (uti) {
-        mimeType = CFBridgingRelease(UTTypeCopyPreferredTagWithClass(uti, kUTTagClassMIMEType));
-        CFRelease(uti);
+      mimeType = kGCDWebServerDefaultMimeType;
+    }
+    pthread_rwlock_wrlock(&_mimeTypeCacheLock);
+    if (_mimeTypeCache == nil) {
+      _mimeTypeCache = [[NSMutableDictionary alloc] init];
+    }
+    if (_mimeTypeCache.count < kMimeTypeCacheMaxCount) {  // Extensions come from file names so bound the cache in case they are attacker controlled
+      [_mimeTypeCache setObject:mimeType forKey:extension];
+    }
+    pthread_rwlock_unlock(&_mimeTypeCacheLock);
+  }
+  return mimeType;
+}
+
+NSString* GCDWebServerGetMimeTypeForExtension(NSString* extension, NSDictionary<NSString*, NSString*>* overrides) {
+  NSUInteger length = extension.length;
+  if (length == 0) {
+    return kGCDWebServerDefaultMimeType;
+  }
+  char buffer[kMimeTypeMaxExtensionLength + 1];
+  BOOL isASCII = NO;
+  if (length <= kMimeTypeMaxExtensionLength) {
+    isASCII = YES;
+    for (NSUInteger i = 0; i < length; ++i) {
+      unichar c = [extension characterAtIndex:i];
+      if (c >= 128) {
+        isASCII = NO;
+        break;
       }
+      buffer[i] = (char)tolower(c);
+    }
+    buffer[length] = 0;
+  }
+  NSString* lowercaseExtension = nil;
+  if (overrides.count) {
+    lowercaseExtension = isASCII ? [[NSString alloc] initWithBytes:buffer length:length encoding:NSASCIIStringEncoding] : [extension lowercaseString];
+    NSString* mimeType = [overrides objectForKey:lowercaseExtension];
+    if (mimeType) {
+      return mimeType;
     }
   }
-  return mimeType ? mimeType : kGCDWebServerDefaultMimeType;
+  if (isASCII) {
+    NSString* mimeType = _LookUpBuiltInMimeType(buffer, length);
+    if (mimeType) {
+      return mimeType;
+    }
+  }
+  if (lowercaseExtension == nil) {
+    lowercaseExtension = isASCII ? [[NSString alloc] initWithBytes:buffer length:length encoding:NSASCIIStringEncoding] : [extension lowercaseString];
+  }
+  return _LookUpSystemMimeType(lowercaseExtension);
 }
 
 NSString* GCDWebServerEscapeURLString(NSString* string) {
@@ -200,42 +493,85 @@ NSString* GCDWebServerUnescapeURLString(NSString* string) {
 #pragma clang diagnostic pop
 }
 
-NSDictionary<NSString*, NSString*>* GCDWebServerParseURLEncodedForm(NSString* form) {
-  NSMutableDictionary* parameters = [NSMutableDictionary dictionary];
-  NSScanner* scanner = [[NSScanner alloc] initWithString:form];
-  [scanner setCharactersToBeSkipped:nil];
-  while (1) {
-    NSString* key = nil;
-    if (![scanner scanUpToString:@"=" intoString:&key] || [scanner isAtEnd]) {
-      break;
-    }
-    [scanner setScanLocation:([scanner scanLocation] + 1)];
+static inline int _HexDigitValue(unsigned char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+  if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  }
+  if ((c >= 'A') && (c <= 'F')) {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
 
-    NSString* value = nil;
-    [scanner scanUpToString:@"&" intoString:&value];
-    if (value == nil) {
-      value = @"";
+// Decodes "+" and "%XX" escapes in a single pass into the buffer which must be at least "length" bytes
+// Invalid percent escapes are preserved literally like web browsers do
+static NSString* _CreateStringByDecodingFormComponent(const unsigned char* bytes, size_t length, unsigned char* buffer) {
+  if (!memchr(bytes, '%', length) && !memchr(bytes, '+', length)) {
+    return [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+  }
+  size_t outLength = 0;
+  for (size_t i = 0; i < length; ++i) {
+    unsigned char c = bytes[i];
+    if (c == '+') {
+      c = ' ';
+    } else if ((c == '%') && (i + 2 < length)) {
+      int high = _HexDigitValue(bytes[i + 1]);
+      int low = _HexDigitValue(bytes[i + 2]);
+      if ((high >= 0) && (low >= 0)) {
+        c = (unsigned char)((high << 4) | low);
+        i += 2;
+      }
     }
+    buffer[outLength++] = c;
+  }
+  return [[NSString alloc] initWithBytes:buffer length:outLength encoding:NSUTF8StringEncoding];
+}
 
-    key = [key stringByReplacingOccurrencesOfString:@"+" withString:@" "];
-    NSString* unescapedKey = key ? GCDWebServerUnescapeURLString(key) : nil;
-    value = [value stringByReplacingOccurrencesOfString:@"+" withString:@" "];
-    NSString* unescapedValue = value ? GCDWebServerUnescapeURLString(value) : nil;
-    if (unescapedKey && unescapedValue) {
-      [parameters setObject:unescapedValue forKey:unescapedKey];
-    } else {
-      GWS_LOG_WARNING(@"Failed parsing URL encoded form for key \"%@\" and value \"%@\"", key, value);
-      GWS_DNOT_REACHED();
+NSDictionary<NSString*, NSString*>* GCDWebServerParseURLEncodedFormBytes(const void* bytes, NSUInteger length) {
+  NSMutableDictionary* parameters = [NSMutableDictionary dictionary];
+  unsigned char stackBuffer[1024];
+  unsigned char* buffer = length <= sizeof(stackBuffer) ? stackBuffer : malloc(length);  // Decoding never makes a component longer
+  const unsigned char* pair = bytes;
+  const unsigned char* end = pair + length;
+  while (pair < end) {
+    const unsigned char* pairEnd = memchr(pair, '&', (size_t)(end - pair));
+    if (pairEnd == NULL) {
+      pairEnd = end;
     }
-
-    if ([scanner isAtEnd]) {
+    if (pairEnd > pair) {  // Skip empty pairs
+      const unsigned char* separator = memchr(pair, '=', (size_t)(pairEnd - pair));
+      const unsigned char* keyEnd = separator ? separator : pairEnd;
+      const unsigned char* value = separator ? separator + 1 : pairEnd;
+      NSString* key = _CreateStringByDecodingFormComponent(pair, (size_t)(keyEnd - pair), buffer);
+      NSString* unescapedValue = _CreateStringByDecodingFormComponent(value, (size_t)(pairEnd - value), buffer);
+      if (key && unescapedValue) {
+        [parameters setObject:unescapedValue forKey:key];
+      } else {
+        GWS_LOG_WARNING(@"Failed parsing URL encoded form pair \"%@\"", [[NSString alloc] initWithBytes:pair length:(NSUInteger)(pairEnd - pair) encoding:NSISOLatin1StringEncoding]);
+      }
+    }
+    if (pairEnd == end) {
       break;
     }
-    [scanner setScanLocation:([scanner scanLocation] + 1)];
+    pair = pairEnd + 1;
+  }
+  if (buffer != stackBuffer) {
+    free(buffer);
   }
   return parameters;
 }
 
+NSDictionary<NSString*, NSString*>* GCDWebServerParseURLEncodedForm(NSString* form) {
+  const char* bytes = CFStringGetCStringPtr((CFStringRef)form, kCFStringEncodingUTF8);  // Avoid a copy if the string is already backed by UTF-8 or ASCII bytes
+  if (bytes == NULL) {
+    bytes = form.UTF8String;
+  }
+  return GCDWebServerParseURLEncodedFormBytes(bytes, bytes ? strlen(bytes) : 0);
+}
+
 NSString* GCDWebServerStringFromSockAddr(const struct sockaddr* addr, BOOL includeService) {
   char hostBuffer[NI_MAXHOST];
   char serviceBuffer[NI_MAXSERV];
@@ -318,17 +654,113 @@ NSString* GCDWebServerComputeMD5Digest(NSString* format, ...) {
   return (NSString*)[NSString stringWithUTF8String:buffer];
 }
 
-NSString* GCDWebServerNormalizePath(NSString* path) {
-  NSMutableArray* components = [[NSMutableArray alloc] init];
-  for (NSString* component in [path componentsSeparatedByString:@"/"]) {
-    if ([component isEqualToString:@".."]) {
-      [components removeLastObject];
-    } else if (component.length && ![component isEqualToString:@"."]) {
-      [components addObject:component];
+size_t GCDWebServerCanonicalizePathBytes(char* bytes, size_t length, BOOL decode, BOOL keepTrailingSlash, BOOL* escapedRoot) {
+  if (decode) {
+    size_t decodedLength = 0;
+    for (size_t i = 0; i < length; ++i) {
+      char c = bytes[i];
+      if ((c == '%') && (i + 2 < length)) {
+        int high = _HexDigitValue((unsigned char)bytes[i + 1]);
+        int low = _HexDigitValue((unsigned char)bytes[i + 2]);
+        if ((high >= 0) && (low >= 0)) {
+          c = (char)((high << 4) | low);
+          i += 2;
+        }
+      }
+      bytes[decodedLength++] = c;
+    }
+    length = decodedLength;
+  }
+
+  // Segments are compacted towards the start of the buffer which is always safe as the output never gets ahead of the input
+  BOOL absolute = (length > 0) && (bytes[0] == '/');
+  BOOL trailingSlash = NO;
+  size_t outLength = 0;
+  size_t position = 0;
+  while (1) {
+    while ((position < length) && (bytes[position] == '/')) {
+      ++position;
+    }
+    if (position >= length) {
+      trailingSlash = (length > 0);
+      break;
+    }
+    size_t start = position;
+    while ((position < length) && (bytes[position] != '/')) {
+      ++position;
     }
+    size_t segmentLength = position - start;
+    if ((segmentLength == 1) && (bytes[start] == '.')) {
+      trailingSlash = (position >= length);
+    } else if ((segmentLength == 2) && (bytes[start] == '.') && (bytes[start + 1] == '.')) {
+      if (outLength > 0) {
+        while ((outLength > 0) && (bytes[outLength - 1] != '/')) {
+          --outLength;
+        }
+        if (outLength > 0) {
+          --outLength;
+        }
+      } else if (escapedRoot) {
+        *escapedRoot = YES;
+      }
+      trailingSlash = (position >= length);
+    } else {
+      if (absolute || (outLength > 0)) {
+        bytes[outLength++] = '/';
+      }
+      memmove(&bytes[outLength], &bytes[start], segmentLength);
+      outLength += segmentLength;
+      trailingSlash = NO;
+    }
+    if (position >= length) {
+      break;
+    }
+  }
+  if (absolute && (outLength == 0)) {
+    bytes[outLength++] = '/';
+  }
+  if (keepTrailingSlash && trailingSlash && (outLength > 0) && (bytes[outLength - 1] != '/')) {
+    bytes[outLength++] = '/';
+  }
+  return outLength;
+}
+
+// Copies the UTF-8 representation of the string into the stack buffer if large enough or into a malloc'ed one otherwise
+static char* _CopyUTF8Bytes(NSString* string, char* stackBuffer, size_t stackBufferSize, size_t* length) {
+  const char* bytes = CFStringGetCStringPtr((CFStringRef)string, kCFStringEncodingUTF8);
+  if (bytes == NULL) {
+    bytes = string.UTF8String;
+  }
+  *length = bytes ? strlen(bytes) : 0;
+  char* buffer = *length <= stackBufferSize ? stackBuffer : malloc(*length);
+  memcpy(buffer, bytes, *length);
+  return buffer;
+}
+
+NSString* GCDWebServerNormalizePath(NSString* path) {
+  char stackBuffer[1024];
+  size_t length;
+  char* buffer = _CopyUTF8Bytes(path, stackBuffer, sizeof(stackBuffer), &length);
+  size_t outLength = GCDWebServerCanonicalizePathBytes(buffer, length, NO, NO, NULL);
+  NSString* result = outLength == length ? path : [[NSString alloc] initWithBytes:buffer length:outLength encoding:NSUTF8StringEncoding];  // Canonicalization only removes bytes so same length means unchanged
+  if (buffer != stackBuffer) {
+    free(buffer);
+  }
+  return result;
+}
+
+NSString* GCDWebServerCanonicalizeRequestPath(NSString* escapedPath) {
+  char stackBuffer[1024];
+  size_t length;
+  char* buffer = _CopyUTF8Bytes(escapedPath, stackBuffer, sizeof(stackBuffer), &length);
+  BOOL escapedRoot = NO;
+  size_t outLength = GCDWebServerCanonicalizePathBytes(buffer, length, YES, YES, &escapedRoot);
+  NSString* result = nil;
+  if (!escapedRoot && !memchr(buffer, 0, outLength)) {
+    result = [[NSString alloc] initWithBytes:buffer length:outLength encoding:NSUTF8StringEncoding];
   }
-  if (path.length && ([path characterAtIndex:0] == '/')) {
-    return [@"/" stringByAppendingString:[components componentsJoinedByString:@"/"]];  // Preserve initial slash
+  if (buffer != stackBuffer) {
+    free(buffer);
   }
-  return [components componentsJoinedByString:@"/"];
+  return result;
 }
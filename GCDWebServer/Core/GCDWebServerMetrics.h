@@ -0,0 +1,104 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  The GCDWebServerMetrics class collects low-overhead statistics about a
+ *  running GCDWebServer: counters, gauges and per-route latency histograms
+ *  broken down by HTTP status class.
+ *
+ *  Counters are striped across cache lines and histograms are updated with
+ *  atomic operations so recording never takes a lock on the request path.
+ *
+ *  Latencies are measured from the first byte of the request to the closing
+ *  of the connection and stored in log-linear buckets with a relative error
+ *  of at most 1/16.
+ *
+ *  @warning Metrics are only recorded if the GCDWebServerOption_EnableMetrics
+ *  option is set when starting the server.
+ */
+@interface GCDWebServerMetrics : NSObject
+
+/**
+ *  Returns the total number of connections opened.
+ */
+@property(nonatomic, readonly) uint64_t totalConnections;
+
+/**
+ *  Returns the total number of HTTP requests that received a response.
+ */
+@property(nonatomic, readonly) uint64_t totalRequests;
+
+/**
+ *  Returns the number of connections currently opened.
+ */
+@property(nonatomic, readonly) NSInteger activeConnections;
+
+/**
+ *  Returns the number of HTTP requests currently being processed by handlers
+ *  or sending their response.
+ */
+@property(nonatomic, readonly) NSInteger inFlightRequests;
+
+/**
+ *  Returns the total number of bytes received from clients.
+ */
+@property(nonatomic, readonly) uint64_t totalBytesReceived;
+
+/**
+ *  Returns the total number of bytes sent to clients.
+ */
+@property(nonatomic, readonly) uint64_t totalBytesSent;
+
+/**
+ *  Returns the ratio between the uncompressed and compressed sizes of all
+ *  the response bodies sent with gzip content encoding or 0.0 if none.
+ */
+@property(nonatomic, readonly) double compressionRatio;
+
+/**
+ *  Returns the latency in seconds below which the given fraction (between
+ *  0.0 and 1.0) of the requests handled by a route have completed.
+ *
+ *  Routes are named after the method and path or regex of their handler
+ *  e.g. "GET /index.html" or "custom" for handlers added with a match block.
+ *
+ *  Returns 0.0 if the route is unknown or has not handled any request yet.
+ */
+- (NSTimeInterval)latencyForRoute:(NSString*)route quantile:(double)quantile;
+
+/**
+ *  Returns all metrics formatted using the Prometheus text exposition format.
+ */
+- (NSString*)prometheusTextRepresentation;
+
+@end
+
+NS_ASSUME_NONNULL_END
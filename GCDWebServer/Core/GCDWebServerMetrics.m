@@ -0,0 +1,339 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !__has_feature(objc_arc)
+#error GCDWebServer requires ARC
+#endif
+
+#import <pthread.h>
+#import <stdatomic.h>
+
+#import "GCDWebServerPrivate.h"
+
+#define kStripeCount 16
+#define kStatusClassCount 5
+#define kHistogramSubBucketBits 4
+#define kHistogramSubBucketCount (1 << kHistogramSubBucketBits)
+#define kHistogramMaxExponent 32  // Latencies are recorded in microseconds and clamped to about 71 minutes
+#define kHistogramBucketCount ((kHistogramMaxExponent - kHistogramSubBucketBits + 1) * kHistogramSubBucketCount)
+#define kUnmatchedRoute @"none"
+
+typedef NS_ENUM(NSUInteger, GCDWebServerMetricsCounter) {
+  kGCDWebServerMetricsCounter_Connections = 0,
+  kGCDWebServerMetricsCounter_Requests,
+  kGCDWebServerMetricsCounter_BytesReceived,
+  kGCDWebServerMetricsCounter_BytesSent,
+  kGCDWebServerMetricsCounter_UncompressedBytes,
+  kGCDWebServerMetricsCounter_CompressedBytes,
+  kGCDWebServerMetricsCounterCount
+};
+
+// Each stripe lives on its own cache line so threads updating counters concurrently don't contend
+typedef struct {
+  _Atomic(uint64_t) values[kGCDWebServerMetricsCounterCount];
+} __attribute__((aligned(64))) GCDWebServerMetricsStripe;
+
+typedef struct {
+  _Atomic(uint64_t) count;
+  _Atomic(uint64_t) sum;  // Microseconds
+  _Atomic(uint64_t) buckets[kHistogramBucketCount];
+} GCDWebServerMetricsHistogram;
+
+static const double _histogramBoundaries[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0};
+static const double _summaryQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static inline NSUInteger _StripeIndex(void) {
+  return (NSUInteger)(((uint64_t)(uintptr_t)pthread_self() * 0x9E3779B97F4A7C15ULL) >> 60);  // Fibonacci hashing into 16 stripes
+}
+
+// Log-linear bucketing: values below 16 get exact buckets, then each power of 2 is split into 16 linear sub-buckets
+static inline NSUInteger _BucketIndexForValue(uint64_t value) {
+  value = MIN(value, (1ULL << kHistogramMaxExponent) - 1);
+  if (value < kHistogramSubBucketCount) {
+    return (NSUInteger)value;
+  }
+  NSUInteger exponent = 63 - __builtin_clzll(value);
+  return (exponent - kHistogramSubBucketBits + 1) * kHistogramSubBucketCount + (NSUInteger)((value >> (exponent - kHistogramSubBucketBits)) & (kHistogramSubBucketCount - 1));
+}
+
+// Returns the exclusive upper bound in microseconds of the values stored in a bucket
+static inline uint64_t _BucketUpperBound(NSUInteger index) {
+  if (index < kHistogramSubBucketCount) {
+    return index + 1;
+  }
+  NSUInteger exponent = index / kHistogramSubBucketCount + kHistogramSubBucketBits - 1;
+  NSUInteger subBucket = index % kHistogramSubBucketCount;
+  return (uint64_t)(kHistogramSubBucketCount + subBucket + 1) << (exponent - kHistogramSubBucketBits);
+}
+
+static NSString* _EscapeLabelValue(NSString* value) {
+  value = [value stringByReplacingOccurrencesOfString:@"\\" withString:@"\\\\"];
+  value = [value stringByReplacingOccurrencesOfString:@"\"" withString:@"\\\""];
+  return [value stringByReplacingOccurrencesOfString:@"\n" withString:@"\\n"];
+}
+
+@implementation GCDWebServerRouteMetrics {
+  GCDWebServerMetricsHistogram _histograms[kStatusClassCount];
+}
+
+- (instancetype)initWithRoute:(NSString*)route {
+  if ((self = [super init])) {
+    _route = [route copy];
+  }
+  return self;
+}
+
+- (void)recordLatency:(uint64_t)latency statusCode:(NSInteger)statusCode {
+  if ((statusCode < 100) || (statusCode >= 100 * (kStatusClassCount + 1))) {
+    return;
+  }
+  GCDWebServerMetricsHistogram* histogram = &_histograms[statusCode / 100 - 1];
+  uint64_t microseconds = latency / NSEC_PER_USEC;
+  atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->sum, microseconds, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->buckets[_BucketIndexForValue(microseconds)], 1, memory_order_relaxed);
+}
+
+// Copies the buckets of the histogram for a status class and returns their total count
+- (uint64_t)copyBuckets:(uint64_t*)buckets sum:(uint64_t*)sum forStatusClass:(NSUInteger)statusClass {
+  GCDWebServerMetricsHistogram* histogram = &_histograms[statusClass];
+  uint64_t count = 0;
+  for (NSUInteger i = 0; i < kHistogramBucketCount; ++i) {
+    buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    count += buckets[i];
+  }
+  *sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+  return count;  // Computed from the buckets so it is always consistent with them
+}
+
+@end
+
+static double _QuantileFromBuckets(const uint64_t* buckets, uint64_t count, double quantile) {
+  if (count == 0) {
+    return 0.0;
+  }
+  uint64_t rank = (uint64_t)ceil(MAX(MIN(quantile, 1.0), 0.0) * (double)count);
+  uint64_t cumulativeCount = 0;
+  for (NSUInteger i = 0; i < kHistogramBucketCount; ++i) {
+    cumulativeCount += buckets[i];
+    if ((cumulativeCount >= rank) && (cumulativeCount > 0)) {
+      return (double)_BucketUpperBound(i) / (double)USEC_PER_SEC;
+    }
+  }
+  return (double)_BucketUpperBound(kHistogramBucketCount - 1) / (double)USEC_PER_SEC;
+}
+
+@implementation GCDWebServerMetrics {
+  GCDWebServerMetricsStripe _stripes[kStripeCount];
+  _Atomic(NSInteger) _activeConnections;
+  _Atomic(NSInteger) _inFlightRequests;
+  pthread_mutex_t _routesMutex;
+  NSMutableDictionary<NSString*, GCDWebServerRouteMetrics*>* _routes;  // Protected by _routesMutex
+  GCDWebServerRouteMetrics* _unmatchedRouteMetrics;
+}
+
+- (instancetype)init {
+  if ((self = [super init])) {
+    pthread_mutex_init(&_routesMutex, NULL);
+    _routes = [[NSMutableDictionary alloc] init];
+    _unmatchedRouteMetrics = [self routeMetricsForRoute:kUnmatchedRoute];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  pthread_mutex_destroy(&_routesMutex);
+}
+
+- (void)_incrementCounter:(GCDWebServerMetricsCounter)counter by:(uint64_t)value {
+  atomic_fetch_add_explicit(&_stripes[_StripeIndex()].values[counter], value, memory_order_relaxed);
+}
+
+- (uint64_t)_valueForCounter:(GCDWebServerMetricsCounter)counter {
+  uint64_t value = 0;
+  for (NSUInteger i = 0; i < kStripeCount; ++i) {
+    value += atomic_load_explicit(&_stripes[i].values[counter], memory_order_relaxed);
+  }
+  return value;
+}
+
+- (GCDWebServerRouteMetrics*)routeMetricsForRoute:(NSString*)route {
+  pthread_mutex_lock(&_routesMutex);
+  GCDWebServerRouteMetrics* routeMetrics = _routes[route];
+  if (routeMetrics == nil) {
+    routeMetrics = [[GCDWebServerRouteMetrics alloc] initWithRoute:route];
+    _routes[route] = routeMetrics;
+  }
+  pthread_mutex_unlock(&_routesMutex);
+  return routeMetrics;
+}
+
+- (NSArray<GCDWebServerRouteMetrics*>*)_sortedRouteMetrics {
+  pthread_mutex_lock(&_routesMutex);
+  NSArray* routes = [_routes.allKeys sortedArrayUsingSelector:@selector(compare:)];
+  NSArray* routeMetrics = [_routes objectsForKeys:routes notFoundMarker:[NSNull null]];
+  pthread_mutex_unlock(&_routesMutex);
+  return routeMetrics;
+}
+
+- (void)connectionDidOpen {
+  [self _incrementCounter:kGCDWebServerMetricsCounter_Connections by:1];
+  atomic_fetch_add_explicit(&_activeConnections, 1, memory_order_relaxed);
+}
+
+- (void)connectionDidCloseWithBytesReceived:(uint64_t)bytesReceived bytesSent:(uint64_t)bytesSent {
+  [self _incrementCounter:kGCDWebServerMetricsCounter_BytesReceived by:bytesReceived];
+  [self _incrementCounter:kGCDWebServerMetricsCounter_BytesSent by:bytesSent];
+  atomic_fetch_sub_explicit(&_activeConnections, 1, memory_order_relaxed);
+}
+
+- (void)requestDidStart {
+  atomic_fetch_add_explicit(&_inFlightRequests, 1, memory_order_relaxed);
+}
+
+- (void)requestDidEnd {
+  atomic_fetch_sub_explicit(&_inFlightRequests, 1, memory_order_relaxed);
+}
+
+- (void)recordResponseWithRouteMetrics:(GCDWebServerRouteMetrics*)routeMetrics statusCode:(NSInteger)statusCode latency:(uint64_t)latency {
+  [self _incrementCounter:kGCDWebServerMetricsCounter_Requests by:1];
+  [routeMetrics ? routeMetrics : _unmatchedRouteMetrics recordLatency:latency statusCode:statusCode];
+}
+
+- (void)recordCompressedBodyWithUncompressedLength:(uint64_t)uncompressedLength compressedLength:(uint64_t)compressedLength {
+  [self _incrementCounter:kGCDWebServerMetricsCounter_UncompressedBytes by:uncompressedLength];
+  [self _incrementCounter:kGCDWebServerMetricsCounter_CompressedBytes by:compressedLength];
+}
+
+- (uint64_t)totalConnections {
+  return [self _valueForCounter:kGCDWebServerMetricsCounter_Connections];
+}
+
+- (uint64_t)totalRequests {
+  return [self _valueForCounter:kGCDWebServerMetricsCounter_Requests];
+}
+
+- (NSInteger)activeConnections {
+  return atomic_load_explicit(&_activeConnections, memory_order_relaxed);
+}
+
+- (NSInteger)inFlightRequests {
+  return atomic_load_explicit(&_inFlightRequests, memory_order_relaxed);
+}
+
+- (uint64_t)totalBytesReceived {
+  return [self _valueForCounter:kGCDWebServerMetricsCounter_BytesReceived];
+}
+
+- (uint64_t)totalBytesSent {
+  return [self _valueForCounter:kGCDWebServerMetricsCounter_BytesSent];
+}
+
+- (double)compressionRatio {
+  uint64_t compressedBytes = [self _valueForCounter:kGCDWebServerMetricsCounter_CompressedBytes];
+  return compressedBytes ? (double)[self _valueForCounter:kGCDWebServerMetricsCounter_UncompressedBytes] / (double)compressedBytes : 0.0;
+}
+
+- (NSTimeInterval)latencyForRoute:(NSString*)route quantile:(double)quantile {
+  pthread_mutex_lock(&_routesMutex);
+  GCDWebServerRouteMetrics* routeMetrics = _routes[route];
+  pthread_mutex_unlock(&_routesMutex);
+  if (routeMetrics == nil) {
+    return 0.0;
+  }
+  uint64_t* buckets = malloc(kHistogramBucketCount * sizeof(uint64_t));
+  uint64_t* totalBuckets = calloc(kHistogramBucketCount, sizeof(uint64_t));
+  uint64_t totalCount = 0;
+  for (NSUInteger statusClass = 0; statusClass < kStatusClassCount; ++statusClass) {
+    uint64_t sum;
+    totalCount += [routeMetrics copyBuckets:buckets sum:&sum forStatusClass:statusClass];
+    for (NSUInteger i = 0; i < kHistogramBucketCount; ++i) {
+      totalBuckets[i] += buckets[i];
+    }
+  }
+  double latency = _QuantileFromBuckets(totalBuckets, totalCount, quantile);
+  free(totalBuckets);
+  free(buckets);
+  return latency;
+}
+
+static void _AppendCounter(NSMutableString* string, NSString* name, NSString* type, NSString* help, NSString* value) {
+  [string appendFormat:@"# HELP %@ %@\n# TYPE %@ %@\n%@ %@\n", name, help, name, type, name, value];
+}
+
+- (NSString*)prometheusTextRepresentation {
+  NSMutableString* string = [[NSMutableString alloc] init];
+  _AppendCounter(string, @"gcdwebserver_connections_total", @"counter", @"Total number of connections opened.", [NSString stringWithFormat:@"%llu", self.totalConnections]);
+  _AppendCounter(string, @"gcdwebserver_requests_total", @"counter", @"Total number of requests which received a response.", [NSString stringWithFormat:@"%llu", self.totalRequests]);
+  _AppendCounter(string, @"gcdwebserver_received_bytes_total", @"counter", @"Total number of bytes received from clients.", [NSString stringWithFormat:@"%llu", self.totalBytesReceived]);
+  _AppendCounter(string, @"gcdwebserver_sent_bytes_total", @"counter", @"Total number of bytes sent to clients.", [NSString stringWithFormat:@"%llu", self.totalBytesSent]);
+  _AppendCounter(string, @"gcdwebserver_active_connections", @"gauge", @"Number of connections currently opened.", [NSString stringWithFormat:@"%li", (long)self.activeConnections]);
+  _AppendCounter(string, @"gcdwebserver_in_flight_requests", @"gauge", @"Number of requests currently being processed.", [NSString stringWithFormat:@"%li", (long)self.inFlightRequests]);
+  _AppendCounter(string, @"gcdwebserver_compression_ratio", @"gauge", @"Ratio between uncompressed and gzip compressed response body sizes.", [NSString stringWithFormat:@"%g", self.compressionRatio]);
+
+  NSMutableString* histogramString = [[NSMutableString alloc] init];
+  NSMutableString* summaryString = [[NSMutableString alloc] init];
+  uint64_t* buckets = malloc(kHistogramBucketCount * sizeof(uint64_t));
+  for (GCDWebServerRouteMetrics* routeMetrics in [self _sortedRouteMetrics]) {
+    NSString* route = _EscapeLabelValue(routeMetrics.route);
+    for (NSUInteger statusClass = 0; statusClass < kStatusClassCount; ++statusClass) {
+      uint64_t sum;
+      uint64_t count = [routeMetrics copyBuckets:buckets sum:&sum forStatusClass:statusClass];
+      if (count == 0) {
+        continue;
+      }
+      NSString* labels = [NSString stringWithFormat:@"route=\"%@\",status_class=\"%lux\"", route, (unsigned long)statusClass + 1];
+      NSUInteger bucketIndex = 0;
+      uint64_t cumulativeCount = 0;
+      for (size_t i = 0; i < sizeof(_histogramBoundaries) / sizeof(double); ++i) {
+        uint64_t boundary = (uint64_t)(_histogramBoundaries[i] * (double)USEC_PER_SEC);
+        while ((bucketIndex < kHistogramBucketCount) && (_BucketUpperBound(bucketIndex) <= boundary)) {
+          cumulativeCount += buckets[bucketIndex];
+          bucketIndex += 1;
+        }
+        [histogramString appendFormat:@"gcdwebserver_request_duration_seconds_bucket{%@,le=\"%g\"} %llu\n", labels, _histogramBoundaries[i], cumulativeCount];
+      }
+      [histogramString appendFormat:@"gcdwebserver_request_duration_seconds_bucket{%@,le=\"+Inf\"} %llu\n", labels, count];
+      [histogramString appendFormat:@"gcdwebserver_request_duration_seconds_sum{%@} %g\n", labels, (double)sum / (double)USEC_PER_SEC];
+      [histogramString appendFormat:@"gcdwebserver_request_duration_seconds_count{%@} %llu\n", labels, count];
+
+      for (size_t i = 0; i < sizeof(_summaryQuantiles) / sizeof(double); ++i) {
+        [summaryString appendFormat:@"gcdwebserver_request_latency_seconds{%@,quantile=\"%g\"} %g\n", labels, _summaryQuantiles[i], _QuantileFromBuckets(buckets, count, _summaryQuantiles[i])];
+      }
+      [summaryString appendFormat:@"gcdwebserver_request_latency_seconds_sum{%@} %g\n", labels, (double)sum / (double)USEC_PER_SEC];
+      [summaryString appendFormat:@"gcdwebserver_request_latency_seconds_count{%@} %llu\n", labels, count];
+    }
+  }
+  free(buckets);
+  [string appendString:@"# HELP gcdwebserver_request_duration_seconds Request latency from first byte received to connection closed.\n# TYPE gcdwebserver_request_duration_seconds histogram\n"];
+  [string appendString:histogramString];
+  [string appendString:@"# HELP gcdwebserver_request_latency_seconds Request latency quantiles from first byte received to connection closed.\n# TYPE gcdwebserver_request_latency_seconds summary\n"];
+  [string appendString:summaryString];
+  return string;
+}
+
+@end
@@ -27,6 +27,7 @@
 
 #import <os/object.h>
 #import <sys/socket.h>
+#import <mach/mach_time.h>
 
 /**
  *  All GCDWebServer headers.
@@ -34,6 +35,8 @@
 
 #import "GCDWebServerHTTPStatusCodes.h"
 #import "GCDWebServerFunctions.h"
+#import "GCDWebServerMetrics.h"
+#import "GCDWebServerAccessLog.h"
 
 #import "GCDWebServer.h"
 #import "GCDWebServerConnection.h"
@@ -47,6 +50,9 @@
 #import "GCDWebServerErrorResponse.h"
 #import "GCDWebServerFileResponse.h"
 #import "GCDWebServerStreamedResponse.h"
+#import "GCDWebServerEventStreamResponse.h"
+
+#import "GCDWebServerWebSocket.h"
 
 /**
  *  Check if a custom logging facility should be used instead.
@@ -161,17 +167,35 @@ NS_ASSUME_NONNULL_BEGIN
 
 #define kGCDWebServerDefaultMimeType @"application/octet-stream"
 #define kGCDWebServerErrorDomain @"GCDWebServerErrorDomain"
+#define kGCDWebServerMaxByteRanges 64  // Larger "Range" headers are ignored
 
 static inline BOOL GCDWebServerIsValidByteRange(NSRange range) {
   return ((range.location != NSUIntegerMax) || (range.length > 0));
 }
 
+static inline uint64_t GCDWebServerGetMonotonicTime(void) {  // Nanoseconds
+  static mach_timebase_info_data_t timebase;
+  if (timebase.denom == 0) {
+    mach_timebase_info(&timebase);
+  }
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
 static inline NSError* GCDWebServerMakePosixError(int code) {
   return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:@{NSLocalizedDescriptionKey : (NSString*)[NSString stringWithUTF8String:strerror(code)]}];
 }
 
+#define kGCDWebServerHTTPDateLength 29
+
 extern void GCDWebServerInitializeFunctions(void);
+extern NSDictionary<NSString*, NSString*>* GCDWebServerParseURLEncodedFormBytes(const void* bytes, NSUInteger length);
+extern size_t GCDWebServerCanonicalizePathBytes(char* bytes, size_t length, BOOL decode, BOOL keepTrailingSlash, BOOL* _Nullable escapedRoot);  // In place, returns new length
+extern NSString* _Nullable GCDWebServerCanonicalizeRequestPath(NSString* escapedPath);  // Returns nil if the path escapes the root or is invalid
 extern NSString* _Nullable GCDWebServerNormalizeHeaderValue(NSString* _Nullable value);
+extern BOOL GCDWebServerResolveByteRange(NSRange* range, NSUInteger length);  // Converts a range from -[GCDWebServerRequest byteRange] to an absolute one - Returns NO if not satisfiable
+extern BOOL GCDWebServerIsETagListMatching(NSString* list, NSString* _Nullable eTag, BOOL weakComparison);  // Does not handle "*"
+extern BOOL GCDWebServerIsIfRangeMatching(NSString* ifRange, NSString* _Nullable eTag, NSDate* _Nullable lastModifiedDate);
+extern void GCDWebServerFormatHTTPDate(time_t time, char buffer[kGCDWebServerHTTPDateLength]);  // IMF-fixdate from RFC 7231 without a NUL terminator
 extern NSString* _Nullable GCDWebServerTruncateHeaderValue(NSString* _Nullable value);
 extern NSString* _Nullable GCDWebServerExtractHeaderValueParameter(NSString* _Nullable value, NSString* attribute);
 extern NSStringEncoding GCDWebServerStringEncodingFromCharset(NSString* charset);
@@ -182,27 +206,194 @@ extern NSString* GCDWebServerStringFromSockAddr(const struct sockaddr* addr, BOO
 
 @interface GCDWebServerConnection ()
 - (instancetype)initWithServer:(GCDWebServer*)server localAddress:(NSData*)localAddress remoteAddress:(NSData*)remoteAddress socket:(CFSocketNativeHandle)socket;
+@property(nonatomic, readonly) uint64_t timeoutDeadline;  // Monotonic time in nanoseconds or 0 if no timeout is armed
+- (void)timeoutDidExpire;
+@property(nonatomic, readonly) dispatch_queue_t ioQueue;
+- (void)readUpgradedData:(NSMutableData*)data completionBlock:(void (^)(BOOL success))block;  // Only for connections upgraded to another protocol - Must be called on the I/O queue
+- (void)writeUpgradedData:(NSData*)data completionBlock:(void (^)(BOOL success))block;
+- (void)shutdownUpgradedConnection;  // Pending reads and writes fail
+@end
+
+@interface GCDWebServerTimerWheelEntry : NSObject
+- (instancetype)initWithConnection:(GCDWebServerConnection*)connection;
+@end
+
+@interface GCDWebServerTimerWheel : NSObject
+- (void)scheduleEntry:(GCDWebServerTimerWheelEntry*)entry;
+@end
+
+@interface GCDWebServerRouteMetrics : NSObject
+@property(nonatomic, readonly) NSString* route;
+- (instancetype)initWithRoute:(NSString*)route;
+@end
+
+@interface GCDWebServerMetrics ()
+- (GCDWebServerRouteMetrics*)routeMetricsForRoute:(NSString*)route;
+- (void)connectionDidOpen;
+- (void)connectionDidCloseWithBytesReceived:(uint64_t)bytesReceived bytesSent:(uint64_t)bytesSent;
+- (void)requestDidStart;
+- (void)requestDidEnd;
+- (void)recordResponseWithRouteMetrics:(nullable GCDWebServerRouteMetrics*)routeMetrics statusCode:(NSInteger)statusCode latency:(uint64_t)latency;  // Latency in nanoseconds
+- (void)recordCompressedBodyWithUncompressedLength:(uint64_t)uncompressedLength compressedLength:(uint64_t)compressedLength;
+@end
+
+typedef struct {
+  CFAbsoluteTime time;
+  uint64_t duration;  // From the first byte of the request in nanoseconds
+  uint64_t bytesReceived;
+  uint64_t bytesSent;
+  int statusCode;
+  socklen_t remoteAddressLength;
+  struct sockaddr_storage remoteAddress;
+  char method[16];
+  char target[512];
+  char referrer[256];
+  char userAgent[256];
+  char traceID[33];
+} GCDWebServerAccessLogRecord;
+
+extern void GCDWebServerAccessLogCopyString(NSString* _Nullable string, char* buffer, size_t size);  // Truncates to fit and always NUL-terminates
+
+@interface GCDWebServerAccessLog ()
+- (BOOL)shouldLogRequestWithStatusCode:(NSInteger)statusCode;
+- (void)appendRecord:(const GCDWebServerAccessLogRecord*)record;  // Never blocks and drops the record if the ring buffer is full
+@end
+
+@interface GCDWebServerWorkerPool : NSObject
+@property(nonatomic, readonly) GCDWebServerWorkerPoolStatistics statistics;
+- (instancetype)initWithWorkerCount:(NSUInteger)workerCount maxQueuedBlocks:(NSUInteger)maxQueuedBlocks;
+- (BOOL)submitBlock:(dispatch_block_t)block;  // Returns NO if the queue is full or the pool has been invalidated
+- (void)invalidate;
+@end
+
+@interface GCDWebServerResponseCache : NSObject
+- (instancetype)initWithMaxSize:(NSUInteger)maxSize;
+- (nullable GCDWebServerResponse*)cachedResponseForRequest:(GCDWebServerRequest*)request needsRevalidation:(BOOL*)needsRevalidation;  // Returns a new response on every hit - "needsRevalidation" is only set on the first stale hit
+- (void)storeResponse:(GCDWebServerResponse*)response forRequest:(GCDWebServerRequest*)request;  // Replaces any cached response for the request and does nothing else if not cacheable
+- (void)cancelRevalidationForRequest:(GCDWebServerRequest*)request;  // Lets a later stale hit trigger the revalidation again
+- (void)removeResponseForRequest:(GCDWebServerRequest*)request;  // Only removes the variant matching the request
+- (void)removeAllResponses;
+- (void)removeResponsesForPath:(NSString*)path;
+@end
+
+typedef NS_ENUM(int, GCDWebServerNonceStatus) {
+  kGCDWebServerNonceStatus_Unknown = 0,
+  kGCDWebServerNonceStatus_Expired,
+  kGCDWebServerNonceStatus_Valid
+};
+
+@interface GCDWebServerAuthenticationState : NSObject
+- (BOOL)isVerifiedCredential:(NSString*)authorization;  // Authorization header previously verified and not expired
+- (void)addVerifiedCredential:(NSString*)authorization expirationTime:(uint64_t)expirationTime;  // Monotonic time in nanoseconds
+- (NSString*)issueNonceForClient:(NSString*)client;
+- (GCDWebServerNonceStatus)checkNonce:(NSString*)nonce client:(NSString*)client expirationTime:(uint64_t*)expirationTime;
+- (BOOL)acceptNonceCount:(uint64_t)nonceCount forNonce:(NSString*)nonce;  // Returns NO if already accepted or too far behind the highest accepted one
+@end
+
+@class GCDWebServerHandler;
+
+typedef void (^GCDWebServerCoalescedResponseBlock)(GCDWebServerResponse* _Nullable sharedResponse);  // Called with nil if the response cannot be shared
+
+@interface GCDWebServerRequestCoalescer : NSObject
+- (BOOL)addWaiterForRequest:(GCDWebServerRequest*)request handler:(GCDWebServerHandler*)handler block:(GCDWebServerCoalescedResponseBlock)block;  // Returns NO if there is no identical request in flight, in which case the caller must process the request and call -finishRequest:handler:withResponse:
+- (void)finishRequest:(GCDWebServerRequest*)request handler:(GCDWebServerHandler*)handler withResponse:(nullable GCDWebServerResponse*)response;  // Must be called before the response is prepared for reading
 @end
 
 @interface GCDWebServer ()
 @property(nonatomic, readonly) NSMutableArray<GCDWebServerHandler*>* handlers;
 @property(nonatomic, readonly, nullable) NSString* serverName;
+@property(nonatomic, readonly, nullable) NSData* serverHeaderData;  // Preformatted "Server" header line
 @property(nonatomic, readonly, nullable) NSString* authenticationRealm;
 @property(nonatomic, readonly, nullable) NSMutableDictionary<NSString*, NSString*>* authenticationBasicAccounts;
 @property(nonatomic, readonly, nullable) NSMutableDictionary<NSString*, NSString*>* authenticationDigestAccounts;
+@property(nonatomic, readonly, nullable) GCDWebServerAuthenticationState* authenticationState;
 @property(nonatomic, readonly) BOOL shouldAutomaticallyMapHEADToGET;
 @property(nonatomic, readonly) dispatch_queue_priority_t dispatchQueuePriority;
+@property(nonatomic, readonly) dispatch_queue_t handlerQueue;  // Default concurrent queue for handlers without their own queue
+@property(nonatomic, readonly, nullable) GCDWebServerWorkerPool* workerPool;
+@property(nonatomic, readonly, nullable) GCDWebServerMetrics* activeMetrics;  // Only set while running with metrics enabled
+@property(nonatomic, readonly, nullable) GCDWebServerRequestTimingsBlock requestTimingsObserver;
+@property(nonatomic, readonly, nullable) GCDWebServerAccessLog* accessLog;
+@property(nonatomic, readonly, nullable) NSDictionary<NSString*, NSString*>* mimeTypeOverrides;  // Keys are lowercased
+@property(nonatomic, readonly) GCDWebServerFileETagMode fileETagMode;
+@property(nonatomic, readonly, nullable) GCDWebServerResponseCache* responseCache;
+@property(nonatomic, readonly, nullable) GCDWebServerRequestCoalescer* requestCoalescer;
+@property(nonatomic, readonly) NSUInteger maxInFlightRequests;
+@property(nonatomic, readonly) NSUInteger overloadRetryAfter;
+@property(nonatomic, readonly) GCDWebServerTimerWheel* timerWheel;
+@property(nonatomic, readonly) NSTimeInterval idleTimeout;
+@property(nonatomic, readonly) NSTimeInterval headerReadTimeout;
+@property(nonatomic, readonly) NSTimeInterval bodyReadTimeout;
+@property(nonatomic, readonly) NSTimeInterval writeTimeout;
 - (void)willStartConnection:(GCDWebServerConnection*)connection;
 - (void)didEndConnection:(GCDWebServerConnection*)connection;
+- (void)admitRequestWithBlock:(dispatch_block_t)admitBlock rejectBlock:(dispatch_block_t)rejectBlock;
+- (void)didFinishRequest;
+- (dispatch_queue_t)nextIOQueue;  // Serial queues assigned to connections in a round-robin fashion
 @end
 
 @interface GCDWebServerHandler : NSObject
 @property(nonatomic, readonly) GCDWebServerMatchBlock matchBlock;
+@property(nonatomic, readonly, nullable) GCDWebServerProcessBlock processBlock;  // Only set for synchronous handlers
 @property(nonatomic, readonly) GCDWebServerAsyncProcessBlock asyncProcessBlock;
+@property(nonatomic, copy) NSString* route;  // Name used to aggregate metrics
+@property(nonatomic, nullable) GCDWebServerRouteMetrics* routeMetrics;
+@property(nonatomic, readonly, nullable) dispatch_queue_t queue;  // NULL to use the server default handler queue
+@end
+
+// NSDictionary which only parses its "application/x-www-form-urlencoded" string on first access
+@interface GCDWebServerLazyURLEncodedForm : NSDictionary<NSString*, NSString*>
+- (instancetype)initWithString:(NSString*)string;
 @end
 
+// Well-known request headers which get an interned name and a dedicated slot in GCDWebServerHeaderMap
+typedef NS_ENUM(NSInteger, GCDWebServerHeader) {
+  kGCDWebServerHeader_Unknown = -1,
+  kGCDWebServerHeader_Accept = 0,
+  kGCDWebServerHeader_AcceptEncoding,
+  kGCDWebServerHeader_AcceptLanguage,
+  kGCDWebServerHeader_Authorization,
+  kGCDWebServerHeader_CacheControl,
+  kGCDWebServerHeader_Connection,
+  kGCDWebServerHeader_ContentEncoding,
+  kGCDWebServerHeader_ContentLength,
+  kGCDWebServerHeader_ContentType,
+  kGCDWebServerHeader_Cookie,
+  kGCDWebServerHeader_Expect,
+  kGCDWebServerHeader_Host,
+  kGCDWebServerHeader_IfMatch,
+  kGCDWebServerHeader_IfModifiedSince,
+  kGCDWebServerHeader_IfNoneMatch,
+  kGCDWebServerHeader_IfRange,
+  kGCDWebServerHeader_IfUnmodifiedSince,
+  kGCDWebServerHeader_LastEventID,
+  kGCDWebServerHeader_Origin,
+  kGCDWebServerHeader_Range,
+  kGCDWebServerHeader_Referer,
+  kGCDWebServerHeader_SecWebSocketKey,
+  kGCDWebServerHeader_SecWebSocketProtocol,
+  kGCDWebServerHeader_SecWebSocketVersion,
+  kGCDWebServerHeader_TraceParent,
+  kGCDWebServerHeader_TransferEncoding,
+  kGCDWebServerHeader_Upgrade,
+  kGCDWebServerHeader_UserAgent,
+  kGCDWebServerHeader_XForwardedFor,
+  kGCDWebServerHeaderCount
+};
+
+// Immutable NSDictionary over the raw header block of a request which keeps names and values as byte ranges in the parse buffer:
+// lookups are case-insensitive, duplicate headers are combined and values are only converted to NSStrings on first access
+@interface GCDWebServerHeaderMap : NSDictionary<NSString*, NSString*>
+- (nullable instancetype)initWithData:(NSData*)data length:(NSUInteger)length;  // "data" starts with the request line and must not be mutated afterwards - Returns nil if malformed
+- (nullable NSString*)valueForHeader:(GCDWebServerHeader)header;
+@end
+
+NSString* GCDWebServerGetHeaderName(GCDWebServerHeader header);
+NSString* _Nullable GCDWebServerGetHeaderValue(NSDictionary<NSString*, NSString*>* headers, GCDWebServerHeader header);  // Uses the slot lookup for GCDWebServerHeaderMap or falls back to -objectForKey:
+
 @interface GCDWebServerRequest ()
 @property(nonatomic, readonly) BOOL usesChunkedTransferEncoding;
+@property(nonatomic, readonly) BOOL hasEvaluatedPreconditions;
 @property(nonatomic) NSData* localAddressData;
 @property(nonatomic) NSData* remoteAddressData;
 - (void)prepareForWriting;
@@ -212,13 +403,33 @@ extern NSString* GCDWebServerStringFromSockAddr(const struct sockaddr* addr, BOO
 - (void)setAttribute:(nullable id)attribute forKey:(NSString*)key;
 @end
 
+@interface GCDWebServerDataResponse ()
+@property(nonatomic, readonly) NSData* data;
+- (GCDWebServerDataResponse*)copyResponse;  // Must be called before the response is prepared for reading
+@end
+
 @interface GCDWebServerResponse ()
 @property(nonatomic, readonly) NSDictionary<NSString*, NSString*>* additionalHeaders;
 @property(nonatomic, readonly) BOOL usesChunkedTransferEncoding;
+@property(nonatomic) NSUInteger uncompressedBodyLength;  // Only set once a gzip encoded body has been fully sent
+@property(nonatomic) NSUInteger compressedBodyLength;
+- (void)restrictToByteRange:(NSRange)range;  // Absolute range within the body which must have a known length
 - (void)prepareForReading;
 - (BOOL)performOpen:(NSError**)error;
 - (void)performReadDataWithCompletion:(GCDWebServerBodyReaderCompletionBlock)block;
 - (void)performClose;
 @end
 
+@interface GCDWebServerWebSocketResponse : GCDWebServerResponse  // 101 response which upgrades the connection once sent
+@property(nonatomic, readonly) GCDWebServerWebSocketOpenBlock openBlock;
+@property(nonatomic, readonly) int compressionWindowBits;  // 0 if "permessage-deflate" was not negotiated
+@property(nonatomic, readonly) BOOL compressionResetsContext;
+- (instancetype)initWithOpenBlock:(GCDWebServerWebSocketOpenBlock)openBlock compressionWindowBits:(int)windowBits resetsContext:(BOOL)resetsContext;
+@end
+
+@interface GCDWebServerWebSocket ()
+- (instancetype)initWithConnection:(GCDWebServerConnection*)connection request:(GCDWebServerRequest*)request response:(GCDWebServerWebSocketResponse*)response;
+- (void)start;  // Must be called on the I/O queue of the connection once the response headers have been sent
+@end
+
 NS_ASSUME_NONNULL_END
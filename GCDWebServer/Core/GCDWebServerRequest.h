@@ -101,11 +101,18 @@ extern NSString* const GCDWebServerRequestAttribute_RegexCaptures;
 
 /**
  *  Returns the HTTP headers for the request.
+ *
+ *  For requests received by the server, lookups on header names are
+ *  case-insensitive and repeated headers are combined into a single value.
  */
 @property(nonatomic, readonly) NSDictionary<NSString*, NSString*>* headers;
 
 /**
  *  Returns the path component of the URL for the request.
+ *
+ *  The path is unescaped and canonicalized i.e. "//", "/./" and "/../"
+ *  components are resolved while a trailing slash is preserved. Requests
+ *  whose path would go above the root are rejected with a 400 status code.
  */
 @property(nonatomic, readonly) NSString* path;
 
@@ -147,18 +154,48 @@ extern NSString* const GCDWebServerRequestAttribute_RegexCaptures;
 @property(nonatomic, readonly, nullable) NSString* ifNoneMatch;
 
 /**
- *  Returns the parsed "Range" header or (NSUIntegerMax, 0) if absent or malformed.
+ *  Returns the "If-Match" header or nil if absent.
+ */
+@property(nonatomic, readonly, nullable) NSString* ifMatch;
+
+/**
+ *  Returns the parsed "If-Unmodified-Since" header or nil if absent or malformed.
+ */
+@property(nonatomic, readonly, nullable) NSDate* ifUnmodifiedSince;
+
+/**
+ *  Returns the parsed "Range" header or (NSUIntegerMax, 0) if absent, malformed
+ *  or containing multiple ranges (see byteRanges).
  *  The range will be set to (offset, length) if expressed from the beginning
  *  of the entity body, or (NSUIntegerMax, length) if expressed from its end.
  */
 @property(nonatomic, readonly) NSRange byteRange;
 
+/**
+ *  Returns all the ranges from the "Range" header in the order they appear and
+ *  using the same representation as the byteRange property (wrapped in NSValues),
+ *  or nil if the header is absent or malformed.
+ */
+@property(nonatomic, readonly, nullable) NSArray<NSValue*>* byteRanges;
+
 /**
  *  Returns YES if the client supports gzip content encoding according to the
  *  "Accept-Encoding" header.
  */
 @property(nonatomic, readonly) BOOL acceptsGzipContentEncoding;
 
+/**
+ *  Returns the "traceparent" header propagated by the client according to the
+ *  W3C Trace Context specification or nil if absent or malformed.
+ */
+@property(nonatomic, readonly, nullable) NSString* traceParent;
+
+/**
+ *  Returns the 32 hexadecimal characters trace ID from the "traceparent"
+ *  header or nil if absent or malformed.
+ */
+@property(nonatomic, readonly, nullable) NSString* traceID;
+
 /**
  *  Returns the address of the local peer (i.e. server) for the request
  *  as a raw "struct sockaddr".
@@ -198,6 +235,25 @@ extern NSString* const GCDWebServerRequestAttribute_RegexCaptures;
  */
 - (BOOL)hasByteRange;
 
+/**
+ *  Evaluates the "If-Match", "If-Unmodified-Since", "If-None-Match" and
+ *  "If-Modified-Since" preconditions of the request in the order defined by
+ *  RFC 7232 against the current state of the target resource. If-Match uses
+ *  the strong comparison and If-None-Match the weak one, and both accept
+ *  lists of entity tags as well as "*".
+ *
+ *  Handlers for state-changing methods like PUT or DELETE must call this
+ *  method before modifying the resource and return a response with the
+ *  returned status code if it's not 0. For GET and HEAD requests only,
+ *  GCDWebServer otherwise evaluates the preconditions against the eTag and
+ *  lastModifiedDate properties of the response returned by the handler,
+ *  before opening its body.
+ *
+ *  @return 304 (Not Modified), 412 (Precondition Failed) or 0 if the request
+ *  should be performed.
+ */
+- (NSInteger)statusCodeForPreconditionsWithETag:(nullable NSString*)eTag lastModifiedDate:(nullable NSDate*)lastModifiedDate resourceExists:(BOOL)exists;
+
 /**
  *  Retrieves an attribute associated with this request using the given key.
  *
@@ -29,6 +29,7 @@
 #error GCDWebServer requires ARC
 #endif
 
+#import <stdatomic.h>
 #import <zlib.h>
 
 #import "GCDWebServerPrivate.h"
@@ -134,11 +135,420 @@ NSString* const GCDWebServerRequestAttribute_RegexCaptures = @"GCDWebServerReque
 
 @end
 
+@implementation GCDWebServerLazyURLEncodedForm {
+  NSString* _string;
+  _Atomic(void*) _arguments;  // Retained NSDictionary once parsed
+}
+
+- (instancetype)initWithString:(NSString*)string {
+  if ((self = [super init])) {
+    _string = [string copy];
+  }
+  return self;
+}
+
+- (void)dealloc {
+  void* arguments = atomic_load(&_arguments);
+  if (arguments) {
+    CFRelease(arguments);
+  }
+}
+
+// Parses on first access from any thread: concurrent callers may parse more than once but only one result is kept
+- (NSDictionary*)_arguments {
+  void* arguments = atomic_load_explicit(&_arguments, memory_order_acquire);
+  if (arguments == NULL) {
+    void* parsedArguments = (void*)CFBridgingRetain(GCDWebServerParseURLEncodedForm(_string));
+    if (atomic_compare_exchange_strong_explicit(&_arguments, &arguments, parsedArguments, memory_order_acq_rel, memory_order_acquire)) {
+      arguments = parsedArguments;
+    } else {
+      CFRelease(parsedArguments);
+    }
+  }
+  return (__bridge NSDictionary*)arguments;
+}
+
+- (NSUInteger)count {
+  return [self _arguments].count;
+}
+
+- (id)objectForKey:(id)key {
+  return [[self _arguments] objectForKey:key];
+}
+
+- (NSEnumerator*)keyEnumerator {
+  return [[self _arguments] keyEnumerator];
+}
+
+- (id)copyWithZone:(NSZone*)zone {
+  return self;  // Immutable
+}
+
+@end
+
+typedef struct {
+  const char* name;
+  size_t length;
+  __unsafe_unretained NSString* key;
+} GCDWebServerHeaderName;
+
+#define _HEADER_NAME(__NAME__) \
+  { __NAME__, sizeof(__NAME__) - 1, @__NAME__ }
+
+static const GCDWebServerHeaderName _headerNames[kGCDWebServerHeaderCount] = {
+  _HEADER_NAME("Accept"),
+  _HEADER_NAME("Accept-Encoding"),
+  _HEADER_NAME("Accept-Language"),
+  _HEADER_NAME("Authorization"),
+  _HEADER_NAME("Cache-Control"),
+  _HEADER_NAME("Connection"),
+  _HEADER_NAME("Content-Encoding"),
+  _HEADER_NAME("Content-Length"),
+  _HEADER_NAME("Content-Type"),
+  _HEADER_NAME("Cookie"),
+  _HEADER_NAME("Expect"),
+  _HEADER_NAME("Host"),
+  _HEADER_NAME("If-Match"),
+  _HEADER_NAME("If-Modified-Since"),
+  _HEADER_NAME("If-None-Match"),
+  _HEADER_NAME("If-Range"),
+  _HEADER_NAME("If-Unmodified-Since"),
+  _HEADER_NAME("Last-Event-ID"),
+  _HEADER_NAME("Origin"),
+  _HEADER_NAME("Range"),
+  _HEADER_NAME("Referer"),
+  _HEADER_NAME("Sec-WebSocket-Key"),
+  _HEADER_NAME("Sec-WebSocket-Protocol"),
+  _HEADER_NAME("Sec-WebSocket-Version"),
+  _HEADER_NAME("traceparent"),
+  _HEADER_NAME("Transfer-Encoding"),
+  _HEADER_NAME("Upgrade"),
+  _HEADER_NAME("User-Agent"),
+  _HEADER_NAME("X-Forwarded-For")};
+
+#define kHeaderMapMaxHeaders 256
+
+typedef struct {
+  uint32_t nameOffset;
+  uint32_t nameLength;
+  uint32_t valueOffset;
+  uint32_t valueLength;
+  int32_t header;  // GCDWebServerHeader
+  int32_t next;  // Index of the next header with the same name or -1
+  BOOL duplicate;  // Not the first header with this name
+  _Atomic(void*) value;  // Retained NSString combining all headers with this name once materialized
+} GCDWebServerHeaderEntry;
+
+NSString* GCDWebServerGetHeaderName(GCDWebServerHeader header) {
+  GWS_DCHECK((header >= 0) && (header < kGCDWebServerHeaderCount));
+  return _headerNames[header].key;
+}
+
+NSString* GCDWebServerGetHeaderValue(NSDictionary<NSString*, NSString*>* headers, GCDWebServerHeader header) {
+  if ([headers isKindOfClass:[GCDWebServerHeaderMap class]]) {
+    return [(GCDWebServerHeaderMap*)headers valueForHeader:header];
+  }
+  return [headers objectForKey:_headerNames[header].key];
+}
+
+static GCDWebServerHeader _LookupHeader(const char* name, size_t length) {
+  for (GCDWebServerHeader header = 0; header < kGCDWebServerHeaderCount; ++header) {
+    if ((_headerNames[header].length == length) && !strncasecmp(_headerNames[header].name, name, length)) {
+      return header;
+    }
+  }
+  return kGCDWebServerHeader_Unknown;
+}
+
+// https://tools.ietf.org/html/rfc7230#section-3.2.6
+static inline BOOL _IsTokenCharacter(unsigned char c) {
+  if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+    return YES;
+  }
+  return (c != 0) && (strchr("!#$%&'*+-.^_`|~", c) != NULL);
+}
+
+// https://tools.ietf.org/html/rfc7230#section-3.3.2 - only digits, no sign, whitespace or list
+static BOOL _ParseContentLength(const char* bytes, NSUInteger length, NSUInteger* value) {
+  if (length == 0) {
+    return NO;
+  }
+  NSUInteger result = 0;
+  for (NSUInteger i = 0; i < length; ++i) {
+    if ((bytes[i] < '0') || (bytes[i] > '9')) {
+      return NO;
+    }
+    NSUInteger digit = bytes[i] - '0';
+    if (result > (NSUIntegerMax - 1 - digit) / 10) {  // NSUIntegerMax is the marker for unknown lengths
+      return NO;
+    }
+    result = result * 10 + digit;
+  }
+  *value = result;
+  return YES;
+}
+
+static NSString* _NewStringFromHeaderBytes(const char* bytes, NSUInteger length) {
+  NSString* string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+  if (string == nil) {
+    string = [[NSString alloc] initWithBytes:bytes length:length encoding:NSISOLatin1StringEncoding];  // Legacy clients may send obs-text
+  }
+  return string;
+}
+
+@implementation GCDWebServerHeaderMap {
+  NSData* _data;
+  GCDWebServerHeaderEntry* _entries;
+  NSUInteger _entryCount;
+  NSUInteger _uniqueCount;
+  int32_t _slots[kGCDWebServerHeaderCount];  // Index of the first entry for each well-known header or -1
+}
+
+- (instancetype)initWithData:(NSData*)data length:(NSUInteger)length {
+  GWS_DCHECK(length <= data.length);
+  if ((length > UINT32_MAX) || (length > data.length)) {
+    return nil;
+  }
+  if ((self = [super init])) {
+    _data = data;
+    for (NSUInteger i = 0; i < kGCDWebServerHeaderCount; ++i) {
+      _slots[i] = -1;
+    }
+
+    const char* bytes = data.bytes;
+    const char* end = bytes + length;
+    const char* line = memchr(bytes, '\n', length);  // Skip request line
+    if (line == NULL) {
+      return nil;
+    }
+    ++line;
+    NSUInteger capacity = 0;
+    for (const char* p = line; (p < end) && (p = memchr(p, '\n', end - p)); ++p) {
+      ++capacity;
+    }
+    if (capacity > kHeaderMapMaxHeaders + 1) {
+      GWS_LOG_WARNING(@"Too many request headers (%lu)", (unsigned long)capacity);
+      return nil;
+    }
+    _entries = calloc(MAX(capacity, 1), sizeof(GCDWebServerHeaderEntry));
+
+    while (line < end) {
+      const char* lineEnd = memchr(line, '\n', end - line);
+      if (lineEnd == NULL) {
+        return nil;
+      }
+      const char* contentEnd = ((lineEnd > line) && (lineEnd[-1] == '\r')) ? lineEnd - 1 : lineEnd;
+      if (contentEnd == line) {  // Empty line terminates headers
+        break;
+      }
+      if ((*line == ' ') || (*line == '\t')) {  // Reject obsolete line folding (https://tools.ietf.org/html/rfc7230#section-3.2.4)
+        return nil;
+      }
+      const char* colon = line;
+      while ((colon < contentEnd) && _IsTokenCharacter(*colon)) {
+        ++colon;
+      }
+      if ((colon == line) || (colon == contentEnd) || (*colon != ':')) {  // Also rejects whitespace before colon
+        return nil;
+      }
+      const char* value = colon + 1;
+      const char* valueEnd = contentEnd;
+      while ((value < valueEnd) && ((*value == ' ') || (*value == '\t'))) {
+        ++value;
+      }
+      while ((valueEnd > value) && ((valueEnd[-1] == ' ') || (valueEnd[-1] == '\t'))) {
+        --valueEnd;
+      }
+
+      GCDWebServerHeaderEntry* entry = &_entries[_entryCount];
+      entry->nameOffset = (uint32_t)(line - bytes);
+      entry->nameLength = (uint32_t)(colon - line);
+      entry->valueOffset = (uint32_t)(value - bytes);
+      entry->valueLength = (uint32_t)(valueEnd - value);
+      entry->header = (int32_t)_LookupHeader(line, entry->nameLength);
+      entry->next = -1;
+      int32_t first = -1;
+      if (entry->header != kGCDWebServerHeader_Unknown) {
+        first = _slots[entry->header];
+        if (first < 0) {
+          _slots[entry->header] = (int32_t)_entryCount;
+        }
+        if ((entry->header == kGCDWebServerHeader_ContentLength) || (entry->header == kGCDWebServerHeader_TransferEncoding)) {  // Conflicting framing headers allow request smuggling (https://tools.ietf.org/html/rfc7230#section-3.3.3)
+          NSUInteger contentLength;
+          if ((entry->header == kGCDWebServerHeader_ContentLength) && !_ParseContentLength(value, entry->valueLength, &contentLength)) {
+            GWS_LOG_WARNING(@"Invalid 'Content-Length' request header");
+            return nil;
+          }
+          if (first >= 0) {
+            if ((_entries[first].valueLength != entry->valueLength) || memcmp(bytes + _entries[first].valueOffset, value, entry->valueLength)) {
+              GWS_LOG_WARNING(@"Conflicting duplicate '%s' request headers", _headerNames[entry->header].name);
+              return nil;
+            }
+            line = lineEnd + 1;  // Identical duplicates are dropped so the value is never turned into a list
+            continue;
+          }
+        }
+      } else {
+        for (NSUInteger i = 0; i < _entryCount; ++i) {
+          GCDWebServerHeaderEntry* other = &_entries[i];
+          if (!other->duplicate && (other->header == kGCDWebServerHeader_Unknown) && (other->nameLength == entry->nameLength) && !strncasecmp(bytes + other->nameOffset, line, entry->nameLength)) {
+            first = (int32_t)i;
+            break;
+          }
+        }
+      }
+      if (first >= 0) {
+        int32_t last = first;
+        while (_entries[last].next >= 0) {
+          last = _entries[last].next;
+        }
+        _entries[last].next = (int32_t)_entryCount;
+        entry->duplicate = YES;
+      } else {
+        ++_uniqueCount;
+      }
+      ++_entryCount;
+      line = lineEnd + 1;
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  for (NSUInteger i = 0; i < _entryCount; ++i) {
+    void* value = atomic_load(&_entries[i].value);
+    if (value) {
+      CFRelease(value);
+    }
+  }
+  free(_entries);
+}
+
+// Materializes on first access from any thread: concurrent callers may convert more than once but only one result is kept
+- (NSString*)_valueAtIndex:(int32_t)index {
+  GCDWebServerHeaderEntry* entry = &_entries[index];
+  void* value = atomic_load_explicit(&entry->value, memory_order_acquire);
+  if (value == NULL) {
+    const char* bytes = _data.bytes;
+    NSString* string;
+    if (entry->next < 0) {
+      string = _NewStringFromHeaderBytes(bytes + entry->valueOffset, entry->valueLength);
+    } else {  // https://tools.ietf.org/html/rfc7230#section-3.2.2 except for "Cookie" (https://tools.ietf.org/html/rfc6265#section-5.4)
+      const char* separator = entry->header == kGCDWebServerHeader_Cookie ? "; " : ", ";
+      NSMutableData* data = [[NSMutableData alloc] init];
+      for (int32_t i = index; i >= 0; i = _entries[i].next) {
+        if (i != index) {
+          [data appendBytes:separator length:2];
+        }
+        [data appendBytes:(bytes + _entries[i].valueOffset) length:_entries[i].valueLength];
+      }
+      string = _NewStringFromHeaderBytes(data.bytes, data.length);
+    }
+    void* newValue = (void*)CFBridgingRetain(string);
+    if (atomic_compare_exchange_strong_explicit(&entry->value, &value, newValue, memory_order_acq_rel, memory_order_acquire)) {
+      value = newValue;
+    } else {
+      CFRelease(newValue);
+    }
+  }
+  return (__bridge NSString*)value;
+}
+
+- (NSString*)valueForHeader:(GCDWebServerHeader)header {
+  GWS_DCHECK((header >= 0) && (header < kGCDWebServerHeaderCount));
+  int32_t index = _slots[header];
+  return index >= 0 ? [self _valueAtIndex:index] : nil;
+}
+
+- (NSUInteger)count {
+  return _uniqueCount;
+}
+
+- (id)objectForKey:(id)key {
+  if (![key isKindOfClass:[NSString class]]) {
+    return nil;
+  }
+  const char* name = [(NSString*)key UTF8String];
+  size_t length = strlen(name);
+  const char* bytes = _data.bytes;
+  for (NSUInteger i = 0; i < _entryCount; ++i) {
+    GCDWebServerHeaderEntry* entry = &_entries[i];
+    if (!entry->duplicate && (entry->nameLength == length) && !strncasecmp(bytes + entry->nameOffset, name, length)) {
+      return [self _valueAtIndex:(int32_t)i];
+    }
+  }
+  return nil;
+}
+
+- (NSEnumerator*)keyEnumerator {
+  NSMutableArray* keys = [[NSMutableArray alloc] initWithCapacity:_uniqueCount];
+  const char* bytes = _data.bytes;
+  for (NSUInteger i = 0; i < _entryCount; ++i) {
+    GCDWebServerHeaderEntry* entry = &_entries[i];
+    if (!entry->duplicate) {
+      if (entry->header != kGCDWebServerHeader_Unknown) {
+        [keys addObject:_headerNames[entry->header].key];
+      } else {
+        [keys addObject:[[NSString alloc] initWithBytes:(bytes + entry->nameOffset) length:entry->nameLength encoding:NSASCIIStringEncoding]];
+      }
+    }
+  }
+  return [keys objectEnumerator];
+}
+
+- (id)copyWithZone:(NSZone*)zone {
+  return self;  // Immutable
+}
+
+@end
+
 @implementation GCDWebServerRequest {
   BOOL _opened;
   NSMutableArray<GCDWebServerBodyDecoder*>* _decoders;
   id<GCDWebServerBodyWriter> __unsafe_unretained _writer;
   NSMutableDictionary<NSString*, id>* _attributes;
+  BOOL _parsedIfModifiedSince;
+  NSDate* _ifModifiedSince;
+  BOOL _parsedIfUnmodifiedSince;
+  NSDate* _ifUnmodifiedSince;
+  BOOL _parsedByteRange;
+  NSRange _byteRange;
+  NSArray<NSValue*>* _byteRanges;
+  BOOL _parsedAcceptEncoding;
+  BOOL _acceptsGzipContentEncoding;
+  BOOL _parsedTraceParent;
+  NSString* _traceParent;
+  NSString* _traceID;
+}
+
+static inline BOOL _IsLowercaseHexString(const char* string, size_t length, BOOL allowAllZeros) {
+  BOOL allZeros = YES;
+  for (size_t i = 0; i < length; ++i) {
+    char c = string[i];
+    if (!(((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'f')))) {
+      return NO;
+    }
+    if (c != '0') {
+      allZeros = NO;
+    }
+  }
+  return allowAllZeros || !allZeros;
+}
+
+// https://www.w3.org/TR/trace-context/#traceparent-header
+static BOOL _IsValidTraceParent(NSString* traceParent) {
+  const char* string = traceParent.UTF8String;
+  size_t length = string ? strlen(string) : 0;
+  if ((length < 55) || (string[2] != '-') || (string[35] != '-') || (string[52] != '-')) {
+    return NO;
+  }
+  if (!_IsLowercaseHexString(string, 2, YES) || !strncmp(string, "ff", 2) || (!strncmp(string, "00", 2) && (length != 55))) {
+    return NO;
+  }
+  if ((length > 55) && (string[55] != '-')) {  // Future versions can only append fields
+    return NO;
+  }
+  return _IsLowercaseHexString(string + 3, 32, NO) && _IsLowercaseHexString(string + 36, 16, NO) && _IsLowercaseHexString(string + 53, 2, YES);
 }
 
 - (instancetype)initWithMethod:(NSString*)method url:(NSURL*)url headers:(NSDictionary<NSString*, NSString*>*)headers path:(NSString*)path query:(NSDictionary<NSString*, NSString*>*)query {
@@ -149,12 +559,14 @@ NSString* const GCDWebServerRequestAttribute_RegexCaptures = @"GCDWebServerReque
     _path = [path copy];
     _query = query;
 
-    _contentType = GCDWebServerNormalizeHeaderValue([_headers objectForKey:@"Content-Type"]);
-    _usesChunkedTransferEncoding = [GCDWebServerNormalizeHeaderValue([_headers objectForKey:@"Transfer-Encoding"]) isEqualToString:@"chunked"];
-    NSString* lengthHeader = [_headers objectForKey:@"Content-Length"];
+    // Only the headers needed to read the body are parsed upfront, the others on first access
+    _contentType = GCDWebServerNormalizeHeaderValue(GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_ContentType));
+    _usesChunkedTransferEncoding = [GCDWebServerNormalizeHeaderValue(GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_TransferEncoding)) isEqualToString:@"chunked"];
+    NSString* lengthHeader = GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_ContentLength);
     if (lengthHeader) {
-      NSInteger length = [lengthHeader integerValue];
-      if (_usesChunkedTransferEncoding || (length < 0)) {
+      NSUInteger length = 0;
+      const char* lengthString = [lengthHeader UTF8String];
+      if (_usesChunkedTransferEncoding || !lengthString || !_ParseContentLength(lengthString, strlen(lengthString), &length)) {
         GWS_LOG_WARNING(@"Invalid 'Content-Length' header '%@' for '%@' request on \"%@\"", lengthHeader, _method, _URL);
         GWS_DNOT_REACHED();
         return nil;
@@ -176,58 +588,226 @@ NSString* const GCDWebServerRequestAttribute_RegexCaptures = @"GCDWebServerReque
       _contentLength = NSUIntegerMax;
     }
 
-    NSString* modifiedHeader = [_headers objectForKey:@"If-Modified-Since"];
+    _decoders = [[NSMutableArray alloc] init];
+    _attributes = [[NSMutableDictionary alloc] init];
+  }
+  return self;
+}
+
+- (BOOL)hasBody {
+  return _contentType ? YES : NO;
+}
+
+- (NSDate*)ifModifiedSince {
+  if (!_parsedIfModifiedSince) {
+    NSString* modifiedHeader = GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_IfModifiedSince);
     if (modifiedHeader) {
       _ifModifiedSince = [GCDWebServerParseRFC822(modifiedHeader) copy];
     }
-    _ifNoneMatch = [_headers objectForKey:@"If-None-Match"];
-
-    _byteRange = NSMakeRange(NSUIntegerMax, 0);
-    NSString* rangeHeader = GCDWebServerNormalizeHeaderValue([_headers objectForKey:@"Range"]);
-    if (rangeHeader) {
-      if ([rangeHeader hasPrefix:@"bytes="]) {
-        NSArray* components = [[rangeHeader substringFromIndex:6] componentsSeparatedByString:@","];
-        if (components.count == 1) {
-          components = [(NSString*)[components firstObject] componentsSeparatedByString:@"-"];
-          if (components.count == 2) {
-            NSString* startString = [components objectAtIndex:0];
-            NSInteger startValue = [startString integerValue];
-            NSString* endString = [components objectAtIndex:1];
-            NSInteger endValue = [endString integerValue];
-            if (startString.length && (startValue >= 0) && endString.length && (endValue >= startValue)) {  // The second 500 bytes: "500-999"
-              _byteRange.location = startValue;
-              _byteRange.length = endValue - startValue + 1;
-            } else if (startString.length && (startValue >= 0)) {  // The bytes after 9500 bytes: "9500-"
-              _byteRange.location = startValue;
-              _byteRange.length = NSUIntegerMax;
-            } else if (endString.length && (endValue > 0)) {  // The final 500 bytes: "-500"
-              _byteRange.location = NSUIntegerMax;
-              _byteRange.length = endValue;
-            }
-          }
-        }
-      }
-      if ((_byteRange.location == NSUIntegerMax) && (_byteRange.length == 0)) {  // Ignore "Range" header if syntactically invalid
-        GWS_LOG_WARNING(@"Failed to parse 'Range' header \"%@\" for url: %@", rangeHeader, url);
+    _parsedIfModifiedSince = YES;
+  }
+  return _ifModifiedSince;
+}
+
+- (NSString*)ifNoneMatch {
+  return GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_IfNoneMatch);
+}
+
+- (NSString*)ifMatch {
+  return GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_IfMatch);
+}
+
+- (NSDate*)ifUnmodifiedSince {
+  if (!_parsedIfUnmodifiedSince) {
+    NSString* unmodifiedHeader = GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_IfUnmodifiedSince);
+    if (unmodifiedHeader) {
+      _ifUnmodifiedSince = [GCDWebServerParseRFC822(unmodifiedHeader) copy];
+    }
+    _parsedIfUnmodifiedSince = YES;
+  }
+  return _ifUnmodifiedSince;
+}
+
+// Values too large to be a valid offset into any file are clamped to NSUIntegerMax - 1 so they never collide with the NSUIntegerMax marker
+static BOOL _ScanByteRangeValue(const char** string, NSUInteger* value) {
+  const char* p = *string;
+  NSUInteger result = 0;
+  while ((*p >= '0') && (*p <= '9')) {
+    NSUInteger digit = *p - '0';
+    result = result > (NSUIntegerMax - 1 - digit) / 10 ? NSUIntegerMax - 1 : result * 10 + digit;
+    ++p;
+  }
+  if (p == *string) {
+    return NO;
+  }
+  *string = p;
+  *value = result;
+  return YES;
+}
+
+// https://tools.ietf.org/html/rfc7233#section-2.1
+static NSArray<NSValue*>* _ParseByteRanges(const char* string) {
+  if (strncasecmp(string, "bytes=", 6)) {
+    return nil;
+  }
+  NSMutableArray<NSValue*>* ranges = [[NSMutableArray alloc] init];
+  const char* p = string + 6;
+  while (1) {
+    while ((*p == ' ') || (*p == '\t')) {
+      ++p;
+    }
+    if (*p == ',') {  // Empty list elements are allowed
+      ++p;
+      continue;
+    }
+    if (*p == 0) {
+      break;
+    }
+    NSUInteger startValue = 0;
+    NSUInteger endValue = 0;
+    BOOL hasStart = _ScanByteRangeValue(&p, &startValue);
+    if (*p != '-') {
+      return nil;
+    }
+    ++p;
+    BOOL hasEnd = _ScanByteRangeValue(&p, &endValue);
+    NSRange range;
+    if (hasStart && hasEnd) {  // The second 500 bytes: "500-999"
+      if (endValue < startValue) {
+        return nil;
       }
+      range = NSMakeRange(startValue, endValue - startValue + 1);
+    } else if (hasStart) {  // The bytes after 9500 bytes: "9500-"
+      range = NSMakeRange(startValue, NSUIntegerMax);
+    } else if (hasEnd && (endValue > 0)) {  // The final 500 bytes: "-500"
+      range = NSMakeRange(NSUIntegerMax, endValue);
+    } else {
+      return nil;
+    }
+    if (ranges.count == kGCDWebServerMaxByteRanges) {
+      return nil;
+    }
+    [ranges addObject:[NSValue valueWithRange:range]];
+    while ((*p == ' ') || (*p == '\t')) {
+      ++p;
     }
+    if (*p == ',') {
+      ++p;
+    } else if (*p != 0) {
+      return nil;
+    }
+  }
+  return ranges.count ? ranges : nil;
+}
 
-    if ([[_headers objectForKey:@"Accept-Encoding"] rangeOfString:@"gzip"].location != NSNotFound) {
-      _acceptsGzipContentEncoding = YES;
+- (void)_parseByteRanges {
+  _byteRange = NSMakeRange(NSUIntegerMax, 0);
+  NSString* rangeHeader = GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_Range);
+  if (rangeHeader) {
+    _byteRanges = _ParseByteRanges(rangeHeader.UTF8String);
+    if (_byteRanges.count == 1) {
+      _byteRange = [_byteRanges[0] rangeValue];
+    } else if (_byteRanges == nil) {  // Ignore "Range" header if syntactically invalid
+      GWS_LOG_WARNING(@"Failed to parse 'Range' header \"%@\" for url: %@", rangeHeader, _URL);
     }
+  }
+  _parsedByteRange = YES;
+}
 
-    _decoders = [[NSMutableArray alloc] init];
-    _attributes = [[NSMutableDictionary alloc] init];
+- (NSRange)byteRange {
+  if (!_parsedByteRange) {
+    [self _parseByteRanges];
   }
-  return self;
+  return _byteRange;
 }
 
-- (BOOL)hasBody {
-  return _contentType ? YES : NO;
+- (NSArray<NSValue*>*)byteRanges {
+  if (!_parsedByteRange) {
+    [self _parseByteRanges];
+  }
+  return _byteRanges;
 }
 
 - (BOOL)hasByteRange {
-  return GCDWebServerIsValidByteRange(_byteRange);
+  return GCDWebServerIsValidByteRange(self.byteRange);
+}
+
+static BOOL _IsETagMatching(NSString* header, NSString* eTag, BOOL exists, BOOL weakComparison) {
+  if ([[header stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] isEqualToString:@"*"]) {
+    return exists;
+  }
+  return exists && GCDWebServerIsETagListMatching(header, eTag, weakComparison);
+}
+
+// HTTP dates have a 1 second resolution
+static inline NSTimeInterval _HTTPTime(NSDate* date) {
+  return floor(date.timeIntervalSince1970);
+}
+
+// https://tools.ietf.org/html/rfc7232#section-6
+- (NSInteger)statusCodeForPreconditionsWithETag:(NSString*)eTag lastModifiedDate:(NSDate*)lastModifiedDate resourceExists:(BOOL)exists {
+  _hasEvaluatedPreconditions = YES;
+  BOOL isSafe = [_method isEqualToString:@"GET"] || [_method isEqualToString:@"HEAD"];
+  NSString* ifMatch = self.ifMatch;
+  if (ifMatch) {
+    if (!_IsETagMatching(ifMatch, eTag, exists, NO)) {
+      return kGCDWebServerHTTPStatusCode_PreconditionFailed;
+    }
+  } else if (exists && lastModifiedDate && self.ifUnmodifiedSince) {
+    if (_HTTPTime(lastModifiedDate) > _HTTPTime(self.ifUnmodifiedSince)) {
+      return kGCDWebServerHTTPStatusCode_PreconditionFailed;
+    }
+  }
+  NSString* ifNoneMatch = self.ifNoneMatch;
+  if (ifNoneMatch) {
+    if (_IsETagMatching(ifNoneMatch, eTag, exists, YES)) {
+      return isSafe ? kGCDWebServerHTTPStatusCode_NotModified : kGCDWebServerHTTPStatusCode_PreconditionFailed;
+    }
+  } else if (isSafe && exists && lastModifiedDate && self.ifModifiedSince) {
+    if (_HTTPTime(lastModifiedDate) <= _HTTPTime(self.ifModifiedSince)) {
+      return kGCDWebServerHTTPStatusCode_NotModified;
+    }
+  }
+  return 0;
+}
+
+- (BOOL)acceptsGzipContentEncoding {
+  if (!_parsedAcceptEncoding) {
+    _acceptsGzipContentEncoding = [GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_AcceptEncoding) rangeOfString:@"gzip"].location != NSNotFound;
+    _parsedAcceptEncoding = YES;
+  }
+  return _acceptsGzipContentEncoding;
+}
+
+- (void)_parseTraceParent {
+  NSString* traceParentHeader = GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_TraceParent);
+  if (traceParentHeader == nil) {
+    traceParentHeader = [_headers objectForKey:@"Traceparent"];
+  }
+  if (traceParentHeader) {
+    traceParentHeader = [traceParentHeader stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    if (_IsValidTraceParent(traceParentHeader)) {
+      _traceParent = [traceParentHeader copy];
+      _traceID = [_traceParent substringWithRange:NSMakeRange(3, 32)];
+    } else {
+      GWS_LOG_WARNING(@"Ignoring invalid 'traceparent' header \"%@\" for url: %@", traceParentHeader, _URL);
+    }
+  }
+  _parsedTraceParent = YES;
+}
+
+- (NSString*)traceParent {
+  if (!_parsedTraceParent) {
+    [self _parseTraceParent];
+  }
+  return _traceParent;
+}
+
+- (NSString*)traceID {
+  if (!_parsedTraceParent) {
+    [self _parseTraceParent];
+  }
+  return _traceID;
 }
 
 - (id)attributeForKey:(NSString*)key {
@@ -248,7 +828,7 @@ NSString* const GCDWebServerRequestAttribute_RegexCaptures = @"GCDWebServerReque
 
 - (void)prepareForWriting {
   _writer = self;
-  if ([GCDWebServerNormalizeHeaderValue([self.headers objectForKey:@"Content-Encoding"]) isEqualToString:@"gzip"]) {
+  if ([GCDWebServerNormalizeHeaderValue(GCDWebServerGetHeaderValue(_headers, kGCDWebServerHeader_ContentEncoding)) isEqualToString:@"gzip"]) {
     GCDWebServerGZipDecoder* decoder = [[GCDWebServerGZipDecoder alloc] initWithRequest:self writer:_writer];
     [_decoders addObject:decoder];
     _writer = decoder;
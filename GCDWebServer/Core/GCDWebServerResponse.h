@@ -82,6 +82,16 @@ typedef void (^GCDWebServerBodyReaderCompletionBlock)(NSData* _Nullable data, NS
  */
 - (void)asyncReadDataWithCompletion:(GCDWebServerBodyReaderCompletionBlock)block;
 
+/**
+ *  If this method is implemented, it will be called right after -open: when
+ *  only a byte range of the body is sent, so that the reader can skip directly
+ *  to "offset" instead of having the skipped bytes read and discarded.
+ *
+ *  It should return YES on success or NO on failure and set the "error" argument
+ *  which is guaranteed to be non-NULL.
+ */
+- (BOOL)seekToOffset:(NSUInteger)offset error:(NSError**)error;
+
 @end
 
 /**
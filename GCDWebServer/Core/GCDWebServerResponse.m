@@ -42,6 +42,10 @@
 @interface GCDWebServerGZipEncoder : GCDWebServerBodyEncoder
 @end
 
+@interface GCDWebServerByteRangeEncoder : GCDWebServerBodyEncoder
+- (instancetype)initWithResponse:(GCDWebServerResponse* _Nonnull)response reader:(id<GCDWebServerBodyReader> _Nonnull)reader byteRange:(NSRange)range;
+@end
+
 @implementation GCDWebServerBodyEncoder {
   GCDWebServerResponse* __unsafe_unretained _response;
   id<GCDWebServerBodyReader> __unsafe_unretained _reader;
@@ -70,12 +74,14 @@
 @end
 
 @implementation GCDWebServerGZipEncoder {
+  GCDWebServerResponse* __unsafe_unretained _response;
   z_stream _stream;
   BOOL _finished;
 }
 
 - (instancetype)initWithResponse:(GCDWebServerResponse* _Nonnull)response reader:(id<GCDWebServerBodyReader> _Nonnull)reader {
   if ((self = [super initWithResponse:response reader:reader])) {
+    _response = response;
     response.contentLength = NSUIntegerMax;  // Make sure "Content-Length" header is not set since we don't know it
     [response setValue:@"gzip" forAdditionalHeader:@"Content-Encoding"];
   }
@@ -142,16 +148,110 @@
 }
 
 - (void)close {
+  if (_finished) {
+    _response.uncompressedBodyLength = (NSUInteger)_stream.total_in;
+    _response.compressedBodyLength = (NSUInteger)_stream.total_out;
+  }
   deflateEnd(&_stream);
   [super close];
 }
 
 @end
 
+// Skips and trims the body of the wrapped reader so that only a byte range of it is sent
+@implementation GCDWebServerByteRangeEncoder {
+  id<GCDWebServerBodyReader> __unsafe_unretained _reader;
+  NSUInteger _skippedLength;
+  NSUInteger _remainingLength;
+}
+
+- (instancetype)initWithResponse:(GCDWebServerResponse* _Nonnull)response reader:(id<GCDWebServerBodyReader> _Nonnull)reader byteRange:(NSRange)range {
+  if ((self = [super initWithResponse:response reader:reader])) {
+    _reader = reader;
+    _skippedLength = range.location;
+    _remainingLength = range.length;
+  }
+  return self;
+}
+
+- (BOOL)respondsToSelector:(SEL)selector {
+  if (selector == @selector(asyncReadDataWithCompletion:)) {  // Only read asynchronously if the wrapped reader does
+    return [_reader respondsToSelector:selector];
+  }
+  return [super respondsToSelector:selector];
+}
+
+- (BOOL)open:(NSError**)error {
+  if (![super open:error]) {
+    return NO;
+  }
+  if (_skippedLength && [_reader respondsToSelector:@selector(seekToOffset:error:)]) {
+    if (![_reader seekToOffset:_skippedLength error:error]) {
+      [super close];
+      return NO;
+    }
+    _skippedLength = 0;
+  }
+  return YES;
+}
+
+// Returns nil if all the data must be skipped
+- (NSData*)_processData:(NSData*)data {
+  if (_skippedLength) {
+    if (data.length <= _skippedLength) {
+      _skippedLength -= data.length;
+      return nil;
+    }
+    data = [data subdataWithRange:NSMakeRange(_skippedLength, data.length - _skippedLength)];
+    _skippedLength = 0;
+  }
+  if (data.length > _remainingLength) {
+    data = [data subdataWithRange:NSMakeRange(0, _remainingLength)];
+  }
+  _remainingLength -= data.length;
+  return data;
+}
+
+- (NSData*)readData:(NSError**)error {
+  while (_remainingLength) {
+    NSData* data = [super readData:error];
+    if (data.length == 0) {
+      return data;  // Error or body shorter than expected
+    }
+    data = [self _processData:data];
+    if (data) {
+      return data;
+    }
+  }
+  return [NSData data];
+}
+
+- (void)asyncReadDataWithCompletion:(GCDWebServerBodyReaderCompletionBlock)block {
+  if (_remainingLength == 0) {
+    block([NSData data], nil);
+    return;
+  }
+  [_reader asyncReadDataWithCompletion:^(NSData* data, NSError* error) {
+    if (data.length == 0) {
+      block(data, error);  // Error or body shorter than expected
+    } else {
+      NSData* processedData = [self _processData:data];
+      if (processedData) {
+        block(processedData, nil);
+      } else {
+        [self asyncReadDataWithCompletion:block];
+      }
+    }
+  }];
+}
+
+@end
+
 @implementation GCDWebServerResponse {
   BOOL _opened;
   NSMutableArray<GCDWebServerBodyEncoder*>* _encoders;
   id<GCDWebServerBodyReader> __unsafe_unretained _reader;
+  NSRange _bodyByteRange;
 }
 
 + (instancetype)response {
@@ -164,6 +264,7 @@
     _contentLength = NSUIntegerMax;
     _statusCode = kGCDWebServerHTTPStatusCode_OK;
     _cacheControlMaxAge = 0;
+    _bodyByteRange = NSMakeRange(NSUIntegerMax, 0);
     _additionalHeaders = [[NSMutableDictionary alloc] init];
     _encoders = [[NSMutableArray alloc] init];
   }
@@ -194,8 +295,22 @@
   ;
 }
 
+- (void)restrictToByteRange:(NSRange)range {
+  GWS_DCHECK(_contentLength != NSUIntegerMax);
+  GWS_DCHECK(range.location + range.length <= _contentLength);
+  [self setValue:[NSString stringWithFormat:@"bytes %lu-%lu/%lu", (unsigned long)range.location, (unsigned long)(range.location + range.length - 1), (unsigned long)_contentLength] forAdditionalHeader:@"Content-Range"];
+  _statusCode = kGCDWebServerHTTPStatusCode_PartialContent;
+  _contentLength = range.length;
+  _bodyByteRange = range;
+}
+
 - (void)prepareForReading {
   _reader = self;
+  if (GCDWebServerIsValidByteRange(_bodyByteRange)) {
+    GCDWebServerByteRangeEncoder* encoder = [[GCDWebServerByteRangeEncoder alloc] initWithResponse:self reader:_reader byteRange:_bodyByteRange];
+    [_encoders addObject:encoder];
+    _reader = encoder;
+  }
   if (_gzipContentEncodingEnabled) {
     GCDWebServerGZipEncoder* encoder = [[GCDWebServerGZipEncoder alloc] initWithResponse:self reader:_reader];
     [_encoders addObject:encoder];
@@ -0,0 +1,206 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#import "GCDWebServer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class GCDWebServerWebSocket;
+
+/**
+ *  Status codes sent in WebSocket close frames.
+ *
+ *  See https://tools.ietf.org/html/rfc6455#section-7.4.1 for details.
+ */
+typedef NS_ENUM(NSInteger, GCDWebServerWebSocketCloseCode) {
+  kGCDWebServerWebSocketCloseCode_Normal = 1000,
+  kGCDWebServerWebSocketCloseCode_GoingAway = 1001,
+  kGCDWebServerWebSocketCloseCode_ProtocolError = 1002,
+  kGCDWebServerWebSocketCloseCode_UnsupportedData = 1003,
+  kGCDWebServerWebSocketCloseCode_NoStatusReceived = 1005,  // Never sent
+  kGCDWebServerWebSocketCloseCode_AbnormalClosure = 1006,  // Never sent
+  kGCDWebServerWebSocketCloseCode_InvalidPayload = 1007,
+  kGCDWebServerWebSocketCloseCode_PolicyViolation = 1008,
+  kGCDWebServerWebSocketCloseCode_MessageTooBig = 1009,
+  kGCDWebServerWebSocketCloseCode_InternalError = 1011
+};
+
+/**
+ *  The GCDWebServerWebSocketOpenBlock is called once the WebSocket handshake
+ *  has been sent to the client and before any message is received.
+ *
+ *  This is the place to set the delegate and configure the WebSocket.
+ */
+typedef void (^GCDWebServerWebSocketOpenBlock)(GCDWebServerWebSocket* webSocket);
+
+/**
+ *  Delegate methods for GCDWebServerWebSocket.
+ *
+ *  All methods are called on a serial queue private to the WebSocket.
+ */
+@protocol GCDWebServerWebSocketDelegate <NSObject>
+@optional
+
+/**
+ *  This method is called when a complete text message has been received.
+ */
+- (void)webSocket:(GCDWebServerWebSocket*)webSocket didReceiveText:(NSString*)text;
+
+/**
+ *  This method is called when a complete binary message has been received.
+ */
+- (void)webSocket:(GCDWebServerWebSocket*)webSocket didReceiveData:(NSData*)data;
+
+/**
+ *  This method is called when a pong frame has been received.
+ */
+- (void)webSocket:(GCDWebServerWebSocket*)webSocket didReceivePongWithData:(NSData*)data;
+
+/**
+ *  This method is called when all queued messages have been written to the
+ *  socket after a call to -sendText: or -sendData: returned NO.
+ */
+- (void)webSocketDidDrainSendBuffer:(GCDWebServerWebSocket*)webSocket;
+
+/**
+ *  This method is called exactly once when the WebSocket is closed.
+ *
+ *  If the connection was lost without a close frame, the code is
+ *  kGCDWebServerWebSocketCloseCode_AbnormalClosure.
+ */
+- (void)webSocket:(GCDWebServerWebSocket*)webSocket didCloseWithCode:(NSInteger)code reason:(nullable NSString*)reason;
+
+@end
+
+/**
+ *  The GCDWebServerWebSocket class wraps a GCDWebServerConnection which was
+ *  upgraded to the WebSocket protocol (RFC 6455) by a handler added with
+ *  -addWebSocketHandlerForPath:openBlock:.
+ *
+ *  Frames are parsed and unmasked in place in the receive buffer, fragmented
+ *  messages are reassembled and pings are answered automatically. The
+ *  "permessage-deflate" extension (RFC 7692) is used if offered by the client.
+ *
+ *  The WebSocket keeps itself and its connection alive until it is closed.
+ *  The next frames are only read from the socket once the delegate has
+ *  processed the previous messages, so a slow delegate slows down the client
+ *  through TCP flow control instead of buffering an unbounded amount of data.
+ *
+ *  @warning Sending methods can be called from any thread.
+ */
+@interface GCDWebServerWebSocket : NSObject
+
+/**
+ *  Sets the delegate for the WebSocket.
+ */
+@property(nonatomic, weak, nullable) id<GCDWebServerWebSocketDelegate> delegate;
+
+/**
+ *  Returns the HTTP request which initiated the WebSocket handshake.
+ */
+@property(nonatomic, readonly) GCDWebServerRequest* request;
+
+/**
+ *  Returns YES if the "permessage-deflate" extension was negotiated.
+ */
+@property(nonatomic, readonly, getter=isCompressionEnabled) BOOL compressionEnabled;
+
+/**
+ *  Returns NO once a close frame has been sent or received or the connection
+ *  was lost.
+ */
+@property(nonatomic, readonly, getter=isOpen) BOOL open;
+
+/**
+ *  Returns the number of bytes queued for sending but not yet written to the
+ *  socket.
+ */
+@property(nonatomic, readonly) NSUInteger bufferedAmount;
+
+/**
+ *  Sets the maximum number of bytes that can be queued for sending before
+ *  -sendText: and -sendData: start returning NO.
+ *
+ *  The default value is 1 MiB.
+ */
+@property(nonatomic) NSUInteger maxBufferedAmount;
+
+/**
+ *  Sets the maximum size of a received message after reassembly and
+ *  decompression. Larger messages close the WebSocket with
+ *  kGCDWebServerWebSocketCloseCode_MessageTooBig.
+ *
+ *  The default value is 16 MiB.
+ */
+@property(nonatomic) NSUInteger maxMessageSize;
+
+/**
+ *  Sends a text message.
+ *
+ *  Returns NO if the WebSocket is not open or if the message was dropped
+ *  because the send buffer is full, in which case the delegate is notified
+ *  with -webSocketDidDrainSendBuffer: once it has been written out.
+ */
+- (BOOL)sendText:(NSString*)text;
+
+/**
+ *  Sends a binary message.
+ *
+ *  Returns NO in the same cases as -sendText:.
+ */
+- (BOOL)sendData:(NSData*)data;
+
+/**
+ *  Sends a ping frame with up to 125 bytes of application data.
+ *
+ *  Pings are never subject to the send buffer limit.
+ */
+- (void)sendPingWithData:(nullable NSData*)data;
+
+/**
+ *  Starts the closing handshake. The connection is closed once the client
+ *  has replied with its own close frame or after a few seconds otherwise.
+ */
+- (void)closeWithCode:(NSInteger)code reason:(nullable NSString*)reason;
+
+@end
+
+@interface GCDWebServer (WebSockets)
+
+/**
+ *  Adds a handler to the server to accept WebSocket connections on a
+ *  specific case-insensitive path.
+ *
+ *  Requests which are not valid WebSocket handshakes are answered with a
+ *  400 or 426 HTTP status code.
+ */
+- (void)addWebSocketHandlerForPath:(NSString*)path openBlock:(GCDWebServerWebSocketOpenBlock)block;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,770 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !__has_feature(objc_arc)
+#error GCDWebServer requires ARC
+#endif
+
+#import <CommonCrypto/CommonDigest.h>
+#import <stdatomic.h>
+#import <zlib.h>
+
+#import "GCDWebServerPrivate.h"
+
+#define kDefaultMaxBufferedAmount (1 * 1024 * 1024)
+#define kDefaultMaxMessageSize (16 * 1024 * 1024)
+#define kReceiveBufferCapacity (64 * 1024)
+#define kMinCompressedPayloadLength 128  // Smaller messages are not worth compressing
+#define kClosingHandshakeTimeout (5 * NSEC_PER_SEC)
+
+// https://tools.ietf.org/html/rfc6455#section-5.2
+typedef NS_ENUM(uint8_t, GCDWebServerWebSocketOpcode) {
+  kGCDWebServerWebSocketOpcode_Continuation = 0x0,
+  kGCDWebServerWebSocketOpcode_Text = 0x1,
+  kGCDWebServerWebSocketOpcode_Binary = 0x2,
+  kGCDWebServerWebSocketOpcode_Close = 0x8,
+  kGCDWebServerWebSocketOpcode_Ping = 0x9,
+  kGCDWebServerWebSocketOpcode_Pong = 0xA
+};
+
+static const uint8_t _deflateTrailer[4] = {0x00, 0x00, 0xFF, 0xFF};
+
+// https://tools.ietf.org/html/rfc6455#section-5.3 - Works on 8 bytes at a time as the mask repeats every 4 bytes
+static void _UnmaskBytes(uint8_t* bytes, size_t length, const uint8_t* mask) {
+  uint32_t mask32;
+  memcpy(&mask32, mask, sizeof(mask32));
+  uint64_t mask64 = ((uint64_t)mask32 << 32) | mask32;
+  size_t i = 0;
+  for (; i + sizeof(mask64) <= length; i += sizeof(mask64)) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));  // Compiles to unaligned loads and stores
+    word ^= mask64;
+    memcpy(bytes + i, &word, sizeof(word));
+  }
+  for (; i < length; ++i) {
+    bytes[i] ^= mask[i % 4];
+  }
+}
+
+// https://tools.ietf.org/html/rfc6455#section-7.4
+static BOOL _IsValidReceivedCloseCode(NSInteger code) {
+  if ((code >= 1000) && (code <= 1014)) {
+    return (code != 1004) && (code != 1005) && (code != 1006);
+  }
+  return (code >= 3000) && (code <= 4999);
+}
+
+static BOOL _HeaderContainsToken(NSString* value, NSString* token) {
+  for (NSString* item in [value componentsSeparatedByString:@","]) {
+    if ([[item stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] caseInsensitiveCompare:token] == NSOrderedSame) {
+      return YES;
+    }
+  }
+  return NO;
+}
+
+// https://tools.ietf.org/html/rfc7692#section-7.1 - Accepts the first acceptable offer and returns nil if there is none
+static NSString* _NegotiateDeflateExtension(NSString* header, int* windowBits, BOOL* resetsContext) {
+  NSCharacterSet* whitespaceCharacterSet = [NSCharacterSet whitespaceCharacterSet];
+  for (NSString* offer in [header componentsSeparatedByString:@","]) {
+    NSArray<NSString*>* parameters = [offer componentsSeparatedByString:@";"];
+    if ([[parameters.firstObject stringByTrimmingCharactersInSet:whitespaceCharacterSet] caseInsensitiveCompare:@"permessage-deflate"] != NSOrderedSame) {
+      continue;
+    }
+    BOOL acceptable = YES;
+    BOOL noContextTakeover = NO;
+    int maxWindowBits = 0;
+    for (NSUInteger i = 1; acceptable && (i < parameters.count); ++i) {
+      NSString* name = [parameters[i] stringByTrimmingCharactersInSet:whitespaceCharacterSet];
+      NSString* value = nil;
+      NSRange range = [name rangeOfString:@"="];
+      if (range.location != NSNotFound) {
+        value = [[name substringFromIndex:(range.location + 1)] stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@" \t\""]];
+        name = [[name substringToIndex:range.location] stringByTrimmingCharactersInSet:whitespaceCharacterSet];
+      }
+      if ([name isEqualToString:@"server_no_context_takeover"] && !value) {
+        noContextTakeover = YES;
+      } else if ([name isEqualToString:@"server_max_window_bits"] && value) {
+        maxWindowBits = value.intValue;
+        acceptable = (maxWindowBits >= 9) && (maxWindowBits <= MAX_WBITS);  // zlib does not support 8 bits windows for raw deflate streams
+      } else if ([name isEqualToString:@"client_no_context_takeover"] || [name isEqualToString:@"client_max_window_bits"]) {
+        // Nothing to do as the inflater always uses the largest window and keeps its context
+      } else {
+        acceptable = NO;
+      }
+    }
+    if (acceptable) {
+      NSMutableString* response = [NSMutableString stringWithString:@"permessage-deflate"];
+      if (noContextTakeover) {
+        [response appendString:@"; server_no_context_takeover"];
+      }
+      if (maxWindowBits) {
+        [response appendFormat:@"; server_max_window_bits=%i", maxWindowBits];
+      }
+      *windowBits = maxWindowBits ? maxWindowBits : MAX_WBITS;
+      *resetsContext = noContextTakeover;
+      return response;
+    }
+  }
+  return nil;
+}
+
+@implementation GCDWebServerWebSocketResponse
+
+- (instancetype)initWithOpenBlock:(GCDWebServerWebSocketOpenBlock)openBlock compressionWindowBits:(int)windowBits resetsContext:(BOOL)resetsContext {
+  if ((self = [super initWithStatusCode:kGCDWebServerHTTPStatusCode_SwitchingProtocols])) {
+    _openBlock = [openBlock copy];
+    _compressionWindowBits = windowBits;
+    _compressionResetsContext = resetsContext;
+  }
+  return self;
+}
+
+@end
+
+// https://tools.ietf.org/html/rfc6455#section-4.2
+static GCDWebServerResponse* _CreateHandshakeResponse(GCDWebServerRequest* request, GCDWebServerWebSocketOpenBlock openBlock) {
+  NSDictionary<NSString*, NSString*>* headers = request.headers;
+  if (!_HeaderContainsToken(GCDWebServerGetHeaderValue(headers, kGCDWebServerHeader_Upgrade), @"websocket") || !_HeaderContainsToken(GCDWebServerGetHeaderValue(headers, kGCDWebServerHeader_Connection), @"upgrade")) {
+    GCDWebServerResponse* response = [GCDWebServerErrorResponse responseWithClientError:kGCDWebServerHTTPStatusCode_UpgradeRequired message:@"WebSocket handshake required"];
+    [response setValue:@"websocket" forAdditionalHeader:@"Upgrade"];
+    return response;
+  }
+  if (![GCDWebServerGetHeaderValue(headers, kGCDWebServerHeader_SecWebSocketVersion) isEqualToString:@"13"]) {
+    GCDWebServerResponse* response = [GCDWebServerErrorResponse responseWithClientError:kGCDWebServerHTTPStatusCode_UpgradeRequired message:@"Unsupported WebSocket version"];
+    [response setValue:@"13" forAdditionalHeader:@"Sec-WebSocket-Version"];
+    return response;
+  }
+  NSString* key = GCDWebServerGetHeaderValue(headers, kGCDWebServerHeader_SecWebSocketKey);
+  if ([[NSData alloc] initWithBase64EncodedString:(key ?: @"") options:0].length != 16) {
+    return [GCDWebServerErrorResponse responseWithClientError:kGCDWebServerHTTPStatusCode_BadRequest message:@"Invalid WebSocket key"];
+  }
+
+  NSData* acceptData = [[key stringByAppendingString:@"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"] dataUsingEncoding:NSUTF8StringEncoding];
+  unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+  CC_SHA1(acceptData.bytes, (CC_LONG)acceptData.length, digest);
+  int windowBits = 0;
+  BOOL resetsContext = NO;
+  NSString* extension = _NegotiateDeflateExtension([headers objectForKey:@"Sec-WebSocket-Extensions"], &windowBits, &resetsContext);
+  GCDWebServerWebSocketResponse* response = [[GCDWebServerWebSocketResponse alloc] initWithOpenBlock:openBlock compressionWindowBits:windowBits resetsContext:resetsContext];
+  [response setValue:@"websocket" forAdditionalHeader:@"Upgrade"];
+  [response setValue:@"Upgrade" forAdditionalHeader:@"Connection"];  // Replaces the built-in "Connection: Close" header
+  [response setValue:[[NSData dataWithBytes:digest length:sizeof(digest)] base64EncodedStringWithOptions:0] forAdditionalHeader:@"Sec-WebSocket-Accept"];
+  if (extension) {
+    [response setValue:extension forAdditionalHeader:@"Sec-WebSocket-Extensions"];
+  }
+  return response;
+}
+
+@implementation GCDWebServerWebSocket {
+  GCDWebServerConnection* _connection;  // Released once closed
+  dispatch_queue_t _ioQueue;
+  dispatch_queue_t _delegateQueue;
+  GCDWebServerWebSocketOpenBlock _openBlock;
+  z_stream _deflateStream;
+  z_stream _inflateStream;
+  BOOL _deflateInitialized;
+  BOOL _inflateInitialized;
+  BOOL _deflateResetsContext;
+  atomic_bool _open;
+  atomic_bool _needsDrainNotification;
+  _Atomic(NSUInteger) _bufferedAmount;
+
+  // Accessed on _ioQueue only
+  NSMutableData* _receiveBuffer;
+  NSMutableData* _messageData;  // Only set while receiving a fragmented message
+  GCDWebServerWebSocketOpcode _messageOpcode;
+  BOOL _messageCompressed;
+  NSMutableArray<NSData*>* _pendingFrames;
+  BOOL _writing;
+  BOOL _closeSent;
+  BOOL _closesAfterCloseFrame;
+  BOOL _closed;
+  NSInteger _closeCode;  // From the first close frame sent or received
+  NSString* _closeReason;
+}
+
+- (instancetype)initWithConnection:(GCDWebServerConnection*)connection request:(GCDWebServerRequest*)request response:(GCDWebServerWebSocketResponse*)response {
+  if ((self = [super init])) {
+    _connection = connection;
+    _request = request;
+    _ioQueue = connection.ioQueue;
+    _delegateQueue = dispatch_queue_create([NSStringFromClass([self class]) UTF8String], DISPATCH_QUEUE_SERIAL);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_retain(_ioQueue);
+#endif
+    _openBlock = response.openBlock;
+    _maxBufferedAmount = kDefaultMaxBufferedAmount;
+    _maxMessageSize = kDefaultMaxMessageSize;
+    atomic_init(&_open, true);
+    atomic_init(&_needsDrainNotification, false);
+    atomic_init(&_bufferedAmount, 0);
+    _receiveBuffer = [[NSMutableData alloc] initWithCapacity:kReceiveBufferCapacity];
+    _pendingFrames = [[NSMutableArray alloc] init];
+
+    if (response.compressionWindowBits) {
+      _compressionEnabled = YES;
+      _deflateResetsContext = response.compressionResetsContext;
+      _deflateInitialized = (deflateInit2(&_deflateStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -response.compressionWindowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK);  // Negative window bits for raw deflate streams
+      _inflateInitialized = (inflateInit2(&_inflateStream, -MAX_WBITS) == Z_OK);
+    }
+  }
+  return self;
+}
+
+- (void)dealloc {
+  if (_deflateInitialized) {
+    deflateEnd(&_deflateStream);
+  }
+  if (_inflateInitialized) {
+    inflateEnd(&_inflateStream);
+  }
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+  dispatch_release(_delegateQueue);
+  dispatch_release(_ioQueue);
+#endif
+}
+
+- (BOOL)isOpen {
+  return atomic_load(&_open);
+}
+
+- (NSUInteger)bufferedAmount {
+  return atomic_load(&_bufferedAmount);
+}
+
+// Always called on _ioQueue
+- (void)start {
+  if (_compressionEnabled && (!_deflateInitialized || !_inflateInitialized)) {
+    GWS_LOG_ERROR(@"Failed initializing WebSocket compression");
+    [self _failWithCode:kGCDWebServerWebSocketCloseCode_InternalError];
+    return;
+  }
+  GCDWebServerWebSocketOpenBlock openBlock = _openBlock;
+  _openBlock = nil;
+  dispatch_async(_delegateQueue, ^{
+    @autoreleasepool {
+      openBlock(self);
+    }
+    dispatch_async(self->_ioQueue, ^{  // The delegate must be set before receiving the first message
+      [self _readFrames];
+    });
+  });
+}
+
+#pragma mark - Receiving
+
+// Always called on _ioQueue
+- (void)_readFrames {
+  if (_closed) {
+    return;
+  }
+  [_connection readUpgradedData:_receiveBuffer
+                completionBlock:^(BOOL success) {
+                  if (success) {
+                    [self _processReceiveBuffer];
+                  } else {
+                    [self _finish];
+                  }
+                }];
+}
+
+// Always called on _ioQueue - Frames are unmasked in place in the receive buffer and only copied once complete
+- (void)_processReceiveBuffer {
+  uint8_t* bytes = _receiveBuffer.mutableBytes;
+  size_t length = _receiveBuffer.length;
+  size_t offset = 0;
+  BOOL didDeliver = NO;
+  while (!_closesAfterCloseFrame && !_closed) {  // Stop at the first close frame or error
+    uint8_t* frame = bytes + offset;
+    size_t available = length - offset;
+    if (available < 2) {
+      break;
+    }
+    BOOL isFinal = (frame[0] & 0x80) != 0;
+    BOOL isCompressed = (frame[0] & 0x40) != 0;
+    GCDWebServerWebSocketOpcode opcode = (GCDWebServerWebSocketOpcode)(frame[0] & 0x0F);
+    uint64_t payloadLength = frame[1] & 0x7F;
+    size_t headerLength = 2;
+    if (payloadLength == 126) {
+      if (available < 4) {
+        break;
+      }
+      payloadLength = ((uint64_t)frame[2] << 8) | frame[3];
+      headerLength = 4;
+    } else if (payloadLength == 127) {
+      if (available < 10) {
+        break;
+      }
+      payloadLength = 0;
+      for (size_t i = 2; i < 10; ++i) {
+        payloadLength = (payloadLength << 8) | frame[i];
+      }
+      headerLength = 10;
+    }
+
+    NSInteger errorCode = 0;
+    if (!(frame[1] & 0x80) || (frame[0] & 0x30)) {  // Clients must mask all frames and no extension uses RSV2 or RSV3
+      errorCode = kGCDWebServerWebSocketCloseCode_ProtocolError;
+    } else if (opcode & 0x08) {
+      if (!isFinal || isCompressed || (payloadLength > 125) || (opcode > kGCDWebServerWebSocketOpcode_Pong)) {
+        errorCode = kGCDWebServerWebSocketCloseCode_ProtocolError;
+      }
+    } else if (opcode == kGCDWebServerWebSocketOpcode_Continuation) {
+      if (!_messageData || isCompressed) {  // RSV1 is only set on the first frame of a compressed message
+        errorCode = kGCDWebServerWebSocketCloseCode_ProtocolError;
+      }
+    } else if ((opcode > kGCDWebServerWebSocketOpcode_Binary) || _messageData || (isCompressed && !_compressionEnabled)) {
+      errorCode = kGCDWebServerWebSocketCloseCode_ProtocolError;
+    }
+    if (!errorCode && !(opcode & 0x08) && (payloadLength > _maxMessageSize - _messageData.length)) {
+      errorCode = kGCDWebServerWebSocketCloseCode_MessageTooBig;
+    }
+    if (errorCode) {
+      [self _failWithCode:errorCode];
+      return;
+    }
+    headerLength += 4;
+    if ((available < headerLength) || (available - headerLength < payloadLength)) {
+      break;
+    }
+    uint8_t* payload = frame + headerLength;
+    _UnmaskBytes(payload, (size_t)payloadLength, payload - 4);
+    offset += headerLength + (size_t)payloadLength;
+
+    if (opcode & 0x08) {
+      [self _processControlFrameWithOpcode:opcode payload:payload length:(size_t)payloadLength];
+      didDeliver = YES;
+    } else if (opcode != kGCDWebServerWebSocketOpcode_Continuation) {
+      if (isFinal) {
+        didDeliver = [self _processMessage:[NSData dataWithBytes:payload length:(NSUInteger)payloadLength] opcode:opcode isCompressed:isCompressed];
+      } else {
+        _messageData = [[NSMutableData alloc] initWithBytes:payload length:(NSUInteger)payloadLength];
+        _messageOpcode = opcode;
+        _messageCompressed = isCompressed;
+      }
+    } else {
+      [_messageData appendBytes:payload length:(NSUInteger)payloadLength];
+      if (isFinal) {
+        NSData* data = _messageData;
+        _messageData = nil;
+        didDeliver = [self _processMessage:data opcode:_messageOpcode isCompressed:_messageCompressed];
+      }
+    }
+  }
+  if (_closesAfterCloseFrame || _closed) {
+    return;
+  }
+
+  if (offset == length) {
+    _receiveBuffer.length = 0;
+  } else if (offset > 0) {
+    [_receiveBuffer replaceBytesInRange:NSMakeRange(0, offset) withBytes:NULL length:0];
+  }
+  if (didDeliver) {
+    dispatch_async(_delegateQueue, ^{  // Don't read more frames until the delegate has caught up
+      dispatch_async(self->_ioQueue, ^{
+        [self _readFrames];
+      });
+    });
+  } else {
+    [self _readFrames];
+  }
+}
+
+// Always called on _ioQueue - Returns NO if the WebSocket was closed
+- (BOOL)_processMessage:(NSData*)data opcode:(GCDWebServerWebSocketOpcode)opcode isCompressed:(BOOL)isCompressed {
+  if (isCompressed) {
+    NSInteger errorCode = 0;
+    data = [self _inflatePayload:data errorCode:&errorCode];
+    if (data == nil) {
+      [self _failWithCode:errorCode];
+      return NO;
+    }
+  }
+  if (opcode == kGCDWebServerWebSocketOpcode_Text) {
+    NSString* text = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    if (text == nil) {
+      [self _failWithCode:kGCDWebServerWebSocketCloseCode_InvalidPayload];
+      return NO;
+    }
+    dispatch_async(_delegateQueue, ^{
+      id<GCDWebServerWebSocketDelegate> delegate = self.delegate;
+      if ([delegate respondsToSelector:@selector(webSocket:didReceiveText:)]) {
+        [delegate webSocket:self didReceiveText:text];
+      }
+    });
+  } else {
+    dispatch_async(_delegateQueue, ^{
+      id<GCDWebServerWebSocketDelegate> delegate = self.delegate;
+      if ([delegate respondsToSelector:@selector(webSocket:didReceiveData:)]) {
+        [delegate webSocket:self didReceiveData:data];
+      }
+    });
+  }
+  return YES;
+}
+
+// Always called on _ioQueue
+- (void)_processControlFrameWithOpcode:(GCDWebServerWebSocketOpcode)opcode payload:(const uint8_t*)payload length:(size_t)length {
+  switch (opcode) {
+    case kGCDWebServerWebSocketOpcode_Ping:
+      if (!_closeSent) {
+        [self _enqueueFrame:[self _frameWithOpcode:kGCDWebServerWebSocketOpcode_Pong payload:[NSData dataWithBytes:payload length:length] compress:NO] urgent:YES];
+      }
+      break;
+
+    case kGCDWebServerWebSocketOpcode_Pong: {
+      NSData* data = [NSData dataWithBytes:payload length:length];
+      dispatch_async(_delegateQueue, ^{
+        id<GCDWebServerWebSocketDelegate> delegate = self.delegate;
+        if ([delegate respondsToSelector:@selector(webSocket:didReceivePongWithData:)]) {
+          [delegate webSocket:self didReceivePongWithData:data];
+        }
+      });
+      break;
+    }
+
+    case kGCDWebServerWebSocketOpcode_Close: {
+      NSInteger code = kGCDWebServerWebSocketCloseCode_NoStatusReceived;
+      NSString* reason = nil;
+      if (length == 1) {
+        [self _failWithCode:kGCDWebServerWebSocketCloseCode_ProtocolError];
+        return;
+      }
+      if (length >= 2) {
+        code = ((NSInteger)payload[0] << 8) | payload[1];
+        reason = [[NSString alloc] initWithBytes:(payload + 2) length:(length - 2) encoding:NSUTF8StringEncoding];
+        if (!_IsValidReceivedCloseCode(code) || !reason) {
+          [self _failWithCode:(reason ? kGCDWebServerWebSocketCloseCode_ProtocolError : kGCDWebServerWebSocketCloseCode_InvalidPayload)];
+          return;
+        }
+      }
+      atomic_store(&_open, false);
+      if (!_closeCode) {
+        _closeCode = code;
+        _closeReason = reason.length ? reason : nil;
+      }
+      if (_closeSent) {
+        [self _finish];
+      } else {
+        _closesAfterCloseFrame = YES;
+        [self _sendCloseFrameWithCode:(length >= 2 ? code : 0) reason:nil];  // Echo the status code
+      }
+      break;
+    }
+
+    default:
+      GWS_DNOT_REACHED();
+      break;
+  }
+}
+
+// Always called on _ioQueue - Returns nil on error
+- (NSData*)_inflatePayload:(NSData*)payload errorCode:(NSInteger*)errorCode {
+  NSUInteger maxLength = _maxMessageSize;
+  NSMutableData* output = [[NSMutableData alloc] initWithLength:MIN(MAX(4 * payload.length, 4096), maxLength + 1)];
+  size_t produced = 0;
+  for (int pass = 0; pass < 2; ++pass) {  // https://tools.ietf.org/html/rfc7692#section-7.2.2
+    _inflateStream.next_in = (Bytef*)(pass ? _deflateTrailer : payload.bytes);
+    _inflateStream.avail_in = (uInt)(pass ? sizeof(_deflateTrailer) : payload.length);
+    do {
+      if (produced == output.length) {
+        if (produced > maxLength) {
+          *errorCode = kGCDWebServerWebSocketCloseCode_MessageTooBig;
+          return nil;
+        }
+        output.length = MIN(2 * produced, maxLength + 1);
+      }
+      _inflateStream.next_out = (Bytef*)output.mutableBytes + produced;
+      _inflateStream.avail_out = (uInt)(output.length - produced);
+      int result = inflate(&_inflateStream, Z_SYNC_FLUSH);
+      produced = output.length - _inflateStream.avail_out;
+      if (result == Z_STREAM_END) {  // Clients may end the deflate stream with a final block
+        inflateReset(&_inflateStream);
+      } else if ((result != Z_OK) && (result != Z_BUF_ERROR)) {
+        GWS_LOG_WARNING(@"Failed inflating WebSocket message (%i)", result);
+        *errorCode = kGCDWebServerWebSocketCloseCode_InvalidPayload;
+        return nil;
+      }
+    } while ((_inflateStream.avail_in > 0) || (_inflateStream.avail_out == 0));
+  }
+  if (produced > maxLength) {
+    *errorCode = kGCDWebServerWebSocketCloseCode_MessageTooBig;
+    return nil;
+  }
+  output.length = produced;
+  return output;
+}
+
+#pragma mark - Sending
+
+// Always called on _ioQueue - Returns nil on error
+- (NSData*)_deflatePayload:(NSData*)payload {
+  NSMutableData* output = [[NSMutableData alloc] initWithLength:(payload.length / 2 + 64)];
+  size_t produced = 0;
+  _deflateStream.next_in = (Bytef*)payload.bytes;
+  _deflateStream.avail_in = (uInt)payload.length;
+  while (1) {
+    if (produced == output.length) {
+      output.length = 2 * produced;
+    }
+    _deflateStream.next_out = (Bytef*)output.mutableBytes + produced;
+    _deflateStream.avail_out = (uInt)(output.length - produced);
+    int result = deflate(&_deflateStream, Z_SYNC_FLUSH);
+    produced = output.length - _deflateStream.avail_out;
+    if ((result != Z_OK) && (result != Z_BUF_ERROR)) {
+      GWS_LOG_ERROR(@"Failed deflating WebSocket message (%i)", result);
+      deflateReset(&_deflateStream);
+      return nil;
+    }
+    if ((_deflateStream.avail_in == 0) && (_deflateStream.avail_out > 0)) {
+      break;
+    }
+  }
+  if (_deflateResetsContext) {
+    deflateReset(&_deflateStream);
+  }
+  GWS_DCHECK((produced >= sizeof(_deflateTrailer)) && !memcmp((char*)output.bytes + produced - sizeof(_deflateTrailer), _deflateTrailer, sizeof(_deflateTrailer)));
+  output.length = produced - sizeof(_deflateTrailer);  // https://tools.ietf.org/html/rfc7692#section-7.2.1
+  return output;
+}
+
+// Always called on _ioQueue - Frames sent by servers are never masked
+- (NSData*)_frameWithOpcode:(GCDWebServerWebSocketOpcode)opcode payload:(NSData*)payload compress:(BOOL)compress {
+  if (compress) {
+    NSData* compressedPayload = [self _deflatePayload:payload];
+    if (compressedPayload) {
+      payload = compressedPayload;
+    } else {
+      compress = NO;
+    }
+  }
+  uint64_t length = payload.length;
+  uint8_t header[10];
+  size_t headerLength;
+  header[0] = (uint8_t)(0x80 | (compress ? 0x40 : 0x00) | opcode);
+  if (length < 126) {
+    header[1] = (uint8_t)length;
+    headerLength = 2;
+  } else if (length <= 0xFFFF) {
+    header[1] = 126;
+    header[2] = (uint8_t)(length >> 8);
+    header[3] = (uint8_t)length;
+    headerLength = 4;
+  } else {
+    header[1] = 127;
+    for (size_t i = 0; i < 8; ++i) {
+      header[2 + i] = (uint8_t)(length >> (56 - 8 * i));
+    }
+    headerLength = 10;
+  }
+  NSMutableData* frame = [[NSMutableData alloc] initWithCapacity:(headerLength + payload.length)];
+  [frame appendBytes:header length:headerLength];
+  [frame appendData:payload];
+  return frame;
+}
+
+// Always called on _ioQueue - Urgent frames skip ahead of the queued messages
+- (void)_enqueueFrame:(NSData*)frame urgent:(BOOL)urgent {
+  atomic_fetch_add(&_bufferedAmount, frame.length);
+  if (urgent) {
+    [_pendingFrames insertObject:frame atIndex:0];
+  } else {
+    [_pendingFrames addObject:frame];
+  }
+  [self _writeNextFrame];
+}
+
+// Always called on _ioQueue - Only one frame is written at a time so the write timeout of the connection applies to each of them
+- (void)_writeNextFrame {
+  if (_writing || !_connection || !_pendingFrames.count) {
+    return;
+  }
+  NSData* frame = _pendingFrames.firstObject;
+  [_pendingFrames removeObjectAtIndex:0];
+  _writing = YES;
+  [_connection writeUpgradedData:frame
+                 completionBlock:^(BOOL success) {
+                   self->_writing = NO;
+                   NSUInteger bufferedAmount = atomic_fetch_sub(&self->_bufferedAmount, frame.length) - frame.length;
+                   if (!success) {
+                     [self _finish];
+                   } else if ((((const uint8_t*)frame.bytes)[0] & 0x0F) == kGCDWebServerWebSocketOpcode_Close) {
+                     [self _didSendCloseFrame];
+                   } else {
+                     if (bufferedAmount == 0) {
+                       [self _notifyDrainIfNeeded];
+                     }
+                     [self _writeNextFrame];
+                   }
+                 }];
+}
+
+// Always called on _ioQueue
+- (void)_notifyDrainIfNeeded {
+  if ((atomic_load(&_bufferedAmount) == 0) && atomic_exchange(&_needsDrainNotification, false)) {
+    dispatch_async(_delegateQueue, ^{
+      id<GCDWebServerWebSocketDelegate> delegate = self.delegate;
+      if ([delegate respondsToSelector:@selector(webSocketDidDrainSendBuffer:)]) {
+        [delegate webSocketDidDrainSendBuffer:self];
+      }
+    });
+  }
+}
+
+- (BOOL)_sendMessage:(NSData*)data opcode:(GCDWebServerWebSocketOpcode)opcode {
+  if (!atomic_load(&_open)) {
+    return NO;
+  }
+  NSUInteger length = data.length;
+  NSUInteger bufferedAmount = atomic_fetch_add(&_bufferedAmount, length);
+  if (bufferedAmount && (bufferedAmount + length > _maxBufferedAmount)) {  // A message larger than the limit is still accepted if nothing else is queued
+    atomic_fetch_sub(&_bufferedAmount, length);
+    atomic_store(&_needsDrainNotification, true);
+    dispatch_async(_ioQueue, ^{  // In case the buffer drained in the meantime
+      [self _notifyDrainIfNeeded];
+    });
+    return NO;
+  }
+  dispatch_async(_ioQueue, ^{
+    atomic_fetch_sub(&self->_bufferedAmount, length);  // Replaced by the actual frame length
+    if (!self->_closeSent && !self->_closed) {
+      [self _enqueueFrame:[self _frameWithOpcode:opcode payload:data compress:(self->_compressionEnabled && (length >= kMinCompressedPayloadLength))] urgent:NO];
+    }
+  });
+  return YES;
+}
+
+- (BOOL)sendText:(NSString*)text {
+  return [self _sendMessage:[text dataUsingEncoding:NSUTF8StringEncoding] opcode:kGCDWebServerWebSocketOpcode_Text];
+}
+
+- (BOOL)sendData:(NSData*)data {
+  return [self _sendMessage:[data copy] opcode:kGCDWebServerWebSocketOpcode_Binary];
+}
+
+- (void)sendPingWithData:(NSData*)data {
+  GWS_DCHECK(data.length <= 125);
+  NSData* payload = data ? [data subdataWithRange:NSMakeRange(0, MIN(data.length, 125))] : [NSData data];
+  dispatch_async(_ioQueue, ^{
+    if (!self->_closeSent && !self->_closed) {
+      [self _enqueueFrame:[self _frameWithOpcode:kGCDWebServerWebSocketOpcode_Ping payload:payload compress:NO] urgent:YES];
+    }
+  });
+}
+
+#pragma mark - Closing
+
+- (void)closeWithCode:(NSInteger)code reason:(NSString*)reason {
+  dispatch_async(_ioQueue, ^{
+    if (!self->_closeSent && !self->_closed) {
+      [self _sendCloseFrameWithCode:code reason:reason];
+    }
+  });
+}
+
+// Always called on _ioQueue - A status code of 0 sends an empty close frame
+- (void)_sendCloseFrameWithCode:(NSInteger)code reason:(NSString*)reason {
+  GWS_DCHECK(!_closeSent);
+  _closeSent = YES;
+  atomic_store(&_open, false);
+  if (!_closeCode) {
+    _closeCode = code ? code : kGCDWebServerWebSocketCloseCode_NoStatusReceived;
+    _closeReason = reason;
+  }
+  NSMutableData* payload = [[NSMutableData alloc] init];
+  if (code) {
+    uint8_t bytes[2] = {(uint8_t)(code >> 8), (uint8_t)code};
+    [payload appendBytes:bytes length:sizeof(bytes)];
+    NSData* reasonData = [reason dataUsingEncoding:NSUTF8StringEncoding];
+    if (reasonData.length <= 123) {  // Control frame payloads are limited to 125 bytes
+      [payload appendData:reasonData];
+    }
+  }
+  [self _enqueueFrame:[self _frameWithOpcode:kGCDWebServerWebSocketOpcode_Close payload:payload compress:NO] urgent:NO];
+}
+
+// Always called on _ioQueue
+- (void)_didSendCloseFrame {
+  if (_closesAfterCloseFrame) {
+    [self _finish];
+  } else {
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kClosingHandshakeTimeout), _ioQueue, ^{  // Don't wait forever for the client to reply
+      [self _finish];
+    });
+  }
+}
+
+// Always called on _ioQueue - https://tools.ietf.org/html/rfc6455#section-7.1.7
+- (void)_failWithCode:(NSInteger)code {
+  GWS_LOG_WARNING(@"Failing WebSocket connection with status code %i", (int)code);
+  _messageData = nil;
+  if (_closeSent) {
+    [self _finish];
+  } else {
+    _closesAfterCloseFrame = YES;
+    [self _sendCloseFrameWithCode:code reason:nil];
+  }
+}
+
+// Always called on _ioQueue
+- (void)_finish {
+  if (_closed) {
+    return;
+  }
+  _closed = YES;
+  atomic_store(&_open, false);
+  [_pendingFrames removeAllObjects];
+  [_connection shutdownUpgradedConnection];  // Pending reads and writes fail which releases the connection
+  _connection = nil;
+
+  NSInteger code = _closeCode ? _closeCode : kGCDWebServerWebSocketCloseCode_AbnormalClosure;
+  NSString* reason = _closeReason;
+  GWS_LOG_DEBUG(@"WebSocket closed with status code %i", (int)code);
+  dispatch_async(_delegateQueue, ^{
+    id<GCDWebServerWebSocketDelegate> delegate = self.delegate;
+    if ([delegate respondsToSelector:@selector(webSocket:didCloseWithCode:reason:)]) {
+      [delegate webSocket:self didCloseWithCode:code reason:reason];
+    }
+  });
+}
+
+@end
+
+@implementation GCDWebServer (WebSockets)
+
+- (void)addWebSocketHandlerForPath:(NSString*)path openBlock:(GCDWebServerWebSocketOpenBlock)block {
+  [self addHandlerForMethod:@"GET"
+                       path:path
+               requestClass:[GCDWebServerRequest class]
+               processBlock:^GCDWebServerResponse*(GCDWebServerRequest* request) {
+                 return _CreateHandshakeResponse(request, block);
+               }];
+}
+
+@end
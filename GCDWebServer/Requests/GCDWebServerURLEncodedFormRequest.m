@@ -43,8 +43,13 @@
   }
 
   NSString* charset = GCDWebServerExtractHeaderValueParameter(self.contentType, @"charset");
-  NSString* string = [[NSString alloc] initWithData:self.data encoding:GCDWebServerStringEncodingFromCharset(charset)];
-  _arguments = GCDWebServerParseURLEncodedForm(string);
+  NSStringEncoding encoding = GCDWebServerStringEncodingFromCharset(charset);
+  if ((encoding == NSUTF8StringEncoding) || (encoding == NSASCIIStringEncoding)) {
+    _arguments = GCDWebServerParseURLEncodedFormBytes(self.data.bytes, self.data.length);  // Parse the body in place without creating an intermediary string
+  } else {
+    NSString* string = [[NSString alloc] initWithData:self.data encoding:encoding];
+    _arguments = string ? GCDWebServerParseURLEncodedForm(string) : @{};
+  }
   return YES;
 }
 
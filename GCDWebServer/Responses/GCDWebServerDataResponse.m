@@ -63,6 +63,24 @@
   return data;
 }
 
+- (GCDWebServerDataResponse*)copyResponse {
+  GCDWebServerDataResponse* response = [[GCDWebServerDataResponse alloc] initWithData:_data contentType:self.contentType];  // The data is shared, not copied
+  response.statusCode = self.statusCode;
+  response.cacheControlMaxAge = self.cacheControlMaxAge;
+  response.lastModifiedDate = self.lastModifiedDate;
+  response.eTag = self.eTag;
+  response.gzipContentEncodingEnabled = self.gzipContentEncodingEnabled;
+  [self.additionalHeaders enumerateKeysAndObjectsUsingBlock:^(NSString* key, NSString* value, BOOL* stop) {
+    [response setValue:value forAdditionalHeader:key];
+  }];
+  return response;
+}
+
+- (BOOL)seekToOffset:(NSUInteger)offset error:(NSError**)error {
+  _data = [_data subdataWithRange:NSMakeRange(offset, _data.length - offset)];
+  return YES;
+}
+
 - (NSString*)description {
   NSMutableString* description = [NSMutableString stringWithString:[super description]];
   [description appendString:@"\n\n"];
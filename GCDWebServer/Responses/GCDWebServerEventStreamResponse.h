@@ -0,0 +1,173 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#import "GCDWebServer.h"
+#import "GCDWebServerResponse.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Policies applied by GCDWebServerEventStreamResponse when a client reads
+ *  events slower than they are published and its queue is full.
+ */
+typedef NS_ENUM(int, GCDWebServerEventStreamOverflowPolicy) {
+  kGCDWebServerEventStreamOverflowPolicy_DropOldest = 0,  // Discard the oldest queued event
+  kGCDWebServerEventStreamOverflowPolicy_Disconnect  // Close the connection
+};
+
+/**
+ *  The GCDWebServerEventBroadcaster class publishes Server-Sent Events on a
+ *  topic to all the GCDWebServerEventStreamResponse instances subscribed to it.
+ *
+ *  Each event is serialized once and the resulting buffer is shared by all
+ *  subscribers without being copied, including when it is written to the
+ *  sockets.
+ *
+ *  Events are assigned consecutive numeric IDs and the most recent ones are
+ *  kept in a ring buffer so clients reconnecting with a "Last-Event-ID"
+ *  header receive the events they missed.
+ *
+ *  A comment line is sent at regular intervals to idle subscribers so
+ *  intermediaries don't time out the connections and disconnected clients
+ *  are detected.
+ *
+ *  @warning This class is thread-safe.
+ */
+@interface GCDWebServerEventBroadcaster : NSObject
+
+/**
+ *  Returns the maximum number of past events kept to resume streams.
+ */
+@property(nonatomic, readonly) NSUInteger historyCapacity;
+
+/**
+ *  Returns the interval in seconds between heartbeat comments.
+ */
+@property(nonatomic, readonly) NSTimeInterval heartbeatInterval;
+
+/**
+ *  Returns the number of subscribed responses.
+ */
+@property(nonatomic, readonly) NSUInteger subscriberCount;
+
+/**
+ *  Returns the ID of the last published event or 0 if none.
+ */
+@property(nonatomic, readonly) uint64_t lastEventID;
+
+/**
+ *  This method is the designated initializer for the class.
+ *
+ *  Pass 0 for "historyCapacity" to disable resuming streams and 0.0 for
+ *  "heartbeatInterval" to disable heartbeats.
+ */
+- (instancetype)initWithHistoryCapacity:(NSUInteger)historyCapacity heartbeatInterval:(NSTimeInterval)heartbeatInterval;
+
+/**
+ *  Creates a broadcaster keeping the last 256 events and sending a heartbeat
+ *  every 15 seconds.
+ */
+- (instancetype)init;
+
+/**
+ *  Publishes an event with an optional name to all subscribers.
+ *
+ *  Multiline data is split into multiple "data" fields. Returns the ID
+ *  assigned to the event.
+ */
+- (uint64_t)publishEvent:(nullable NSString*)event data:(NSString*)data;
+
+@end
+
+/**
+ *  The GCDWebServerEventStreamResponse subclass of GCDWebServerResponse
+ *  streams the events of a GCDWebServerEventBroadcaster as a
+ *  "text/event-stream" body until the client disconnects.
+ *
+ *  Events are queued per response while the client is reading previous ones.
+ *  The queue is bounded and the overflow policy decides what happens when a
+ *  slow client lets it fill up.
+ */
+@interface GCDWebServerEventStreamResponse : GCDWebServerResponse
+@property(nonatomic, copy) NSString* contentType;  // Redeclare as non-null
+
+/**
+ *  Returns the broadcaster this response is subscribed to.
+ */
+@property(nonatomic, readonly) GCDWebServerEventBroadcaster* broadcaster;
+
+/**
+ *  Sets the maximum number of events queued for the client.
+ *
+ *  The default value is 64.
+ *
+ *  @warning This must be set before the response is returned to GCDWebServer.
+ */
+@property(nonatomic) NSUInteger maxQueuedEvents;
+
+/**
+ *  Sets what happens when the queue is full.
+ *
+ *  The default value is kGCDWebServerEventStreamOverflowPolicy_DropOldest.
+ *
+ *  @warning This must be set before the response is returned to GCDWebServer.
+ */
+@property(nonatomic) GCDWebServerEventStreamOverflowPolicy overflowPolicy;
+
+/**
+ *  Returns the number of events dropped because the queue was full.
+ */
+@property(nonatomic, readonly) NSUInteger droppedEvents;
+
+/**
+ *  Creates a response subscribed to a broadcaster which resumes from the
+ *  "Last-Event-ID" header of the request if any.
+ */
++ (instancetype)responseWithBroadcaster:(GCDWebServerEventBroadcaster*)broadcaster request:(GCDWebServerRequest*)request;
+
+/**
+ *  This method is the designated initializer for the class.
+ *
+ *  If "lastEventID" is a valid event ID, the events published after it which
+ *  are still in the history of the broadcaster are sent first.
+ */
+- (instancetype)initWithBroadcaster:(GCDWebServerEventBroadcaster*)broadcaster lastEventID:(nullable NSString*)lastEventID;
+
+@end
+
+@interface GCDWebServer (EventStreams)
+
+/**
+ *  Adds a handler to the server to respond to incoming "GET" HTTP requests
+ *  on a given path with the events published by a broadcaster.
+ */
+- (void)addEventStreamHandlerForPath:(NSString*)path broadcaster:(GCDWebServerEventBroadcaster*)broadcaster;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,345 @@
+/*
+ Copyright (c) 2012-2019, Pierre-Olivier Latour
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * The name of Pierre-Olivier Latour may not be used to endorse
+ or promote products derived from this software without specific
+ prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL PIERRE-OLIVIER LATOUR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if !__has_feature(objc_arc)
+#error GCDWebServer requires ARC
+#endif
+
+#import <pthread.h>
+
+#import "GCDWebServerPrivate.h"
+
+#define kDefaultHistoryCapacity 256
+#define kDefaultHeartbeatInterval 15.0
+#define kDefaultMaxQueuedEvents 64
+
+static NSData* _heartbeatData = nil;
+
+@interface GCDWebServerEventSubscriber : NSObject
+@property(nonatomic, readonly) NSMutableArray<NSData*>* queue;
+@property(nonatomic, copy) GCDWebServerBodyReaderCompletionBlock pendingBlock;  // Set while the response waits for the next event
+@property(nonatomic, readonly) NSUInteger maxQueuedEvents;
+@property(nonatomic, readonly) GCDWebServerEventStreamOverflowPolicy overflowPolicy;
+@property(atomic) NSUInteger droppedEvents;
+@property(nonatomic) BOOL overflowed;
+@property(nonatomic) BOOL idle;  // Nothing was sent since the last heartbeat
+@end
+
+@implementation GCDWebServerEventSubscriber
+
+- (instancetype)initWithMaxQueuedEvents:(NSUInteger)maxQueuedEvents overflowPolicy:(GCDWebServerEventStreamOverflowPolicy)overflowPolicy {
+  if ((self = [super init])) {
+    _queue = [[NSMutableArray alloc] init];
+    _maxQueuedEvents = MAX(maxQueuedEvents, 1);
+    _overflowPolicy = overflowPolicy;
+  }
+  return self;
+}
+
+@end
+
+// https://html.spec.whatwg.org/multipage/server-sent-events.html#event-stream-interpretation
+static NSData* _SerializeEvent(uint64_t eventID, NSString* event, NSString* data) {
+  GWS_DCHECK(!event || ([event rangeOfCharacterFromSet:[NSCharacterSet newlineCharacterSet]].location == NSNotFound));
+  NSMutableString* string = [[NSMutableString alloc] initWithFormat:@"id: %llu\n", eventID];
+  if (event.length) {
+    [string appendFormat:@"event: %@\n", event];
+  }
+  NSString* normalizedData = [[data stringByReplacingOccurrencesOfString:@"\r\n" withString:@"\n"] stringByReplacingOccurrencesOfString:@"\r" withString:@"\n"];
+  for (NSString* line in [normalizedData componentsSeparatedByString:@"\n"]) {
+    [string appendFormat:@"data: %@\n", line];
+  }
+  [string appendString:@"\n"];
+  return [string dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+static BOOL _ParseEventID(NSString* string, uint64_t* eventID) {
+  const char* cString = string.UTF8String;
+  if (!cString || (*cString < '0') || (*cString > '9')) {
+    return NO;
+  }
+  char* end = NULL;
+  errno = 0;
+  *eventID = strtoull(cString, &end, 10);
+  return (errno == 0) && (*end == 0);
+}
+
+// Must be called with the mutex of the broadcaster locked - Returns the block to call with the data if the response was waiting for it
+static GCDWebServerBodyReaderCompletionBlock _EnqueueData(GCDWebServerEventSubscriber* subscriber, NSData* data) {
+  if (subscriber.overflowed) {
+    return nil;
+  }
+  subscriber.idle = NO;
+  GCDWebServerBodyReaderCompletionBlock block = subscriber.pendingBlock;
+  if (block) {
+    subscriber.pendingBlock = nil;
+    return block;
+  }
+  NSMutableArray<NSData*>* queue = subscriber.queue;
+  if (queue.count >= subscriber.maxQueuedEvents) {
+    if (subscriber.overflowPolicy == kGCDWebServerEventStreamOverflowPolicy_Disconnect) {
+      subscriber.overflowed = YES;
+      [queue removeAllObjects];
+      return nil;
+    }
+    [queue removeObjectAtIndex:0];
+    subscriber.droppedEvents += 1;
+  }
+  [queue addObject:data];
+  return nil;
+}
+
+@implementation GCDWebServerEventBroadcaster {
+  pthread_mutex_t _mutex;
+
+  // Protected by _mutex
+  uint64_t _lastEventID;
+  NSMutableArray<NSData*>* _history;  // Events with IDs from _lastEventID - _history.count + 1 to _lastEventID
+  NSMutableArray<GCDWebServerEventSubscriber*>* _subscribers;
+  dispatch_source_t _heartbeatTimer;  // Only exists while there are subscribers
+}
+
++ (void)initialize {
+  if (_heartbeatData == nil) {
+    _heartbeatData = [[NSData alloc] initWithBytes:":\n\n" length:3];
+  }
+}
+
+- (instancetype)initWithHistoryCapacity:(NSUInteger)historyCapacity heartbeatInterval:(NSTimeInterval)heartbeatInterval {
+  if ((self = [super init])) {
+    pthread_mutex_init(&_mutex, NULL);
+    _historyCapacity = historyCapacity;
+    _heartbeatInterval = heartbeatInterval;
+    _history = [[NSMutableArray alloc] initWithCapacity:historyCapacity];
+    _subscribers = [[NSMutableArray alloc] init];
+  }
+  return self;
+}
+
+- (instancetype)init {
+  return [self initWithHistoryCapacity:kDefaultHistoryCapacity heartbeatInterval:kDefaultHeartbeatInterval];
+}
+
+- (void)dealloc {
+  GWS_DCHECK(_heartbeatTimer == NULL);
+  pthread_mutex_destroy(&_mutex);
+}
+
+- (NSUInteger)subscriberCount {
+  pthread_mutex_lock(&_mutex);
+  NSUInteger count = _subscribers.count;
+  pthread_mutex_unlock(&_mutex);
+  return count;
+}
+
+- (uint64_t)lastEventID {
+  pthread_mutex_lock(&_mutex);
+  uint64_t eventID = _lastEventID;
+  pthread_mutex_unlock(&_mutex);
+  return eventID;
+}
+
+// Events are serialized once and the same buffer is passed to all subscribers
+- (uint64_t)publishEvent:(NSString*)event data:(NSString*)data {
+  NSMutableArray<GCDWebServerBodyReaderCompletionBlock>* blocks = [[NSMutableArray alloc] init];
+  pthread_mutex_lock(&_mutex);
+  uint64_t eventID = ++_lastEventID;
+  NSData* eventData = _SerializeEvent(eventID, event, data);
+  if (_historyCapacity) {
+    if (_history.count == _historyCapacity) {
+      [_history removeObjectAtIndex:0];
+    }
+    [_history addObject:eventData];
+  }
+  for (GCDWebServerEventSubscriber* subscriber in _subscribers) {
+    GCDWebServerBodyReaderCompletionBlock block = _EnqueueData(subscriber, eventData);
+    if (block) {
+      [blocks addObject:block];
+    }
+  }
+  pthread_mutex_unlock(&_mutex);
+
+  for (GCDWebServerBodyReaderCompletionBlock block in blocks) {  // Not holding the mutex as this starts writing to the sockets
+    block(eventData, nil);
+  }
+  return eventID;
+}
+
+// Heartbeats are only sent to subscribers which are waiting for events and didn't get any during the last interval
+- (void)_sendHeartbeats {
+  NSMutableArray<GCDWebServerBodyReaderCompletionBlock>* blocks = [[NSMutableArray alloc] init];
+  pthread_mutex_lock(&_mutex);
+  for (GCDWebServerEventSubscriber* subscriber in _subscribers) {
+    GCDWebServerBodyReaderCompletionBlock block = subscriber.pendingBlock;
+    if (subscriber.idle && block) {
+      subscriber.pendingBlock = nil;
+      [blocks addObject:block];
+    }
+    subscriber.idle = YES;
+  }
+  pthread_mutex_unlock(&_mutex);
+
+  for (GCDWebServerBodyReaderCompletionBlock block in blocks) {
+    block(_heartbeatData, nil);
+  }
+}
+
+- (GCDWebServerEventSubscriber*)addSubscriberWithLastEventID:(NSString*)lastEventID maxQueuedEvents:(NSUInteger)maxQueuedEvents overflowPolicy:(GCDWebServerEventStreamOverflowPolicy)overflowPolicy {
+  GCDWebServerEventSubscriber* subscriber = [[GCDWebServerEventSubscriber alloc] initWithMaxQueuedEvents:maxQueuedEvents overflowPolicy:overflowPolicy];
+  uint64_t eventID;
+  pthread_mutex_lock(&_mutex);
+  if (lastEventID && _ParseEventID(lastEventID, &eventID) && (eventID < _lastEventID)) {  // Replay the missed events still in the history but no more than fit in the queue
+    uint64_t missedCount = _lastEventID - eventID;
+    NSUInteger count = _history.count;
+    NSUInteger start = missedCount < count ? count - (NSUInteger)missedCount : 0;
+    start = MAX(start, count > subscriber.maxQueuedEvents ? count - subscriber.maxQueuedEvents : 0);
+    for (NSUInteger i = start; i < count; ++i) {
+      [subscriber.queue addObject:_history[i]];
+    }
+  }
+  [_subscribers addObject:subscriber];
+  if ((_heartbeatInterval > 0.0) && (_heartbeatTimer == NULL)) {
+    uint64_t interval = (uint64_t)(_heartbeatInterval * (double)NSEC_PER_SEC);
+    _heartbeatTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    dispatch_source_set_timer(_heartbeatTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    dispatch_source_set_event_handler(_heartbeatTimer, ^{
+      @autoreleasepool {
+        [self _sendHeartbeats];
+      }
+    });
+    dispatch_resume(_heartbeatTimer);
+  }
+  pthread_mutex_unlock(&_mutex);
+  return subscriber;
+}
+
+- (void)removeSubscriber:(GCDWebServerEventSubscriber*)subscriber {
+  pthread_mutex_lock(&_mutex);
+  [_subscribers removeObjectIdenticalTo:subscriber];
+  subscriber.pendingBlock = nil;
+  if ((_subscribers.count == 0) && _heartbeatTimer) {  // Releases the timer handler which retains the broadcaster
+    dispatch_source_cancel(_heartbeatTimer);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_heartbeatTimer);
+#endif
+    _heartbeatTimer = NULL;
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+// Coalesces the backlog of slow clients into a single write
+- (void)readDataForSubscriber:(GCDWebServerEventSubscriber*)subscriber completion:(GCDWebServerBodyReaderCompletionBlock)block {
+  NSData* data = nil;
+  pthread_mutex_lock(&_mutex);
+  BOOL overflowed = subscriber.overflowed;
+  if (!overflowed) {
+    NSMutableArray<NSData*>* queue = subscriber.queue;
+    if (queue.count == 1) {
+      data = queue.firstObject;
+    } else if (queue.count > 1) {
+      NSMutableData* batch = [[NSMutableData alloc] init];
+      for (NSData* eventData in queue) {
+        [batch appendData:eventData];
+      }
+      data = batch;
+    } else {
+      subscriber.pendingBlock = block;
+    }
+    [queue removeAllObjects];
+  }
+  pthread_mutex_unlock(&_mutex);
+
+  if (overflowed) {
+    GWS_LOG_WARNING(@"Disconnecting event stream client too slow to keep up");
+    block(nil, GCDWebServerMakePosixError(ENOBUFS));
+  } else if (data) {
+    block(data, nil);
+  }
+}
+
+@end
+
+@implementation GCDWebServerEventStreamResponse {
+  NSString* _lastEventID;
+  GCDWebServerEventSubscriber* _subscriber;
+}
+
+@dynamic contentType;
+
++ (instancetype)responseWithBroadcaster:(GCDWebServerEventBroadcaster*)broadcaster request:(GCDWebServerRequest*)request {
+  return [(GCDWebServerEventStreamResponse*)[[self class] alloc] initWithBroadcaster:broadcaster lastEventID:GCDWebServerGetHeaderValue(request.headers, kGCDWebServerHeader_LastEventID)];
+}
+
+- (instancetype)initWithBroadcaster:(GCDWebServerEventBroadcaster*)broadcaster lastEventID:(NSString*)lastEventID {
+  if ((self = [super init])) {
+    _broadcaster = broadcaster;
+    _lastEventID = [lastEventID copy];
+    _maxQueuedEvents = kDefaultMaxQueuedEvents;
+    _overflowPolicy = kGCDWebServerEventStreamOverflowPolicy_DropOldest;
+
+    self.contentType = @"text/event-stream";
+  }
+  return self;
+}
+
+- (NSUInteger)droppedEvents {
+  return _subscriber.droppedEvents;
+}
+
+- (BOOL)open:(NSError**)error {
+  _subscriber = [_broadcaster addSubscriberWithLastEventID:_lastEventID maxQueuedEvents:_maxQueuedEvents overflowPolicy:_overflowPolicy];
+  return YES;
+}
+
+- (void)asyncReadDataWithCompletion:(GCDWebServerBodyReaderCompletionBlock)block {
+  [_broadcaster readDataForSubscriber:_subscriber completion:block];
+}
+
+- (void)close {
+  [_broadcaster removeSubscriber:_subscriber];
+}
+
+- (NSString*)description {
+  NSMutableString* description = [NSMutableString stringWithString:[super description]];
+  [description appendString:@"\n\n<EVENT STREAM>"];
+  return description;
+}
+
+@end
+
+@implementation GCDWebServer (EventStreams)
+
+- (void)addEventStreamHandlerForPath:(NSString*)path broadcaster:(GCDWebServerEventBroadcaster*)broadcaster {
+  [self addHandlerForMethod:@"GET"
+                       path:path
+               requestClass:[GCDWebServerRequest class]
+               processBlock:^GCDWebServerResponse*(GCDWebServerRequest* request) {
+                 return [GCDWebServerEventStreamResponse responseWithBroadcaster:broadcaster request:request];
+               }];
+}
+
+@end
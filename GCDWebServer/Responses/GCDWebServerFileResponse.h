@@ -29,6 +29,14 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
+/**
+ *  Controls how the eTag property of a GCDWebServerFileResponse is computed.
+ */
+typedef NS_ENUM(int, GCDWebServerFileETagMode) {
+  kGCDWebServerFileETagMode_FileSystem = 0,  // Based on the file node ID and modification date
+  kGCDWebServerFileETagMode_ContentDigest  // SHA-256 digest of the file contents (see below)
+};
+
 /**
  *  The GCDWebServerFileResponse subclass of GCDWebServerResponse reads the body
  *  of the HTTP response from a file on disk.
@@ -88,13 +96,18 @@ NS_ASSUME_NONNULL_BEGIN
  *  and "length" values will be automatically adjusted to be compatible with the
  *  actual size of the file.
  *
+ *  If the range cannot be satisfied, the response will have a 416 status code
+ *  and a "Content-Range" header only indicating the length of the file.
+ *
  *  This argument would typically be set to the value of the byteRange property
  *  of the current GCDWebServerRequest.
  */
 - (nullable instancetype)initWithFile:(NSString*)path byteRange:(NSRange)range;
 
 /**
- *  This method is the designated initializer for the class.
+ *  Initializes a response like -initWithFile:byteRange: and sets the
+ *  "Content-Disposition" HTTP header for a download if the "attachment"
+ *  argument is YES.
  *
  *  If MIME type overrides are specified, they allow to customize the built-in
  *  mapping from extensions to MIME types. Keys of the dictionary must be lowercased
@@ -103,6 +116,38 @@ NS_ASSUME_NONNULL_BEGIN
  */
 - (nullable instancetype)initWithFile:(NSString*)path byteRange:(NSRange)range isAttachment:(BOOL)attachment mimeTypeOverrides:(nullable NSDictionary<NSString*, NSString*>*)overrides;
 
+/**
+ *  Initializes a response like
+ *  -initWithFile:byteRanges:ifRange:isAttachment:mimeTypeOverrides:eTagMode:
+ *  using kGCDWebServerFileETagMode_FileSystem.
+ *
+ *  The byte ranges use the same representation as -initWithFile:byteRange:
+ *  and would typically be set to the value of the byteRanges property of the
+ *  current GCDWebServerRequest. Unsatisfiable ranges are dropped and the others
+ *  are sorted and coalesced if overlapping or close to each other. A single
+ *  remaining range is sent as a regular 206 response while multiple ones are
+ *  streamed from the file as a "multipart/byteranges" body. If no range can be
+ *  satisfied, the response will have a 416 status code.
+ *
+ *  If the "If-Range" argument is not nil and doesn't match the entity tag or
+ *  the modification date of the file, the byte ranges are ignored and the entire
+ *  file is sent instead.
+ */
+- (nullable instancetype)initWithFile:(NSString*)path byteRanges:(nullable NSArray<NSValue*>*)ranges ifRange:(nullable NSString*)ifRange isAttachment:(BOOL)attachment mimeTypeOverrides:(nullable NSDictionary<NSString*, NSString*>*)overrides;
+
+/**
+ *  This method is the designated initializer for the class.
+ *
+ *  With kGCDWebServerFileETagMode_ContentDigest, the entity tag is a SHA-256
+ *  digest of the file contents so it survives copies and deployments of
+ *  unchanged files. Digests are computed in the background the first time a
+ *  file is served, then cached in memory and in an extended attribute of the
+ *  file, and are invalidated whenever the size or modification date of the
+ *  file changes. Until the digest of a file is available, the entity tag is
+ *  computed like with kGCDWebServerFileETagMode_FileSystem.
+ */
+- (nullable instancetype)initWithFile:(NSString*)path byteRanges:(nullable NSArray<NSValue*>*)ranges ifRange:(nullable NSString*)ifRange isAttachment:(BOOL)attachment mimeTypeOverrides:(nullable NSDictionary<NSString*, NSString*>*)overrides eTagMode:(GCDWebServerFileETagMode)eTagMode;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -29,21 +29,150 @@
 #error GCDWebServer requires ARC
 #endif
 
+#import <CommonCrypto/CommonDigest.h>
+#import <pthread.h>
 #import <sys/stat.h>
+#import <sys/xattr.h>
 
 #import "GCDWebServerPrivate.h"
 
 #define kFileReadBufferSize (32 * 1024)
+#define kByteRangeCoalescingGap 80  // Roughly the overhead of an extra "multipart/byteranges" part
+#define kDigestReadBufferSize (256 * 1024)
+#define kDigestCacheCountLimit 4096
+#define kDigestAttributeName "GCDWebServer.ContentDigest"  // Value is "{mtime seconds}.{mtime nanoseconds} {size} {SHA-256 hex digest}"
+
+static NSCache<NSString*, NSString*>* _digestCache = nil;
+static NSMutableSet<NSString*>* _pendingDigests = nil;
+static pthread_mutex_t _pendingDigestsMutex = PTHREAD_MUTEX_INITIALIZER;
+static dispatch_queue_t _digestQueue = NULL;
+
+static inline NSString* _DigestCacheKey(const struct stat* info) {
+  return [NSString stringWithFormat:@"%i/%llu/%li.%li/%lli", info->st_dev, info->st_ino, info->st_mtimespec.tv_sec, info->st_mtimespec.tv_nsec, info->st_size];
+}
+
+// The extended attribute travels with the file contents so it is only checked against the size and modification date
+static NSString* _ReadDigestAttribute(const char* path, const struct stat* info) {
+  char value[128];
+  ssize_t length = getxattr(path, kDigestAttributeName, value, sizeof(value) - 1, 0, XATTR_NOFOLLOW);
+  if (length <= 0) {
+    return nil;
+  }
+  value[length] = 0;
+  long seconds;
+  long nanoseconds;
+  long long size;
+  char digest[2 * CC_SHA256_DIGEST_LENGTH + 1];
+  if ((sscanf(value, "%li.%li %lli %64s", &seconds, &nanoseconds, &size, digest) != 4) || (strlen(digest) != 2 * CC_SHA256_DIGEST_LENGTH)) {
+    return nil;
+  }
+  if ((seconds != info->st_mtimespec.tv_sec) || (nanoseconds != info->st_mtimespec.tv_nsec) || (size != info->st_size)) {
+    return nil;
+  }
+  return [[NSString alloc] initWithUTF8String:digest];
+}
+
+static BOOL _IsSameFileVersion(const struct stat* a, const struct stat* b) {
+  return (a->st_dev == b->st_dev) && (a->st_ino == b->st_ino) && (a->st_size == b->st_size) && (a->st_mtimespec.tv_sec == b->st_mtimespec.tv_sec) && (a->st_mtimespec.tv_nsec == b->st_mtimespec.tv_nsec);
+}
+
+// Returns nil if the file was modified while being read
+static NSString* _ComputeDigest(NSString* path, const struct stat* info) {
+  int file = open([path fileSystemRepresentation], O_NOFOLLOW | O_RDONLY);
+  if (file <= 0) {
+    return nil;
+  }
+  NSString* digest = nil;
+  struct stat before;
+  if (!fstat(file, &before) && _IsSameFileVersion(&before, info)) {
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    char* buffer = malloc(kDigestReadBufferSize);
+    ssize_t result;
+    while ((result = read(file, buffer, kDigestReadBufferSize)) > 0) {
+      CC_SHA256_Update(&context, buffer, (CC_LONG)result);
+    }
+    free(buffer);
+    unsigned char hash[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(hash, &context);
+    struct stat after;
+    if ((result == 0) && !fstat(file, &after) && _IsSameFileVersion(&after, info)) {
+      char string[2 * CC_SHA256_DIGEST_LENGTH + 1];
+      for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; ++i) {
+        snprintf(&string[2 * i], 3, "%02x", hash[i]);
+      }
+      digest = [[NSString alloc] initWithUTF8String:string];
+
+      char value[128];
+      snprintf(value, sizeof(value), "%li.%li %lli %s", info->st_mtimespec.tv_sec, info->st_mtimespec.tv_nsec, info->st_size, string);
+      if (fsetxattr(file, kDigestAttributeName, value, strlen(value), 0, 0)) {  // Read-only volumes are expected to fail
+        GWS_LOG_DEBUG(@"Failed saving content digest for file \"%@\": %s", path, strerror(errno));
+      }
+    }
+  }
+  close(file);
+  return digest;
+}
+
+// Returns the cached digest if any or schedules its computation in the background
+static NSString* _GetContentDigest(NSString* path, const struct stat* info) {
+  NSString* key = _DigestCacheKey(info);
+  NSString* digest = [_digestCache objectForKey:key];
+  if (digest == nil) {
+    digest = _ReadDigestAttribute([path fileSystemRepresentation], info);
+    if (digest) {
+      [_digestCache setObject:digest forKey:key];
+    } else {
+      pthread_mutex_lock(&_pendingDigestsMutex);
+      BOOL schedule = ![_pendingDigests containsObject:key];
+      if (schedule) {
+        [_pendingDigests addObject:key];
+      }
+      pthread_mutex_unlock(&_pendingDigestsMutex);
+      if (schedule) {
+        struct stat fileInfo = *info;
+        dispatch_async(_digestQueue, ^{
+          @autoreleasepool {
+            NSString* computedDigest = _ComputeDigest(path, &fileInfo);
+            if (computedDigest) {
+              [_digestCache setObject:computedDigest forKey:key];
+            }
+            pthread_mutex_lock(&_pendingDigestsMutex);
+            [_pendingDigests removeObject:key];
+            pthread_mutex_unlock(&_pendingDigestsMutex);
+          }
+        });
+      }
+    }
+  }
+  return digest;
+}
 
 @implementation GCDWebServerFileResponse {
   NSString* _path;
-  NSUInteger _offset;
-  NSUInteger _size;
+  NSUInteger _fileSize;
+  NSRange* _ranges;  // Absolute, sorted and non-overlapping if more than one
+  NSUInteger _rangeCount;
+  NSArray<NSData*>* _partHeaders;  // Only set for "multipart/byteranges" bodies
+  NSData* _closingDelimiter;
+  NSUInteger _rangeIndex;
+  NSUInteger _rangeOffset;
+  BOOL _partHeaderSent;
   int _file;
 }
 
 @dynamic contentType, lastModifiedDate, eTag;
 
++ (void)initialize {
+  if (_digestCache == nil) {
+    _digestCache = [[NSCache alloc] init];
+    _digestCache.countLimit = kDigestCacheCountLimit;
+    _pendingDigests = [[NSMutableSet alloc] init];
+    _digestQueue = dispatch_queue_create("GCDWebServerFileResponse.digest", DISPATCH_QUEUE_SERIAL);
+    dispatch_set_target_queue(_digestQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+  }
+}
+
 + (instancetype)responseWithFile:(NSString*)path {
   return [(GCDWebServerFileResponse*)[[self class] alloc] initWithFile:path];
 }
@@ -61,22 +190,37 @@
 }
 
 - (instancetype)initWithFile:(NSString*)path {
-  return [self initWithFile:path byteRange:NSMakeRange(NSUIntegerMax, 0) isAttachment:NO mimeTypeOverrides:nil];
+  return [self initWithFile:path byteRanges:nil ifRange:nil isAttachment:NO mimeTypeOverrides:nil];
 }
 
 - (instancetype)initWithFile:(NSString*)path isAttachment:(BOOL)attachment {
-  return [self initWithFile:path byteRange:NSMakeRange(NSUIntegerMax, 0) isAttachment:attachment mimeTypeOverrides:nil];
+  return [self initWithFile:path byteRanges:nil ifRange:nil isAttachment:attachment mimeTypeOverrides:nil];
 }
 
 - (instancetype)initWithFile:(NSString*)path byteRange:(NSRange)range {
   return [self initWithFile:path byteRange:range isAttachment:NO mimeTypeOverrides:nil];
 }
 
+- (instancetype)initWithFile:(NSString*)path byteRange:(NSRange)range isAttachment:(BOOL)attachment mimeTypeOverrides:(NSDictionary<NSString*, NSString*>*)overrides {
+  NSArray* ranges = GCDWebServerIsValidByteRange(range) ? @[ [NSValue valueWithRange:range] ] : nil;
+  return [self initWithFile:path byteRanges:ranges ifRange:nil isAttachment:attachment mimeTypeOverrides:overrides];
+}
+
 static inline NSDate* _NSDateFromTimeSpec(const struct timespec* t) {
   return [NSDate dateWithTimeIntervalSince1970:((NSTimeInterval)t->tv_sec + (NSTimeInterval)t->tv_nsec / 1000000000.0)];
 }
 
-- (instancetype)initWithFile:(NSString*)path byteRange:(NSRange)range isAttachment:(BOOL)attachment mimeTypeOverrides:(NSDictionary<NSString*, NSString*>*)overrides {
+static int _CompareByteRanges(const void* a, const void* b) {
+  NSUInteger locationA = ((const NSRange*)a)->location;
+  NSUInteger locationB = ((const NSRange*)b)->location;
+  return locationA < locationB ? -1 : (locationA > locationB ? 1 : 0);
+}
+
+- (instancetype)initWithFile:(NSString*)path byteRanges:(NSArray<NSValue*>*)ranges ifRange:(NSString*)ifRange isAttachment:(BOOL)attachment mimeTypeOverrides:(NSDictionary<NSString*, NSString*>*)overrides {
+  return [self initWithFile:path byteRanges:ranges ifRange:ifRange isAttachment:attachment mimeTypeOverrides:overrides eTagMode:kGCDWebServerFileETagMode_FileSystem];
+}
+
+- (instancetype)initWithFile:(NSString*)path byteRanges:(NSArray<NSValue*>*)ranges ifRange:(NSString*)ifRange isAttachment:(BOOL)attachment mimeTypeOverrides:(NSDictionary<NSString*, NSString*>*)overrides eTagMode:(GCDWebServerFileETagMode)eTagMode {
   struct stat info;
   if (lstat([path fileSystemRepresentation], &info) || !(info.st_mode & S_IFREG)) {
     GWS_DNOT_REACHED();
@@ -89,32 +233,79 @@ static inline NSDate* _NSDateFromTimeSpec(const struct timespec* t) {
   }
 #endif
   NSUInteger fileSize = (NSUInteger)info.st_size;
+  NSString* eTag = eTagMode == kGCDWebServerFileETagMode_ContentDigest ? _GetContentDigest(path, &info) : nil;
+  if (eTag == nil) {
+    eTag = [NSString stringWithFormat:@"%llu/%li/%li", info.st_ino, info.st_mtimespec.tv_sec, info.st_mtimespec.tv_nsec];
+  }
+  NSDate* lastModifiedDate = _NSDateFromTimeSpec(&info.st_mtimespec);
 
-  BOOL hasByteRange = GCDWebServerIsValidByteRange(range);
-  if (hasByteRange) {
-    if (range.location != NSUIntegerMax) {
-      range.location = MIN(range.location, fileSize);
-      range.length = MIN(range.length, fileSize - range.location);
-    } else {
-      range.length = MIN(range.length, fileSize);
-      range.location = fileSize - range.length;
-    }
-    if (range.length == 0) {
-      return nil;  // TODO: Return 416 status code and "Content-Range: bytes */{file length}" header
-    }
-  } else {
-    range.location = 0;
-    range.length = fileSize;
+  if (ranges.count && ifRange && !GCDWebServerIsIfRangeMatching(ifRange, eTag, lastModifiedDate)) {
+    GWS_LOG_DEBUG(@"Ignoring byte ranges as 'If-Range' header \"%@\" does not match file \"%@\"", ifRange, path);
+    ranges = nil;  // Send the entire file instead
+  }
+  if (ranges.count > kGCDWebServerMaxByteRanges) {
+    ranges = nil;
   }
 
   if ((self = [super init])) {
     _path = [path copy];
-    _offset = range.location;
-    _size = range.length;
-    if (hasByteRange) {
+    _fileSize = fileSize;
+    _file = -1;
+    _ranges = malloc(MAX(ranges.count, (NSUInteger)1) * sizeof(NSRange));
+    if (ranges.count) {
+      for (NSValue* value in ranges) {
+        NSRange range = value.rangeValue;
+        if (GCDWebServerResolveByteRange(&range, fileSize)) {
+          _ranges[_rangeCount++] = range;
+        }
+      }
+      if (_rangeCount > 1) {  // https://tools.ietf.org/html/rfc7233#section-4.1
+        qsort(_ranges, _rangeCount, sizeof(NSRange), _CompareByteRanges);
+        NSUInteger count = 1;
+        for (NSUInteger i = 1; i < _rangeCount; ++i) {
+          NSRange* last = &_ranges[count - 1];
+          NSUInteger lastEnd = last->location + last->length;
+          if (_ranges[i].location <= lastEnd + kByteRangeCoalescingGap) {
+            last->length = MAX(lastEnd, _ranges[i].location + _ranges[i].length) - last->location;
+          } else {
+            _ranges[count++] = _ranges[i];
+          }
+        }
+        _rangeCount = count;
+      }
+    } else {
+      _ranges[0] = NSMakeRange(0, fileSize);
+      _rangeCount = 1;
+    }
+
+    NSString* mimeType = GCDWebServerGetMimeTypeForExtension([_path pathExtension], overrides);
+    NSUInteger contentLength = 0;
+    if (ranges.count == 0) {
+      contentLength = fileSize;
+    } else if (_rangeCount == 0) {  // https://tools.ietf.org/html/rfc7233#section-4.4
+      [self setStatusCode:kGCDWebServerHTTPStatusCode_RequestedRangeNotSatisfiable];
+      [self setValue:[NSString stringWithFormat:@"bytes */%lu", (unsigned long)fileSize] forAdditionalHeader:@"Content-Range"];
+      GWS_LOG_DEBUG(@"No satisfiable byte range for file \"%@\"", path);
+    } else if (_rangeCount == 1) {
       [self setStatusCode:kGCDWebServerHTTPStatusCode_PartialContent];
-      [self setValue:[NSString stringWithFormat:@"bytes %lu-%lu/%lu", (unsigned long)_offset, (unsigned long)(_offset + _size - 1), (unsigned long)fileSize] forAdditionalHeader:@"Content-Range"];
-      GWS_LOG_DEBUG(@"Using content bytes range [%lu-%lu] for file \"%@\"", (unsigned long)_offset, (unsigned long)(_offset + _size - 1), path);
+      [self setValue:[NSString stringWithFormat:@"bytes %lu-%lu/%lu", (unsigned long)_ranges[0].location, (unsigned long)(_ranges[0].location + _ranges[0].length - 1), (unsigned long)fileSize] forAdditionalHeader:@"Content-Range"];
+      GWS_LOG_DEBUG(@"Using content bytes range [%lu-%lu] for file \"%@\"", (unsigned long)_ranges[0].location, (unsigned long)(_ranges[0].location + _ranges[0].length - 1), path);
+      contentLength = _ranges[0].length;
+    } else {  // https://tools.ietf.org/html/rfc7233#appendix-A
+      NSString* boundary = [NSString stringWithFormat:@"%08x%08x%08x", arc4random(), arc4random(), arc4random()];
+      NSMutableArray* partHeaders = [[NSMutableArray alloc] initWithCapacity:_rangeCount];
+      for (NSUInteger i = 0; i < _rangeCount; ++i) {
+        NSString* header = [NSString stringWithFormat:@"\r\n--%@\r\nContent-Type: %@\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n", boundary, mimeType, (unsigned long)_ranges[i].location, (unsigned long)(_ranges[i].location + _ranges[i].length - 1), (unsigned long)fileSize];
+        NSData* data = [header dataUsingEncoding:NSUTF8StringEncoding];
+        [partHeaders addObject:data];
+        contentLength += data.length + _ranges[i].length;
+      }
+      _partHeaders = partHeaders;
+      _closingDelimiter = [[NSString stringWithFormat:@"\r\n--%@--\r\n", boundary] dataUsingEncoding:NSUTF8StringEncoding];
+      contentLength += _closingDelimiter.length;
+      [self setStatusCode:kGCDWebServerHTTPStatusCode_PartialContent];
+      GWS_LOG_DEBUG(@"Using %lu content bytes ranges for file \"%@\"", (unsigned long)_rangeCount, path);
+      mimeType = [@"multipart/byteranges; boundary=" stringByAppendingString:boundary];
     }
 
     if (attachment) {
@@ -129,15 +320,22 @@ static inline NSDate* _NSDateFromTimeSpec(const struct timespec* t) {
       }
     }
 
-    self.contentType = GCDWebServerGetMimeTypeForExtension([_path pathExtension], overrides);
-    self.contentLength = _size;
-    self.lastModifiedDate = _NSDateFromTimeSpec(&info.st_mtimespec);
-    self.eTag = [NSString stringWithFormat:@"%llu/%li/%li", info.st_ino, info.st_mtimespec.tv_sec, info.st_mtimespec.tv_nsec];
+    self.contentType = mimeType;
+    self.contentLength = contentLength;
+    self.lastModifiedDate = lastModifiedDate;
+    self.eTag = eTag;
   }
   return self;
 }
 
+- (void)dealloc {
+  free(_ranges);
+}
+
 - (BOOL)open:(NSError**)error {
+  if (_rangeCount == 0) {
+    return YES;  // Nothing to read for "416 Range Not Satisfiable"
+  }
   _file = open([_path fileSystemRepresentation], O_NOFOLLOW | O_RDONLY);
   if (_file <= 0) {
     if (error) {
@@ -145,35 +343,54 @@ static inline NSDate* _NSDateFromTimeSpec(const struct timespec* t) {
     }
     return NO;
   }
-  if (lseek(_file, _offset, SEEK_SET) != (off_t)_offset) {
-    if (error) {
-      *error = GCDWebServerMakePosixError(errno);
-    }
-    close(_file);
-    return NO;
-  }
   return YES;
 }
 
+// Parts are streamed straight from the file with their headers interleaved, filling each buffer as much as possible
 - (NSData*)readData:(NSError**)error {
-  size_t length = MIN((NSUInteger)kFileReadBufferSize, _size);
-  NSMutableData* data = [[NSMutableData alloc] initWithLength:length];
-  ssize_t result = read(_file, data.mutableBytes, length);
-  if (result < 0) {
-    if (error) {
-      *error = GCDWebServerMakePosixError(errno);
+  NSMutableData* data = [[NSMutableData alloc] initWithCapacity:kFileReadBufferSize];
+  while ((_rangeIndex < _rangeCount) && (data.length < kFileReadBufferSize)) {
+    NSRange range = _ranges[_rangeIndex];
+    if (_partHeaders && !_partHeaderSent) {
+      [data appendData:_partHeaders[_rangeIndex]];
+      _partHeaderSent = YES;
+    }
+    NSUInteger length = MIN(range.length - _rangeOffset, data.length < kFileReadBufferSize ? kFileReadBufferSize - data.length : 0);
+    if (length > 0) {
+      NSUInteger dataLength = data.length;
+      data.length = dataLength + length;
+      ssize_t result = pread(_file, (char*)data.mutableBytes + dataLength, length, (off_t)(range.location + _rangeOffset));
+      if (result < 0) {
+        if (error) {
+          *error = GCDWebServerMakePosixError(errno);
+        }
+        return nil;
+      }
+      data.length = dataLength + result;
+      if (result == 0) {  // File was truncated since the response was created
+        if (error) {
+          *error = GCDWebServerMakePosixError(EIO);
+        }
+        return nil;
+      }
+      _rangeOffset += result;
+    }
+    if (_rangeOffset == range.length) {
+      _rangeIndex += 1;
+      _rangeOffset = 0;
+      _partHeaderSent = NO;
+      if ((_rangeIndex == _rangeCount) && _closingDelimiter) {
+        [data appendData:_closingDelimiter];
+      }
     }
-    return nil;
-  }
-  if (result > 0) {
-    [data setLength:result];
-    _size -= result;
   }
   return data;
 }
 
 - (void)close {
-  close(_file);
+  if (_file > 0) {
+    close(_file);
+  }
 }
 
 - (NSString*)description {
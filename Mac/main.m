@@ -26,6 +26,13 @@
  */
 
 #import <libgen.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <pthread.h>
+#import <stdatomic.h>
+#import <sys/resource.h>
+#import <mach/mach.h>
+#import <mach/mach_time.h>
 
 #import "GCDWebServer.h"
 
@@ -55,6 +62,355 @@ typedef enum {
   kMode_AsyncResponse
 } Mode;
 
+#define kBenchmarkReadBufferSize (64 * 1024)
+
+typedef struct {
+  uint16_t port;
+  BOOL keepAlive;
+  char** paths;  // Weighted request mix where paths are repeated according to their weight
+  NSUInteger pathCount;
+  uint64_t deadline;
+  atomic_int finishedWorkers;
+} BenchmarkConfiguration;
+
+typedef struct {
+  int socket;
+  char buffer[kBenchmarkReadBufferSize];
+  size_t start;
+  size_t end;
+} BenchmarkReader;
+
+typedef struct {
+  BenchmarkConfiguration* configuration;
+  unsigned int seed;
+  uint64_t* latencies;
+  size_t latencyCount;
+  size_t latencyCapacity;
+  uint64_t errors;
+  uint64_t bytesReceived;
+  BenchmarkReader reader;
+} BenchmarkWorker;
+
+static uint64_t _BenchmarkNow(void) {
+  static mach_timebase_info_data_t info;
+  if (info.denom == 0) {
+    mach_timebase_info(&info);
+  }
+  return mach_absolute_time() * info.numer / info.denom;
+}
+
+static int _BenchmarkConnect(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return -1;
+  }
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+  struct sockaddr_in address;
+  bzero(&address, sizeof(address));
+  address.sin_len = sizeof(address);
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (const struct sockaddr*)&address, sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static BOOL _BenchmarkSend(int fd, const char* bytes, size_t length) {
+  while (length > 0) {
+    ssize_t result = write(fd, bytes, length);
+    if (result <= 0) {
+      if ((result < 0) && (errno == EINTR)) {
+        continue;
+      }
+      return NO;
+    }
+    bytes += result;
+    length -= (size_t)result;
+  }
+  return YES;
+}
+
+static BOOL _BenchmarkFill(BenchmarkReader* reader) {
+  if (reader->start == reader->end) {
+    reader->start = 0;
+    reader->end = 0;
+  } else if (reader->start > 0) {
+    memmove(reader->buffer, &reader->buffer[reader->start], reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  if (reader->end == kBenchmarkReadBufferSize) {
+    return NO;  // Line too long
+  }
+  while (1) {
+    ssize_t result = read(reader->socket, &reader->buffer[reader->end], kBenchmarkReadBufferSize - reader->end);
+    if (result > 0) {
+      reader->end += (size_t)result;
+      return YES;
+    }
+    if ((result < 0) && (errno == EINTR)) {
+      continue;
+    }
+    return NO;
+  }
+}
+
+// Returns the line without its CRLF terminator
+static BOOL _BenchmarkReadLine(BenchmarkReader* reader, char* line, size_t size) {
+  while (1) {
+    char* start = &reader->buffer[reader->start];
+    char* newline = memchr(start, '\n', reader->end - reader->start);
+    if (newline) {
+      size_t length = (size_t)(newline - start);
+      if ((length > 0) && (newline[-1] == '\r')) {
+        length -= 1;
+      }
+      length = MIN(length, size - 1);
+      memcpy(line, start, length);
+      line[length] = 0;
+      reader->start += (size_t)(newline - start) + 1;
+      return YES;
+    }
+    if (!_BenchmarkFill(reader)) {
+      return NO;
+    }
+  }
+}
+
+static BOOL _BenchmarkSkip(BenchmarkReader* reader, uint64_t length, uint64_t* bytesReceived) {
+  while (length > 0) {
+    if (reader->start == reader->end) {
+      if (!_BenchmarkFill(reader)) {
+        return NO;
+      }
+    }
+    size_t available = (size_t)MIN(length, (uint64_t)(reader->end - reader->start));
+    reader->start += available;
+    length -= available;
+    *bytesReceived += available;
+  }
+  return YES;
+}
+
+static BOOL _BenchmarkReadResponse(BenchmarkReader* reader, int* statusCode, BOOL* shouldClose, uint64_t* bytesReceived) {
+  char line[8192];
+  if (!_BenchmarkReadLine(reader, line, sizeof(line)) || (sscanf(line, "HTTP/1.%*d %d", statusCode) != 1)) {
+    return NO;
+  }
+  long long contentLength = -1;
+  BOOL chunked = NO;
+  *shouldClose = !strncmp(line, "HTTP/1.0", 8);
+  while (1) {
+    if (!_BenchmarkReadLine(reader, line, sizeof(line))) {
+      return NO;
+    }
+    if (line[0] == 0) {
+      break;
+    }
+    if (!strncasecmp(line, "Content-Length:", 15)) {
+      contentLength = strtoll(&line[15], NULL, 10);
+    } else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+      chunked = (strcasestr(&line[18], "chunked") != NULL);
+    } else if (!strncasecmp(line, "Connection:", 11)) {
+      *shouldClose = (strcasestr(&line[11], "close") != NULL);
+    }
+  }
+  if (chunked) {
+    while (1) {
+      if (!_BenchmarkReadLine(reader, line, sizeof(line))) {
+        return NO;
+      }
+      unsigned long long size = strtoull(line, NULL, 16);
+      if (size == 0) {
+        do {
+          if (!_BenchmarkReadLine(reader, line, sizeof(line))) {
+            return NO;
+          }
+        } while (line[0]);  // Skip trailers
+        break;
+      }
+      if (!_BenchmarkSkip(reader, size, bytesReceived) || !_BenchmarkReadLine(reader, line, sizeof(line))) {
+        return NO;
+      }
+    }
+  } else if (contentLength >= 0) {
+    return _BenchmarkSkip(reader, (uint64_t)contentLength, bytesReceived);
+  } else {
+    *shouldClose = YES;
+    while (1) {  // Body is delimited by the connection closing
+      *bytesReceived += reader->end - reader->start;
+      reader->start = reader->end;
+      if (!_BenchmarkFill(reader)) {
+        break;
+      }
+    }
+  }
+  return YES;
+}
+
+static void* _BenchmarkWorkerMain(void* context) {
+  BenchmarkWorker* worker = context;
+  BenchmarkConfiguration* configuration = worker->configuration;
+  worker->reader.socket = -1;
+  char request[4096];
+  while (_BenchmarkNow() < configuration->deadline) {
+    if (worker->reader.socket < 0) {
+      worker->reader.socket = _BenchmarkConnect(configuration->port);
+      worker->reader.start = 0;
+      worker->reader.end = 0;
+      if (worker->reader.socket < 0) {
+        worker->errors += 1;
+        usleep(1000);
+        continue;
+      }
+    }
+    const char* path = configuration->paths[rand_r(&worker->seed) % configuration->pathCount];
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: %s\r\n\r\n", path, configuration->keepAlive ? "keep-alive" : "close");
+    uint64_t startTime = _BenchmarkNow();
+    int statusCode = 0;
+    BOOL shouldClose = YES;
+    BOOL success = _BenchmarkSend(worker->reader.socket, request, (size_t)length) && _BenchmarkReadResponse(&worker->reader, &statusCode, &shouldClose, &worker->bytesReceived);
+    if (success && (statusCode < 400)) {
+      if (worker->latencyCount == worker->latencyCapacity) {
+        worker->latencyCapacity = MAX(2 * worker->latencyCapacity, 4096);
+        worker->latencies = realloc(worker->latencies, worker->latencyCapacity * sizeof(uint64_t));
+      }
+      worker->latencies[worker->latencyCount++] = _BenchmarkNow() - startTime;
+    } else {
+      worker->errors += 1;
+    }
+    if (!success || shouldClose || !configuration->keepAlive) {
+      close(worker->reader.socket);
+      worker->reader.socket = -1;
+    }
+  }
+  if (worker->reader.socket >= 0) {
+    close(worker->reader.socket);
+  }
+  atomic_fetch_add(&configuration->finishedWorkers, 1);
+  return NULL;
+}
+
+static int _CompareLatencies(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double _LatencyQuantile(const uint64_t* latencies, size_t count, double quantile) {
+  if (count == 0) {
+    return 0.0;
+  }
+  size_t index = (size_t)ceil(quantile * (double)count);
+  return (double)latencies[index > 0 ? index - 1 : 0] / (double)NSEC_PER_MSEC;
+}
+
+static double _CPUTime(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1000000.0 + (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1000000.0;
+}
+
+static uint64_t _ResidentSize(void) {
+  struct mach_task_basic_info info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return info.resident_size;
+}
+
+// Runs an HTTP load generator in-process against the server and prints the results as a single JSON object
+static int _RunBenchmark(GCDWebServer* webServer, const char* modeName, NSArray* paths, NSUInteger concurrency, NSTimeInterval duration, BOOL keepAlive, NSString* outputPath) {
+  [GCDWebServer setLogLevel:3];  // Only log warnings and errors so logging does not dominate the measurements
+  NSDictionary* options = @{GCDWebServerOption_Port : @8080, GCDWebServerOption_BindToLocalhost : @YES};
+  if (![webServer startWithOptions:options error:NULL]) {
+    return -1;
+  }
+
+  BenchmarkConfiguration configuration;
+  bzero(&configuration, sizeof(configuration));
+  configuration.port = (uint16_t)webServer.port;
+  configuration.keepAlive = keepAlive;
+  for (NSString* entry in paths) {  // Entries are "path" or "path:weight"
+    NSRange range = [entry rangeOfString:@":" options:NSBackwardsSearch];
+    NSString* path = range.location != NSNotFound ? [entry substringToIndex:range.location] : entry;
+    NSInteger weight = range.location != NSNotFound ? MAX([[entry substringFromIndex:(range.location + 1)] integerValue], 1) : 1;
+    for (NSInteger i = 0; i < weight; ++i) {
+      configuration.paths = realloc(configuration.paths, (configuration.pathCount + 1) * sizeof(char*));
+      configuration.paths[configuration.pathCount++] = strdup([path UTF8String]);
+    }
+  }
+  atomic_init(&configuration.finishedWorkers, 0);
+
+  fprintf(stderr, "Benchmarking \"%s\" mode with %lu connections for %.0f seconds (keep-alive %s)...\n", modeName, (unsigned long)concurrency, duration, keepAlive ? "on" : "off");
+  BenchmarkWorker* workers = calloc(concurrency, sizeof(BenchmarkWorker));
+  pthread_t* threads = calloc(concurrency, sizeof(pthread_t));
+  double startCPUTime = _CPUTime();
+  uint64_t startTime = _BenchmarkNow();
+  configuration.deadline = startTime + (uint64_t)(duration * (double)NSEC_PER_SEC);
+  for (NSUInteger i = 0; i < concurrency; ++i) {
+    workers[i].configuration = &configuration;
+    workers[i].seed = (unsigned int)i + 1;
+    pthread_create(&threads[i], NULL, _BenchmarkWorkerMain, &workers[i]);
+  }
+  while (atomic_load(&configuration.finishedWorkers) < (int)concurrency) {
+    CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, true);  // Some handlers complete on the main queue
+  }
+  for (NSUInteger i = 0; i < concurrency; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = (double)(_BenchmarkNow() - startTime) / (double)NSEC_PER_SEC;
+  double cpuTime = _CPUTime() - startCPUTime;
+  uint64_t residentSize = _ResidentSize();
+  [webServer stop];
+
+  size_t count = 0;
+  uint64_t errors = 0;
+  uint64_t bytesReceived = 0;
+  for (NSUInteger i = 0; i < concurrency; ++i) {
+    count += workers[i].latencyCount;
+    errors += workers[i].errors;
+    bytesReceived += workers[i].bytesReceived;
+  }
+  uint64_t* latencies = malloc(MAX(count, 1) * sizeof(uint64_t));
+  size_t offset = 0;
+  for (NSUInteger i = 0; i < concurrency; ++i) {
+    memcpy(&latencies[offset], workers[i].latencies, workers[i].latencyCount * sizeof(uint64_t));
+    offset += workers[i].latencyCount;
+    free(workers[i].latencies);
+  }
+  qsort(latencies, count, sizeof(uint64_t), _CompareLatencies);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  NSMutableString* json = [NSMutableString string];
+  [json appendFormat:@"{\"mode\":\"%s\",\"concurrency\":%lu,\"keep_alive\":%s,\"duration\":%.3f", modeName, (unsigned long)concurrency, keepAlive ? "true" : "false", elapsed];
+  [json appendFormat:@",\"requests\":%lu,\"errors\":%llu,\"rps\":%.1f,\"bytes_received\":%llu", (unsigned long)count, (unsigned long long)errors, (double)count / elapsed, (unsigned long long)bytesReceived];
+  [json appendFormat:@",\"latency_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f}", _LatencyQuantile(latencies, count, 0.5), _LatencyQuantile(latencies, count, 0.99), _LatencyQuantile(latencies, count, 0.999), _LatencyQuantile(latencies, count, 1.0)];
+  [json appendFormat:@",\"cpu_seconds\":%.3f,\"cpu_percent\":%.1f,\"rss_bytes\":%llu,\"max_rss_bytes\":%llu}\n", cpuTime, 100.0 * cpuTime / elapsed, (unsigned long long)residentSize, (unsigned long long)usage.ru_maxrss];  // ru_maxrss is in bytes on macOS
+  if (outputPath) {
+    if (![json writeToFile:outputPath atomically:YES encoding:NSUTF8StringEncoding error:NULL]) {
+      fprintf(stderr, "Failed writing benchmark results to \"%s\"\n", [outputPath UTF8String]);
+    }
+  }
+  fprintf(stdout, "%s", [json UTF8String]);
+
+  free(latencies);
+  for (NSUInteger i = 0; i < configuration.pathCount; ++i) {
+    free(configuration.paths[i]);
+  }
+  free(configuration.paths);
+  free(threads);
+  free(workers);
+  return count ? 0 : -1;
+}
+
 @interface Delegate : NSObject <GCDWebServerDelegate, GCDWebDAVServerDelegate, GCDWebUploaderDelegate>
 @end
 
@@ -147,9 +503,19 @@ int main(int argc, const char* argv[]) {
     NSString* authenticationPassword = nil;
     BOOL bindToLocalhost = NO;
     BOOL requestNATPortMapping = NO;
+    const char* modeName = "webServer";
+    BOOL benchmark = NO;
+    NSUInteger concurrency = 16;
+    NSTimeInterval benchmarkDuration = 10.0;
+    BOOL benchmarkKeepAlive = YES;
+    NSArray* benchmarkPaths = nil;
+    NSString* benchmarkOutputPath = nil;
+    BOOL replay = NO;
+    NSUInteger replayRepeatCount = 1;
+    NSString* replayBaselinePath = nil;
 
     if (argc == 1) {
-      fprintf(stdout, "Usage: %s [-mode webServer | htmlPage | htmlForm | htmlFileUpload | webDAV | webUploader | streamingResponse | asyncResponse] [-record] [-root directory] [-tests directory] [-authenticationMethod Basic | Digest] [-authenticationRealm realm] [-authenticationUser user] [-authenticationPassword password] [--localhost]\n\n", basename((char*)argv[0]));
+      fprintf(stdout, "Usage: %s [-mode webServer | htmlPage | htmlForm | htmlFileUpload | webDAV | webUploader | streamingResponse | asyncResponse] [-record] [-root directory] [-tests directory [-replay [-concurrency count] [-repeat count] [-baseline file]]] [-authenticationMethod Basic | Digest] [-authenticationRealm realm] [-authenticationUser user] [-authenticationPassword password] [--localhost] [-benchmark [-concurrency count] [-duration seconds] [-paths path[:weight],...] [-output file] [--no-keepalive]]\n\n", basename((char*)argv[0]));
     } else {
       for (int i = 1; i < argc; ++i) {
         if (argv[i][0] != '-') {
@@ -157,6 +523,7 @@ int main(int argc, const char* argv[]) {
         }
         if (!strcmp(argv[i], "-mode") && (i + 1 < argc)) {
           ++i;
+          modeName = argv[i];
           if (!strcmp(argv[i], "webServer")) {
             mode = kMode_WebServer;
           } else if (!strcmp(argv[i], "htmlPage")) {
@@ -198,6 +565,30 @@ int main(int argc, const char* argv[]) {
           bindToLocalhost = YES;
         } else if (!strcmp(argv[i], "--nat")) {
           requestNATPortMapping = YES;
+        } else if (!strcmp(argv[i], "-benchmark")) {
+          benchmark = YES;
+        } else if (!strcmp(argv[i], "-concurrency") && (i + 1 < argc)) {
+          ++i;
+          concurrency = (NSUInteger)MAX(atoi(argv[i]), 1);
+        } else if (!strcmp(argv[i], "-duration") && (i + 1 < argc)) {
+          ++i;
+          benchmarkDuration = MAX(atof(argv[i]), 1.0);
+        } else if (!strcmp(argv[i], "-paths") && (i + 1 < argc)) {
+          ++i;
+          benchmarkPaths = [[NSString stringWithUTF8String:argv[i]] componentsSeparatedByString:@","];
+        } else if (!strcmp(argv[i], "-output") && (i + 1 < argc)) {
+          ++i;
+          benchmarkOutputPath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:argv[i] length:strlen(argv[i])];
+        } else if (!strcmp(argv[i], "--no-keepalive")) {
+          benchmarkKeepAlive = NO;
+        } else if (!strcmp(argv[i], "-replay")) {
+          replay = YES;
+        } else if (!strcmp(argv[i], "-repeat") && (i + 1 < argc)) {
+          ++i;
+          replayRepeatCount = (NSUInteger)MAX(atoi(argv[i]), 1);
+        } else if (!strcmp(argv[i], "-baseline") && (i + 1 < argc)) {
+          ++i;
+          replayBaselinePath = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:argv[i] length:strlen(argv[i])];
         }
       }
     }
@@ -373,14 +764,34 @@ int main(int argc, const char* argv[]) {
       }
     }
 
-    if (webServer) {
+    if (webServer && benchmark) {
+      if (benchmarkPaths == nil) {
+        switch (mode) {
+          case kMode_StreamingResponse:
+            benchmarkPaths = @[ @"/sync" ];
+            break;
+          case kMode_AsyncResponse:
+            benchmarkPaths = @[ @"/async" ];
+            break;
+          default:
+            benchmarkPaths = @[ @"/" ];
+            break;
+        }
+      }
+      result = _RunBenchmark(webServer, modeName, benchmarkPaths, concurrency, benchmarkDuration, benchmarkKeepAlive, benchmarkOutputPath);
+    } else if (webServer) {
       Delegate* delegate = [[Delegate alloc] init];
       if (testDirectory) {
 #if DEBUG
         webServer.delegate = delegate;
 #endif
-        fprintf(stdout, "<RUNNING TESTS FROM \"%s\">\n\n", [testDirectory UTF8String]);
-        result = (int)[webServer runTestsWithOptions:@{GCDWebServerOption_Port : @8080} inDirectory:testDirectory];
+        if (replay) {
+          fprintf(stdout, "<REPLAYING TESTS FROM \"%s\">\n\n", [testDirectory UTF8String]);
+          result = (int)[webServer runReplayWithOptions:@{GCDWebServerOption_Port : @8080} inDirectory:testDirectory concurrency:concurrency repeatCount:replayRepeatCount baselinePath:replayBaselinePath];
+        } else {
+          fprintf(stdout, "<RUNNING TESTS FROM \"%s\">\n\n", [testDirectory UTF8String]);
+          result = (int)[webServer runTestsWithOptions:@{GCDWebServerOption_Port : @8080} inDirectory:testDirectory];
+        }
       } else {
         webServer.delegate = delegate;
         if (recording) {